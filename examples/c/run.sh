@@ -1,2 +1,4 @@
 gcc examples/c/hello.c -o build/hello_c_rhd -lrhd
-./build/hello_c_rhd
\ No newline at end of file
+./build/hello_c_rhd
+gcc examples/c/sim.c -o build/sim_c_rhd -lrhd -lm
+./build/sim_c_rhd
\ No newline at end of file
@@ -0,0 +1,47 @@
+// Offline load test: the driver and the host DSP run against the simulated
+// RHD2164 as fast as the host allows, and the rate is compared to real time.
+#include <rhd_dsp.h>
+#include <rhd_sim.h>
+#include <stdio.h>
+#include <time.h>
+
+#define FS 20000
+#define BURST 32
+#define N_FRAMES (10 * FS)
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main() {
+  static rhd_sim_t sim;
+  static rhd_device_t dev;
+  static rhd_dsp_t dsp;
+  static uint16_t tx[2 * (BURST * RHD_SWEEP_CMDS + 2)];
+  static uint16_t rx[2 * (BURST * RHD_SWEEP_CMDS + 2)];
+  static uint16_t frames[BURST][RHD_FRAME_CH];
+  static int16_t out[BURST][RHD_FRAME_CH];
+
+  rhd_sim_init(&sim, true);
+  rhd_sim_set_sine(&sim, FS, 150, 2000, 50);
+  if (rhd_init_async(&dev, true, &sim.async) != 0) {
+    printf("Sanity check failed\n");
+    return 1;
+  }
+  rhd_setup(&dev, FS, 20, 500, true, 10);
+  rhd_set_burst_buf(&dev, tx, rx, sizeof(rx) / sizeof(rx[0]));
+  rhd_dsp_init_emg(&dsp, &dev, 50, 20, 450, true);
+
+  double t0 = now_s();
+  for (int i = 0; i < N_FRAMES / BURST; i++) {
+    rhd2164_sample_frames(&dev, BURST, frames);
+    rhd_dsp_process(&dsp, frames, out, BURST);
+  }
+  double dt = now_s() - t0;
+
+  printf("%d frames in %.3f s: %.0f frames/s, %.1fx real time at %d Hz\n",
+         N_FRAMES, dt, N_FRAMES / dt, N_FRAMES / dt / FS, FS);
+  return 0;
+}
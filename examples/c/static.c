@@ -0,0 +1,38 @@
+// Allocation-free acquisition, as on an MCU: all the driver's memory is
+// static and sized at compile time, see rhd_static.h. `make footprint` builds
+// it to report the static storage.
+#include "rhd_static.h"
+#include <stdio.h>
+
+static rhd_static_t rhd_mem[RHD_STATIC_DEVICES];
+
+// Replace with the SPI driver of the target, eg a DMA transfer of `len` words.
+// With DDR wiring, as set up below, it receives `len` words too
+int spi_rw(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)tx_buf;
+  for (size_t i = 0; i < len; i++) {
+    rx_buf[i] = 0;
+  }
+  return len;
+}
+
+int main() {
+  for (int i = 0; i < RHD_STATIC_DEVICES; i++) {
+    rhd_init(&rhd_mem[i].dev, true, spi_rw);
+    rhd_setup(&rhd_mem[i].dev, 2000, 20, 500, true, 10);
+    RHD_STATIC_ATTACH(&rhd_mem[i]);
+  }
+  printf("%d device(s), %u bytes of static storage\n", RHD_STATIC_DEVICES,
+         (unsigned)RHD_STATIC_BYTES);
+
+  // Main loop: sample, then hand the frames over
+  uint16_t(*frames)[RHD_FRAME_CH];
+  for (int loop = 0; loop < 100; loop++) {
+    for (int i = 0; i < RHD_STATIC_DEVICES; i++) {
+      rhd_stream_produce(&rhd_mem[i].stream);
+      size_t n = rhd_stream_borrow(&rhd_mem[i].stream, &frames);
+      rhd_stream_release(&rhd_mem[i].stream, n);
+    }
+  }
+  return 0;
+}
@@ -63,8 +63,13 @@ def build_cffi(
         ffibuilder.cdef(text)
 
     # Copy all files into cwd and patch path
-    shutil.copy(rhd_h_path, "./")
-    shutil.copy(rhd_c_path, "./")
+    # librhd's other modules (stream, timer, ...) live next to rhd.c
+    rhd_dir = os.path.dirname(rhd_c_path)
+    rhd_files = sorted(
+        f for f in os.listdir(rhd_dir) if f.endswith(".c") or f.endswith(".h")
+    )
+    for f in rhd_files:
+        shutil.copy(f"{rhd_dir}/{f}", "./")
     for i, f in enumerate(h_files):
         shutil.copy(f, "./")
         h_files[i] = f.split("/")[-1]
@@ -77,7 +82,7 @@ def build_cffi(
     """ + "\n".join(
         [f'#include "{h}"' for h in h_files]
     )
-    sources = ["rhd.c", *c_files]
+    sources = [*[f for f in rhd_files if f.endswith(".c")], *c_files]
 
     if len(libraries) == 0:
         ffibuilder.set_source(
@@ -105,8 +110,9 @@ def build_cffi(
             shutil.copy(f, out_path)
             os.remove(f)
 
-    for f in ["rhd.h", "rhd.c", *h_files, *c_files]:
-        os.remove(f)
+    for f in [*rhd_files, *h_files, *c_files]:
+        if os.path.exists(f):
+            os.remove(f)
 
 
 def benchmark(fn, n=1, *args):
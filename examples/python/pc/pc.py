@@ -52,7 +52,7 @@ if __name__ == "__main__":
         "src/rhd.c",
         cwdir + "/cffi_rw.h",
         cwdir + "/cffi_rw.c",
-        [],
+        ["pthread", "m"],
         cwdir,
     )
 
@@ -1,9 +1,10 @@
 #include "rhd_pynq.h"
+#include "../../../src/rhd_stream.h"
+#include "../../../src/rhd_timer.h"
 #include <pynq_api.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
 
 // AXI gpio 0: 0x4120 | 1 channel | 24 bits | control signals
 // AXI gpio 1: 0x4121 | 2 channels | 1 bit | spi_start, spi_done
@@ -13,11 +14,13 @@ PYNQ_MMIO_WINDOW axi_gpio_0;
 PYNQ_MMIO_WINDOW axi_gpio_1;
 PYNQ_MMIO_WINDOW axi_gpio_2;
 
-uint8_t *spi_done = NULL;
-uint8_t *spi_start = NULL;
+// MMIO words of the handshake, static so the back end never allocates
+static uint8_t spi_done = 0;
+static uint8_t spi_start = 0;
+static bool pynq_open = false;
 
 int rhd_pynq_setup(char bitstream[], uint16_t clk_div, uint8_t clk_wait) {
-  if (spi_start != NULL) {
+  if (pynq_open) {
     return -1;
   }
 
@@ -35,8 +38,7 @@ int rhd_pynq_setup(char bitstream[], uint16_t clk_div, uint8_t clk_wait) {
   PYNQ_createMMIOWindow(&axi_gpio_1, 0x41210000, 0x200);
   PYNQ_createMMIOWindow(&axi_gpio_2, 0x41220000, 0x200);
 
-  spi_start = (uint8_t *)malloc(sizeof(uint8_t));
-  spi_done = (uint8_t *)malloc(sizeof(uint8_t));
+  pynq_open = true;
 
   uint32_t cfg_val = clk_wait << 16 | clk_div;
   PYNQ_writeMMIO(&axi_gpio_0, &cfg_val, 0, 3);
@@ -49,8 +51,7 @@ int rhd_pynq_close() {
   PYNQ_closeMMIOWindow(&axi_gpio_1);
   PYNQ_closeMMIOWindow(&axi_gpio_2);
 
-  free(spi_start);
-  free(spi_done);
+  pynq_open = false;
 
   return PYNQ_SUCCESS;
 }
@@ -59,38 +60,195 @@ int rhd_pynq_rw(uint16_t *tx, uint16_t *rx, size_t len) {
   for (unsigned int i = 0; i < len; i++) {
     PYNQ_writeMMIO(&axi_gpio_2, &tx[i], 0, sizeof(uint16_t));
 
-    *spi_start = 1;
-    PYNQ_writeMMIO(&axi_gpio_1, spi_start, 0, sizeof(uint8_t));
-    *spi_start = 0;
-    PYNQ_writeMMIO(&axi_gpio_1, spi_start, 0, sizeof(uint8_t));
+    spi_start = 1;
+    PYNQ_writeMMIO(&axi_gpio_1, &spi_start, 0, sizeof(uint8_t));
+    spi_start = 0;
+    PYNQ_writeMMIO(&axi_gpio_1, &spi_start, 0, sizeof(uint8_t));
 
     do {
-      PYNQ_readMMIO(&axi_gpio_1, spi_done, 8, sizeof(uint8_t));
-    } while (*spi_done == 0);
-    *spi_done = 0;
+      PYNQ_readMMIO(&axi_gpio_1, &spi_done, 8, sizeof(uint8_t));
+    } while (spi_done == 0);
+    spi_done = 0;
 
-    PYNQ_readMMIO(&axi_gpio_2, (uint32_t *)rx, 8, sizeof(uint32_t));
+    // spi_dout_a and spi_dout_b land in rx[2i] and rx[2i + 1]
+    PYNQ_readMMIO(&axi_gpio_2, (uint32_t *)&rx[2 * i], 8, sizeof(uint32_t));
   }
   return len;
 }
 
-uint32_t get_timestamp_us() {
-  // https://stackoverflow.com/a/5833240
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  return tv.tv_sec * (uint32_t)1000000 + tv.tv_usec;
-}
-
 uint16_t *rhd_pynq_sampling(rhd_device_t *dev, uint32_t nsamples,
                             uint32_t dt_micro) {
   uint16_t *bigbuf = (uint16_t *)malloc(64 * nsamples * sizeof(uint16_t));
+  rhd_pynq_sample_into(dev, bigbuf, nsamples, dt_micro);
+  return bigbuf;
+}
+
+void rhd_pynq_sample_into(rhd_device_t *dev, uint16_t *bigbuf,
+                          uint32_t nsamples, uint32_t dt_micro) {
+  if (dt_micro == 0) {
+    // Free-running: one pipelined burst, paced by the SPI clock only
+    rhd2164_sample_frames(dev, nsamples, (uint16_t(*)[RHD_FRAME_CH])bigbuf);
+    return;
+  }
+
+  // Sleep until absolute deadlines instead of spinning, so the rate can't drift
+  rhd_timer_t timer;
+  rhd_timer_init(&timer, 1e6f / dt_micro);
   for (uint32_t i = 0; i < nsamples; i++) {
-    uint32_t t0 = get_timestamp_us();
-    rhd_sample_all(dev);
-    memcpy(bigbuf + (i * 64), dev->sample_buf, 64 * sizeof(uint16_t));
-    while (get_timestamp_us() - t0 < dt_micro) {
-      ;
+    rhd_timer_wait(&timer);
+    rhd2164_sample_all(dev, bigbuf + (i * 64));
+  }
+
+  rhd_timer_stats_t stats;
+  rhd_timer_stats(&timer, &stats);
+  printf("fs target %.1f Hz, effective %.1f Hz, lateness %.1f +/- %.1f us "
+         "(max %.1f us), %u missed\n",
+         1e6 / dt_micro, stats.fs_eff, stats.late_mean_ns / 1000,
+         stats.late_std_ns / 1000, stats.late_max_ns / 1000.0, stats.misses);
+}
+
+// AXI DMA back end: 1 MM2S channel streams the commands to the SPI IP, 1 S2MM
+// channel streams the MISO words back. Both buffers live in CMA memory and
+// are used directly as the driver's burst buffers, so nothing is copied.
+// Small transfers from other buffers (register access, ...) go through a
+// bounce area at the end of the CMA buffers.
+PYNQ_AXI_DMA axi_dma;
+PYNQ_SHARED_MEMORY dma_tx_mem;
+PYNQ_SHARED_MEMORY dma_rx_mem;
+size_t dma_burst_words = 0;
+bool dma_double_bits = false;
+
+// AXI DMA's simple mode runs one transfer per channel at a time: the second
+// submitted transfer is issued as soon as the first one completes.
+#define DMA_QUEUE_LEN 2
+// Bounce slot of a non-burst transfer: a sweep and the reads of a check
+#define DMA_BOUNCE_WORDS (RHD_SWEEP_WORDS + 2 * RHD_CHECK_CMDS)
+typedef struct {
+  size_t tx_off;
+  size_t rx_off;
+  size_t tx_len;
+  size_t rx_len;
+  uint16_t *rx_bounce; // where to copy rx back to, NULL if received in place
+} dma_xfer_t;
+dma_xfer_t dma_queue[DMA_QUEUE_LEN];
+int dma_submitted = 0;
+int dma_issued = 0;
+int dma_completed = 0;
+
+static void rhd_pynq_dma_issue(const dma_xfer_t *x) {
+  // Arm the receive channel first so no MISO word is lost
+  PYNQ_issueDMATransfer(&axi_dma, &dma_rx_mem, x->rx_off, x->rx_len,
+                        AXI_DMA_READ);
+  PYNQ_issueDMATransfer(&axi_dma, &dma_tx_mem, x->tx_off, x->tx_len,
+                        AXI_DMA_WRITE);
+}
+
+static int rhd_pynq_dma_submit(void *ctx, uint16_t *tx, uint16_t *rx,
+                               size_t len) {
+  (void)ctx;
+  if (dma_submitted - dma_completed >= DMA_QUEUE_LEN) {
+    return -1;
+  }
+
+  dma_xfer_t *x = &dma_queue[dma_submitted % DMA_QUEUE_LEN];
+  uint16_t *tx_mem = (uint16_t *)dma_tx_mem.pointer;
+  uint16_t *rx_mem = (uint16_t *)dma_rx_mem.pointer;
+  x->tx_len = len * sizeof(uint16_t);
+  x->rx_len = (dma_double_bits ? len : 2 * len) * sizeof(uint16_t);
+  x->rx_bounce = NULL;
+
+  if (tx >= tx_mem && tx < tx_mem + dma_burst_words) {
+    x->tx_off = (uint8_t *)tx - (uint8_t *)tx_mem;
+    x->rx_off = (uint8_t *)rx - (uint8_t *)rx_mem;
+  } else {
+    // Each queue entry owns one sweep of the bounce area
+    if (x->rx_len > DMA_BOUNCE_WORDS * sizeof(uint16_t)) {
+      return -1;
     }
+    size_t bounce = dma_burst_words + (dma_submitted % DMA_QUEUE_LEN) *
+                                          DMA_BOUNCE_WORDS;
+    memcpy(tx_mem + bounce, tx, x->tx_len);
+    x->tx_off = bounce * sizeof(uint16_t);
+    x->rx_off = bounce * sizeof(uint16_t);
+    x->rx_bounce = rx;
   }
-  return bigbuf;
+
+  if (dma_issued == dma_completed) {
+    rhd_pynq_dma_issue(x);
+    dma_issued++;
+  }
+  return dma_submitted++;
+}
+
+static int rhd_pynq_dma_complete(void *ctx, int ticket) {
+  (void)ctx;
+  if (ticket != dma_completed) {
+    return -1;
+  }
+
+  PYNQ_waitForDMAComplete(&axi_dma, AXI_DMA_WRITE);
+  PYNQ_waitForDMAComplete(&axi_dma, AXI_DMA_READ);
+  dma_completed++;
+
+  dma_xfer_t *x = &dma_queue[ticket % DMA_QUEUE_LEN];
+  if (x->rx_bounce != NULL) {
+    memcpy(x->rx_bounce, (uint8_t *)dma_rx_mem.pointer + x->rx_off,
+           x->rx_len);
+  }
+  size_t len = x->tx_len / sizeof(uint16_t);
+
+  // Keep the DMA busy while the driver demuxes this transfer
+  if (dma_issued < dma_submitted) {
+    rhd_pynq_dma_issue(&dma_queue[dma_issued % DMA_QUEUE_LEN]);
+    dma_issued++;
+  }
+  return len;
+}
+
+static const rhd_rw_async_t rhd_pynq_dma_async = {
+    rhd_pynq_dma_submit, NULL, rhd_pynq_dma_complete, NULL};
+
+int rhd_pynq_dma_init(rhd_device_t *dev, bool mode, size_t dma_addr,
+                      size_t burst_frames) {
+  // 2 words received per command, 2 halves for double buffering
+  size_t words = 2 * (burst_frames * RHD_SWEEP_CMDS + 2) * 2;
+  size_t mem_len =
+      (words + DMA_QUEUE_LEN * DMA_BOUNCE_WORDS) * sizeof(uint16_t);
+
+  int ret = PYNQ_openDMA(&axi_dma, dma_addr);
+  if (ret != PYNQ_SUCCESS) {
+    printf("Error opening AXI DMA %d\n", ret);
+    return ret;
+  }
+  // Uncached, so the CPU and the DMA see the same data without flushes
+  PYNQ_allocatedSharedMemory(&dma_tx_mem, mem_len, 0);
+  PYNQ_allocatedSharedMemory(&dma_rx_mem, mem_len, 0);
+
+  dma_burst_words = words;
+  dma_double_bits = mode;
+  dma_submitted = 0;
+  dma_issued = 0;
+  dma_completed = 0;
+
+  ret = rhd_init_async(dev, mode, &rhd_pynq_dma_async);
+  rhd_set_burst_buf(dev, (uint16_t *)dma_tx_mem.pointer,
+                    (uint16_t *)dma_rx_mem.pointer, words);
+  return ret;
+}
+
+int rhd_pynq_dma_close() {
+  PYNQ_freeSharedMemory(&dma_tx_mem);
+  PYNQ_freeSharedMemory(&dma_rx_mem);
+  PYNQ_closeDMA(&axi_dma);
+  return PYNQ_SUCCESS;
+}
+
+int rhd_pynq_dma_stream(rhd_device_t *dev, rhd_stream_t *s,
+                        uint16_t (*slots)[RHD_FRAME_CH], size_t n_slots,
+                        size_t burst_frames) {
+  int ret = rhd_stream_init(s, dev, slots, n_slots, burst_frames);
+  if (ret != 0) {
+    return ret;
+  }
+  return rhd_stream_start(s);
 }
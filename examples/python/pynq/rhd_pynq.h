@@ -1,4 +1,5 @@
 #include "../../../src/rhd.h"
+#include "../../../src/rhd_stream.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -26,12 +27,14 @@ int rhd_pynq_setup(char bitstream[], uint16_t clk_div, uint8_t clk_wait);
 int rhd_pynq_close(void);
 
 /**
- * @brief Custom DDR SPI read/write function.
+ * @brief Custom SPI read/write function, SDR only: give it to `rhd_init` with
+ * `mode = false`, like `rhd_pynq.py` does.
  *
  * @param tx pointer to tx buffer
- * @param rx pointer to rx buffer, will only receive the last transfer in case
- * of multiples
- * @param len transfer length, tx and rx assumed to be long enough
+ * @param rx pointer to rx buffer, receives MISO A and MISO B for every word
+ * sent, as `{a0, b0, a1, b1, ...}`
+ * @param len transfer length, tx and rx assumed to be long enough (`len` and
+ * `2 * len` words respectively)
  * @return int
  */
 int rhd_pynq_rw(uint16_t *tx, uint16_t *rx, size_t len);
@@ -41,11 +44,64 @@ int rhd_pynq_rw(uint16_t *tx, uint16_t *rx, size_t len);
  * advantage versus Python.
  *
  * @param dev
- * @param nsamples
- * @param dt_micro
- * @return uint16_t*
+ * @param nsamples number of 64-channel frames to sample
+ * @param dt_micro sampling period, 0 to sample all frames in a single burst
+ * @return uint16_t* `64 * nsamples` samples, to be freed by the caller
  */
 uint16_t *rhd_pynq_sampling(rhd_device_t *dev, uint32_t nsamples,
                             uint32_t dt_micro);
 
+/**
+ * @brief Same as `rhd_pynq_sampling`, into a caller-provided buffer, so
+ * repeated calls don't allocate.
+ *
+ * @param dev
+ * @param bigbuf destination of `64 * nsamples` samples
+ * @param nsamples number of 64-channel frames to sample
+ * @param dt_micro sampling period, 0 to sample all frames in a single burst
+ */
+void rhd_pynq_sample_into(rhd_device_t *dev, uint16_t *bigbuf,
+                          uint32_t nsamples, uint32_t dt_micro);
+
+/**
+ * @brief Initialize `dev` with the AXI DMA back end, instead of the per-word
+ * AXI GPIO handshake of `rhd_pynq_rw`. It needs a bitstream where an AXI DMA
+ * streams 16-bit command words to the SPI IP and streams its MISO words back
+ * (32 bits per command without `mode`, like `rhd_pynq_rw`).
+ *
+ * Bursts are encoded and demuxed directly in CMA memory, and a burst is
+ * transferred while the previous one is demuxed.
+ *
+ * @param dev pointer to rhd_device_t instance, initialized by this function
+ * @param mode true if using hardware flipflop strategy, false otherwise.
+ * @param dma_addr AXI DMA base address, see the bitstream's `.hwh`
+ * @param burst_frames frames per DMA transfer, eg 32 for ~1 ms blocks at
+ * 30 kS/s
+ * @return int sanity check result, 0 for success, otherwise PYNQ error code
+ */
+int rhd_pynq_dma_init(rhd_device_t *dev, bool mode, size_t dma_addr,
+                      size_t burst_frames);
+
+/**
+ * @brief Free the AXI DMA back end resources.
+ *
+ * @return int
+ */
+int rhd_pynq_dma_close(void);
+
+/**
+ * @brief Start streaming frames into a ring buffer, `burst_frames` per DMA
+ * transfer. The frames land in the ring slots straight out of the demux.
+ *
+ * @param dev device initialized with `rhd_pynq_dma_init`
+ * @param s stream to initialize and start
+ * @param slots ring storage of `n_slots` frames
+ * @param n_slots ring length, power of 2
+ * @param burst_frames frames per DMA transfer, at most `rhd_pynq_dma_init`'s
+ * @return int 0 for success
+ */
+int rhd_pynq_dma_stream(rhd_device_t *dev, rhd_stream_t *s,
+                        uint16_t (*slots)[RHD_FRAME_CH], size_t n_slots,
+                        size_t burst_frames);
+
 // CFFI END
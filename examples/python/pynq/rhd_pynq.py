@@ -4,6 +4,7 @@ import os
 sys.path.append(os.path.dirname(__file__) + "/../")  # patch PATHs
 
 import cffi_utils
+import numpy as np
 
 def test():
     from _rhd_cffi import ffi, lib
@@ -19,10 +20,12 @@ def test():
     lib.rhd_init(dev, False, ffi.addressof(lib, "rhd_pynq_rw"))
     lib.rhd_setup(dev, 1000, 10, 500, True, 20)
 
+    # One buffer for every call, read as an array instead of element by element
+    buf = ffi.new("uint16_t[]", 64 * 1000)
     for i in range(10):
-        p = lib.rhd_pynq_sampling(dev, 1000, 100)
-        print([p[j] for j in range(10)])
-        p = ffi.gc(p, lib.free)
+        lib.rhd_pynq_sample_into(dev, buf, 1000, 100)
+        p = np.frombuffer(ffi.buffer(buf), dtype=np.uint16).reshape(1000, 64)
+        print(p[0, :10])
 
     for i in range(40, 45):
         lib.rhd_read_force(dev, i)
@@ -41,7 +44,7 @@ if __name__ == "__main__":
         "src/rhd.c",
         os.path.dirname(__file__) + "/rhd_pynq.h",
         os.path.dirname(__file__) + "/rhd_pynq.c",
-        ["pynq", "cma", "pthread"],
+        ["pynq", "cma", "pthread", "m"],
         os.path.dirname(__file__),
     )
     test()
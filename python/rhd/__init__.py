@@ -0,0 +1,220 @@
+"""
+Python bindings of librhd, the RHD2164 driver.
+
+Frames are read in bulk, straight into NumPy arrays: one C call per read
+instead of one per frame, and the GIL is released while it runs, so other
+Python threads keep going during acquisition.
+
+Every array returned here is C-contiguous `uint16`, of shape `(n_frames, 64)`:
+row `f` is frame `f`, with samples in the device's channel order (see
+`Device.ch_map`). Arrays given by the caller must follow the same contract,
+eg `np.empty((n, 64), np.uint16)`.
+
+### Example
+>>> import rhd
+>>> dev = rhd.Device(rw=my_spi_address, ddr=True)
+>>> dev.setup(fs=2000, fl=20, fh=500, dsp=True, fdsp=10)
+>>> with rhd.Stream(dev, n_slots=4096, burst=32) as s:
+...     frames = s.read(2000)
+"""
+
+import numpy as np
+
+from ._rhd_cffi import ffi, lib
+
+FRAME_CH = lib.RHD_FRAME_CH
+
+__all__ = ["Device", "Stream", "FRAME_CH", "ffi", "lib"]
+
+# Python transport and its device's wiring, rhd_rw_t has no context argument
+# so there is one per process
+_py_rw = None
+_py_ddr = False
+
+
+@ffi.def_extern()
+def rhd_py_rw(tx_buf, rx_buf, length):
+    # DDR transfers receive `length` words, SDR ones 2 per command
+    n_rx = length if _py_ddr else 2 * length
+    tx = np.frombuffer(ffi.buffer(tx_buf, 2 * length), dtype=np.uint16)
+    rx = np.frombuffer(ffi.buffer(rx_buf, 2 * n_rx), dtype=np.uint16)
+    return _py_rw(tx, rx)
+
+
+def _frames(out, n_frames):
+    """
+    Check or allocate a destination array of `n_frames` frames.
+
+    Returns the array and its C pointer.
+    """
+    if out is None:
+        out = np.empty((n_frames, FRAME_CH), dtype=np.uint16)
+    if (
+        out.dtype != np.uint16
+        or out.ndim != 2
+        or out.shape[1] != FRAME_CH
+        or out.shape[0] < n_frames
+        or not out.flags.c_contiguous
+    ):
+        raise ValueError("out must be a C-contiguous (n, 64) uint16 array")
+    return out, ffi.cast("uint16_t (*)[64]", ffi.from_buffer(out))
+
+
+class Device:
+    """
+    An RHD2164 and its transport.
+
+    Params:
+        - rw : C transport, an `rhd_rw_t` function pointer from another CFFI
+          module or its address as an `int`. Or a Python callable
+          `rw(tx, rx) -> int`, given the buffers as `uint16` arrays (see
+          `rhd_rw_t` for their contract): it is slow, one call per transfer,
+          and it holds the GIL.
+        - ddr : DDR (flip-flop) wiring, see `rhd_init`
+    """
+
+    def __init__(self, rw, ddr=False):
+        global _py_rw, _py_ddr
+        self._dev = ffi.new("rhd_device_t *")
+        if isinstance(rw, int):
+            rw = ffi.cast("rhd_rw_t", rw)
+        elif callable(rw):
+            _py_rw = rw
+            _py_ddr = bool(ddr)
+            rw = lib.rhd_py_rw
+        self._rw = rw
+        lib.rhd_init(self._dev, ddr, rw)
+        self._burst = None
+
+    @property
+    def ptr(self):
+        """`rhd_device_t *`, for other CFFI modules"""
+        return self._dev
+
+    @property
+    def n_ch(self):
+        """Number of valid samples per frame"""
+        return self._dev.n_ch
+
+    @property
+    def ch_map(self):
+        """Physical channel of every sample of a frame"""
+        return list(self._dev.ch_map)[: self.n_ch]
+
+    def setup(self, fs, fl, fh, dsp=True, fdsp=10.0):
+        """See `rhd_setup`, returns its sanity check result"""
+        return lib.rhd_setup(self._dev, fs, fl, fh, dsp, fdsp)
+
+    def cfg_channels(self, ch_mask, sparse=True):
+        """
+        Sample the channels of a 64-bit mask, in channel list mode by default.
+        See `rhd_cfg_ch` and `rhd_cfg_sparse`.
+        """
+        lib.rhd_cfg_ch(self._dev, ch_mask & 0xFFFFFFFF, ch_mask >> 32)
+        return lib.rhd_cfg_sparse(self._dev, sparse)
+
+    def read_reg(self, reg):
+        return lib.rhd_r(self._dev, reg)
+
+    def write_reg(self, reg, val):
+        return lib.rhd_w(self._dev, reg, val)
+
+    def set_burst_words(self, words):
+        """
+        Split bursts into transfers of up to `words` received words, see
+        `rhd_set_burst_buf`. 0 to go back to one sweep per transfer.
+        """
+        if words == 0:
+            lib.rhd_set_burst_buf(self._dev, ffi.NULL, ffi.NULL, 0)
+            self._burst = None
+            return
+        self._burst = (ffi.new("uint16_t[]", words), ffi.new("uint16_t[]", words))
+        lib.rhd_set_burst_buf(self._dev, self._burst[0], self._burst[1], words)
+
+    def read_frames(self, n_frames, out=None):
+        """
+        Sample `n_frames` consecutive frames in a single call, see
+        `rhd2164_sample_frames`.
+
+        Returns a `(n_frames, 64)` `uint16` array, `out` if given.
+        """
+        out, ptr = _frames(out, n_frames)
+        ret = lib.rhd2164_sample_frames(self._dev, n_frames, ptr)
+        if ret < 0:
+            raise IOError(f"rhd2164_sample_frames: transport error {ret}")
+        return out
+
+    def to_uv(self, frames):
+        """Convert raw samples to microvolts, see `rhd_convert_block_uv`"""
+        frames = np.ascontiguousarray(frames, dtype=np.uint16)
+        uv = np.empty(frames.shape, dtype=np.float32)
+        lib.rhd_convert_block_uv(
+            self._dev,
+            ffi.cast("uint16_t *", ffi.from_buffer(frames)),
+            ffi.cast("float *", ffi.from_buffer(uv)),
+            frames.size,
+        )
+        return uv
+
+
+class Stream:
+    """
+    Acquisition thread sampling a `Device` into a ring of `n_slots` frames, see
+    `rhd_stream.h`. The device belongs to the stream while it runs.
+
+    Params:
+        - dev : configured `Device`
+        - n_slots : ring size in frames, a power of 2
+        - burst : most frames sampled per transfer
+    """
+
+    def __init__(self, dev, n_slots=4096, burst=16):
+        self._dev = dev
+        self._slots = np.empty((n_slots, FRAME_CH), dtype=np.uint16)
+        self._s = ffi.new("rhd_stream_t *")
+        ret = lib.rhd_stream_init(
+            self._s,
+            dev.ptr,
+            ffi.cast("uint16_t (*)[64]", ffi.from_buffer(self._slots)),
+            n_slots,
+            burst,
+        )
+        if ret < 0:
+            raise ValueError("n_slots must be a power of 2")
+
+    def start(self):
+        ret = lib.rhd_stream_start(self._s)
+        if ret != 0:
+            raise RuntimeError(f"rhd_stream_start: {ret}")
+
+    def stop(self):
+        lib.rhd_stream_stop(self._s)
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *exc):
+        self.stop()
+
+    @property
+    def available(self):
+        return lib.rhd_stream_available(self._s)
+
+    @property
+    def overruns(self):
+        """Frames dropped so far because the reader fell behind"""
+        return lib.rhd_stream_overruns(self._s)
+
+    def read(self, n_frames, out=None, timeout_ms=0):
+        """
+        Block until `n_frames` frames are read, or `timeout_ms` (0 waits
+        forever). The GIL is released while waiting. Without a running
+        thread, the frames are sampled by this call.
+
+        Returns a `(n, 64)` `uint16` array, `n` < `n_frames` on timeout, a view
+        of `out` if given.
+        """
+        out, ptr = _frames(out, n_frames)
+        n = lib.rhd_stream_read(self._s, ptr, n_frames, timeout_ms)
+        return out[:n]
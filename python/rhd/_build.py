@@ -0,0 +1,92 @@
+"""
+CFFI builder of `rhd._rhd_cffi`, in out-of-line API mode.
+
+Compiles librhd's sources from `src/` into the extension itself, so the module
+does not depend on an installed `librhd.so`. It is run by `setup.py`: install
+the package with `pip install ./python` from the repo's root, or
+`pip install -e ./python` for development.
+"""
+
+import glob
+import os
+
+from cffi import FFI
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+SRC = os.path.join(ROOT, "src")
+
+# Declarations exposed to Python. Structs are partial (`...;`): the compiler
+# fills in the layout, so it follows the headers, RHD_INSTRUMENT included.
+CDEF = """
+#define RHD_FRAME_CH 64
+#define RHD_SWEEP_CMDS 32
+
+typedef int (*rhd_rw_t)(uint16_t *tx_buf, uint16_t *rx_buf, size_t len);
+
+typedef struct {
+    int (*submit)(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf, size_t len);
+    int (*poll)(void *ctx, int ticket);
+    int (*complete)(void *ctx, int ticket);
+    void *ctx;
+} rhd_rw_async_t;
+
+typedef struct {
+    bool double_bits;
+    bool sparse;
+    uint64_t ch_mask;
+    float fs;
+    size_t n_ch;
+    uint8_t ch_map[64];
+    ...;
+} rhd_device_t;
+
+typedef struct {
+    ...;
+} rhd_stream_t;
+
+int rhd_init(rhd_device_t *dev, bool mode, rhd_rw_t rw);
+int rhd_init_async(rhd_device_t *dev, bool mode, const rhd_rw_async_t *async);
+void rhd_set_burst_buf(rhd_device_t *dev, uint16_t *tx, uint16_t *rx,
+                       size_t words);
+int rhd_setup(rhd_device_t *dev, float fs, float fl, float fh, bool dsp,
+              float fdsp);
+int rhd_cfg_ch(rhd_device_t *dev, uint32_t channels_l, uint32_t channels_h);
+int rhd_cfg_sparse(rhd_device_t *dev, bool enable);
+uint8_t rhd_r(rhd_device_t *dev, uint16_t reg);
+uint8_t rhd_w(rhd_device_t *dev, uint16_t reg, uint16_t val);
+
+int rhd2164_sample_frames(rhd_device_t *dev, size_t n_frames,
+                          uint16_t (*out)[64]);
+int rhd2164_sample_block(rhd_device_t *dev, size_t n_frames, uint16_t *block,
+                         size_t block_len);
+
+void rhd_convert_block_uv(const rhd_device_t *dev, const uint16_t *raw,
+                          float *uv, size_t n);
+
+int rhd_stream_init(rhd_stream_t *s, rhd_device_t *dev,
+                    uint16_t (*slots)[64], size_t n_slots, size_t burst);
+size_t rhd_stream_read(rhd_stream_t *s, uint16_t (*out)[64],
+                       size_t n_frames, uint32_t timeout_ms);
+size_t rhd_stream_available(rhd_stream_t *s);
+uint32_t rhd_stream_overruns(rhd_stream_t *s);
+int rhd_stream_start(rhd_stream_t *s);
+int rhd_stream_stop(rhd_stream_t *s);
+
+/* Transport implemented in Python, see rhd.Device */
+extern "Python" int rhd_py_rw(uint16_t *tx_buf, uint16_t *rx_buf, size_t len);
+"""
+
+ffibuilder = FFI()
+ffibuilder.cdef(CDEF)
+ffibuilder.set_source(
+    "rhd._rhd_cffi",
+    """
+    #include "rhd.h"
+    #include "rhd_convert.h"
+    #include "rhd_stream.h"
+    """,
+    sources=sorted(glob.glob(os.path.join(SRC, "*.c"))),
+    include_dirs=[SRC],
+    libraries=["pthread", "m"],
+    extra_compile_args=["-O3"],
+)
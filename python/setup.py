@@ -0,0 +1,6 @@
+from setuptools import setup
+
+setup(
+    packages=["rhd"],
+    cffi_modules=["rhd/_build.py:ffibuilder"],
+)
@@ -6,8 +6,22 @@
  * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
  */
 
+#if defined(RHD_INSTRUMENT) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "rhd.h"
 
+#include <string.h>
+
+#ifdef RHD_INSTRUMENT
+#include <time.h>
+#endif
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 /**
  * @brief Duplicate the bits of a value.
  * It is assumed to be an 8-bits value.
@@ -27,13 +41,286 @@ static int rhd_duplicate_bits(uint8_t val);
  */
 static void rhd_unsplit_u16(uint16_t data, uint8_t *a, uint8_t *b);
 
-static const uint16_t RHD_ADC_CH_CMD_DOUBLE[32] = {
-    0x00, 0x03, 0x0C, 0x0F, 0x30, 0x33, 0x3C, 0x3F, 0xC0, 0xC3, 0xCC,
-    0xCF, 0xF0, 0xF3, 0xFC, 0xFF, 0x300, 0x303, 0x30C, 0x30F, 0x330, 0x333,
-    0x33C, 0x33F, 0x3C0, 0x3C3, 0x3CC, 0x3CF, 0x3F0, 0x3F3, 0x3FC, 0x3FF};
-static const uint16_t RHD_ADC_CH_CMD[32] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
-                                            11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21,
-                                            22, 23, 24, 25, 26, 27, 28, 29, 30, 31};
+/**
+ * @brief Transfer data with the device's transport: the asynchronous one if
+ * attached, blocking until completion, otherwise `dev->rw`.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param tx write buffer
+ * @param rx receive buffer
+ * @param len number of 16-bit values to send
+ * @return int transport return code
+ */
+static int rhd_xfer(rhd_device_t *dev, uint16_t *tx, uint16_t *rx, size_t len);
+
+/**
+ * @brief Reset the driver state shared by both transports, then check the
+ * link. `dev->rw` and `dev->async` must be set.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param mode true if using hardware flipflop strategy, false otherwise.
+ * @return int same as @ref rhd_init
+ */
+static int rhd_init_common(rhd_device_t *dev, bool mode);
+
+#ifdef RHD_INSTRUMENT
+/**
+ * @brief Account for a transport call which started at `t0`.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param t0 submission time [ns]
+ * @param len number of words sent
+ * @param ret transport return code
+ */
+static void rhd_stat_rw(rhd_device_t *dev, uint64_t t0, size_t len, int ret);
+
+/**
+ * @brief Account for `n` frames sampled by one call.
+ */
+static void rhd_stat_frames(rhd_device_t *dev, size_t n);
+
+static uint64_t rhd_stat_now(void);
+
+static void rhd_stat_add(uint64_t *counter, uint64_t n);
+
+#define RHD_STAT_NOW() rhd_stat_now()
+#define RHD_STAT_RW(dev, t0, len, ret) rhd_stat_rw((dev), (t0), (len), (ret))
+#define RHD_STAT_FRAMES(dev, n) rhd_stat_frames((dev), (n))
+#define RHD_STAT_INC(dev, field) rhd_stat_add(&(dev)->stats.field, 1)
+#else
+#define RHD_STAT_NOW() 0
+#define RHD_STAT_RW(dev, t0, len, ret) ((void)(t0))
+#define RHD_STAT_FRAMES(dev, n) ((void)0)
+#define RHD_STAT_INC(dev, field) ((void)0)
+#endif
+
+/**
+ * @brief Write a configuration register through the shadow: skipped if it
+ * already holds `val`, only staged during a batch.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param reg register 0-21
+ * @param val value to write
+ * @return received value, 0 if nothing was sent
+ */
+static uint8_t rhd_w_shadow(rhd_device_t *dev, uint16_t reg, uint8_t val);
+
+/**
+ * @brief Send the dirty registers of the shadow in a single transfer, see
+ * @ref rhd_cfg_flush.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param calib append the calibration commands to the transfer
+ * @return int number of registers written
+ */
+static int rhd_flush(rhd_device_t *dev, bool calib);
+
+/**
+ * @brief Shadow writes of the @ref rhd_setup configuration.
+ */
+static void rhd_setup_regs(rhd_device_t *dev, float fs, float fl, float fh,
+                           bool dsp, float fdsp, uint32_t channels_l,
+                           uint32_t channels_h);
+
+/**
+ * @brief Encode command `i` of a transfer into `tx`, doubling its bits in
+ * DDR mode.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param tx transmit buffer
+ * @param i command index
+ * @param cmd 16-bit command
+ */
+static void rhd_put_cmd(const rhd_device_t *dev, uint16_t *tx, size_t i,
+                        uint16_t cmd);
+
+/**
+ * @brief Extract the 8-bit result of command `i` of a transfer from `rx`.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param rx receive buffer
+ * @param i command index
+ * @return uint8_t result, as returned by @ref rhd_send
+ */
+static uint8_t rhd_get_result(const rhd_device_t *dev, const uint16_t *rx,
+                              size_t i);
+
+/**
+ * @brief Rebuild the sweep tables from `dev->ch_mask`, see
+ * @ref rhd_cfg_sparse.
+ *
+ * @param dev pointer to rhd_device_t instance
+ */
+static void rhd_build_sweep(rhd_device_t *dev);
+
+/**
+ * @brief Demux the result of `n` commands of a channel list sweep, starting
+ * at sweep command `k`, into packed frame `frame`, whose samples are
+ * `ch_stride` apart.
+ */
+static void rhd_demux_sparse(const rhd_device_t *dev, const uint16_t *rx,
+                             size_t k, size_t n, uint16_t *frame,
+                             size_t ch_stride);
+
+/**
+ * @brief Demux the result of sweep command `k` into `frame`, or into the
+ * auxiliary results for an auxiliary slot.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param rx received data of the command, 2 words
+ * @param k command index in the sweep
+ * @param aux_j auxiliary command counter of the slot, if it is one
+ * @param frame destination frame
+ * @param ch_stride distance between the samples of `frame`
+ */
+static void rhd_decode_cmd(const rhd_device_t *dev, const uint16_t *rx,
+                           size_t k, size_t aux_j, uint16_t *frame,
+                           size_t ch_stride);
+
+/**
+ * @brief Burst decode into any layout: sample `ch` of frame `f` goes to
+ * `out[f * frame_stride + ch * ch_stride]`.
+ */
+static void rhd_burst_decode(const rhd_device_t *dev, const uint16_t *rx,
+                             size_t slot, size_t n, uint16_t *out,
+                             size_t frame_stride, size_t ch_stride);
+
+/**
+ * @brief Sample a burst of `n_frames` frames into any layout, see
+ * @ref rhd_burst_decode.
+ */
+static int rhd_sample_burst(rhd_device_t *dev, size_t n_frames, uint16_t *out,
+                            size_t frame_stride, size_t ch_stride);
+
+/**
+ * @brief Split the 2 words received per command into MISO A and MISO B
+ * results, unsplitting DDR data if `dev->double_bits` is set.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param rx source data, 2 words per command
+ * @param a destination MISO A results
+ * @param b destination MISO B results
+ * @param n_cmds number of commands
+ */
+static void rhd_demux(const rhd_device_t *dev, const uint16_t *rx, uint16_t *a,
+                      uint16_t *b, size_t n_cmds);
+
+/**
+ * @brief Exact 16-bit MISO A word received for a command, unsplit in DDR
+ * mode without the alignment bit of @ref rhd_demux.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param rx received data of the command, 2 words
+ * @return uint16_t MISO A word
+ */
+static uint16_t rhd_get_word(const rhd_device_t *dev, const uint16_t *rx);
+
+/**
+ * @brief Send the check reads in the slots from `n_data - 2` (the flush
+ * commands) until the end of a sequence, if checks are enabled.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param tx encoded chunk of the sequence
+ * @param slot first slot of the chunk
+ * @param n number of commands of the chunk
+ * @param n_data number of commands of the sequence before the checks
+ */
+static void rhd_check_encode(const rhd_device_t *dev, uint16_t *tx,
+                             size_t slot, size_t n, size_t n_data);
+
+/**
+ * @brief Check the answers received in the slots from `n_data`, see
+ * @ref rhd_check_encode.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param rx received data of the chunk, 2 words per command
+ * @param slot first slot of the chunk
+ * @param n number of commands of the chunk
+ * @param n_data number of commands of the sequence before the checks
+ */
+static void rhd_check_answers(rhd_device_t *dev, const uint16_t *rx,
+                              size_t slot, size_t n, size_t n_data);
+
+/**
+ * @brief Read the MISO A words answered to the 2 check reads, which the checks
+ * expect.
+ *
+ * @param dev pointer to rhd_device_t instance
+ */
+static void rhd_check_read_words(rhd_device_t *dev);
+
+/**
+ * @brief @ref rhd2164_burst_encode of a chunk of a burst, then its check
+ * reads, see @ref rhd_check_encode.
+ */
+static size_t rhd_check_burst_encode(const rhd_device_t *dev, uint16_t *tx,
+                                     size_t slot, size_t n, size_t n_data);
+
+/**
+ * @brief @ref rhd_burst_decode of a chunk of a burst, up to `n_data`, then
+ * check its answers, see @ref rhd_check_answers.
+ */
+static void rhd_check_burst_decode(rhd_device_t *dev, const uint16_t *rx,
+                                   size_t slot, size_t n, size_t n_data,
+                                   uint16_t *out, size_t frame_stride,
+                                   size_t ch_stride);
+
+/**
+ * @brief Bits duplication of every 8-bit value, used for DDR commands.
+ * `RHD_DUP_LUT[val]` is equivalent to doubling every bit of `val`.
+ */
+static const uint16_t RHD_DUP_LUT[256] = {
+    0x0000, 0x0003, 0x000C, 0x000F, 0x0030, 0x0033, 0x003C, 0x003F,
+    0x00C0, 0x00C3, 0x00CC, 0x00CF, 0x00F0, 0x00F3, 0x00FC, 0x00FF,
+    0x0300, 0x0303, 0x030C, 0x030F, 0x0330, 0x0333, 0x033C, 0x033F,
+    0x03C0, 0x03C3, 0x03CC, 0x03CF, 0x03F0, 0x03F3, 0x03FC, 0x03FF,
+    0x0C00, 0x0C03, 0x0C0C, 0x0C0F, 0x0C30, 0x0C33, 0x0C3C, 0x0C3F,
+    0x0CC0, 0x0CC3, 0x0CCC, 0x0CCF, 0x0CF0, 0x0CF3, 0x0CFC, 0x0CFF,
+    0x0F00, 0x0F03, 0x0F0C, 0x0F0F, 0x0F30, 0x0F33, 0x0F3C, 0x0F3F,
+    0x0FC0, 0x0FC3, 0x0FCC, 0x0FCF, 0x0FF0, 0x0FF3, 0x0FFC, 0x0FFF,
+    0x3000, 0x3003, 0x300C, 0x300F, 0x3030, 0x3033, 0x303C, 0x303F,
+    0x30C0, 0x30C3, 0x30CC, 0x30CF, 0x30F0, 0x30F3, 0x30FC, 0x30FF,
+    0x3300, 0x3303, 0x330C, 0x330F, 0x3330, 0x3333, 0x333C, 0x333F,
+    0x33C0, 0x33C3, 0x33CC, 0x33CF, 0x33F0, 0x33F3, 0x33FC, 0x33FF,
+    0x3C00, 0x3C03, 0x3C0C, 0x3C0F, 0x3C30, 0x3C33, 0x3C3C, 0x3C3F,
+    0x3CC0, 0x3CC3, 0x3CCC, 0x3CCF, 0x3CF0, 0x3CF3, 0x3CFC, 0x3CFF,
+    0x3F00, 0x3F03, 0x3F0C, 0x3F0F, 0x3F30, 0x3F33, 0x3F3C, 0x3F3F,
+    0x3FC0, 0x3FC3, 0x3FCC, 0x3FCF, 0x3FF0, 0x3FF3, 0x3FFC, 0x3FFF,
+    0xC000, 0xC003, 0xC00C, 0xC00F, 0xC030, 0xC033, 0xC03C, 0xC03F,
+    0xC0C0, 0xC0C3, 0xC0CC, 0xC0CF, 0xC0F0, 0xC0F3, 0xC0FC, 0xC0FF,
+    0xC300, 0xC303, 0xC30C, 0xC30F, 0xC330, 0xC333, 0xC33C, 0xC33F,
+    0xC3C0, 0xC3C3, 0xC3CC, 0xC3CF, 0xC3F0, 0xC3F3, 0xC3FC, 0xC3FF,
+    0xCC00, 0xCC03, 0xCC0C, 0xCC0F, 0xCC30, 0xCC33, 0xCC3C, 0xCC3F,
+    0xCCC0, 0xCCC3, 0xCCCC, 0xCCCF, 0xCCF0, 0xCCF3, 0xCCFC, 0xCCFF,
+    0xCF00, 0xCF03, 0xCF0C, 0xCF0F, 0xCF30, 0xCF33, 0xCF3C, 0xCF3F,
+    0xCFC0, 0xCFC3, 0xCFCC, 0xCFCF, 0xCFF0, 0xCFF3, 0xCFFC, 0xCFFF,
+    0xF000, 0xF003, 0xF00C, 0xF00F, 0xF030, 0xF033, 0xF03C, 0xF03F,
+    0xF0C0, 0xF0C3, 0xF0CC, 0xF0CF, 0xF0F0, 0xF0F3, 0xF0FC, 0xF0FF,
+    0xF300, 0xF303, 0xF30C, 0xF30F, 0xF330, 0xF333, 0xF33C, 0xF33F,
+    0xF3C0, 0xF3C3, 0xF3CC, 0xF3CF, 0xF3F0, 0xF3F3, 0xF3FC, 0xF3FF,
+    0xFC00, 0xFC03, 0xFC0C, 0xFC0F, 0xFC30, 0xFC33, 0xFC3C, 0xFC3F,
+    0xFCC0, 0xFCC3, 0xFCCC, 0xFCCF, 0xFCF0, 0xFCF3, 0xFCFC, 0xFCFF,
+    0xFF00, 0xFF03, 0xFF0C, 0xFF0F, 0xFF30, 0xFF33, 0xFF3C, 0xFF3F,
+    0xFFC0, 0xFFC3, 0xFFCC, 0xFFCF, 0xFFF0, 0xFFF3, 0xFFFC, 0xFFFF};
+
+/**
+ * @brief Pre-encoded TX vectors of a full sweep (CONVERT 0 to 31), with and
+ * without bits duplication.
+ */
+static const uint16_t RHD_SWEEP_TX[RHD_SWEEP_CMDS] = {
+    0x0000, 0x0100, 0x0200, 0x0300, 0x0400, 0x0500, 0x0600, 0x0700,
+    0x0800, 0x0900, 0x0A00, 0x0B00, 0x0C00, 0x0D00, 0x0E00, 0x0F00,
+    0x1000, 0x1100, 0x1200, 0x1300, 0x1400, 0x1500, 0x1600, 0x1700,
+    0x1800, 0x1900, 0x1A00, 0x1B00, 0x1C00, 0x1D00, 0x1E00, 0x1F00};
+static const uint16_t RHD_SWEEP_TX_DOUBLE[RHD_SWEEP_WORDS] = {
+    0x0000, 0x0000, 0x0003, 0x0000, 0x000C, 0x0000, 0x000F, 0x0000,
+    0x0030, 0x0000, 0x0033, 0x0000, 0x003C, 0x0000, 0x003F, 0x0000,
+    0x00C0, 0x0000, 0x00C3, 0x0000, 0x00CC, 0x0000, 0x00CF, 0x0000,
+    0x00F0, 0x0000, 0x00F3, 0x0000, 0x00FC, 0x0000, 0x00FF, 0x0000,
+    0x0300, 0x0000, 0x0303, 0x0000, 0x030C, 0x0000, 0x030F, 0x0000,
+    0x0330, 0x0000, 0x0333, 0x0000, 0x033C, 0x0000, 0x033F, 0x0000,
+    0x03C0, 0x0000, 0x03C3, 0x0000, 0x03CC, 0x0000, 0x03CF, 0x0000,
+    0x03F0, 0x0000, 0x03F3, 0x0000, 0x03FC, 0x0000, 0x03FF, 0x0000};
 
 uint8_t rhd_send(rhd_device_t *dev, uint16_t reg, uint16_t val)
 {
@@ -42,9 +329,9 @@ uint8_t rhd_send(rhd_device_t *dev, uint16_t reg, uint16_t val)
   case 0:
   {
     uint16_t tx = (reg << 8) | (val & 0xFF);
-    uint16_t rx = 0;
-    dev->rw(&tx, &rx, 1);
-    return (uint8_t)(rx & 0xFF);
+    uint16_t rx[2] = {0};
+    rhd_xfer(dev, &tx, rx, 1);
+    return (uint8_t)(rx[0] & 0xFF);
   }
   default:
   {
@@ -52,7 +339,7 @@ uint8_t rhd_send(rhd_device_t *dev, uint16_t reg, uint16_t val)
     uint16_t rx[2] = {0};
     tx[0] = rhd_duplicate_bits(reg);
     tx[1] = rhd_duplicate_bits(val);
-    dev->rw(tx, rx, 2);
+    rhd_xfer(dev, tx, rx, 2);
     uint8_t rx_a, rx_b;
     rhd_unsplit_u16(rx[1], &rx_a, &rx_b);
     return rx_a;
@@ -69,18 +356,179 @@ uint8_t rhd_r(rhd_device_t *dev, uint16_t reg)
 
 uint8_t rhd_w(rhd_device_t *dev, uint16_t reg, uint16_t val)
 {
+  if (reg < RHD_SHADOW_REGS)
+  {
+    dev->regs[reg] = val & 0xFF;
+    dev->regs_valid |= 1UL << reg;
+    dev->regs_dirty &= ~(1UL << reg);
+  }
   // reg is 6 bits, b[7,6] = [1, 0]
   reg = (reg & 0x3F) | 0x80;
   return rhd_send(dev, reg, val);
 }
 
-int rhd_init(rhd_device_t *dev, bool mode, rhd_rw_t rw)
+void rhd_cfg_begin(rhd_device_t *dev) { dev->regs_defer = true; }
+
+int rhd_cfg_flush(rhd_device_t *dev) { return rhd_flush(dev, false); }
+
+static int rhd_flush(rhd_device_t *dev, bool calib)
+{
+  const size_t tx_per_cmd = dev->double_bits ? 2 : 1;
+  size_t n = 0;
+  size_t n_regs = 0;
+
+  dev->regs_defer = false;
+  for (uint16_t reg = 0; reg < RHD_SHADOW_REGS; reg++)
+  {
+    if (!(dev->regs_dirty & (1UL << reg)))
+    {
+      continue;
+    }
+    rhd_put_cmd(dev, dev->tx_buf, n++, ((reg | 0x80) << 8) | dev->regs[reg]);
+  }
+  dev->regs_valid |= dev->regs_dirty;
+  dev->regs_dirty = 0;
+  n_regs = n;
+
+  if (calib)
+  {
+    // Same as rhd_calib, 22 + 10 commands fit in tx_buf
+    rhd_put_cmd(dev, dev->tx_buf, n++, 0x5500);
+    for (int i = 0; i < 9; i++)
+    {
+      rhd_put_cmd(dev, dev->tx_buf, n++, RHD_CMD_READ(CHIP_ID));
+    }
+  }
+
+  if (n > 0)
+  {
+    rhd_xfer(dev, dev->tx_buf, dev->rx_buf, n * tx_per_cmd);
+  }
+  return n_regs;
+}
+
+void rhd_cfg_invalidate(rhd_device_t *dev)
+{
+  dev->regs_valid = 0;
+  dev->regs_dirty = 0;
+  dev->regs_defer = false;
+}
+
+static uint8_t rhd_w_shadow(rhd_device_t *dev, uint16_t reg, uint8_t val)
+{
+  const uint32_t bit = 1UL << reg;
+  if ((dev->regs_valid & bit) && !(dev->regs_dirty & bit) &&
+      dev->regs[reg] == val)
+  {
+    return 0;
+  }
+  if (dev->regs_defer)
+  {
+    dev->regs[reg] = val;
+    dev->regs_dirty |= bit;
+    return 0;
+  }
+  return rhd_w(dev, reg, val);
+}
+
+static int rhd_init_common(rhd_device_t *dev, bool mode)
 {
   dev->double_bits = mode;
-  dev->rw = rw;
+  rhd_set_burst_buf(dev, NULL, NULL, 0);
+  rhd_cfg_invalidate(dev);
+  dev->sparse = false;
+  dev->ch_mask = ~(uint64_t)0;
+  dev->fs = 0;
+  dev->aux_cmds = NULL;
+  dev->aux_out = NULL;
+  dev->n_aux = 0;
+  dev->aux_k = 0;
+  dev->aux_next = 0;
+  dev->cmdq = NULL;
+  dev->inj_k = 0;
+  dev->inj_next = 0;
+  dev->chk_period = 0;
+  dev->chk_count = 0;
+  dev->chk_held = false;
+  dev->chk_word[0] = 0;
+  dev->chk_word[1] = 0;
+  memset(&dev->check, 0, sizeof(dev->check));
+#ifdef RHD_INSTRUMENT
+  memset(&dev->stats, 0, sizeof(dev->stats));
+#endif
+  rhd_build_sweep(dev);
   return rhd_sanity_check(dev);
 }
 
+int rhd_init(rhd_device_t *dev, bool mode, rhd_rw_t rw)
+{
+  dev->rw = rw;
+  dev->async = NULL;
+  return rhd_init_common(dev, mode);
+}
+
+int rhd_init_async(rhd_device_t *dev, bool mode, const rhd_rw_async_t *async)
+{
+  dev->rw = NULL;
+  dev->async = async;
+  return rhd_init_common(dev, mode);
+}
+
+/**
+ * @brief Run a transfer right away, its result is kept for `complete`.
+ */
+static int rhd_rw_sync_submit(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf,
+                              size_t len)
+{
+  rhd_rw_sync_t *sync = (rhd_rw_sync_t *)ctx;
+  int ticket = sync->next_ticket;
+  sync->next_ticket = (sync->next_ticket + 1) & 0x7FFFFFFF;
+  sync->rets[ticket & 1] = sync->rw(sync->ctx, tx_buf, rx_buf, len);
+  return ticket;
+}
+
+static int rhd_rw_sync_poll(void *ctx, int ticket)
+{
+  (void)ctx;
+  (void)ticket;
+  return 1;
+}
+
+static int rhd_rw_sync_complete(void *ctx, int ticket)
+{
+  rhd_rw_sync_t *sync = (rhd_rw_sync_t *)ctx;
+  return sync->rets[ticket & 1];
+}
+
+void rhd_rw_sync_init(rhd_rw_sync_t *sync, rhd_rw_ctx_t rw, void *ctx,
+                      rhd_rw_async_t *async)
+{
+  sync->rw = rw;
+  sync->ctx = ctx;
+  sync->rets[0] = 0;
+  sync->rets[1] = 0;
+  sync->next_ticket = 0;
+  async->submit = rhd_rw_sync_submit;
+  async->poll = rhd_rw_sync_poll;
+  async->complete = rhd_rw_sync_complete;
+  async->ctx = sync;
+}
+
+void rhd_set_burst_buf(rhd_device_t *dev, uint16_t *tx, uint16_t *rx,
+                       size_t words)
+{
+  if (tx == NULL || rx == NULL || words < 2)
+  {
+    dev->burst_tx = NULL;
+    dev->burst_rx = NULL;
+    dev->burst_words = 0;
+    return;
+  }
+  dev->burst_tx = tx;
+  dev->burst_rx = rx;
+  dev->burst_words = words & ~(size_t)1;
+}
+
 int rhd_setup(rhd_device_t *dev, float fs, float fl, float fh, bool dsp,
               float fdsp)
 {
@@ -89,270 +537,1272 @@ int rhd_setup(rhd_device_t *dev, float fs, float fl, float fh, bool dsp,
   // High bandwidth (R8-R11) = 300 Hz
   // Low bandwifth (R12-R13) = 20 Hz
 
+  rhd_preset_t p;
+
   // dummy cmds
   rhd_r(dev, CHIP_ID);
   rhd_r(dev, CHIP_ID);
 
-  // configure everything
-  rhd_w(dev, ADC_CFG, 0b11011110);
-  rhd_w(dev, MUX_LOAD_TEMP_SENS_AUX_DIG_OUT, 0b00000000);
-  // TODO fn to cfg temp/digout ^
-  rhd_w(dev, IMP_CHK_CTRL, 0);
-  rhd_w(dev, IMP_CHK_DAC, 0);
-  rhd_w(dev, IMP_CHK_AMP_SEL, 0);
-
-  rhd_cfg_fs(dev, fs, 32);
-  rhd_cfg_dsp(dev, true, false, dsp, fdsp, fs);
-  rhd_cfg_ch(dev, 0xFFFFFFFF, 0xFFFFFFFF);
-  rhd_cfg_amp_bw(dev, fl, fh);
-
-  rhd_calib(dev);
+  // configure everything and calibrate, in a single transfer
+  rhd_preset_compile(&p, fs, fl, fh, dsp, fdsp, 0xFFFFFFFF, 0xFFFFFFFF);
+  rhd_cfg_invalidate(dev);
+  rhd_preset_apply(dev, &p, true);
 
   return rhd_sanity_check(dev);
 }
 
-int rhd_cfg_ch(rhd_device_t *dev, uint32_t channels_l, uint32_t channels_h)
+static void rhd_setup_regs(rhd_device_t *dev, float fs, float fl, float fh,
+                           bool dsp, float fdsp, uint32_t channels_l,
+                           uint32_t channels_h)
 {
-  rhd_w(dev, IND_AMP_PWR_0, channels_l & 0xFF);
-  rhd_w(dev, IND_AMP_PWR_1, (channels_l >> 8) & 0xFF);
-  rhd_w(dev, IND_AMP_PWR_2, (channels_l >> 16) & 0xFF);
-  rhd_w(dev, IND_AMP_PWR_3, (channels_l >> 24) & 0xFF);
+  rhd_w_shadow(dev, ADC_CFG, 0b11011110);
+  rhd_cfg_aux_dig(dev, false, 0, false, false);
+  rhd_w_shadow(dev, IMP_CHK_CTRL, 0);
+  rhd_w_shadow(dev, IMP_CHK_DAC, 0);
+  rhd_w_shadow(dev, IMP_CHK_AMP_SEL, 0);
 
-  rhd_w(dev, IND_AMP_PWR_4, channels_h & 0xFF);
-  rhd_w(dev, IND_AMP_PWR_5, (channels_h >> 8) & 0xFF);
-  rhd_w(dev, IND_AMP_PWR_6, (channels_h >> 16) & 0xFF);
-  return rhd_w(dev, IND_AMP_PWR_7, (channels_h >> 24) & 0xFF);
+  rhd_cfg_fs(dev, fs, 32);
+  rhd_cfg_dsp(dev, true, false, dsp, fdsp, fs);
+  rhd_cfg_ch(dev, channels_l, channels_h);
+  rhd_cfg_amp_bw(dev, fl, fh);
 }
 
-int rhd_cfg_fs(rhd_device_t *dev, float fs, int n_ch)
+void rhd_preset_compile(rhd_preset_t *p, float fs, float fl, float fh,
+                        bool dsp, float fdsp, uint32_t channels_l,
+                        uint32_t channels_h)
 {
-  const float msps = fs * n_ch;
-  const int msps_lut[9] = {120000, 140000, 175000, 220000, 280000,
-                           350000, 440000, 525000, 700000};
-  const int adc_buf_bias_lut[9] = {32, 16, 8, 8, 8, 4, 3, 3, 2};
-  const int mux_bias_lut[9] = {40, 40, 40, 32, 26, 18, 16, 7, 4};
-
-  int i_lut = 0;
-  for (unsigned int i = 0; i < sizeof(msps_lut) / sizeof(int); i++)
-  {
-    if (msps <= msps_lut[i])
-    {
-      break;
-    }
-    i_lut = i;
-  }
-
-  rhd_w(dev, SUPPLY_SENS_ADC_BUF_BIAS, adc_buf_bias_lut[i_lut]);
-  rhd_w(dev, MUX_BIAS_CURR, mux_bias_lut[i_lut]);
+  // Scratch device in a batch that never flushes: no transfers
+  rhd_device_t tmp;
+  memset(&tmp, 0, sizeof(tmp));
+  tmp.regs_defer = true;
+  rhd_setup_regs(&tmp, fs, fl, fh, dsp, fdsp, channels_l, channels_h);
 
-  return msps;
+  memcpy(p->regs, tmp.regs, sizeof(p->regs));
+  p->ch_mask = tmp.ch_mask;
+  p->fs = tmp.fs;
 }
 
-int rhd_cfg_amp_bw(rhd_device_t *dev, float fl, float fh)
+int rhd_preset_apply(rhd_device_t *dev, const rhd_preset_t *p, bool calib)
 {
-  const int fh_lut[17] = {20000, 15000, 10000, 7500, 5000, 3000,
-                          2500, 2000, 1500, 1000, 750, 500,
-                          300, 250, 200, 150, 100};
-  const int rh1_dac1_lut[17] = {8, 11, 17, 22, 33, 3, 13, 27, 1,
-                                46, 41, 30, 6, 42, 24, 44, 38};
-  const int rh1_dac2_lut[17] = {0, 0, 0, 0, 0, 1, 1, 1, 2,
-                                2, 3, 5, 9, 10, 13, 17, 26};
-  const int rh2_dac1_lut[17] = {4, 8, 16, 23, 37, 13, 25, 44, 23,
-                                30, 36, 43, 2, 5, 7, 8, 5};
-  const int rh2_dac2_lut[17] = {0, 0, 0, 0, 0, 1, 1, 1, 2,
-                                3, 4, 6, 11, 13, 16, 21, 31};
-
-  int i_fh = 0;
-  for (unsigned int i = 0; i < sizeof(fh_lut) / sizeof(int); i++)
+  rhd_cfg_begin(dev);
+  for (uint16_t reg = 0; reg < RHD_SHADOW_REGS; reg++)
   {
-    if (fh >= fh_lut[i])
-    {
-      break;
-    }
-    i_fh++;
+    rhd_w_shadow(dev, reg, p->regs[reg]);
   }
-
-  const float fl_lut[25] = {0.1, 0.25, 0.3, 0.5, 0.75, 1.0, 1.5, 2.0, 2.5,
-                            3.0, 5.0, 7.5, 10, 15, 20, 25, 30, 50,
-                            75, 100, 150, 200, 250, 300, 500};
-  const int rl_dac1_lut[25] = {16, 56, 1, 35, 49, 44, 9, 8, 42,
-                               20, 40, 18, 5, 62, 54, 48, 44, 34,
-                               28, 25, 21, 18, 17, 15, 13};
-  const int rl_dac2_lut[25] = {60, 54, 40, 17, 9, 6, 4, 3, 2, 2, 1, 1, 1,
-                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-  const int rl_dac3_lut[25] = {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-  int i_fl = 0;
-  for (unsigned int i = 0; i < sizeof(fl_lut) / sizeof(float); i++)
+  dev->ch_mask = p->ch_mask;
+  dev->fs = p->fs;
+  if (dev->sparse)
   {
-    if (fl <= fl_lut[i])
+    rhd_build_sweep(dev);
+    if (dev->fs > 0)
     {
-      break;
+      rhd_cfg_fs(dev, dev->fs, 0);
     }
-    i_fl++;
   }
-
-  rhd_w(dev, AMP_BW_SEL_0, rh1_dac1_lut[i_fh]);
-  rhd_w(dev, AMP_BW_SEL_1, rh1_dac2_lut[i_fh]);
-  rhd_w(dev, AMP_BW_SEL_2, rh2_dac1_lut[i_fh]);
-  rhd_w(dev, AMP_BW_SEL_3, rh2_dac2_lut[i_fh]);
-  rhd_w(dev, AMP_BW_SEL_4, rl_dac1_lut[i_fl]);
-  int ret =
-      rhd_w(dev, AMP_BW_SEL_5, (rl_dac3_lut[i_fl] << 6) | rl_dac2_lut[i_fl]);
-
-  return ret;
+  return rhd_flush(dev, calib);
 }
 
-int rhd_cfg_dsp(rhd_device_t *dev, bool twos_comp, bool abs_mode, bool dsp,
-                float fdsp, float fs)
+int rhd_cfg_ch(rhd_device_t *dev, uint32_t channels_l, uint32_t channels_h)
 {
-  const double k_lut[16] = {0.99, 0.1103, 0.04579, 0.02125,
-                            0.01027, 0.005053, 0.002506, 0.001248,
-                            0.0006229, 0.0003112, 0.0001555, 0.00007773,
-                            0.00003886, 0.00001943, 0.000009714, 0.000004857};
-
-  int dsp_val = 0;
-  if (dsp)
+  // Physical order: channels_h is reversed
+  uint64_t mask = channels_l;
+  for (int i = 0; i < 32; i++)
   {
-    float k = fdsp / fs;
-    for (unsigned int i = 0; i < sizeof(k_lut) / sizeof(double); i++)
+    mask |= (uint64_t)((channels_h >> (31 - i)) & 1) << (32 + i);
+  }
+  dev->ch_mask = mask;
+  if (dev->sparse)
+  {
+    rhd_build_sweep(dev);
+    if (dev->fs > 0)
     {
-      if (k > k_lut[i])
-      {
-        break;
-      }
-      dsp_val++;
+      rhd_cfg_fs(dev, dev->fs, 0);
     }
   }
 
-  return rhd_w(dev, ADC_OUT_FMT_DPS_OFF_RMVL,
-               (1 << 7) | (((int)twos_comp) << 6) | (((int)abs_mode) << 5) |
-                   (((int)dsp) << 4) | dsp_val);
+  rhd_w_shadow(dev, IND_AMP_PWR_0, channels_l & 0xFF);
+  rhd_w_shadow(dev, IND_AMP_PWR_1, (channels_l >> 8) & 0xFF);
+  rhd_w_shadow(dev, IND_AMP_PWR_2, (channels_l >> 16) & 0xFF);
+  rhd_w_shadow(dev, IND_AMP_PWR_3, (channels_l >> 24) & 0xFF);
+
+  rhd_w_shadow(dev, IND_AMP_PWR_4, channels_h & 0xFF);
+  rhd_w_shadow(dev, IND_AMP_PWR_5, (channels_h >> 8) & 0xFF);
+  rhd_w_shadow(dev, IND_AMP_PWR_6, (channels_h >> 16) & 0xFF);
+  return rhd_w_shadow(dev, IND_AMP_PWR_7, (channels_h >> 24) & 0xFF);
 }
 
-uint8_t rhd_calib(rhd_device_t *dev)
+int rhd_cfg_sparse(rhd_device_t *dev, bool enable)
 {
-  int ret = rhd_send(dev, 0b01010101, 0);
-
-  for (int i = 0; i < 9; i++)
+  dev->sparse = enable;
+  rhd_build_sweep(dev);
+  if (dev->fs > 0)
   {
-    // 9 dummy cmds
-    ret = rhd_r(dev, CHIP_ID);
+    rhd_cfg_fs(dev, dev->fs, 0);
   }
-
-  return ret;
+  return dev->n_ch;
 }
 
-uint8_t rhd_clear_calib(rhd_device_t *dev) { return rhd_send(dev, 0b01101010, 0); }
-
-int rhd_sanity_check(rhd_device_t *dev)
+int rhd_cfg_aux_dig(rhd_device_t *dev, bool temp_en, uint8_t temp_s,
+                    bool digout_hiz, bool digout)
 {
-  const char INTAN[] = "INTAN";
-  int ret = 0;
-  for (int i = 0; i < sizeof(INTAN) - 1; i++)
-  {
-    char let = (char)rhd_read_force(dev, INTAN_0 + i);
-    if (let != INTAN[i])
-    {
-      ret = i + INTAN_0;
-      break;
-    }
-  }
-  return ret;
+  // R3 : MUX load = 0, tempS2, tempS1, tempen, digoutHiZ, digout
+  return rhd_w_shadow(dev, MUX_LOAD_TEMP_SENS_AUX_DIG_OUT,
+                      ((temp_s & 0b11) << 3) | (((int)temp_en) << 2) |
+                          (((int)digout_hiz) << 1) | (int)digout);
 }
 
-uint8_t rhd_read_force(rhd_device_t *dev, int reg)
+int rhd_cfg_zcheck(rhd_device_t *dev, bool enable, rhd_zcheck_scale_t scale,
+                   uint8_t ch)
 {
-  for (int i = 0; i < 2; i++)
+  // R5 : DAC power, load = 0, scale, conn all = 0, sel pol = 0, en
+  // R6 : DAC at mid-scale
+  // R7 : electrode select
+  if (!enable)
   {
-    rhd_r(dev, reg);
+    rhd_w_shadow(dev, IMP_CHK_CTRL, 0);
+    rhd_w_shadow(dev, IMP_CHK_DAC, 0);
+    return rhd_w_shadow(dev, IMP_CHK_AMP_SEL, 0);
   }
-  return rhd_r(dev, reg);
+  rhd_w_shadow(dev, IMP_CHK_CTRL, 0x41 | ((scale & 0x3) << 3));
+  rhd_w_shadow(dev, IMP_CHK_DAC, 128);
+  return rhd_w_shadow(dev, IMP_CHK_AMP_SEL, ch & 0x3F);
 }
 
-uint16_t *rhd2164_sample(rhd_device_t *dev, uint16_t ch, uint16_t *rx)
+int rhd_aux_set(rhd_device_t *dev, const uint16_t *cmds, size_t n_cmds,
+                size_t slots, uint16_t *results)
 {
-  switch ((int)dev->double_bits)
+  if (cmds == NULL || n_cmds == 0 || slots == 0)
   {
-  case 0:
-  {
-    uint16_t tx = (ch << 8);
-    dev->rw(&tx, rx, 1);
-    return rx;
+    slots = 0;
+    cmds = NULL;
+    results = NULL;
+    n_cmds = 0;
   }
-  default:
+  else if (slots + dev->inj_k > RHD_SWEEP_CMDS)
   {
-    uint16_t tx[2] = {0};
-    tx[0] = rhd_duplicate_bits(ch);
-
-    dev->rw(tx, rx, 2);
+    return -1;
+  }
 
-    uint8_t dat_a[2] = {0};
-    uint8_t dat_b[2] = {0};
-    rhd_unsplit_u16(rx[0], &dat_a[1], &dat_b[1]);
-    rhd_unsplit_u16(rx[1], &dat_a[0], &dat_b[0]);
-    rx[0] =
-        (((uint16_t)dat_a[1]) << 8) | dat_a[0] | 1;
-    rx[1] =
-        (((uint16_t)dat_b[1]) << 8) | dat_b[0] | 1;
-    return rx;
+  dev->aux_cmds = cmds;
+  dev->aux_out = results;
+  dev->n_aux = n_cmds;
+  dev->aux_k = slots;
+  dev->aux_next = 0;
+  for (size_t i = 0; results != NULL && i < n_cmds; i++)
+  {
+    results[i] = 0;
   }
+  rhd_build_sweep(dev);
+  if (dev->fs > 0)
+  {
+    rhd_cfg_fs(dev, dev->fs, 0);
   }
+  return 0;
 }
 
-uint16_t rhd2000_sample(rhd_device_t *dev, uint16_t ch)
+void rhd_aux_advance(rhd_device_t *dev, size_t n_frames)
 {
-  uint16_t tx = (ch << 8);
-  uint16_t rx;
-  dev->rw(&tx, &rx, 1);
-  return rx;
+  if (dev->n_aux > 0)
+  {
+    dev->aux_next = (dev->aux_next + n_frames * dev->aux_k) % dev->n_aux;
+  }
+  dev->inj_next += n_frames * dev->inj_k;
 }
 
-void rhd2164_sample_all(rhd_device_t *dev, uint16_t *sample_buf)
+int rhd_cmdq_init(rhd_cmdq_t *q, rhd_cmdq_cell_t *cells, size_t n_cells)
 {
-  // Let ch0 sample from last iter, ask for ch1
-  // const uint16_t *RHD_ADC_CH =
-  //     (int)dev->double_bits ? RHD_ADC_CH_CMD_DOUBLE : RHD_ADC_CH_CMD;
-  uint16_t rx[2] = {0};
-
-  for (int ch = 0; ch < 32; ch++)
+  if (n_cells == 0 || (n_cells & (n_cells - 1)) != 0)
   {
-    rhd2164_sample(dev, ch, rx);
-    int rx_ch = ch < 2 ? 31 - ch : ch - 2;
-    sample_buf[rx_ch] = rx[0];
-    sample_buf[rx_ch + 32] = rx[1];
+    return -1;
   }
-  // Alignment
-  sample_buf[0] &= 0xFFFE;
+  q->cells = cells;
+  q->mask = n_cells - 1;
+  q->enq = 0;
+  q->deq = 0;
+  for (size_t i = 0; i < n_cells; i++)
+  {
+    cells[i].seq = i;
+  }
+  memset(q->inflight, 0, sizeof(q->inflight));
+  return 0;
 }
 
-static int rhd_duplicate_bits(uint8_t val)
+int rhd_cmdq_attach(rhd_device_t *dev, rhd_cmdq_t *q, size_t slots)
 {
-  int out = 0;
-  for (int i = 0; i < 8; i++)
+  if (q == NULL)
   {
-    int tmp = (val >> i) & 1;
-    out |= (tmp << 1 | tmp) << 2 * i;
+    slots = 0;
   }
-  return out;
-}
+  else if (slots + dev->aux_k > RHD_SWEEP_CMDS ||
+           (slots > 0 && dev->n_conv + dev->aux_k < 2))
+  {
+    return -1;
+  }
+
+  dev->cmdq = q;
+  dev->inj_k = slots;
+  rhd_build_sweep(dev);
+  if (dev->fs > 0)
+  {
+    rhd_cfg_fs(dev, dev->fs, 0);
+  }
+  return 0;
+}
+
+int rhd_cmdq_push(rhd_cmdq_t *q, uint16_t cmd, rhd_future_t *fut)
+{
+  // Bounded MPMC queue by sequence numbers (D. Vyukov), used with one
+  // consumer
+  size_t pos = __atomic_load_n(&q->enq, __ATOMIC_RELAXED);
+  rhd_cmdq_cell_t *cell;
+  for (;;)
+  {
+    cell = &q->cells[pos & q->mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0)
+    {
+      if (__atomic_compare_exchange_n(&q->enq, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+        break;
+      }
+    }
+    else if (dif < 0)
+    {
+      return -1;
+    }
+    else
+    {
+      pos = __atomic_load_n(&q->enq, __ATOMIC_RELAXED);
+    }
+  }
+
+  if (fut != NULL)
+  {
+    fut->result = 0;
+    __atomic_store_n(&fut->done, 0, __ATOMIC_RELAXED);
+  }
+  cell->cmd = cmd;
+  cell->fut = fut;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+bool rhd_future_ready(const rhd_future_t *fut)
+{
+  return __atomic_load_n(&fut->done, __ATOMIC_ACQUIRE) != 0;
+}
+
+static uint16_t rhd_inj_take(const rhd_device_t *dev, uint64_t j)
+{
+  rhd_cmdq_t *q = dev->cmdq;
+  rhd_cmdq_slot_t *slot = &q->inflight[j % RHD_CMDQ_INFLIGHT];
+
+  if (slot->busy)
+  {
+    // Sent again, eg as a flush slot of the previous burst
+    return slot->j == j ? slot->cmd : RHD_CMD_READ(CHIP_ID);
+  }
+
+  rhd_cmdq_cell_t *cell = &q->cells[q->deq & q->mask];
+  if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != q->deq + 1)
+  {
+    return RHD_CMD_READ(CHIP_ID);
+  }
+  slot->busy = true;
+  slot->j = j;
+  slot->cmd = cell->cmd;
+  slot->fut = cell->fut;
+  __atomic_store_n(&cell->seq, q->deq + q->mask + 1, __ATOMIC_RELEASE);
+  q->deq++;
+  return slot->cmd;
+}
+
+static void rhd_inj_done(const rhd_device_t *dev, const uint16_t *rx,
+                         uint64_t j)
+{
+  rhd_cmdq_t *q = dev->cmdq;
+  rhd_cmdq_slot_t *slot = &q->inflight[j % RHD_CMDQ_INFLIGHT];
+
+  if (!slot->busy || slot->j != j)
+  {
+    return;
+  }
+  slot->busy = false;
+  rhd_future_t *fut = slot->fut;
+  if (fut == NULL)
+  {
+    return;
+  }
+
+  fut->result = rhd_get_word(dev, rx);
+  __atomic_store_n(&fut->done, 1, __ATOMIC_RELEASE);
+  if (fut->cb != NULL)
+  {
+    fut->cb(fut, fut->ctx);
+  }
+}
+
+int rhd_cfg_fs(rhd_device_t *dev, float fs, int n_ch)
+{
+  dev->fs = fs;
+  if (n_ch <= 0)
+  {
+    n_ch = dev->n_sweep;
+  }
+  const float msps = fs * n_ch;
+  static const int msps_lut[9] = {120000, 140000, 175000, 220000, 280000,
+                                  350000, 440000, 525000, 700000};
+  static const int adc_buf_bias_lut[9] = {32, 16, 8, 8, 8, 4, 3, 3, 2};
+  static const int mux_bias_lut[9] = {40, 40, 40, 32, 26, 18, 16, 7, 4};
+
+  int i_lut = 0;
+  for (unsigned int i = 0; i < sizeof(msps_lut) / sizeof(int); i++)
+  {
+    if (msps <= msps_lut[i])
+    {
+      break;
+    }
+    i_lut = i;
+  }
+
+  rhd_w_shadow(dev, SUPPLY_SENS_ADC_BUF_BIAS, adc_buf_bias_lut[i_lut]);
+  rhd_w_shadow(dev, MUX_BIAS_CURR, mux_bias_lut[i_lut]);
+
+  return msps;
+}
+
+int rhd_cfg_amp_bw(rhd_device_t *dev, float fl, float fh)
+{
+  static const int fh_lut[17] = {20000, 15000, 10000, 7500, 5000, 3000,
+                                 2500, 2000, 1500, 1000, 750, 500,
+                                 300, 250, 200, 150, 100};
+  static const int rh1_dac1_lut[17] = {8, 11, 17, 22, 33, 3, 13, 27, 1,
+                                       46, 41, 30, 6, 42, 24, 44, 38};
+  static const int rh1_dac2_lut[17] = {0, 0, 0, 0, 0, 1, 1, 1, 2,
+                                       2, 3, 5, 9, 10, 13, 17, 26};
+  static const int rh2_dac1_lut[17] = {4, 8, 16, 23, 37, 13, 25, 44, 23,
+                                       30, 36, 43, 2, 5, 7, 8, 5};
+  static const int rh2_dac2_lut[17] = {0, 0, 0, 0, 0, 1, 1, 1, 2,
+                                       3, 4, 6, 11, 13, 16, 21, 31};
+
+  int i_fh = 0;
+  for (unsigned int i = 0; i < sizeof(fh_lut) / sizeof(int); i++)
+  {
+    if (fh >= fh_lut[i])
+    {
+      break;
+    }
+    i_fh++;
+  }
+
+  static const float fl_lut[25] = {0.1, 0.25, 0.3, 0.5, 0.75, 1.0, 1.5,
+                                   2.0, 2.5, 3.0, 5.0, 7.5, 10, 15,
+                                   20, 25, 30, 50, 75, 100, 150,
+                                   200, 250, 300, 500};
+  static const int rl_dac1_lut[25] = {16, 56, 1, 35, 49, 44, 9, 8, 42,
+                                      20, 40, 18, 5, 62, 54, 48, 44, 34,
+                                      28, 25, 21, 18, 17, 15, 13};
+  static const int rl_dac2_lut[25] = {60, 54, 40, 17, 9, 6, 4, 3, 2, 2, 1, 1, 1,
+                                      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  static const int rl_dac3_lut[25] = {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+  int i_fl = 0;
+  for (unsigned int i = 0; i < sizeof(fl_lut) / sizeof(float); i++)
+  {
+    if (fl <= fl_lut[i])
+    {
+      break;
+    }
+    i_fl++;
+  }
+
+  rhd_w_shadow(dev, AMP_BW_SEL_0, rh1_dac1_lut[i_fh]);
+  rhd_w_shadow(dev, AMP_BW_SEL_1, rh1_dac2_lut[i_fh]);
+  rhd_w_shadow(dev, AMP_BW_SEL_2, rh2_dac1_lut[i_fh]);
+  rhd_w_shadow(dev, AMP_BW_SEL_3, rh2_dac2_lut[i_fh]);
+  rhd_w_shadow(dev, AMP_BW_SEL_4, rl_dac1_lut[i_fl]);
+  int ret = rhd_w_shadow(dev, AMP_BW_SEL_5,
+                         (rl_dac3_lut[i_fl] << 6) | rl_dac2_lut[i_fl]);
+
+  return ret;
+}
+
+int rhd_cfg_dsp(rhd_device_t *dev, bool twos_comp, bool abs_mode, bool dsp,
+                float fdsp, float fs)
+{
+  static const double k_lut[16] = {0.99, 0.1103, 0.04579, 0.02125,
+                                   0.01027, 0.005053, 0.002506, 0.001248,
+                                   0.0006229, 0.0003112, 0.0001555,
+                                   0.00007773, 0.00003886, 0.00001943,
+                                   0.000009714, 0.000004857};
+
+  int dsp_val = 0;
+  if (dsp)
+  {
+    float k = fdsp / fs;
+    for (unsigned int i = 0; i < sizeof(k_lut) / sizeof(double); i++)
+    {
+      if (k > k_lut[i])
+      {
+        break;
+      }
+      dsp_val++;
+    }
+  }
+
+  return rhd_w_shadow(dev, ADC_OUT_FMT_DPS_OFF_RMVL,
+                      (1 << 7) | (((int)twos_comp) << 6) |
+                          (((int)abs_mode) << 5) | (((int)dsp) << 4) |
+                          dsp_val);
+}
+
+bool rhd_cfg_twos_comp(const rhd_device_t *dev)
+{
+  if (dev->regs_valid & (1UL << ADC_OUT_FMT_DPS_OFF_RMVL))
+  {
+    return (dev->regs[ADC_OUT_FMT_DPS_OFF_RMVL] >> 6) & 1;
+  }
+  return true;
+}
+
+uint8_t rhd_calib(rhd_device_t *dev)
+{
+  int ret = rhd_send(dev, 0b01010101, 0);
+
+  for (int i = 0; i < 9; i++)
+  {
+    // 9 dummy cmds
+    ret = rhd_r(dev, CHIP_ID);
+  }
+
+  return ret;
+}
+
+uint8_t rhd_clear_calib(rhd_device_t *dev) { return rhd_send(dev, 0b01101010, 0); }
+
+int rhd_sanity_check(rhd_device_t *dev)
+{
+  const char INTAN[] = "INTAN";
+  const uint16_t regs[] = {INTAN_0, INTAN_1, INTAN_2, INTAN_3, INTAN_4};
+  uint8_t vals[sizeof(regs) / sizeof(regs[0])];
+  int ret = 0;
+
+  rhd_read_regs(dev, regs, vals, sizeof(regs) / sizeof(regs[0]));
+  for (int i = 0; i < sizeof(INTAN) - 1; i++)
+  {
+    if ((char)vals[i] != INTAN[i])
+    {
+      ret = i + INTAN_0;
+      RHD_STAT_INC(dev, sanity_failures);
+      break;
+    }
+  }
+  return ret;
+}
+
+int rhd_check_set(rhd_device_t *dev, uint32_t period)
+{
+  dev->chk_period = 0;
+  dev->chk_count = 0;
+  memset(&dev->check, 0, sizeof(dev->check));
+  if (period == 0)
+  {
+    return 0;
+  }
+  if (rhd_sanity_check(dev) != 0)
+  {
+    return -1;
+  }
+
+  rhd_check_read_words(dev);
+  dev->chk_period = period;
+  return 0;
+}
+
+int rhd_resync(rhd_device_t *dev)
+{
+  for (int i = 0; i < RHD_CHECK_RETRIES; i++)
+  {
+    RHD_STAT_INC(dev, retries);
+    // Its 2 dummy reads flush whatever was left in the pipeline
+    if (rhd_sanity_check(dev) == 0)
+    {
+      rhd_check_read_words(dev);
+      dev->check.resyncs++;
+      return 0;
+    }
+  }
+  dev->check.failures++;
+  return -1;
+}
+
+static void rhd_check_read_words(rhd_device_t *dev)
+{
+  // Same reads as a check, answered by the last 2
+  rhd_put_cmd(dev, dev->tx_buf, 0, RHD_CMD_READ(CHIP_ID));
+  rhd_put_cmd(dev, dev->tx_buf, 1, RHD_CMD_READ(INTAN_0));
+  rhd_put_cmd(dev, dev->tx_buf, 2, RHD_CMD_READ(CHIP_ID));
+  rhd_put_cmd(dev, dev->tx_buf, 3, RHD_CMD_READ(CHIP_ID));
+  rhd_xfer(dev, dev->tx_buf, dev->rx_buf, dev->double_bits ? 8 : 4);
+  dev->chk_word[0] = rhd_get_word(dev, &dev->rx_buf[4]);
+  dev->chk_word[1] = rhd_get_word(dev, &dev->rx_buf[6]);
+}
+
+static void rhd_check_encode(const rhd_device_t *dev, uint16_t *tx,
+                             size_t slot, size_t n, size_t n_data)
+{
+  if (dev->chk_period == 0)
+  {
+    return;
+  }
+  for (size_t i = n_data - 2 > slot ? n_data - 2 - slot : 0; i < n; i++)
+  {
+    // Different answers, so that a shift by one command shows
+    uint16_t reg = slot + i == n_data - 1 ? INTAN_0 : CHIP_ID;
+    rhd_put_cmd(dev, tx, i, RHD_CMD_READ(reg));
+  }
+}
+
+static void rhd_check_answers(rhd_device_t *dev, const uint16_t *rx,
+                              size_t slot, size_t n, size_t n_data)
+{
+  for (size_t i = n_data > slot ? n_data - slot : 0; i < n; i++)
+  {
+    dev->check.checks++;
+    if (rhd_get_word(dev, &rx[2 * i]) != dev->chk_word[slot + i - n_data])
+    {
+      dev->check.errors++;
+    }
+  }
+}
+
+static size_t rhd_check_burst_encode(const rhd_device_t *dev, uint16_t *tx,
+                                     size_t slot, size_t n, size_t n_data)
+{
+  size_t len = rhd2164_burst_encode(dev, tx, slot, n);
+  rhd_check_encode(dev, tx, slot, n, n_data);
+  return len;
+}
+
+static void rhd_check_burst_decode(rhd_device_t *dev, const uint16_t *rx,
+                                   size_t slot, size_t n, size_t n_data,
+                                   uint16_t *out, size_t frame_stride,
+                                   size_t ch_stride)
+{
+  // The checked reads go past the last frame
+  size_t n_dec = slot >= n_data ? 0 : (n_data - slot < n ? n_data - slot : n);
+  rhd_burst_decode(dev, rx, slot, n_dec, out, frame_stride, ch_stride);
+  rhd_check_answers(dev, rx, slot, n, n_data);
+}
+
+uint8_t rhd_read_force(rhd_device_t *dev, int reg)
+{
+  const uint16_t r = reg;
+  uint8_t val = 0;
+  rhd_read_regs(dev, &r, &val, 1);
+  return val;
+}
+
+int rhd_read_regs(rhd_device_t *dev, const uint16_t *regs, uint8_t *vals,
+                  size_t n)
+{
+  const size_t tx_per_cmd = dev->double_bits ? 2 : 1;
+  // Both modes receive 2 words per command
+  const size_t chunk_cmds = RHD_SWEEP_WORDS / 2;
+  // 2 dummy reads flush the last result out of the pipeline
+  const size_t n_cmds = n + 2;
+  int ret = 0;
+
+  for (size_t cmd = 0; cmd < n_cmds; cmd += chunk_cmds)
+  {
+    size_t len = n_cmds - cmd < chunk_cmds ? n_cmds - cmd : chunk_cmds;
+    for (size_t i = 0; i < len; i++)
+    {
+      uint16_t reg = cmd + i < n ? regs[cmd + i] : CHIP_ID;
+      rhd_put_cmd(dev, dev->tx_buf, i, ((reg & 0x3F) | 0xC0) << 8);
+    }
+    ret = rhd_xfer(dev, dev->tx_buf, dev->rx_buf, len * tx_per_cmd);
+
+    // Command c holds the result of command c - 2
+    for (size_t i = 0; i < len; i++)
+    {
+      if (cmd + i >= 2)
+      {
+        vals[cmd + i - 2] = rhd_get_result(dev, dev->rx_buf, i);
+      }
+    }
+  }
+  return ret;
+}
+
+int rhd_chip_info(rhd_device_t *dev, rhd_chip_info_t *info)
+{
+  const uint16_t regs[5] = {MISO_A_B, DIE_REV, UNI_BIPLR_AMPS, NB_AMP,
+                            CHIP_ID};
+  uint8_t vals[5];
+
+  int ret = rhd_read_regs(dev, regs, vals, 5);
+  info->miso_a_b = vals[0];
+  info->die_rev = vals[1];
+  info->unipolar = vals[2];
+  info->n_amps = vals[3];
+  info->chip_id = vals[4];
+  return ret;
+}
+
+int rhd_dump_regs(rhd_device_t *dev, uint8_t *vals)
+{
+  uint16_t regs[RHD_SHADOW_REGS];
+  for (uint16_t reg = 0; reg < RHD_SHADOW_REGS; reg++)
+  {
+    regs[reg] = reg;
+  }
+
+  int ret = rhd_read_regs(dev, regs, vals, RHD_SHADOW_REGS);
+  for (uint16_t reg = 0; reg < RHD_SHADOW_REGS; reg++)
+  {
+    if (!(dev->regs_dirty & (1UL << reg)))
+    {
+      dev->regs[reg] = vals[reg];
+      dev->regs_valid |= 1UL << reg;
+    }
+  }
+  return ret;
+}
+
+uint16_t *rhd2164_sample(rhd_device_t *dev, uint16_t ch, uint16_t *rx)
+{
+  switch ((int)dev->double_bits)
+  {
+  case 0:
+  {
+    uint16_t tx = (ch << 8);
+    rhd_xfer(dev, &tx, rx, 1);
+    return rx;
+  }
+  default:
+  {
+    uint16_t tx[2] = {0};
+    tx[0] = rhd_duplicate_bits(ch);
+
+    rhd_xfer(dev, tx, rx, 2);
+
+    rhd_unsplit_frame(rx, &rx[0], &rx[1], 1);
+    return rx;
+  }
+  }
+}
+
+uint16_t rhd2000_sample(rhd_device_t *dev, uint16_t ch)
+{
+  uint16_t tx = (ch << 8);
+  uint16_t rx[2] = {0};
+  rhd_xfer(dev, &tx, rx, 1);
+  return rx[0];
+}
+
+void rhd2164_sample_all(rhd_device_t *dev, uint16_t *sample_buf)
+{
+  uint16_t *tx = dev->tx_buf;
+  uint16_t *rx = dev->rx_buf;
+
+  if (dev->sparse || dev->aux_k > 0 || dev->inj_k > 0)
+  {
+    const size_t n = dev->n_sweep;
+    // Both modes receive 2 words per command
+    const size_t chunk_cmds = RHD_SWEEP_WORDS / 2;
+    if (n == 0)
+    {
+      return;
+    }
+    for (size_t c = 0; c < n; c += chunk_cmds)
+    {
+      size_t len = n - c < chunk_cmds ? n - c : chunk_cmds;
+      rhd_xfer(dev, tx, rx, rhd2164_burst_encode(dev, tx, c, len));
+      // Command i holds the result of command i - 2, from the last sweep for
+      // the first 2
+      for (size_t i = 0; i < len; i++)
+      {
+        size_t pos = c + i;
+        size_t k = (pos + 2 * n - 2) % n;
+        size_t aux_j = 0;
+        size_t back = pos < 2 ? (2 - pos + n - 1) / n : 0;
+        if (k >= dev->n_conv + dev->aux_k)
+        {
+          rhd_inj_done(dev, &rx[2 * i],
+                       dev->inj_next - back * dev->inj_k + k - dev->n_conv -
+                           dev->aux_k);
+          continue;
+        }
+        if (k >= dev->n_conv)
+        {
+          // Go back `back` sweeps, modulo n_aux
+          aux_j = dev->aux_next + back * dev->aux_k * (dev->n_aux - 1) + k -
+                  dev->n_conv;
+        }
+        rhd_decode_cmd(dev, &rx[2 * i], k, aux_j, sample_buf, 1);
+      }
+    }
+    rhd_aux_advance(dev, 1);
+    sample_buf[0] &= 0xFFFE;
+    RHD_STAT_FRAMES(dev, 1);
+    return;
+  }
+
+  // The whole sweep is pre-encoded and sent in a single transfer, with the
+  // known reads every `chk_period` frames
+  const bool check =
+      dev->chk_period > 0 && ++dev->chk_count >= dev->chk_period;
+  const size_t n_cmds = RHD_SWEEP_CMDS + (check ? RHD_CHECK_CMDS : 0);
+  const uint64_t errors = dev->check.errors;
+  switch ((int)dev->double_bits)
+  {
+  case 0:
+  {
+    memcpy(tx, RHD_SWEEP_TX, sizeof(RHD_SWEEP_TX));
+    break;
+  }
+  default:
+  {
+    memcpy(tx, RHD_SWEEP_TX_DOUBLE, sizeof(RHD_SWEEP_TX_DOUBLE));
+    break;
+  }
+  }
+  if (check)
+  {
+    dev->chk_count = 0;
+    rhd_check_encode(dev, tx, 0, n_cmds, RHD_SWEEP_CMDS + 2);
+  }
+  rhd_xfer(dev, tx, rx, dev->double_bits ? 2 * n_cmds : n_cmds);
+
+  // Results come back 2 commands later, so ch0 holds last sweep's ch30,
+  // unless the reads of a check flushed it out
+  const uint16_t *prev = dev->chk_held ? dev->chk_hold : rx;
+  rhd_demux(dev, &rx[4], &sample_buf[0], &sample_buf[32], RHD_SWEEP_CMDS - 2);
+  rhd_demux(dev, prev, &sample_buf[30], &sample_buf[62], 2);
+  dev->chk_held = check;
+  if (check)
+  {
+    memcpy(dev->chk_hold, &rx[2 * RHD_SWEEP_CMDS], sizeof(dev->chk_hold));
+    rhd_check_answers(dev, rx, 0, n_cmds, RHD_SWEEP_CMDS + 2);
+  }
+  // Alignment
+  sample_buf[0] &= 0xFFFE;
+  RHD_STAT_FRAMES(dev, 1);
+  if (dev->check.errors != errors)
+  {
+    rhd_resync(dev);
+  }
+}
+
+size_t rhd2164_burst_encode(const rhd_device_t *dev, uint16_t *tx, size_t slot,
+                            size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    size_t f = (slot + i) / dev->n_sweep;
+    size_t k = (slot + i) % dev->n_sweep;
+    if (k >= dev->n_conv + dev->aux_k)
+    {
+      uint64_t j = dev->inj_next + f * dev->inj_k + k - dev->n_conv -
+                   dev->aux_k;
+      rhd_put_cmd(dev, tx, i, rhd_inj_take(dev, j));
+      continue;
+    }
+    if (k >= dev->n_conv)
+    {
+      size_t aux_j = dev->aux_next + f * dev->aux_k + k - dev->n_conv;
+      rhd_put_cmd(dev, tx, i, dev->aux_cmds[aux_j % dev->n_aux]);
+      continue;
+    }
+    int ch = dev->sparse ? dev->sweep_ch[k] : (int)k;
+    if (dev->double_bits)
+    {
+      tx[2 * i] = RHD_SWEEP_TX_DOUBLE[2 * ch];
+      tx[2 * i + 1] = RHD_SWEEP_TX_DOUBLE[2 * ch + 1];
+    }
+    else
+    {
+      tx[i] = RHD_SWEEP_TX[ch];
+    }
+  }
+  return dev->double_bits ? 2 * n : n;
+}
+
+void rhd2164_burst_decode(const rhd_device_t *dev, const uint16_t *rx,
+                          size_t slot, size_t n, uint16_t *out,
+                          size_t frame_stride)
+{
+  rhd_burst_decode(dev, rx, slot, n, out, frame_stride, 1);
+}
+
+static void rhd_burst_decode(const rhd_device_t *dev, const uint16_t *rx,
+                             size_t slot, size_t n, uint16_t *out,
+                             size_t frame_stride, size_t ch_stride)
+{
+  // Results come back 2 commands later, first 2 belong to older commands
+  const size_t n_sweep = dev->n_sweep;
+  size_t i = slot < 2 ? 2 - slot : 0;
+  while (i < n)
+  {
+    size_t f = (slot + i - 2) / n_sweep;
+    size_t k = (slot + i - 2) % n_sweep;
+    uint16_t *frame = out + f * frame_stride;
+    if (k >= dev->n_conv + dev->aux_k)
+    {
+      rhd_inj_done(dev, &rx[2 * i],
+                   dev->inj_next + f * dev->inj_k + k - dev->n_conv -
+                       dev->aux_k);
+      i++;
+      continue;
+    }
+    if (k >= dev->n_conv)
+    {
+      size_t aux_j = dev->aux_next + f * dev->aux_k + k - dev->n_conv;
+      rhd_decode_cmd(dev, &rx[2 * i], k, aux_j, frame, ch_stride);
+      i++;
+      continue;
+    }
+    // Demux runs of consecutive CONVERT commands of the same frame
+    size_t run = dev->n_conv - k < n - i ? dev->n_conv - k : n - i;
+    if (dev->sparse)
+    {
+      rhd_demux_sparse(dev, &rx[2 * i], k, run, frame, ch_stride);
+    }
+    else if (ch_stride == 1)
+    {
+      rhd_demux(dev, &rx[2 * i], &frame[k], &frame[k + 32], run);
+    }
+    else
+    {
+      // Channel-major: scatter every sample to its channel's row
+      uint16_t a[RHD_SWEEP_CMDS], b[RHD_SWEEP_CMDS];
+      rhd_demux(dev, &rx[2 * i], a, b, run);
+      uint16_t *row_a = frame + k * ch_stride;
+      uint16_t *row_b = frame + (k + 32) * ch_stride;
+      for (size_t j = 0; j < run; j++)
+      {
+        row_a[j * ch_stride] = a[j];
+        row_b[j * ch_stride] = b[j];
+      }
+    }
+    i += run;
+  }
+}
+
+int rhd2164_sample_frames(rhd_device_t *dev, size_t n_frames,
+                          uint16_t (*out)[RHD_FRAME_CH])
+{
+  return rhd_sample_burst(dev, n_frames, out[0], RHD_FRAME_CH, 1);
+}
+
+int rhd2164_sample_block(rhd_device_t *dev, size_t n_frames, uint16_t *block,
+                         size_t block_len)
+{
+  if (((uintptr_t)block & (RHD_BLOCK_ALIGN - 1)) != 0 ||
+      block_len != RHD_BLOCK_LEN(block_len) || n_frames > block_len)
+  {
+    return -1;
+  }
+  return rhd_sample_burst(dev, n_frames, block, 1, block_len);
+}
+
+static int rhd_sample_burst(rhd_device_t *dev, size_t n_frames, uint16_t *out,
+                            size_t frame_stride, size_t ch_stride)
+{
+  // 2 more commands flush the last frame out of the pipeline, then 2 more
+  // flush the checked reads
+  const size_t n_data = n_frames * dev->n_sweep + 2;
+  const size_t n_slots = n_data + (dev->chk_period > 0 ? 2 : 0);
+  const uint64_t errors = dev->check.errors;
+  const bool own_buf = dev->burst_tx == NULL;
+  uint16_t *tx = own_buf ? dev->tx_buf : dev->burst_tx;
+  uint16_t *rx = own_buf ? dev->rx_buf : dev->burst_rx;
+  // Both modes receive 2 words per command
+  size_t chunk_cmds = (own_buf ? RHD_SWEEP_WORDS : dev->burst_words) / 2;
+  const size_t tx_per_cmd = dev->double_bits ? 2 : 1;
+  int ret = 0;
+
+  if (n_frames == 0 || dev->n_sweep == 0)
+  {
+    return 0;
+  }
+
+  if (dev->async == NULL || chunk_cmds < 2)
+  {
+    for (size_t slot = 0; slot < n_slots; slot += chunk_cmds)
+    {
+      size_t n = n_slots - slot < chunk_cmds ? n_slots - slot : chunk_cmds;
+      size_t len = rhd_check_burst_encode(dev, tx, slot, n, n_data);
+      ret = rhd_xfer(dev, tx, rx, len);
+      rhd_check_burst_decode(dev, rx, slot, n, n_data, out, frame_stride,
+                             ch_stride);
+    }
+  }
+  else
+  {
+    // Double buffering: the next chunk is in flight while demuxing this one
+    chunk_cmds /= 2;
+    const rhd_rw_async_t *async = dev->async;
+    size_t h = 0;
+    size_t slot = 0;
+    size_t n = n_slots < chunk_cmds ? n_slots : chunk_cmds;
+    size_t len = rhd_check_burst_encode(dev, tx, slot, n, n_data);
+    uint64_t t_sub = RHD_STAT_NOW();
+    int ticket = async->submit(async->ctx, tx, rx, len);
+
+    while (ticket >= 0)
+    {
+      size_t next_slot = slot + n;
+      size_t next_n = n_slots - next_slot < chunk_cmds ? n_slots - next_slot
+                                                       : chunk_cmds;
+      uint16_t *next_tx = tx + (h ^ 1) * tx_per_cmd * chunk_cmds;
+      uint16_t *next_rx = rx + (h ^ 1) * 2 * chunk_cmds;
+      int next_ticket = -1;
+      size_t next_len = 0;
+      uint64_t t_next_sub = 0;
+      if (next_n > 0)
+      {
+        next_len =
+            rhd_check_burst_encode(dev, next_tx, next_slot, next_n, n_data);
+        t_next_sub = RHD_STAT_NOW();
+        next_ticket = async->submit(async->ctx, next_tx, next_rx, next_len);
+      }
+
+      ret = async->complete(async->ctx, ticket);
+      RHD_STAT_RW(dev, t_sub, len, ret);
+      rhd_check_burst_decode(dev, rx + h * 2 * chunk_cmds, slot, n, n_data,
+                             out, frame_stride, ch_stride);
+
+      if (next_n == 0)
+      {
+        break;
+      }
+      slot = next_slot;
+      n = next_n;
+      len = next_len;
+      t_sub = t_next_sub;
+      ticket = next_ticket;
+      h ^= 1;
+    }
+    if (ticket < 0)
+    {
+      ret = ticket;
+    }
+  }
+
+  rhd_aux_advance(dev, n_frames);
+
+  // Alignment
+  for (size_t f = 0; f < n_frames; f++)
+  {
+    out[f * frame_stride] &= 0xFFFE;
+  }
+  RHD_STAT_FRAMES(dev, n_frames);
+  if (dev->check.errors != errors)
+  {
+    rhd_resync(dev);
+  }
+  return ret;
+}
+
+static int rhd_xfer(rhd_device_t *dev, uint16_t *tx, uint16_t *rx, size_t len)
+{
+  uint64_t t0 = RHD_STAT_NOW();
+  int ret;
+  if (dev->async == NULL)
+  {
+    ret = dev->rw(tx, rx, len);
+  }
+  else
+  {
+    int ticket = dev->async->submit(dev->async->ctx, tx, rx, len);
+    ret = ticket < 0 ? ticket : dev->async->complete(dev->async->ctx, ticket);
+  }
+  RHD_STAT_RW(dev, t0, len, ret);
+  return ret;
+}
+
+#ifdef RHD_INSTRUMENT
+/**
+ * @brief Add to a counter which only the device's thread writes. A plain
+ * load and store, atomic so that snapshots from other threads are not torn.
+ */
+static void rhd_stat_add(uint64_t *counter, uint64_t n)
+{
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                   __ATOMIC_RELAXED);
+}
+
+static uint64_t rhd_stat_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void rhd_stat_hist(uint64_t *hist, uint64_t ns, uint64_t n)
+{
+  int i = ns <= 1 ? 0 : 63 - __builtin_clzll(ns);
+  rhd_stat_add(&hist[i < RHD_STATS_BUCKETS ? i : RHD_STATS_BUCKETS - 1], n);
+}
+
+static void rhd_stat_rw(rhd_device_t *dev, uint64_t t0, size_t len, int ret)
+{
+  rhd_stat_add(&dev->stats.rw_calls, 1);
+  rhd_stat_add(&dev->stats.words, len);
+  if (ret < 0)
+  {
+    rhd_stat_add(&dev->stats.rw_errors, 1);
+  }
+  rhd_stat_hist(dev->stats.rw_ns, rhd_stat_now() - t0, 1);
+}
+
+static void rhd_stat_frames(rhd_device_t *dev, size_t n)
+{
+  uint64_t now = rhd_stat_now();
+  if (dev->stats.last_frame_ns != 0 && n > 0)
+  {
+    rhd_stat_hist(dev->stats.period_ns, (now - dev->stats.last_frame_ns) / n,
+                  n);
+  }
+  rhd_stat_add(&dev->stats.frames, n);
+  __atomic_store_n(&dev->stats.last_frame_ns, now, __ATOMIC_RELAXED);
+}
+
+void rhd_stats_snapshot(const rhd_device_t *dev, rhd_stats_t *out)
+{
+  const uint64_t *src = (const uint64_t *)&dev->stats;
+  uint64_t *dst = (uint64_t *)out;
+  for (size_t i = 0; i < sizeof(rhd_stats_t) / sizeof(uint64_t); i++)
+  {
+    dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+  }
+}
+
+uint64_t rhd_stats_quantile(const uint64_t *hist, double q)
+{
+  uint64_t total = 0;
+  for (int i = 0; i < RHD_STATS_BUCKETS; i++)
+  {
+    total += hist[i];
+  }
+  if (total == 0)
+  {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(q * (double)total);
+  rank = rank < total ? rank : total - 1;
+  uint64_t seen = 0;
+  int i = 0;
+  for (; i < RHD_STATS_BUCKETS - 1; i++)
+  {
+    seen += hist[i];
+    if (seen > rank)
+    {
+      break;
+    }
+  }
+  return (uint64_t)2 << i;
+}
+#endif
+
+static void rhd_put_cmd(const rhd_device_t *dev, uint16_t *tx, size_t i,
+                        uint16_t cmd)
+{
+  if (dev->double_bits)
+  {
+    tx[2 * i] = rhd_duplicate_bits(cmd >> 8);
+    tx[2 * i + 1] = rhd_duplicate_bits(cmd & 0xFF);
+  }
+  else
+  {
+    tx[i] = cmd;
+  }
+}
+
+static uint16_t rhd_get_word(const rhd_device_t *dev, const uint16_t *rx)
+{
+  if (dev->double_bits)
+  {
+    uint8_t hi, lo, b;
+    rhd_unsplit_u16(rx[0], &hi, &b);
+    rhd_unsplit_u16(rx[1], &lo, &b);
+    return (uint16_t)((hi << 8) | lo);
+  }
+  return rx[0];
+}
+
+static uint8_t rhd_get_result(const rhd_device_t *dev, const uint16_t *rx,
+                              size_t i)
+{
+  if (dev->double_bits)
+  {
+    uint8_t a, b;
+    rhd_unsplit_u16(rx[2 * i + 1], &a, &b);
+    return a;
+  }
+  return rx[2 * i] & 0xFF;
+}
+
+static int rhd_duplicate_bits(uint8_t val) { return RHD_DUP_LUT[val]; }
 
 static void rhd_unsplit_u16(uint16_t data, uint8_t *a, uint8_t *b)
 {
-  static const uint8_t shift_arr[] = {0x1, 0x2, 0x4, 0x8,
-                                      0x10, 0x20, 0x40, 0x80};
+  // Unshuffle: odd bits go to the high byte, even bits to the low byte
+  uint16_t t = (data ^ (data >> 1)) & 0x2222;
+  data ^= t ^ (t << 1);
+  t = (data ^ (data >> 2)) & 0x0C0C;
+  data ^= t ^ (t << 2);
+  t = (data ^ (data >> 4)) & 0x00F0;
+  data ^= t ^ (t << 4);
+
+  *a = data >> 8;
+  *b = data & 0xFF;
+}
+
+void rhd_unsplit_frame(const uint16_t *rx, uint16_t *a, uint16_t *b,
+                       size_t n_cmds)
+{
+  for (size_t i = 0; i < n_cmds; i++)
+  {
+    uint32_t x = ((uint32_t)rx[2 * i] << 16) | rx[2 * i + 1];
+#if defined(__BMI2__)
+    uint32_t aa = _pext_u32(x, 0xAAAAAAAA);
+    uint32_t bb = _pext_u32(x, 0x55555555);
+#else
+    // Same unshuffle as rhd_unsplit_u16 on both words at once, branch-free so
+    // the compiler can vectorize it (SSE2/AVX2, NEON)
+    uint32_t t = (x ^ (x >> 1)) & 0x22222222;
+    x ^= t ^ (t << 1);
+    t = (x ^ (x >> 2)) & 0x0C0C0C0C;
+    x ^= t ^ (t << 2);
+    t = (x ^ (x >> 4)) & 0x00F000F0;
+    x ^= t ^ (t << 4);
+    t = (x ^ (x >> 8)) & 0x0000FF00;
+    x ^= t ^ (t << 8);
+    uint32_t aa = x >> 16;
+    uint32_t bb = x & 0xFFFF;
+#endif
+    a[i] = (uint16_t)aa | 1;
+    b[i] = (uint16_t)bb | 1;
+  }
+}
+
+static void rhd_build_sweep(rhd_device_t *dev)
+{
+  size_t n = 0;
+  size_t n_ch = 0;
+
+  if (!dev->sparse)
+  {
+    dev->n_conv = RHD_SWEEP_CMDS;
+    dev->n_sweep = RHD_SWEEP_CMDS + dev->aux_k + dev->inj_k;
+    dev->n_ch = RHD_FRAME_CH;
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++)
+    {
+      dev->ch_map[ch] = ch;
+    }
+    return;
+  }
+
+  // CONVERT c returns both c and c + 32
+  for (int c = 0; c < RHD_SWEEP_CMDS; c++)
+  {
+    if ((dev->ch_mask >> c) & 0x100000001ULL)
+    {
+      dev->sweep_ch[n++] = c;
+    }
+  }
+  for (size_t k = 0; k < n; k++)
+  {
+    int c = dev->sweep_ch[k];
+    dev->sweep_a[k] = -1;
+    if ((dev->ch_mask >> c) & 1)
+    {
+      dev->sweep_a[k] = n_ch;
+      dev->ch_map[n_ch++] = c;
+    }
+  }
+  for (size_t k = 0; k < n; k++)
+  {
+    int c = dev->sweep_ch[k] + 32;
+    dev->sweep_b[k] = -1;
+    if ((dev->ch_mask >> c) & 1)
+    {
+      dev->sweep_b[k] = n_ch;
+      dev->ch_map[n_ch++] = c;
+    }
+  }
+  dev->n_conv = n;
+  // The 2 flush commands of a burst are sent again by the next one, so they
+  // can't be injection slots: these wait for a longer channel list
+  dev->n_sweep = n + dev->aux_k + (n + dev->aux_k >= 2 ? dev->inj_k : 0);
+  dev->n_ch = n_ch;
+}
+
+static void rhd_decode_cmd(const rhd_device_t *dev, const uint16_t *rx,
+                           size_t k, size_t aux_j, uint16_t *frame,
+                           size_t ch_stride)
+{
+  if (k >= dev->n_conv)
+  {
+    if (dev->aux_out == NULL)
+    {
+      return;
+    }
+    uint16_t a, b;
+    rhd_demux(dev, rx, &a, &b, 1);
+    // Undo the alignment bit of DDR demux, results are raw
+    dev->aux_out[aux_j % dev->n_aux] = dev->double_bits ? a & 0xFFFE : a;
+  }
+  else if (dev->sparse)
+  {
+    rhd_demux_sparse(dev, rx, k, 1, frame, ch_stride);
+  }
+  else
+  {
+    uint16_t a, b;
+    rhd_demux(dev, rx, &a, &b, 1);
+    frame[k * ch_stride] = a;
+    frame[(k + 32) * ch_stride] = b;
+  }
+}
 
-  uint8_t aa = 0;
-  uint8_t bb = 0;
+static void rhd_demux_sparse(const rhd_device_t *dev, const uint16_t *rx,
+                             size_t k, size_t n, uint16_t *frame,
+                             size_t ch_stride)
+{
+  for (size_t i = 0; i < n; i++, k++)
+  {
+    uint16_t a, b;
+    rhd_demux(dev, &rx[2 * i], &a, &b, 1);
+    if (dev->sweep_a[k] >= 0)
+    {
+      frame[dev->sweep_a[k] * ch_stride] = a;
+    }
+    if (dev->sweep_b[k] >= 0)
+    {
+      frame[dev->sweep_b[k] * ch_stride] = b;
+    }
+  }
+}
 
-  uint16_t dataa = data >> 1;
-  // Doubt we can optimize it much more
-  for (int i = 0; i < 8; i++)
+static void rhd_demux(const rhd_device_t *dev, const uint16_t *rx, uint16_t *a,
+                      uint16_t *b, size_t n_cmds)
+{
+  if (dev->double_bits)
+  {
+    rhd_unsplit_frame(rx, a, b, n_cmds);
+    return;
+  }
+  for (size_t i = 0; i < n_cmds; i++)
   {
-    aa |= (dataa >> i) & shift_arr[i];
-    bb |= (data >> i) & shift_arr[i];
+    a[i] = rx[2 * i];
+    b[i] = rx[2 * i + 1];
   }
-  *a = aa;
-  *b = bb;
 }
@@ -13,11 +13,53 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/** Number of CONVERT commands in a full RHD2164 sweep */
+#define RHD_SWEEP_CMDS 32
+
+/** Number of channels in a RHD2164 frame */
+#define RHD_FRAME_CH 64
+
+/**
+ * Number of 16-bit words received for a full RHD2164 sweep. It is also the
+ * number of words sent in DDR (`double_bits`) mode.
+ */
+#define RHD_SWEEP_WORDS 64
+
+/** Number of writable configuration registers (0-21) kept in the shadow */
+#define RHD_SHADOW_REGS 22
+
+/** Alignment of channel-major blocks, see @ref rhd2164_sample_block */
+#define RHD_BLOCK_ALIGN 64
+
+/** Row length of a channel-major block of `n` frames, so rows stay aligned */
+#define RHD_BLOCK_LEN(n) (((n) + 31) & ~(size_t)31)
+
+/** RHD2000 commands, for auxiliary slots (see @ref rhd_aux_set) */
+#define RHD_CMD_CONVERT(ch) ((uint16_t)(((ch) & 0x3F) << 8))
+#define RHD_CMD_READ(reg) ((uint16_t)((0xC0 | ((reg) & 0x3F)) << 8))
+#define RHD_CMD_WRITE(reg, val)                                                \
+  ((uint16_t)(((0x80 | ((reg) & 0x3F)) << 8) | ((val) & 0xFF)))
+
+/** Auxiliary ADC channels, for @ref RHD_CMD_CONVERT */
+#define RHD_CH_AUX1 32
+#define RHD_CH_AUX2 33
+#define RHD_CH_AUX3 34
+#define RHD_CH_SUPPLY 48
+#define RHD_CH_TEMP 49
+
 /**
  * @brief RHD2164 Read Write function typedef.
  * When called, it must send out w_buf while reading into r_buf.
  * The driver uses @ref rhd_device_t's rx_buf and tx_buf.
  *
+ * A single call can transfer many commands, eg a full sweep of 32 commands.
+ * Every command must be sent with its own chip select pulse: one word of
+ * `tx_buf`, or two words with `double_bits`.
+ *
+ * With `double_bits`, `rx_buf` receives `len` words. Otherwise, `rx_buf`
+ * receives MISO A and MISO B for every word sent, as
+ * `{a0, b0, a1, b1, ...}`, so it must hold `2 * len` words.
+ *
  * @param tx_buf write buffer
  * @param rx_buf receive buffer
  * @param len number of 16-bit values to transfer.
@@ -26,10 +68,205 @@
  */
 typedef int (*rhd_rw_t)(uint16_t *tx_buf, uint16_t *rx_buf, size_t len);
 
+/**
+ * @brief Optional asynchronous transport, eg double-buffered DMA or io_uring.
+ * It follows the same buffer contract as @ref rhd_rw_t.
+ *
+ * The driver keeps at most 2 transfers in flight and completes them in
+ * submission order. The buffers of a transfer must be left untouched by the
+ * transport once it's completed.
+ */
+typedef struct
+{
+  /**
+   * Start a transfer of `len` words.
+   * Returns a ticket >= 0 on success, a negative error code otherwise.
+   */
+  int (*submit)(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf, size_t len);
+  /**
+   * Optional. Check a transfer without blocking.
+   * Returns 1 when done, 0 while in flight, a negative error code otherwise.
+   */
+  int (*poll)(void *ctx, int ticket);
+  /**
+   * Block until a transfer is done. Returns the same code as @ref rhd_rw_t.
+   */
+  int (*complete)(void *ctx, int ticket);
+  /** User context given to every callback */
+  void *ctx;
+} rhd_rw_async_t;
+
+/**
+ * @brief Blocking transport with a context, same contract as @ref rhd_rw_t.
+ */
+typedef int (*rhd_rw_ctx_t)(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf,
+                            size_t len);
+
+/**
+ * @brief State of a blocking transport exposed as an @ref rhd_rw_async_t, see
+ * @ref rhd_rw_sync_init.
+ */
+typedef struct
+{
+  rhd_rw_ctx_t rw;
+  void *ctx;
+  /** Transfer results, by ticket */
+  int rets[2];
+  int next_ticket;
+} rhd_rw_sync_t;
+
+/** Most queued commands in flight in a burst, see @ref rhd_cmdq_attach */
+#define RHD_CMDQ_INFLIGHT 32
+
+/**
+ * @brief Result of a queued command, see @ref rhd_cmdq_push. Owned by the
+ * caller, it must stay valid until the command completes.
+ */
+typedef struct rhd_future
+{
+  /** Called by the acquisition thread on completion, may be NULL */
+  void (*cb)(struct rhd_future *fut, void *ctx);
+  void *ctx;
+  /** MISO A result of the command, READ and WRITE results in the low byte */
+  uint16_t result;
+  /** Set, with release ordering, once `result` is valid */
+  int done;
+} rhd_future_t;
+
+typedef struct
+{
+  size_t seq;
+  uint16_t cmd;
+  rhd_future_t *fut;
+} rhd_cmdq_cell_t;
+
+/** Command sent in injection slot `j`, waiting for its result */
+typedef struct
+{
+  uint64_t j;
+  bool busy;
+  uint16_t cmd;
+  rhd_future_t *fut;
+} rhd_cmdq_slot_t;
+
+/**
+ * @brief Lock-free multi-producer, single-consumer queue of commands, spliced
+ * into the sweeps by the acquisition thread, see @ref rhd_cmdq_attach.
+ */
+typedef struct
+{
+  rhd_cmdq_cell_t *cells;
+  size_t mask;
+  /* Producers */
+  size_t enq;
+  /* Acquisition thread only */
+  size_t deq;
+  rhd_cmdq_slot_t inflight[RHD_CMDQ_INFLIGHT];
+} rhd_cmdq_t;
+
+#ifdef RHD_INSTRUMENT
+/** Number of log2 buckets of the latency histograms */
+#define RHD_STATS_BUCKETS 32
+
+/**
+ * Hot-path counters, with `-DRHD_INSTRUMENT` only. The library and its users
+ * must agree on it, since it changes the layout of rhd_device_t.
+ *
+ * Histogram bucket `i` counts durations in `[2^i, 2^(i+1))` ns, bucket 0
+ * also counts 0 ns and the last bucket everything above.
+ */
+typedef struct
+{
+  /** Transport calls, including failed ones */
+  uint64_t rw_calls;
+  /** Transport calls which returned a negative code */
+  uint64_t rw_errors;
+  /** Words sent */
+  uint64_t words;
+  /** Frames sampled */
+  uint64_t frames;
+  /** Failed sanity checks */
+  uint64_t sanity_failures;
+  /** Resynchronization attempts, see @ref rhd_resync */
+  uint64_t retries;
+  /** Latency of every transport call, from submission to completion */
+  uint64_t rw_ns[RHD_STATS_BUCKETS];
+  /** Period between frames, averaged over every sampling call */
+  uint64_t period_ns[RHD_STATS_BUCKETS];
+  /** Completion time of the last sampling call [ns] */
+  uint64_t last_frame_ns;
+} rhd_stats_t;
+#endif
+
+/**
+ * Commands added after a sweep by integrity checks: the 2 reads whose answers
+ * are checked, then 2 more to flush them out
+ */
+#define RHD_CHECK_CMDS 4
+
+/** Integrity check counters, see @ref rhd_check_set */
+typedef struct
+{
+  /** Known answers checked */
+  uint64_t checks;
+  /** Wrong answers: a slipped pipeline or corrupted words */
+  uint64_t errors;
+  /** Successful resynchronizations after an error */
+  uint64_t resyncs;
+  /** Resynchronizations which gave up, the link needs attention */
+  uint64_t failures;
+} rhd_check_stats_t;
+
 typedef struct
 {
   rhd_rw_t rw;
+  const rhd_rw_async_t *async;
   bool double_bits;
+  uint16_t tx_buf[RHD_SWEEP_WORDS + 2 * RHD_CHECK_CMDS];
+  uint16_t rx_buf[RHD_SWEEP_WORDS + 2 * RHD_CHECK_CMDS];
+  uint16_t *burst_tx;
+  uint16_t *burst_rx;
+  size_t burst_words;
+  /* Shadow of registers 0-21, see rhd_cfg_begin */
+  uint8_t regs[RHD_SHADOW_REGS];
+  uint32_t regs_valid;
+  uint32_t regs_dirty;
+  bool regs_defer;
+  /* Channel list, see rhd_cfg_sparse */
+  bool sparse;
+  uint64_t ch_mask;
+  float fs;
+  /** Number of commands per frame, amplifier and auxiliary */
+  size_t n_sweep;
+  /** Number of amplifier CONVERT commands per frame */
+  size_t n_conv;
+  uint8_t sweep_ch[RHD_SWEEP_CMDS];
+  int8_t sweep_a[RHD_SWEEP_CMDS];
+  int8_t sweep_b[RHD_SWEEP_CMDS];
+  /** Number of samples per frame */
+  size_t n_ch;
+  /** Physical channel of every sample of a frame */
+  uint8_t ch_map[RHD_FRAME_CH];
+  /* Auxiliary slots, see rhd_aux_set */
+  const uint16_t *aux_cmds;
+  uint16_t *aux_out;
+  size_t n_aux;
+  size_t aux_k;
+  size_t aux_next;
+  /* Injection slots, after the auxiliary ones, see rhd_cmdq_attach */
+  rhd_cmdq_t *cmdq;
+  size_t inj_k;
+  uint64_t inj_next;
+  /* Integrity checks, see rhd_check_set */
+  uint32_t chk_period;
+  uint32_t chk_count;
+  bool chk_held;
+  uint16_t chk_word[2];
+  uint16_t chk_hold[4];
+  rhd_check_stats_t check;
+#ifdef RHD_INSTRUMENT
+  rhd_stats_t stats;
+#endif
 } rhd_device_t;
 
 typedef enum
@@ -90,7 +327,8 @@ uint8_t rhd_send(rhd_device_t *dev, uint16_t reg, uint16_t val);
 uint8_t rhd_r(rhd_device_t *dev, uint16_t reg);
 
 /**
- * @brief Write RHD register.
+ * @brief Write RHD register. The write is always sent, and the register
+ * shadow is updated.
  *
  * @param dev pointer to rhd_device_t instance
  * @param reg Register to write to
@@ -113,6 +351,50 @@ uint8_t rhd_w(rhd_device_t *dev, uint16_t reg, uint16_t val);
  */
 int rhd_init(rhd_device_t *dev, bool mode, rhd_rw_t rw);
 
+/**
+ * @brief Initialize RHD device driver with an asynchronous transport instead
+ * of a blocking `rw` function. Bursts then overlap the transfer of a chunk
+ * with the encoding and demux of the previous one, see
+ * @ref rhd2164_sample_frames.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param mode true if using hardware flipflop strategy, false otherwise.
+ * @param async asynchronous transport, must outlive `dev`
+ *
+ * @return int sanity check result, 0 for success.
+ */
+int rhd_init_async(rhd_device_t *dev, bool mode, const rhd_rw_async_t *async);
+
+/**
+ * @brief Wrap a blocking transport which takes a context into an
+ * @ref rhd_rw_async_t, for transports which are instances rather than a single
+ * @ref rhd_rw_t function. Each transfer runs in `submit`, and `complete`
+ * returns its result.
+ *
+ * @param sync state of the wrapper, must outlive `async`
+ * @param rw blocking transport
+ * @param ctx context given to `rw`
+ * @param async transport to fill, to give to @ref rhd_init_async
+ */
+void rhd_rw_sync_init(rhd_rw_sync_t *sync, rhd_rw_ctx_t rw, void *ctx,
+                      rhd_rw_async_t *async);
+
+/**
+ * @brief Attach caller-provided buffers used by @ref rhd2164_sample_frames.
+ * A burst is split into `rw` calls of at most `words` received words, so size
+ * them to what the transport can move in one transfer.
+ *
+ * Without burst buffers, `dev->tx_buf` and `dev->rx_buf` are used and a burst
+ * is sent one sweep at a time.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param tx transmit buffer of `words` values, NULL to detach
+ * @param rx receive buffer of `words` values, NULL to detach
+ * @param words buffers length, at least 2, rounded down to an even number
+ */
+void rhd_set_burst_buf(rhd_device_t *dev, uint16_t *tx, uint16_t *rx,
+                       size_t words);
+
 /**
  * @brief Setup RHD device with sensible defaults, including device calibration.
  *
@@ -134,7 +416,9 @@ int rhd_setup(rhd_device_t *dev, float fs, float fl, float fh, bool dsp,
  * @param dev pointer to rhd_device_t instance
  * @param fs sample rate in Hz
  * @param n_ch number of active channels (includes temperature, etc), for
- * RHD2164, halve the number : 64 ch -> n_ch = 32
+ * RHD2164, halve the number : 64 ch -> n_ch = 32. 0 to use the number of
+ * CONVERT commands per frame, `dev->n_sweep`, which follows the channel list
+ * (see @ref rhd_cfg_sparse)
  * @return int SPI communication return code
  */
 int rhd_cfg_fs(rhd_device_t *dev, float fs, int n_ch);
@@ -148,10 +432,154 @@ int rhd_cfg_fs(rhd_device_t *dev, float fs, int n_ch);
  * @param channels_h bitmask of the channels (32-63) to enable, only for RHD2164
  * WATCH OUT! channels_h registers is reversed : MSb is lower channel, LSb is
  * higher
- * @return int SPI communication return code
+ *
+ * In channel list mode, the sweep is rebuilt from the new mask, and the ADC
+ * biases are updated for the last `fs` given to @ref rhd_cfg_fs.
+ * @return int SPI communication return code, 0 if nothing was sent (see
+ * @ref rhd_cfg_begin)
  */
 int rhd_cfg_ch(rhd_device_t *dev, uint32_t channels_l, uint32_t channels_h);
 
+/**
+ * @brief Enable or disable the RHD2164 channel list mode.
+ *
+ * In channel list mode, a frame only sends CONVERT commands for the channels
+ * enabled by @ref rhd_cfg_ch, and the frames are packed: sample `i` of a
+ * frame is physical channel `dev->ch_map[i]`, for `i < dev->n_ch`. Enabled
+ * channels 0-31 come first, then channels 32-63, in ascending order.
+ *
+ * A CONVERT command returns channels `c` and `c + 32` at once, so the frame
+ * rate scales with the number of pairs used: enable both channels of a pair
+ * for the full speedup.
+ *
+ * @ref rhd2164_sample_all, @ref rhd2164_sample_frames and the burst helpers
+ * all follow the channel list.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param enable true for channel list mode, false to sample all 64 channels
+ * @return int number of samples per frame, `dev->n_ch`
+ */
+int rhd_cfg_sparse(rhd_device_t *dev, bool enable);
+
+/**
+ * @brief Configure the temperature sensor and the auxiliary digital output
+ * (register 3).
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param temp_en enable the temperature sensor
+ * @param temp_s temperature sensor switches, tempS2 in bit 1, tempS1 in bit 0
+ * @param digout_hiz put the auxiliary digital output in high impedance
+ * @param digout auxiliary digital output level
+ * @return int SPI communication return code, 0 if nothing was sent
+ */
+int rhd_cfg_aux_dig(rhd_device_t *dev, bool temp_en, uint8_t temp_s,
+                    bool digout_hiz, bool digout);
+
+/** Impedance check capacitors, for @ref rhd_cfg_zcheck */
+typedef enum
+{
+  RHD_ZCHECK_0PF1 = 0,
+  RHD_ZCHECK_1PF = 1,
+  RHD_ZCHECK_10PF = 3,
+} rhd_zcheck_scale_t;
+
+/**
+ * @brief Configure the impedance check (registers 5-7). When enabled, the
+ * DAC is powered, its output set to mid-scale and connected through the
+ * `scale` capacitor to the electrode of channel `ch`.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param enable enable the impedance check, false also powers the DAC down
+ * @param scale series capacitor, sets the test current
+ * @param ch electrode to connect, 0-63
+ * @return int SPI communication return code, 0 if nothing was sent
+ */
+int rhd_cfg_zcheck(rhd_device_t *dev, bool enable, rhd_zcheck_scale_t scale,
+                   uint8_t ch);
+
+/**
+ * @brief Reserve `slots` auxiliary commands at the end of every frame's sweep.
+ *
+ * The slots cycle through `cmds` round-robin across frames and bursts, eg
+ * `RHD_CMD_CONVERT(RHD_CH_SUPPLY)`, `RHD_CMD_READ(...)` or the register 3
+ * writes that step the temperature sensor. Every result lands in
+ * `results[i]`, the latest raw 16-bit MISO A word received for `cmds[i]`,
+ * without touching the frames.
+ *
+ * Frames cost `slots` more commands, and @ref rhd_cfg_fs is updated
+ * accordingly. Writes sent this way bypass the register shadow.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param cmds `n_cmds` raw commands, must outlive their use, NULL to disable
+ * @param n_cmds number of commands
+ * @param slots number of auxiliary slots per frame, at most 32, 0 to disable
+ * @param results destination of `n_cmds` results, NULL to drop them, eg for
+ * writes
+ * @return int 0 for success, -1 if `slots` is too large
+ */
+int rhd_aux_set(rhd_device_t *dev, const uint16_t *cmds, size_t n_cmds,
+                size_t slots, uint16_t *results);
+
+/**
+ * @brief Move the auxiliary round-robin past `n_frames` frames. Only needed
+ * when driving the burst helpers directly, see @ref rhd2164_burst_encode.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param n_frames number of frames sent
+ */
+void rhd_aux_advance(rhd_device_t *dev, size_t n_frames);
+
+/**
+ * @brief Initialize a command queue.
+ *
+ * @param q pointer to rhd_cmdq_t instance
+ * @param cells queue storage
+ * @param n_cells number of cells, a power of 2
+ * @return int 0 for success, -1 if `n_cells` is not a power of 2
+ */
+int rhd_cmdq_init(rhd_cmdq_t *q, rhd_cmdq_cell_t *cells, size_t n_cells);
+
+/**
+ * @brief Reserve `slots` commands per frame, after the auxiliary slots, for
+ * the commands of a queue. Other threads then reconfigure the chip through
+ * @ref rhd_cmdq_push while this one keeps sampling: each sweep sends what is
+ * queued in its slots, dummy reads otherwise, and completes the futures.
+ *
+ * The first 2 commands of a frame are also the flush commands of a burst,
+ * which the next burst sends again, so they can't be injection slots: the
+ * frame needs at least 2 amplifier or auxiliary slots. If a channel list
+ * later leaves fewer, the queued commands wait until it grows again.
+ *
+ * Queued writes bypass the register shadow, see @ref rhd_cfg_invalidate.
+ * Call from the acquisition thread, between sampling calls. Transports that
+ * replay encoded sweeps, like @ref rhd_bridge_sweep, don't support it.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param q initialized queue, NULL to release the slots
+ * @param slots injection slots per frame
+ * @return int 0 for success, -1 if the frame would have more than
+ * `RHD_SWEEP_CMDS` extra slots, or fewer than 2 other slots
+ */
+int rhd_cmdq_attach(rhd_device_t *dev, rhd_cmdq_t *q, size_t slots);
+
+/**
+ * @brief Queue a command from any thread, without locks.
+ *
+ * @param q pointer to rhd_cmdq_t instance
+ * @param cmd command, see `RHD_CMD_*`
+ * @param fut result, reset here, NULL to ignore it
+ * @return int 0 for success, -1 if the queue is full
+ */
+int rhd_cmdq_push(rhd_cmdq_t *q, uint16_t cmd, rhd_future_t *fut);
+
+/**
+ * @brief Check a future without blocking.
+ *
+ * @param fut future given to @ref rhd_cmdq_push
+ * @return true once the command completed and `fut->result` is valid
+ */
+bool rhd_future_ready(const rhd_future_t *fut);
+
 /**
  * @brief Configure RHD on-chip amplifiers analog bandwidth, which is a bandpass
  * Butterworth filter
@@ -176,14 +604,99 @@ int rhd_cfg_amp_bw(rhd_device_t *dev, float fl, float fh);
  * filter
  * @param fdsp DSP cutoff frequency
  * @param fs channel sampling frequency
- * @return int SPI communication return code
+ * @return int SPI communication return code, 0 if nothing was sent
  */
 int rhd_cfg_dsp(rhd_device_t *dev, bool twos_comp, bool abs_mode, bool dsp,
                 float fdsp, float fs);
 
+/**
+ * @brief Biosignal sample format, from the register 4 shadow.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @return true for two's complement, also when register 4 was never written
+ * (the @ref rhd_setup default), false for offset binary
+ */
+bool rhd_cfg_twos_comp(const rhd_device_t *dev);
+
+/**
+ * @brief Start a batched reconfiguration.
+ *
+ * The driver keeps a shadow of registers 0-21. Outside of a batch, the
+ * `rhd_cfg_*` functions skip the writes that would not change a register.
+ * Between `rhd_cfg_begin` and @ref rhd_cfg_flush, they only update the
+ * shadow, and the registers that changed are sent by the flush.
+ *
+ * @param dev pointer to rhd_device_t instance
+ */
+void rhd_cfg_begin(rhd_device_t *dev);
+
+/**
+ * @brief Send the registers changed since @ref rhd_cfg_begin in a single
+ * transfer, and end the batch.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @return int number of registers written
+ */
+int rhd_cfg_flush(rhd_device_t *dev);
+
+/**
+ * @brief Forget the register shadow, eg after a chip power cycle. The next
+ * configuration writes every register it touches.
+ *
+ * @param dev pointer to rhd_device_t instance
+ */
+void rhd_cfg_invalidate(rhd_device_t *dev);
+
+/**
+ * @brief Register image of a complete configuration, see
+ * @ref rhd_preset_compile.
+ */
+typedef struct
+{
+  uint8_t regs[RHD_SHADOW_REGS];
+  uint64_t ch_mask;
+  float fs;
+} rhd_preset_t;
+
+/**
+ * @brief Compile the configuration of @ref rhd_setup into a register image,
+ * without talking to the chip. Images can be kept in a table and applied
+ * in turn with @ref rhd_preset_apply.
+ *
+ * @param p destination image
+ * @param fs target sampling rate per channel [Hz]
+ * @param fl amplifier lowpass frequency [Hz]
+ * @param fh amplifier highpass frequency [Hz]
+ * @param dsp enable dsp
+ * @param fdsp high-pass DSP cutoff frequency [Hz]
+ * @param channels_l enabled channels 0-31, see @ref rhd_cfg_ch
+ * @param channels_h enabled channels 32-63, reversed, see @ref rhd_cfg_ch
+ */
+void rhd_preset_compile(rhd_preset_t *p, float fs, float fl, float fh,
+                        bool dsp, float fdsp, uint32_t channels_l,
+                        uint32_t channels_h);
+
+/**
+ * @brief Switch to a compiled configuration in a single transfer. Only the
+ * registers that differ from the shadow are written, see
+ * @ref rhd_cfg_begin. In channel list mode, the sweep and the ADC biases
+ * follow the image's channel mask.
+ *
+ * The ADC biases depend on the sampling rate: when switching between images
+ * of different `fs`, `calib` appends the calibration (@ref rhd_calib) to
+ * the same transfer.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param p image from @ref rhd_preset_compile
+ * @param calib also run the ADC calibration
+ * @return int number of registers written
+ */
+int rhd_preset_apply(rhd_device_t *dev, const rhd_preset_t *p, bool calib);
+
 /**
  * @brief "Force read" a register, sending the "read" command 3 times
- * to get the expected value in the RX buffer.
+ * to get the expected value in the RX buffer. The 3 commands go out in a
+ * single transfer.
  *
  * @param dev pointer to rhd_device_t instance
  * @param reg register to read from
@@ -191,6 +704,53 @@ int rhd_cfg_dsp(rhd_device_t *dev, bool twos_comp, bool abs_mode, bool dsp,
  */
 uint8_t rhd_read_force(rhd_device_t *dev, int reg);
 
+/**
+ * @brief Read `n` registers with pipelined read commands. The 2-command
+ * pipeline is only paid once: `n + 2` commands in as few transfers as
+ * `dev->tx_buf` allows (a single one up to 30 registers).
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param regs registers to read, members of rhd_reg_t enum
+ * @param vals destination of the `n` register values
+ * @param n number of registers
+ * @return int return code of the last transfer
+ */
+int rhd_read_regs(rhd_device_t *dev, const uint16_t *regs, uint8_t *vals,
+                  size_t n);
+
+typedef struct
+{
+  /** MISO A/B register, RHD2164 only */
+  uint8_t miso_a_b;
+  uint8_t die_rev;
+  /** 0 for bipolar amplifiers */
+  uint8_t unipolar;
+  uint8_t n_amps;
+  /** 1 for RHD2132, 2 for RHD2216, 4 for RHD2164 */
+  uint8_t chip_id;
+} rhd_chip_info_t;
+
+/**
+ * @brief Read the read-only chip identification registers (59-63) in a
+ * single transfer.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param info destination
+ * @return int return code of the transfer
+ */
+int rhd_chip_info(rhd_device_t *dev, rhd_chip_info_t *info);
+
+/**
+ * @brief Read back the configuration registers (0-21) in a single transfer.
+ * Registers without a pending batched write also refresh the shadow, see
+ * @ref rhd_cfg_begin.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param vals destination of `RHD_SHADOW_REGS` values
+ * @return int return code of the transfer
+ */
+int rhd_dump_regs(rhd_device_t *dev, uint8_t *vals);
+
 /**
  * @brief Run RHD calibration routine
  *
@@ -209,12 +769,50 @@ uint8_t rhd_clear_calib(rhd_device_t *dev);
 
 /**
  * @brief Read the INTAN registers (40-44) to verify if the chip is working.
+ * They are read in a single transfer, see @ref rhd_read_regs.
  *
  * @param dev pointer to rhd_device_t instance
  * @return int 0 for success. Otherwise, returns the first register which failed.
  */
 int rhd_sanity_check(rhd_device_t *dev);
 
+/** Sanity checks tried by @ref rhd_resync before giving up */
+#define RHD_CHECK_RETRIES 3
+
+/**
+ * @brief Check the integrity of the sample path, and resynchronize it
+ * automatically on errors.
+ *
+ * Every burst of @ref rhd2164_sample_frames ends with 2 more commands: its 2
+ * flush commands become `RHD_CMD_READ(CHIP_ID)` and `RHD_CMD_READ(INTAN_0)`,
+ * 2 more reads flush them out, and their answers, received at the end of the
+ * same transfer, are checked against the words read now. The plain sweep of
+ * @ref rhd2164_sample_all sends the same 4 reads every `period` frames. A
+ * word dropped or duplicated anywhere in the transfer shifts the answers, and
+ * a bad DDR demux corrupts them, so either fails the check. Only the last transfer of a burst split
+ * by its buffers is covered, and the channel list and auxiliary slot paths of
+ * @ref rhd2164_sample_all are not checked.
+ *
+ * An error calls @ref rhd_resync at the end of the sampling call, instead of
+ * a full @ref rhd_setup, and the frames of that call may be shifted.
+ * `dev->check` counts checks, errors and resynchronizations.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param period frames between checks of @ref rhd2164_sample_all, 0 to
+ * disable all checks
+ * @return int 0 for success, -1 if the sanity check fails
+ */
+int rhd_check_set(rhd_device_t *dev, uint32_t period);
+
+/**
+ * @brief Resynchronize the command pipeline: flush it, and verify the INTAN
+ * registers, up to `RHD_CHECK_RETRIES` times. The registers are kept.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @return int 0 for success, -1 if every sanity check failed
+ */
+int rhd_resync(rhd_device_t *dev);
+
 /**
  * @brief Sample RHD2000 channel.
  *
@@ -235,15 +833,151 @@ uint16_t rhd2000_sample(rhd_device_t *dev, uint16_t ch);
  */
 uint16_t *rhd2164_sample(rhd_device_t *dev, uint16_t ch, uint16_t *rx);
 
+/**
+ * @brief Unsplit the DDR words received for `n_cmds` commands into their MISO
+ * A and MISO B results. LSb of every result is set to 1 for alignment.
+ *
+ * Uses BMI2's PEXT when built for it (eg `-mbmi2` or `-march=native`),
+ * otherwise a branch-free bit-trick kernel which the compiler vectorizes at
+ * `-O3`.
+ *
+ * @param rx source data, `rx[2i]` and `rx[2i + 1]` being the MSB and LSB
+ * words of command `i`
+ * @param a destination of `n_cmds` MISO A results
+ * @param b destination of `n_cmds` MISO B results
+ * @param n_cmds number of commands to unsplit
+ */
+void rhd_unsplit_frame(const uint16_t *rx, uint16_t *a, uint16_t *b,
+                       size_t n_cmds);
+
 /**
  * @brief Sample all RHD2164 channels.
  *
- * The values are saved into `sample_buf` at their channel index.alignas
+ * The 32 CONVERT commands are sent as a single `rw` call of the whole sweep,
+ * using `dev->tx_buf` and `dev->rx_buf`. The values are then saved into
+ * `sample_buf` at their channel index.
+ *
+ * Because of the 2-command pipeline, channels 30, 31, 62 and 63 hold the
+ * values converted during the previous sweep.
  *
  * Channel 0's LSb is set to 0, while all others are set to 1 for alignment.
  *
+ * In channel list mode, only `dev->n_sweep` commands are sent and
+ * `sample_buf` is packed, see @ref rhd_cfg_sparse. Auxiliary slots are sent
+ * after the amplifier channels, see @ref rhd_aux_set.
+ *
  * @param dev pointer to rhd_device_t instance
+ * @param sample_buf destination buffer of `RHD_FRAME_CH` samples
  */
 void rhd2164_sample_all(rhd_device_t *dev, uint16_t *sample_buf);
 
+/**
+ * @brief Encode the CONVERT commands of burst slots `[slot, slot + n)`.
+ * Every frame is `dev->n_sweep` slots: the amplifier CONVERT commands, in
+ * channel order or `dev->sweep_ch` order in channel list mode, then the
+ * auxiliary slots. Call @ref rhd_aux_advance once the burst is decoded.
+ *
+ * This is the building block of @ref rhd2164_sample_frames, for transports
+ * or engines which manage their own transfers.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param tx destination buffer, `n` words, or `2 * n` with `double_bits`
+ * @param slot first slot index since the start of the burst
+ * @param n number of slots
+ * @return size_t number of words written to `tx`
+ */
+size_t rhd2164_burst_encode(const rhd_device_t *dev, uint16_t *tx, size_t slot,
+                            size_t n);
+
+/**
+ * @brief Demux the results received for burst slots `[slot, slot + n)`.
+ * Slot `s` holds the result of slot `s - 2`, so the first 2 slots of a burst
+ * are discarded and frame `f` is complete once slot `n_sweep * f + n_sweep + 1`
+ * is decoded.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param rx received data, 2 words per slot
+ * @param slot first slot index since the start of the burst
+ * @param n number of slots
+ * @param out destination of frame 0, frame `f` starts at `out + f *
+ * frame_stride`
+ * @param frame_stride distance between consecutive frames in `out`, in
+ * samples
+ */
+void rhd2164_burst_decode(const rhd_device_t *dev, const uint16_t *rx,
+                          size_t slot, size_t n, uint16_t *out,
+                          size_t frame_stride);
+
+/**
+ * @brief Sample `n_frames` consecutive RHD2164 frames.
+ *
+ * The CONVERT commands of every frame are streamed back to back, so the
+ * 2-command pipeline carries over frame boundaries and the whole burst only
+ * costs 2 extra commands. Every channel of a frame comes from the same sweep.
+ *
+ * The command stream is sent in as few `rw` calls as the burst buffers allow,
+ * see @ref rhd_set_burst_buf. With an asynchronous transport, the burst
+ * buffers are split in 2 halves: one half is in flight while the other is
+ * encoded and demuxed.
+ *
+ * Channel 0's LSb of every frame is set to 0 for alignment. In channel list
+ * mode, frames are packed and it is the first sample's LSb instead.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param n_frames number of frames to sample
+ * @param out destination buffer of `n_frames` frames
+ * @return int return code of the last transfer
+ */
+int rhd2164_sample_frames(rhd_device_t *dev, size_t n_frames,
+                          uint16_t (*out)[RHD_FRAME_CH]);
+
+/**
+ * @brief Sample `n_frames` consecutive frames into a channel-major block:
+ * sample `t` of channel `ch` is `block[ch * block_len + t]`, so every
+ * channel's time series is contiguous for vectorized consumers.
+ *
+ * Same acquisition as @ref rhd2164_sample_frames, the demux writes each
+ * sample straight to its row. In channel list mode, row `i` is physical
+ * channel `dev->ch_map[i]`.
+ *
+ * @code
+ * static uint16_t block[RHD_FRAME_CH][RHD_BLOCK_LEN(100)]
+ *     __attribute__((aligned(RHD_BLOCK_ALIGN)));
+ * rhd2164_sample_block(&dev, 100, block[0], RHD_BLOCK_LEN(100));
+ * @endcode
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param n_frames number of frames to sample, at most `block_len`
+ * @param block destination of `dev->n_ch` rows, aligned to `RHD_BLOCK_ALIGN`
+ * @param block_len row length, a multiple of 32 samples, eg
+ * `RHD_BLOCK_LEN(n_frames)`
+ * @return int return code of the last transfer, -1 if the block is
+ * misaligned
+ */
+int rhd2164_sample_block(rhd_device_t *dev, size_t n_frames, uint16_t *block,
+                         size_t block_len);
+
+#ifdef RHD_INSTRUMENT
+/**
+ * @brief Copy the device counters. Safe to call from another thread than the
+ * one driving the device, eg a metrics exporter: every counter is read
+ * atomically, though not all at the same instant. Counters only increase, so
+ * export the difference between snapshots.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param out destination
+ */
+void rhd_stats_snapshot(const rhd_device_t *dev, rhd_stats_t *out);
+
+/**
+ * @brief Estimate a quantile of a latency histogram.
+ *
+ * @param hist histogram of `RHD_STATS_BUCKETS` buckets
+ * @param q quantile, eg 0.99
+ * @return uint64_t upper bound of the bucket holding the quantile [ns], 0 if
+ * the histogram is empty
+ */
+uint64_t rhd_stats_quantile(const uint64_t *hist, double q);
+#endif
+
 #endif /* RHD_H */
\ No newline at end of file
@@ -0,0 +1,467 @@
+/** @file rhd_bridge.c
+ *
+ * @brief Framed serial protocol between a host and an MCU wired to the
+ * RHD2164.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#include "rhd_bridge.h"
+
+#include <string.h>
+
+typedef enum
+{
+  RHD_BRIDGE_WAIT_SYNC0,
+  RHD_BRIDGE_WAIT_SYNC1,
+  RHD_BRIDGE_HEADER,
+  RHD_BRIDGE_PAYLOAD,
+  RHD_BRIDGE_CRC,
+} rhd_bridge_state_t;
+
+static void rhd_bridge_put_u16(uint8_t *buf, uint16_t v)
+{
+  buf[0] = v & 0xFF;
+  buf[1] = v >> 8;
+}
+
+static uint16_t rhd_bridge_get_u16(const uint8_t *buf)
+{
+  return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+static size_t rhd_bridge_put_words(uint8_t *buf, const uint16_t *words,
+                                   size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    rhd_bridge_put_u16(&buf[2 * i], words[i]);
+  }
+  return 2 * n;
+}
+
+static void rhd_bridge_get_words(uint16_t *words, const uint8_t *buf,
+                                 size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    words[i] = rhd_bridge_get_u16(&buf[2 * i]);
+  }
+}
+
+static size_t rhd_bridge_gcd(size_t a, size_t b)
+{
+  while (b != 0)
+  {
+    size_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+uint16_t rhd_bridge_crc16(const uint8_t *buf, size_t len, uint16_t crc)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    crc ^= (uint16_t)buf[i] << 8;
+    for (int b = 0; b < 8; b++)
+    {
+      crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x1021) : crc << 1;
+    }
+  }
+  return crc;
+}
+
+size_t rhd_bridge_encode(uint8_t *out, uint8_t type, uint16_t seq,
+                         const uint8_t *payload, size_t len)
+{
+  out[0] = RHD_BRIDGE_SYNC0;
+  out[1] = RHD_BRIDGE_SYNC1;
+  out[2] = type;
+  rhd_bridge_put_u16(&out[3], seq);
+  rhd_bridge_put_u16(&out[5], (uint16_t)len);
+  if (len > 0 && payload != &out[RHD_BRIDGE_HDR_BYTES])
+  {
+    memmove(&out[RHD_BRIDGE_HDR_BYTES], payload, len);
+  }
+  size_t n = RHD_BRIDGE_HDR_BYTES + len;
+  rhd_bridge_put_u16(&out[n], rhd_bridge_crc16(&out[2], n - 2, 0xFFFF));
+  return n + 2;
+}
+
+void rhd_bridge_parser_init(rhd_bridge_parser_t *p)
+{
+  p->state = RHD_BRIDGE_WAIT_SYNC0;
+  p->pos = 0;
+  p->errors = 0;
+}
+
+int rhd_bridge_parse(rhd_bridge_parser_t *p, uint8_t byte)
+{
+  switch (p->state)
+  {
+  case RHD_BRIDGE_WAIT_SYNC0:
+    p->state = byte == RHD_BRIDGE_SYNC0 ? RHD_BRIDGE_WAIT_SYNC1
+                                        : RHD_BRIDGE_WAIT_SYNC0;
+    return 0;
+  case RHD_BRIDGE_WAIT_SYNC1:
+    if (byte == RHD_BRIDGE_SYNC1)
+    {
+      p->state = RHD_BRIDGE_HEADER;
+      p->pos = 0;
+    }
+    else if (byte != RHD_BRIDGE_SYNC0)
+    {
+      p->state = RHD_BRIDGE_WAIT_SYNC0;
+    }
+    return 0;
+  case RHD_BRIDGE_HEADER:
+    // Type, seq and len, kept in the payload buffer until complete
+    p->payload[p->pos++] = byte;
+    if (p->pos < RHD_BRIDGE_HDR_BYTES - 2)
+    {
+      return 0;
+    }
+    p->type = p->payload[0];
+    p->seq = rhd_bridge_get_u16(&p->payload[1]);
+    p->len = rhd_bridge_get_u16(&p->payload[3]);
+    if (p->len > RHD_BRIDGE_MAX_PAYLOAD)
+    {
+      p->errors++;
+      p->state = RHD_BRIDGE_WAIT_SYNC0;
+      return 0;
+    }
+    p->crc = rhd_bridge_crc16(p->payload, RHD_BRIDGE_HDR_BYTES - 2, 0xFFFF);
+    p->pos = 0;
+    p->state = p->len > 0 ? RHD_BRIDGE_PAYLOAD : RHD_BRIDGE_CRC;
+    return 0;
+  case RHD_BRIDGE_PAYLOAD:
+    p->payload[p->pos++] = byte;
+    if (p->pos == p->len)
+    {
+      p->crc = rhd_bridge_crc16(p->payload, p->len, p->crc);
+      p->pos = 0;
+      p->state = RHD_BRIDGE_CRC;
+    }
+    return 0;
+  default:
+    // CRC, low byte first
+    if (p->pos == 0)
+    {
+      p->pos = 1;
+      p->crc ^= byte;
+      return 0;
+    }
+    p->state = RHD_BRIDGE_WAIT_SYNC0;
+    if ((p->crc ^ ((uint16_t)byte << 8)) != 0)
+    {
+      p->errors++;
+      return 0;
+    }
+    return 1;
+  }
+}
+
+/**
+ * @brief Read the next valid message from the MCU.
+ *
+ * @return int 1 for a message in `h->parser`, 0 on a read timeout, negative
+ * on a read error
+ */
+static int rhd_bridge_host_next(rhd_bridge_host_t *h)
+{
+  for (;;)
+  {
+    while (h->in_pos < h->in_len)
+    {
+      if (rhd_bridge_parse(&h->parser, h->in[h->in_pos++]))
+      {
+        return 1;
+      }
+    }
+    int n = h->read(h->ctx, h->in, sizeof(h->in));
+    if (n <= 0)
+    {
+      return n;
+    }
+    h->in_len = n;
+    h->in_pos = 0;
+  }
+}
+
+static int rhd_bridge_send(rhd_bridge_io_t write, void *ctx, uint8_t *msg,
+                           uint8_t type, uint16_t seq, size_t len)
+{
+  size_t n = rhd_bridge_encode(msg, type, seq, &msg[RHD_BRIDGE_HDR_BYTES],
+                               len);
+  return write(ctx, msg, n) == (int)n ? 0 : -1;
+}
+
+static int rhd_bridge_rw_ctx(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf,
+                             size_t len)
+{
+  return rhd_bridge_rw((rhd_bridge_host_t *)ctx, tx_buf, rx_buf, len);
+}
+
+void rhd_bridge_host_init(rhd_bridge_host_t *h, bool ddr,
+                          rhd_bridge_io_t write, rhd_bridge_io_t read,
+                          void *ctx)
+{
+  h->write = write;
+  h->read = read;
+  h->ctx = ctx;
+  h->ddr = ddr;
+  rhd_bridge_parser_init(&h->parser);
+  h->seq = 0;
+  h->in_len = 0;
+  h->in_pos = 0;
+  h->dev = NULL;
+  h->lost = 0;
+  rhd_rw_sync_init(&h->sync, rhd_bridge_rw_ctx, h, &h->async);
+}
+
+int rhd_bridge_rw(rhd_bridge_host_t *h, uint16_t *tx_buf, uint16_t *rx_buf,
+                  size_t len)
+{
+  const size_t rx_per_word = h->ddr ? 1 : 2;
+
+  for (size_t i = 0; i < len; i += RHD_BRIDGE_MAX_XFER_WORDS)
+  {
+    size_t n = len - i < RHD_BRIDGE_MAX_XFER_WORDS ? len - i
+                                                   : RHD_BRIDGE_MAX_XFER_WORDS;
+    uint16_t seq = h->seq++;
+    size_t bytes = rhd_bridge_put_words(&h->msg[RHD_BRIDGE_HDR_BYTES],
+                                        &tx_buf[i], n);
+    if (rhd_bridge_send(h->write, h->ctx, h->msg, RHD_BRIDGE_XFER, seq,
+                        bytes) < 0)
+    {
+      return -1;
+    }
+
+    // Skip anything else, eg the tail of a stopped sweep
+    const rhd_bridge_parser_t *p = &h->parser;
+    do
+    {
+      if (rhd_bridge_host_next(h) <= 0)
+      {
+        return -1;
+      }
+    } while (p->type != RHD_BRIDGE_RX || p->seq != seq);
+
+    if (p->len != 2 * n * rx_per_word)
+    {
+      return -1;
+    }
+    rhd_bridge_get_words(&rx_buf[i * rx_per_word], p->payload,
+                         n * rx_per_word);
+  }
+  return (int)len;
+}
+
+int rhd_bridge_sweep(rhd_bridge_host_t *h, rhd_device_t *dev,
+                     uint32_t n_frames)
+{
+  const size_t tx_per_cmd = dev->double_bits ? 2 : 1;
+  const size_t words_per_frame = dev->n_sweep * tx_per_cmd;
+  // Frames until the auxiliary slots come back to the same commands
+  size_t period = 1;
+  if (dev->aux_k > 0)
+  {
+    period = dev->n_aux / rhd_bridge_gcd(dev->n_aux, dev->aux_k);
+  }
+  const size_t n_words = period * words_per_frame;
+
+  // The MCU replays the descriptor, queued commands would go out every period
+  if (dev->n_sweep == 0 || dev->inj_k > 0 ||
+      n_words > RHD_BRIDGE_MAX_SWEEP_WORDS)
+  {
+    return -1;
+  }
+
+  uint8_t *payload = &h->msg[RHD_BRIDGE_HDR_BYTES];
+  // One more frame flushes the last one out of the pipeline
+  uint32_t n = n_frames == 0 ? 0 : n_frames + 1;
+  rhd_bridge_put_u16(&payload[0], n & 0xFFFF);
+  rhd_bridge_put_u16(&payload[2], n >> 16);
+  rhd_bridge_put_u16(&payload[4], (uint16_t)words_per_frame);
+  rhd_bridge_put_u16(&payload[6], (uint16_t)n_words);
+  size_t bytes = 8;
+  // Encode through the device's tx buffer, a chunk at a time
+  const size_t chunk = RHD_SWEEP_WORDS / tx_per_cmd;
+  const size_t n_slots = period * dev->n_sweep;
+  for (size_t slot = 0; slot < n_slots; slot += chunk)
+  {
+    size_t n = n_slots - slot < chunk ? n_slots - slot : chunk;
+    size_t len = rhd2164_burst_encode(dev, dev->tx_buf, slot, n);
+    bytes += rhd_bridge_put_words(&payload[bytes], dev->tx_buf, len);
+  }
+
+  h->dev = dev;
+  h->first = true;
+  h->next_frame = 0;
+  return rhd_bridge_send(h->write, h->ctx, h->msg, RHD_BRIDGE_SWEEP, h->seq++,
+                         bytes);
+}
+
+size_t rhd_bridge_read_frames(rhd_bridge_host_t *h,
+                              uint16_t (*out)[RHD_FRAME_CH],
+                              size_t max_frames)
+{
+  rhd_device_t *dev = h->dev;
+  const rhd_bridge_parser_t *p = &h->parser;
+  uint16_t rx[4 * RHD_SWEEP_CMDS];
+  size_t n_out = 0;
+
+  while (dev != NULL && n_out < max_frames && rhd_bridge_host_next(h) > 0)
+  {
+    const size_t n_sweep = dev->n_sweep;
+    if (p->type != RHD_BRIDGE_FRAME || p->len != 4 * n_sweep)
+    {
+      continue;
+    }
+
+    uint16_t gap = (uint16_t)(p->seq - h->next_frame);
+    if (gap != 0)
+    {
+      // The missing frames are lost, and so is the one waiting in the
+      // window. Restart the pipeline on this one.
+      size_t skip = h->first ? gap : (size_t)gap + 1;
+      h->lost += skip;
+      rhd_aux_advance(dev, skip);
+      h->first = true;
+    }
+    h->next_frame = p->seq + 1;
+
+    rhd_bridge_get_words(rx, p->payload, 2 * n_sweep);
+    if (h->first)
+    {
+      // Its first 2 results belong to a frame we don't have
+      rhd2164_burst_decode(dev, rx, 0, n_sweep, h->window[1], RHD_FRAME_CH);
+      h->first = false;
+      continue;
+    }
+
+    // The first 2 results complete the previous frame
+    memcpy(h->window[0], h->window[1], sizeof(h->window[0]));
+    rhd2164_burst_decode(dev, rx, n_sweep, n_sweep, h->window[0],
+                         RHD_FRAME_CH);
+    memcpy(out[n_out], h->window[0], sizeof(out[0]));
+    out[n_out][0] &= 0xFFFE;
+    n_out++;
+    rhd_aux_advance(dev, 1);
+  }
+  return n_out;
+}
+
+int rhd_bridge_stop(rhd_bridge_host_t *h)
+{
+  h->dev = NULL;
+  return rhd_bridge_send(h->write, h->ctx, h->msg, RHD_BRIDGE_STOP, h->seq++,
+                         0);
+}
+
+void rhd_bridge_mcu_init(rhd_bridge_mcu_t *m, bool ddr, rhd_rw_t spi,
+                         rhd_bridge_io_t write, void *ctx)
+{
+  m->spi = spi;
+  m->write = write;
+  m->ctx = ctx;
+  m->ddr = ddr;
+  rhd_bridge_parser_init(&m->parser);
+  m->n_words = 0;
+  m->words_per_frame = 0;
+  m->frames_left = 0;
+  m->sweeping = false;
+  m->frame = 0;
+}
+
+/**
+ * @brief Handle a complete message from the host.
+ */
+static void rhd_bridge_mcu_handle(rhd_bridge_mcu_t *m)
+{
+  const rhd_bridge_parser_t *p = &m->parser;
+  const size_t rx_per_word = m->ddr ? 1 : 2;
+
+  switch (p->type)
+  {
+  case RHD_BRIDGE_XFER:
+  {
+    size_t n = p->len / 2;
+    if (n > RHD_BRIDGE_MAX_XFER_WORDS)
+    {
+      return;
+    }
+    rhd_bridge_get_words(m->words, p->payload, n);
+    m->spi(m->words, m->rx, n);
+    size_t bytes = rhd_bridge_put_words(&m->msg[RHD_BRIDGE_HDR_BYTES], m->rx,
+                                        n * rx_per_word);
+    rhd_bridge_send(m->write, m->ctx, m->msg, RHD_BRIDGE_RX, p->seq, bytes);
+    break;
+  }
+  case RHD_BRIDGE_SWEEP:
+  {
+    if (p->len < 8)
+    {
+      return;
+    }
+    size_t wpf = rhd_bridge_get_u16(&p->payload[4]);
+    size_t n_words = rhd_bridge_get_u16(&p->payload[6]);
+    if (n_words > RHD_BRIDGE_MAX_SWEEP_WORDS || p->len != 8 + 2 * n_words ||
+        wpf == 0 || n_words % wpf != 0 ||
+        wpf * rx_per_word > 2 * RHD_BRIDGE_MAX_XFER_WORDS)
+    {
+      return;
+    }
+    m->frames_left = rhd_bridge_get_u16(&p->payload[0]) |
+                     ((uint32_t)rhd_bridge_get_u16(&p->payload[2]) << 16);
+    m->words_per_frame = wpf;
+    m->n_words = n_words;
+    rhd_bridge_get_words(m->words, &p->payload[8], n_words);
+    m->frame = 0;
+    m->sweeping = true;
+    break;
+  }
+  case RHD_BRIDGE_STOP:
+    m->sweeping = false;
+    break;
+  default:
+    break;
+  }
+}
+
+void rhd_bridge_mcu_feed(rhd_bridge_mcu_t *m, const uint8_t *buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    if (rhd_bridge_parse(&m->parser, buf[i]))
+    {
+      rhd_bridge_mcu_handle(m);
+    }
+  }
+}
+
+bool rhd_bridge_mcu_step(rhd_bridge_mcu_t *m)
+{
+  if (!m->sweeping)
+  {
+    return false;
+  }
+
+  const size_t wpf = m->words_per_frame;
+  const size_t n_rx = m->ddr ? wpf : 2 * wpf;
+  size_t off = (m->frame % (m->n_words / wpf)) * wpf;
+  m->spi(&m->words[off], m->rx, wpf);
+  size_t bytes =
+      rhd_bridge_put_words(&m->msg[RHD_BRIDGE_HDR_BYTES], m->rx, n_rx);
+  rhd_bridge_send(m->write, m->ctx, m->msg, RHD_BRIDGE_FRAME,
+                  (uint16_t)m->frame, bytes);
+  m->frame++;
+
+  if (m->frames_left > 0 && --m->frames_left == 0)
+  {
+    m->sweeping = false;
+  }
+  return true;
+}
@@ -0,0 +1,262 @@
+/** @file rhd_bridge.h
+ *
+ * @brief Framed serial protocol between a host and an MCU wired to the
+ * RHD2164, eg over a UART.
+ *
+ * A message is `A5 5A | type | seq | len | payload | crc`, with `seq` and
+ * `len` (payload bytes) 16-bit little-endian and a CRC-16/CCITT-FALSE of
+ * everything after the sync bytes. Payload words are little-endian.
+ *
+ * - `RHD_BRIDGE_XFER` (host to MCU): words to send over SPI, answered with a
+ *   `RHD_BRIDGE_RX` of the same `seq` holding the received words. This is
+ *   the `rw` transport, for configuration.
+ * - `RHD_BRIDGE_SWEEP` (host to MCU): sweep descriptor, `u32 n_frames`
+ *   (0 until a `RHD_BRIDGE_STOP`), `u16 words_per_frame`, `u16 n_words`,
+ *   then the SPI words of one or more frames, repeated cyclically.
+ * - `RHD_BRIDGE_FRAME` (MCU to host): the words received during frame `seq`
+ *   of the sweep.
+ *
+ * Once a sweep is started, the MCU streams frames on its own, so throughput
+ * is set by the payload size and not by a round trip per word. The host
+ * decodes the stream across frame boundaries like @ref rhd2164_sample_frames
+ * and drops frames around lost or corrupted messages.
+ *
+ * Both ends are here, in portable C: the host side and the MCU side
+ * (@ref rhd_bridge_mcu_t) share the encoder and the parser.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_BRIDGE_H
+#define RHD_BRIDGE_H
+
+#include "rhd.h"
+
+#define RHD_BRIDGE_SYNC0 0xA5
+#define RHD_BRIDGE_SYNC1 0x5A
+
+/** Sync, type, seq and len [bytes] */
+#define RHD_BRIDGE_HDR_BYTES 7
+
+/**
+ * Longest payload [bytes], it sizes the parser and MCU buffers. Lower it for
+ * small MCUs, on both ends of the link: 256 still holds a 64-channel frame,
+ * but sweep descriptors shrink to a few frames of auxiliary slots.
+ */
+#ifndef RHD_BRIDGE_MAX_PAYLOAD
+#define RHD_BRIDGE_MAX_PAYLOAD 1024
+#endif
+
+/** Longest message, with its CRC [bytes] */
+#define RHD_BRIDGE_MAX_MSG (RHD_BRIDGE_HDR_BYTES + RHD_BRIDGE_MAX_PAYLOAD + 2)
+
+/** Most words per XFER, so that the SDR answer fits in a message */
+#define RHD_BRIDGE_MAX_XFER_WORDS (RHD_BRIDGE_MAX_PAYLOAD / 4)
+
+/** Most words of a sweep descriptor */
+#define RHD_BRIDGE_MAX_SWEEP_WORDS ((RHD_BRIDGE_MAX_PAYLOAD - 8) / 2)
+
+typedef enum
+{
+  RHD_BRIDGE_XFER = 1,
+  RHD_BRIDGE_RX = 2,
+  RHD_BRIDGE_SWEEP = 3,
+  RHD_BRIDGE_FRAME = 4,
+  RHD_BRIDGE_STOP = 5,
+} rhd_bridge_type_t;
+
+/**
+ * @brief Byte stream, eg a serial port. Writes send all `len` bytes, reads
+ * return what is available, up to `len`.
+ *
+ * @return int number of bytes, 0 on a read timeout, negative on error
+ */
+typedef int (*rhd_bridge_io_t)(void *ctx, uint8_t *buf, size_t len);
+
+typedef struct
+{
+  int state;
+  size_t pos;
+  uint8_t type;
+  uint16_t seq;
+  uint16_t len;
+  uint16_t crc;
+  uint8_t payload[RHD_BRIDGE_MAX_PAYLOAD];
+  /** Messages dropped for a bad CRC or length */
+  uint32_t errors;
+} rhd_bridge_parser_t;
+
+typedef struct
+{
+  rhd_bridge_io_t write;
+  rhd_bridge_io_t read;
+  void *ctx;
+  bool ddr;
+  rhd_bridge_parser_t parser;
+  uint16_t seq;
+  uint8_t msg[RHD_BRIDGE_MAX_MSG];
+  uint8_t in[256];
+  size_t in_len;
+  size_t in_pos;
+  /* Sweep decoding, 2 frames in flight */
+  rhd_device_t *dev;
+  bool first;
+  uint16_t next_frame;
+  uint16_t window[2][RHD_FRAME_CH];
+  /** Frames lost to missing or corrupted messages */
+  uint32_t lost;
+  /* Transport to give to rhd_init_async */
+  rhd_rw_sync_t sync;
+  rhd_rw_async_t async;
+} rhd_bridge_host_t;
+
+typedef struct
+{
+  rhd_rw_t spi;
+  rhd_bridge_io_t write;
+  void *ctx;
+  bool ddr;
+  rhd_bridge_parser_t parser;
+  uint8_t msg[RHD_BRIDGE_MAX_MSG];
+  uint16_t words[RHD_BRIDGE_MAX_SWEEP_WORDS];
+  uint16_t rx[2 * RHD_BRIDGE_MAX_XFER_WORDS];
+  size_t n_words;
+  size_t words_per_frame;
+  uint32_t frames_left;
+  bool sweeping;
+  uint32_t frame;
+} rhd_bridge_mcu_t;
+
+/**
+ * @brief CRC-16/CCITT-FALSE, polynomial 0x1021.
+ *
+ * @param buf data
+ * @param len number of bytes
+ * @param crc 0xFFFF to start, or the CRC so far
+ * @return uint16_t updated CRC
+ */
+uint16_t rhd_bridge_crc16(const uint8_t *buf, size_t len, uint16_t crc);
+
+/**
+ * @brief Frame a message.
+ *
+ * @param out destination, `RHD_BRIDGE_MAX_MSG` bytes
+ * @param type message type
+ * @param seq sequence number
+ * @param payload payload bytes
+ * @param len number of payload bytes, at most `RHD_BRIDGE_MAX_PAYLOAD`
+ * @return size_t message size [bytes]
+ */
+size_t rhd_bridge_encode(uint8_t *out, uint8_t type, uint16_t seq,
+                         const uint8_t *payload, size_t len);
+
+/**
+ * @brief Reset a parser.
+ *
+ * @param p pointer to rhd_bridge_parser_t instance
+ */
+void rhd_bridge_parser_init(rhd_bridge_parser_t *p);
+
+/**
+ * @brief Feed a byte to the parser. It resynchronizes on the sync bytes
+ * after any error.
+ *
+ * @param p pointer to rhd_bridge_parser_t instance
+ * @param byte received byte
+ * @return int 1 when a valid message is complete in `p`, 0 otherwise
+ */
+int rhd_bridge_parse(rhd_bridge_parser_t *p, uint8_t byte);
+
+/**
+ * @brief Initialize the host side.
+ *
+ * @param h pointer to rhd_bridge_host_t instance
+ * @param ddr RHD2164 transfer mode, as given to @ref rhd_init_async
+ * @param write byte stream to the MCU
+ * @param read byte stream from the MCU
+ * @param ctx user context of `write` and `read`
+ */
+void rhd_bridge_host_init(rhd_bridge_host_t *h, bool ddr,
+                          rhd_bridge_io_t write, rhd_bridge_io_t read,
+                          void *ctx);
+
+/**
+ * @brief Transfer words through the MCU, with the @ref rhd_rw_t buffer
+ * contract. Not available while a sweep is running.
+ *
+ * @param h pointer to rhd_bridge_host_t instance
+ * @param tx_buf write buffer
+ * @param rx_buf receive buffer
+ * @param len number of words
+ * @return int `len` for success, -1 if the MCU did not answer
+ */
+int rhd_bridge_rw(rhd_bridge_host_t *h, uint16_t *tx_buf, uint16_t *rx_buf,
+                  size_t len);
+
+/**
+ * @brief Start a sweep of the device's frames (channel list and auxiliary
+ * slots included) on the MCU.
+ *
+ * @param h pointer to rhd_bridge_host_t instance
+ * @param dev configured device, decoded into by @ref rhd_bridge_read_frames
+ * @param n_frames number of frames, 0 to sweep until @ref rhd_bridge_stop
+ * @return int 0 for success, -1 if the auxiliary slots cycle is too long for
+ * a descriptor, a command queue is attached (see @ref rhd_cmdq_attach) or the
+ * write failed
+ */
+int rhd_bridge_sweep(rhd_bridge_host_t *h, rhd_device_t *dev,
+                     uint32_t n_frames);
+
+/**
+ * @brief Read the frames streamed by the MCU.
+ *
+ * @param h pointer to rhd_bridge_host_t instance
+ * @param out destination frames, same layout as @ref rhd2164_sample_frames
+ * @param max_frames size of `out`
+ * @return size_t number of frames read, less than `max_frames` if the stream
+ * timed out
+ */
+size_t rhd_bridge_read_frames(rhd_bridge_host_t *h,
+                              uint16_t (*out)[RHD_FRAME_CH],
+                              size_t max_frames);
+
+/**
+ * @brief Stop a continuous sweep.
+ *
+ * @param h pointer to rhd_bridge_host_t instance
+ * @return int 0 for success, -1 if the write failed
+ */
+int rhd_bridge_stop(rhd_bridge_host_t *h);
+
+/**
+ * @brief Initialize the MCU side.
+ *
+ * @param m pointer to rhd_bridge_mcu_t instance
+ * @param ddr RHD2164 transfer mode
+ * @param spi SPI transfer to the RHD2164
+ * @param write byte stream to the host
+ * @param ctx user context of `write`
+ */
+void rhd_bridge_mcu_init(rhd_bridge_mcu_t *m, bool ddr, rhd_rw_t spi,
+                         rhd_bridge_io_t write, void *ctx);
+
+/**
+ * @brief Handle bytes received from the host. XFER messages are answered
+ * right away.
+ *
+ * @param m pointer to rhd_bridge_mcu_t instance
+ * @param buf received bytes
+ * @param len number of bytes
+ */
+void rhd_bridge_mcu_feed(rhd_bridge_mcu_t *m, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Sweep and send the next frame, from the MCU main loop or a timer.
+ *
+ * @param m pointer to rhd_bridge_mcu_t instance
+ * @return bool true if a frame was sent
+ */
+bool rhd_bridge_mcu_step(rhd_bridge_mcu_t *m);
+
+#endif
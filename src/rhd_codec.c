@@ -0,0 +1,254 @@
+/** @file rhd_codec.c
+ *
+ * @brief Compact encodings of RHD2164 frames.
+ *
+ * Bit streams are MSb first. The Rice parameter follows the JPEG-LS
+ * adaptation: the smallest `k` such that `cnt << k >= acc`, where `acc` is
+ * the running sum of a channel's zig-zag deltas over the last `cnt` frames.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#include "rhd_codec.h"
+
+/** Halve the Rice statistics every so many frames, to track the signal */
+#define RHD_RICE_RESET 32
+
+typedef struct
+{
+  uint8_t *buf;
+  size_t pos;
+  uint32_t acc;
+  unsigned int n;
+} rhd_bit_writer_t;
+
+typedef struct
+{
+  const uint8_t *buf;
+  size_t len;
+  size_t pos;
+  uint32_t acc;
+  unsigned int n;
+  bool overrun;
+} rhd_bit_reader_t;
+
+static void rhd_bits_put(rhd_bit_writer_t *w, uint32_t val, unsigned int bits)
+{
+  // At most 16 bits at a time, so acc never overflows
+  w->acc = (w->acc << bits) | (val & ((1UL << bits) - 1));
+  w->n += bits;
+  while (w->n >= 8)
+  {
+    w->n -= 8;
+    w->buf[w->pos++] = (uint8_t)(w->acc >> w->n);
+  }
+}
+
+static size_t rhd_bits_flush(rhd_bit_writer_t *w)
+{
+  if (w->n > 0)
+  {
+    w->buf[w->pos++] = (uint8_t)(w->acc << (8 - w->n));
+    w->n = 0;
+  }
+  return w->pos;
+}
+
+static uint32_t rhd_bits_get(rhd_bit_reader_t *r, unsigned int bits)
+{
+  while (r->n < bits)
+  {
+    if (r->pos >= r->len)
+    {
+      r->overrun = true;
+      return 0;
+    }
+    r->acc = (r->acc << 8) | r->buf[r->pos++];
+    r->n += 8;
+  }
+  r->n -= bits;
+  return (r->acc >> r->n) & ((1UL << bits) - 1);
+}
+
+static uint32_t rhd_zigzag(int32_t d) { return ((uint32_t)d << 1) ^ (d >> 31); }
+
+static int32_t rhd_unzigzag(uint32_t z) { return (int32_t)(z >> 1) ^ -(int32_t)(z & 1); }
+
+/**
+ * @brief Delta of sample `ch` against the previous frame, at the codec's
+ * resolution. The previous value is updated.
+ */
+static uint32_t rhd_delta(rhd_codec_t *c, size_t ch, uint16_t val)
+{
+  uint16_t q = val >> c->shift;
+  // Deltas wrap around the sample width, so they fit in 16 - shift bits
+  unsigned int bits = 16 - c->shift;
+  int32_t d = (int32_t)((uint32_t)(q - c->prev[ch]) << (32 - bits)) >>
+              (32 - bits);
+  c->prev[ch] = q;
+  return rhd_zigzag(d);
+}
+
+static uint16_t rhd_undelta(rhd_codec_t *c, size_t ch, uint32_t z)
+{
+  uint16_t mask = 0xFFFF >> c->shift;
+  uint16_t q = (c->prev[ch] + rhd_unzigzag(z)) & mask;
+  c->prev[ch] = q;
+  return q << c->shift;
+}
+
+static unsigned int rhd_rice_k(const rhd_codec_t *c, size_t ch)
+{
+  unsigned int k = 0;
+  while (k < 15 && (c->cnt[ch] << k) < c->acc[ch])
+  {
+    k++;
+  }
+  return k;
+}
+
+static void rhd_rice_update(rhd_codec_t *c, size_t ch, uint32_t z)
+{
+  c->acc[ch] += z;
+  if (++c->cnt[ch] >= RHD_RICE_RESET)
+  {
+    c->acc[ch] >>= 1;
+    c->cnt[ch] >>= 1;
+  }
+}
+
+size_t rhd_pack_bits(const uint16_t *in, size_t n, unsigned int bits,
+                     uint8_t *out)
+{
+  rhd_bit_writer_t w = {out, 0, 0, 0};
+  for (size_t i = 0; i < n; i++)
+  {
+    rhd_bits_put(&w, in[i] >> (16 - bits), bits);
+  }
+  return rhd_bits_flush(&w);
+}
+
+size_t rhd_unpack_bits(const uint8_t *in, size_t n, unsigned int bits,
+                       uint16_t *out)
+{
+  rhd_bit_reader_t r = {in, (n * bits + 7) / 8, 0, 0, 0, false};
+  for (size_t i = 0; i < n; i++)
+  {
+    out[i] = (uint16_t)(rhd_bits_get(&r, bits) << (16 - bits));
+  }
+  return r.pos;
+}
+
+void rhd_codec_init(rhd_codec_t *c, size_t n_ch, unsigned int shift)
+{
+  c->n_ch = n_ch > RHD_FRAME_CH ? RHD_FRAME_CH : n_ch;
+  c->shift = shift > 15 ? 15 : shift;
+  for (size_t ch = 0; ch < RHD_FRAME_CH; ch++)
+  {
+    c->prev[ch] = 0;
+    c->acc[ch] = 0;
+    c->cnt[ch] = 1;
+  }
+}
+
+size_t rhd_encode_varint(rhd_codec_t *c, const uint16_t *frame, uint8_t *out)
+{
+  size_t pos = 0;
+  for (size_t ch = 0; ch < c->n_ch; ch++)
+  {
+    uint32_t z = rhd_delta(c, ch, frame[ch]);
+    while (z >= 0x80)
+    {
+      out[pos++] = (uint8_t)(z | 0x80);
+      z >>= 7;
+    }
+    out[pos++] = (uint8_t)z;
+  }
+  return pos;
+}
+
+size_t rhd_decode_varint(rhd_codec_t *c, const uint8_t *in, size_t len,
+                         uint16_t *frame)
+{
+  size_t pos = 0;
+  for (size_t ch = 0; ch < c->n_ch; ch++)
+  {
+    uint32_t z = 0;
+    unsigned int sh = 0;
+    uint8_t byte;
+    do
+    {
+      if (pos >= len || sh > 14)
+      {
+        return 0;
+      }
+      byte = in[pos++];
+      z |= (uint32_t)(byte & 0x7F) << sh;
+      sh += 7;
+    } while (byte & 0x80);
+    frame[ch] = rhd_undelta(c, ch, z);
+  }
+  return pos;
+}
+
+size_t rhd_encode_rice(rhd_codec_t *c, const uint16_t *frame, uint8_t *out)
+{
+  rhd_bit_writer_t w = {out, 0, 0, 0};
+  const unsigned int bits = 16 - c->shift;
+
+  for (size_t ch = 0; ch < c->n_ch; ch++)
+  {
+    uint32_t z = rhd_delta(c, ch, frame[ch]);
+    unsigned int k = rhd_rice_k(c, ch);
+    uint32_t q = z >> k;
+
+    if (q < RHD_RICE_MAX_Q)
+    {
+      // q ones, a zero, then the k low bits
+      rhd_bits_put(&w, ((1UL << q) - 1) << 1, q + 1);
+      rhd_bits_put(&w, z, k);
+    }
+    else
+    {
+      // Escape: RHD_RICE_MAX_Q ones, then the raw zig-zag delta
+      rhd_bits_put(&w, (1UL << RHD_RICE_MAX_Q) - 1, RHD_RICE_MAX_Q);
+      rhd_bits_put(&w, z, bits);
+    }
+    rhd_rice_update(c, ch, z);
+  }
+  return rhd_bits_flush(&w);
+}
+
+size_t rhd_decode_rice(rhd_codec_t *c, const uint8_t *in, size_t len,
+                       uint16_t *frame)
+{
+  rhd_bit_reader_t r = {in, len, 0, 0, 0, false};
+  const unsigned int bits = 16 - c->shift;
+
+  for (size_t ch = 0; ch < c->n_ch; ch++)
+  {
+    unsigned int k = rhd_rice_k(c, ch);
+    uint32_t q = 0;
+    while (q < RHD_RICE_MAX_Q && rhd_bits_get(&r, 1))
+    {
+      q++;
+    }
+
+    uint32_t z;
+    if (q < RHD_RICE_MAX_Q)
+    {
+      z = (q << k) | rhd_bits_get(&r, k);
+    }
+    else
+    {
+      z = rhd_bits_get(&r, bits);
+    }
+    if (r.overrun)
+    {
+      return 0;
+    }
+    frame[ch] = rhd_undelta(c, ch, z);
+    rhd_rice_update(c, ch, z);
+  }
+  return r.pos;
+}
@@ -0,0 +1,122 @@
+/** @file rhd_codec.h
+ *
+ * @brief Compact encodings of RHD2164 frames, eg for serial or BLE links.
+ *
+ * Three encoders, each with its matching decoder:
+ * - fixed-width bit packing of the top `bits` bits of every sample
+ * - per-channel delta, zig-zag and varint
+ * - per-channel delta, zig-zag and adaptive Rice coding
+ *
+ * The delta encoders are stateful: the decoder must see every frame the
+ * encoder produced, in order, starting from the same @ref rhd_codec_init.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_CODEC_H
+#define RHD_CODEC_H
+
+#include "rhd.h"
+
+/** Largest Rice code of a sample before it escapes to a raw value */
+#define RHD_RICE_MAX_Q 16
+
+/** Upper bound of an encoded frame, for any encoder */
+#define RHD_CODEC_MAX_BYTES ((RHD_FRAME_CH * (RHD_RICE_MAX_Q + 16) + 7) / 8)
+
+typedef struct
+{
+  size_t n_ch;
+  unsigned int shift;
+  uint16_t prev[RHD_FRAME_CH];
+  /* Rice adaptation, per channel */
+  uint32_t acc[RHD_FRAME_CH];
+  uint32_t cnt[RHD_FRAME_CH];
+} rhd_codec_t;
+
+/**
+ * @brief Pack the top `bits` bits of `n` samples, MSb first.
+ *
+ * @param in samples
+ * @param n number of samples
+ * @param bits bits kept per sample, 1-16
+ * @param out destination of `(n * bits + 7) / 8` bytes
+ * @return size_t number of bytes written
+ */
+size_t rhd_pack_bits(const uint16_t *in, size_t n, unsigned int bits,
+                     uint8_t *out);
+
+/**
+ * @brief Unpack samples packed by @ref rhd_pack_bits. The dropped low bits
+ * are set to 0.
+ *
+ * @param in packed data
+ * @param n number of samples
+ * @param bits bits kept per sample, 1-16
+ * @param out destination of `n` samples
+ * @return size_t number of bytes read
+ */
+size_t rhd_unpack_bits(const uint8_t *in, size_t n, unsigned int bits,
+                       uint16_t *out);
+
+/**
+ * @brief Initialize or reset a delta codec. Encoder and decoder each have
+ * their own, initialized with the same parameters.
+ *
+ * @param c pointer to rhd_codec_t instance
+ * @param n_ch samples per frame, at most 64, eg `dev->n_ch`
+ * @param shift low bits dropped before coding, eg 4 to keep the 12 useful
+ * bits of noisy recordings. 0 is lossless.
+ */
+void rhd_codec_init(rhd_codec_t *c, size_t n_ch, unsigned int shift);
+
+/**
+ * @brief Encode a frame as per-channel delta, zig-zag and varint (LEB128).
+ * A sample costs 1 byte for deltas of at most +-63 steps.
+ *
+ * @param c pointer to the encoder's rhd_codec_t instance
+ * @param frame `c->n_ch` samples
+ * @param out destination, at least `RHD_CODEC_MAX_BYTES`
+ * @return size_t number of bytes written
+ */
+size_t rhd_encode_varint(rhd_codec_t *c, const uint16_t *frame, uint8_t *out);
+
+/**
+ * @brief Decode a frame encoded by @ref rhd_encode_varint.
+ *
+ * @param c pointer to the decoder's rhd_codec_t instance
+ * @param in encoded data
+ * @param len bytes available in `in`
+ * @param frame destination of `c->n_ch` samples
+ * @return size_t number of bytes read, 0 if `in` is truncated
+ */
+size_t rhd_decode_varint(rhd_codec_t *c, const uint8_t *in, size_t len,
+                         uint16_t *frame);
+
+/**
+ * @brief Encode a frame as per-channel delta, zig-zag and Rice codes. The
+ * Rice parameter of every channel adapts to its recent deltas, and samples
+ * whose quotient would exceed `RHD_RICE_MAX_Q` escape to a raw value. A
+ * frame is padded to a whole byte.
+ *
+ * @param c pointer to the encoder's rhd_codec_t instance
+ * @param frame `c->n_ch` samples
+ * @param out destination, at least `RHD_CODEC_MAX_BYTES`
+ * @return size_t number of bytes written
+ */
+size_t rhd_encode_rice(rhd_codec_t *c, const uint16_t *frame, uint8_t *out);
+
+/**
+ * @brief Decode a frame encoded by @ref rhd_encode_rice.
+ *
+ * @param c pointer to the decoder's rhd_codec_t instance
+ * @param in encoded data
+ * @param len bytes available in `in`
+ * @param frame destination of `c->n_ch` samples
+ * @return size_t number of bytes read, 0 if `in` is truncated
+ */
+size_t rhd_decode_rice(rhd_codec_t *c, const uint8_t *in, size_t len,
+                       uint16_t *frame);
+
+#endif /* RHD_CODEC_H */
@@ -0,0 +1,63 @@
+/** @file rhd_convert.c
+ *
+ * @brief Conversion of raw RHD2164 results to physical units.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#include "rhd_convert.h"
+
+/**
+ * @brief Signed amplifier code of a raw sample, without its alignment bit.
+ *
+ * Offset binary becomes two's complement by flipping the MSB, then the sign
+ * is extended arithmetically, so both formats take the same branch-free path.
+ *
+ * @param raw raw sample
+ * @param in_xor 0x8000 for offset binary, 0 for two's complement
+ * @return int32_t signed code
+ */
+static inline int32_t rhd_amp_code(uint16_t raw, uint16_t in_xor)
+{
+  int32_t u = (raw ^ in_xor) & 0xFFFE;
+  return u - ((u & 0x8000) << 1);
+}
+
+void rhd_convert_block_uv(const rhd_device_t *dev, const uint16_t *raw,
+                          float *uv, size_t n)
+{
+  const uint16_t in_xor = rhd_cfg_twos_comp(dev) ? 0 : 0x8000;
+  for (size_t i = 0; i < n; i++)
+  {
+    uv[i] = (float)rhd_amp_code(raw[i], in_xor) * RHD_AMP_UV_PER_LSB;
+  }
+}
+
+void rhd_convert_block_nv(const rhd_device_t *dev, const uint16_t *raw,
+                          int32_t *nv, size_t n)
+{
+  const uint16_t in_xor = rhd_cfg_twos_comp(dev) ? 0 : 0x8000;
+  for (size_t i = 0; i < n; i++)
+  {
+    nv[i] = rhd_amp_code(raw[i], in_xor) * RHD_AMP_NV_PER_LSB;
+  }
+}
+
+void rhd_convert_aux_v(const uint16_t *raw, float *v, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    v[i] = (float)(raw[i] & 0xFFFE) * RHD_AUX_V_PER_LSB;
+  }
+}
+
+float rhd_convert_supply_v(uint16_t raw)
+{
+  return (float)(raw & 0xFFFE) * RHD_SUPPLY_V_PER_LSB;
+}
+
+float rhd_convert_temp_c(uint16_t t1, uint16_t t2)
+{
+  int32_t d = (int32_t)(t2 & 0xFFFE) - (int32_t)(t1 & 0xFFFE);
+  return (float)d / RHD_TEMP_LSB_PER_C - 273.15f;
+}
@@ -0,0 +1,95 @@
+/** @file rhd_convert.h
+ *
+ * @brief Conversion of raw RHD2164 results to physical units.
+ *
+ * Frames hold amplifier codes whose LSB is forced to 1 by the demux and
+ * cleared on channel 0 to flag frame alignment, in the format configured by
+ * @ref rhd_cfg_dsp. The block functions strip that bit and undo the format
+ * on flat arrays, so they take frames (`n_frames * RHD_FRAME_CH` samples) as
+ * well as channel-major blocks from @ref rhd2164_sample_block. The loops are
+ * branch-free and vectorize with SSE2/AVX2 or NEON.
+ *
+ * Auxiliary ADC results (@ref rhd_aux_set) are unipolar and have their own
+ * scales.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_CONVERT_H
+#define RHD_CONVERT_H
+
+#include "rhd.h"
+
+/** Amplifier resolution [nV/LSB] */
+#define RHD_AMP_NV_PER_LSB 195
+
+/** Amplifier resolution [uV/LSB] */
+#define RHD_AMP_UV_PER_LSB 0.195f
+
+/** Auxiliary inputs resolution [V/LSB] */
+#define RHD_AUX_V_PER_LSB 0.0000374f
+
+/** Supply voltage sensor resolution [V/LSB] */
+#define RHD_SUPPLY_V_PER_LSB 0.0000748f
+
+/** Temperature sensor resolution of a reading difference [LSB/degC] */
+#define RHD_TEMP_LSB_PER_C 98.9f
+
+/**
+ * @brief Convert amplifier samples to microvolts.
+ *
+ * @param dev pointer to rhd_device_t instance, for the sample format
+ * @param raw frames or block samples
+ * @param uv destination, `n` samples
+ * @param n number of samples
+ */
+void rhd_convert_block_uv(const rhd_device_t *dev, const uint16_t *raw,
+                          float *uv, size_t n);
+
+/**
+ * @brief Convert amplifier samples to nanovolts, in integers.
+ *
+ * Whole microvolts would drop most of the 0.195 uV resolution, nanovolts keep
+ * it exactly and fit in 23 bits.
+ *
+ * @param dev pointer to rhd_device_t instance, for the sample format
+ * @param raw frames or block samples
+ * @param nv destination, `n` samples
+ * @param n number of samples
+ */
+void rhd_convert_block_nv(const rhd_device_t *dev, const uint16_t *raw,
+                          int32_t *nv, size_t n);
+
+/**
+ * @brief Convert auxiliary input results (CONVERT of RHD_CH_AUX1-3) to volts.
+ *
+ * @param raw auxiliary results
+ * @param v destination, `n` values
+ * @param n number of results
+ */
+void rhd_convert_aux_v(const uint16_t *raw, float *v, size_t n);
+
+/**
+ * @brief Convert a supply voltage sensor result (CONVERT of RHD_CH_SUPPLY) to
+ * volts.
+ *
+ * @param raw result
+ * @return float supply voltage [V]
+ */
+float rhd_convert_supply_v(uint16_t raw);
+
+/**
+ * @brief Convert two temperature sensor results (CONVERT of RHD_CH_TEMP) to
+ * degrees Celsius.
+ *
+ * The sensor is read as a difference: `t1` with temp_S1 set, `t2` after
+ * setting temp_S2 too, see @ref rhd_cfg_aux_dig.
+ *
+ * @param t1 first result
+ * @param t2 second result
+ * @return float die temperature [degC]
+ */
+float rhd_convert_temp_c(uint16_t t1, uint16_t t2);
+
+#endif
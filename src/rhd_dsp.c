@@ -0,0 +1,220 @@
+/** @file rhd_dsp.c
+ *
+ * @brief Host-side fixed-point DSP for blocks of RHD2164 frames.
+ *
+ * Biquads are direct form I, with the RBJ audio EQ cookbook coefficients.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#include "rhd_dsp.h"
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/** Quality factor of a second-order Butterworth section, 1 / sqrt(2) */
+#define RHD_BUTTER_Q 0.70710678118654752
+
+/**
+ * @brief Quantize normalized biquad coefficients to Q28.
+ */
+static void rhd_biquad_set(rhd_biquad_t *bq, double b0, double b1, double b2,
+                           double a0, double a1, double a2)
+{
+  const double one = (double)((int32_t)1 << RHD_DSP_Q);
+  bq->b0 = (int32_t)lround(b0 / a0 * one);
+  bq->b1 = (int32_t)lround(b1 / a0 * one);
+  bq->b2 = (int32_t)lround(b2 / a0 * one);
+  bq->a1 = (int32_t)lround(a1 / a0 * one);
+  bq->a2 = (int32_t)lround(a2 / a0 * one);
+}
+
+static int32_t rhd_sat16(int32_t v)
+{
+  v = v > INT16_MAX ? INT16_MAX : v;
+  return v < INT16_MIN ? INT16_MIN : v;
+}
+
+void rhd_biquad_notch(rhd_biquad_t *bq, float fs, float f0, float q)
+{
+  double w0 = 2 * M_PI * f0 / fs;
+  double alpha = sin(w0) / (2 * q);
+  double c = cos(w0);
+  rhd_biquad_set(bq, 1, -2 * c, 1, 1 + alpha, -2 * c, 1 - alpha);
+}
+
+void rhd_biquad_highpass(rhd_biquad_t *bq, float fs, float fc)
+{
+  double w0 = 2 * M_PI * fc / fs;
+  double alpha = sin(w0) / (2 * RHD_BUTTER_Q);
+  double c = cos(w0);
+  rhd_biquad_set(bq, (1 + c) / 2, -(1 + c), (1 + c) / 2, 1 + alpha, -2 * c,
+                 1 - alpha);
+}
+
+void rhd_biquad_lowpass(rhd_biquad_t *bq, float fs, float fc)
+{
+  double w0 = 2 * M_PI * fc / fs;
+  double alpha = sin(w0) / (2 * RHD_BUTTER_Q);
+  double c = cos(w0);
+  rhd_biquad_set(bq, (1 - c) / 2, 1 - c, (1 - c) / 2, 1 + alpha, -2 * c,
+                 1 - alpha);
+}
+
+void rhd_dsp_init(rhd_dsp_t *d, size_t n_ch, bool twos_comp)
+{
+  d->n_ch = n_ch > RHD_FRAME_CH ? RHD_FRAME_CH : n_ch;
+  d->in_xor = twos_comp ? 0 : 0x8000;
+  d->rectify = false;
+  d->n_stages = 0;
+  rhd_dsp_reset(d);
+}
+
+int rhd_dsp_init_emg(rhd_dsp_t *d, const rhd_device_t *dev, float mains,
+                     float fl, float fh, bool rectify)
+{
+  const float fs = dev->fs;
+  rhd_biquad_t bq;
+
+  if (fs <= 0)
+  {
+    return -1;
+  }
+
+  rhd_dsp_init(d, dev->n_ch, rhd_cfg_twos_comp(dev));
+  d->rectify = rectify;
+
+  if (mains > 0 && mains < fs / 2)
+  {
+    rhd_biquad_notch(&bq, fs, mains, 30);
+    rhd_dsp_add(d, &bq);
+  }
+  if (fl > 0 && fl < fs / 2)
+  {
+    rhd_biquad_highpass(&bq, fs, fl);
+    rhd_dsp_add(d, &bq);
+  }
+  if (fh > 0 && fh < fs / 2)
+  {
+    rhd_biquad_lowpass(&bq, fs, fh);
+    rhd_dsp_add(d, &bq);
+  }
+  return 0;
+}
+
+int rhd_dsp_add(rhd_dsp_t *d, const rhd_biquad_t *bq)
+{
+  if (d->n_stages >= RHD_DSP_MAX_STAGES)
+  {
+    return -1;
+  }
+  d->stages[d->n_stages++] = *bq;
+  return 0;
+}
+
+void rhd_dsp_reset(rhd_dsp_t *d)
+{
+  for (size_t s = 0; s < RHD_DSP_MAX_STAGES; s++)
+  {
+    for (size_t ch = 0; ch < RHD_FRAME_CH; ch++)
+    {
+      d->x1[s][ch] = 0;
+      d->x2[s][ch] = 0;
+      d->y1[s][ch] = 0;
+      d->y2[s][ch] = 0;
+    }
+  }
+}
+
+void rhd_dsp_process(rhd_dsp_t *d, const uint16_t (*in)[RHD_FRAME_CH],
+                     int16_t (*out)[RHD_FRAME_CH], size_t n_frames)
+{
+  const size_t n_ch = d->n_ch;
+  const uint16_t in_xor = d->in_xor;
+  int32_t x[RHD_FRAME_CH];
+
+  for (size_t t = 0; t < n_frames; t++)
+  {
+    for (size_t ch = 0; ch < n_ch; ch++)
+    {
+      x[ch] = (int16_t)(in[t][ch] ^ in_xor);
+    }
+
+    for (size_t s = 0; s < d->n_stages; s++)
+    {
+      const rhd_biquad_t bq = d->stages[s];
+      int32_t *restrict x1 = d->x1[s];
+      int32_t *restrict x2 = d->x2[s];
+      int32_t *restrict y1 = d->y1[s];
+      int32_t *restrict y2 = d->y2[s];
+
+      // One pass over all channels: no dependency between lanes
+      for (size_t ch = 0; ch < n_ch; ch++)
+      {
+        int64_t acc = (int64_t)bq.b0 * x[ch] + (int64_t)bq.b1 * x1[ch] +
+                      (int64_t)bq.b2 * x2[ch] - (int64_t)bq.a1 * y1[ch] -
+                      (int64_t)bq.a2 * y2[ch];
+        int32_t y = rhd_sat16(
+            (int32_t)((acc + ((int64_t)1 << (RHD_DSP_Q - 1))) >> RHD_DSP_Q));
+        x2[ch] = x1[ch];
+        x1[ch] = x[ch];
+        y2[ch] = y1[ch];
+        y1[ch] = y;
+        x[ch] = y;
+      }
+    }
+
+    if (d->rectify)
+    {
+      for (size_t ch = 0; ch < n_ch; ch++)
+      {
+        x[ch] = rhd_sat16(x[ch] < 0 ? -x[ch] : x[ch]);
+      }
+    }
+    for (size_t ch = 0; ch < n_ch; ch++)
+    {
+      out[t][ch] = (int16_t)x[ch];
+    }
+  }
+}
+
+void rhd_dsp_rms(const int16_t (*x)[RHD_FRAME_CH], size_t n_frames,
+                 size_t n_ch, uint16_t *rms)
+{
+  uint64_t acc[RHD_FRAME_CH] = {0};
+
+  for (size_t t = 0; t < n_frames; t++)
+  {
+    for (size_t ch = 0; ch < n_ch; ch++)
+    {
+      acc[ch] += (uint64_t)((int32_t)x[t][ch] * x[t][ch]);
+    }
+  }
+  for (size_t ch = 0; ch < n_ch; ch++)
+  {
+    rms[ch] = n_frames ? (uint16_t)lround(sqrt((double)acc[ch] / n_frames))
+                       : 0;
+  }
+}
+
+void rhd_dsp_mav(const int16_t (*x)[RHD_FRAME_CH], size_t n_frames,
+                 size_t n_ch, uint16_t *mav)
+{
+  uint64_t acc[RHD_FRAME_CH] = {0};
+
+  for (size_t t = 0; t < n_frames; t++)
+  {
+    for (size_t ch = 0; ch < n_ch; ch++)
+    {
+      int32_t v = x[t][ch];
+      acc[ch] += (uint32_t)(v < 0 ? -v : v);
+    }
+  }
+  for (size_t ch = 0; ch < n_ch; ch++)
+  {
+    mav[ch] = n_frames ? (uint16_t)((acc[ch] + n_frames / 2) / n_frames) : 0;
+  }
+}
@@ -0,0 +1,155 @@
+/** @file rhd_dsp.h
+ *
+ * @brief Host-side fixed-point DSP for blocks of RHD2164 frames: biquad
+ * filters (notch, high-pass, low-pass), rectification and RMS/MAV features.
+ *
+ * Filters are sequential in time, so a block is processed one time step at a
+ * time and every step runs all channels of the frame in one pass. Filter
+ * states are stored channel-contiguous (`state[stage][ch]`), so that pass is
+ * a plain loop over channels that compilers turn into SSE/AVX2 or NEON
+ * vectors.
+ *
+ * Samples are int16. Coefficients are Q28 and accumulate in 64 bits: narrow
+ * notches need the precision, since a zero off by 1e-4 rad already leaves
+ * 10% of the mains through. Outputs saturate.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_DSP_H
+#define RHD_DSP_H
+
+#include "rhd.h"
+
+/** Fractional bits of the biquad coefficients */
+#define RHD_DSP_Q 28
+
+/** Maximum number of biquad sections in a pipeline */
+#define RHD_DSP_MAX_STAGES 4
+
+typedef struct
+{
+  /** Q28 coefficients, normalized by a0 */
+  int32_t b0, b1, b2, a1, a2;
+} rhd_biquad_t;
+
+typedef struct
+{
+  size_t n_ch;
+  /** XORed into raw samples: 0x8000 for offset binary, 0 for two's
+   * complement */
+  uint16_t in_xor;
+  bool rectify;
+  size_t n_stages;
+  rhd_biquad_t stages[RHD_DSP_MAX_STAGES];
+  int32_t x1[RHD_DSP_MAX_STAGES][RHD_FRAME_CH];
+  int32_t x2[RHD_DSP_MAX_STAGES][RHD_FRAME_CH];
+  int32_t y1[RHD_DSP_MAX_STAGES][RHD_FRAME_CH];
+  int32_t y2[RHD_DSP_MAX_STAGES][RHD_FRAME_CH];
+} rhd_dsp_t;
+
+/**
+ * @brief Notch biquad, eg at 50 or 60 Hz.
+ *
+ * @param bq destination
+ * @param fs sampling rate [Hz]
+ * @param f0 notch frequency [Hz]
+ * @param q quality factor, eg 30
+ */
+void rhd_biquad_notch(rhd_biquad_t *bq, float fs, float f0, float q);
+
+/**
+ * @brief Second-order Butterworth high-pass biquad.
+ *
+ * @param bq destination
+ * @param fs sampling rate [Hz]
+ * @param fc cutoff frequency [Hz]
+ */
+void rhd_biquad_highpass(rhd_biquad_t *bq, float fs, float fc);
+
+/**
+ * @brief Second-order Butterworth low-pass biquad.
+ *
+ * @param bq destination
+ * @param fs sampling rate [Hz]
+ * @param fc cutoff frequency [Hz]
+ */
+void rhd_biquad_lowpass(rhd_biquad_t *bq, float fs, float fc);
+
+/**
+ * @brief Initialize an empty pipeline, which only converts the samples.
+ *
+ * @param d pointer to rhd_dsp_t instance
+ * @param n_ch samples per frame, at most 64, eg `dev->n_ch`
+ * @param twos_comp true if the chip outputs two's complement samples (see
+ * @ref rhd_cfg_dsp), false for offset binary
+ */
+void rhd_dsp_init(rhd_dsp_t *d, size_t n_ch, bool twos_comp);
+
+/**
+ * @brief Initialize an EMG pipeline for a configured device: mains notch,
+ * then a `[fl, fh]` Butterworth band-pass and optional rectification. The
+ * sampling rate and sample format are the ones given to @ref rhd_setup.
+ *
+ * @param d pointer to rhd_dsp_t instance
+ * @param dev configured device
+ * @param mains mains frequency [Hz], 50 or 60, 0 for no notch
+ * @param fl band-pass lower cutoff [Hz], 0 for no high-pass
+ * @param fh band-pass higher cutoff [Hz], 0 for no low-pass
+ * @param rectify true for full-wave rectified output
+ * @return int 0 for success, -1 if the device sampling rate is unknown
+ */
+int rhd_dsp_init_emg(rhd_dsp_t *d, const rhd_device_t *dev, float mains,
+                     float fl, float fh, bool rectify);
+
+/**
+ * @brief Append a biquad section to the pipeline.
+ *
+ * @param d pointer to rhd_dsp_t instance
+ * @param bq section coefficients
+ * @return int 0 for success, -1 if the pipeline is full
+ */
+int rhd_dsp_add(rhd_dsp_t *d, const rhd_biquad_t *bq);
+
+/**
+ * @brief Clear the filter states, eg after a gap in the acquisition.
+ *
+ * @param d pointer to rhd_dsp_t instance
+ */
+void rhd_dsp_reset(rhd_dsp_t *d);
+
+/**
+ * @brief Filter a block of frames. Filter states carry over blocks.
+ *
+ * @param d pointer to rhd_dsp_t instance
+ * @param in `n_frames` raw frames, eg borrowed from a @ref rhd_stream_t
+ * @param out `n_frames` filtered frames, may not alias `in`
+ * @param n_frames number of frames
+ */
+void rhd_dsp_process(rhd_dsp_t *d, const uint16_t (*in)[RHD_FRAME_CH],
+                     int16_t (*out)[RHD_FRAME_CH], size_t n_frames);
+
+/**
+ * @brief Root mean square of every channel over a window of frames.
+ *
+ * @param x `n_frames` filtered frames
+ * @param n_frames window length
+ * @param n_ch channels per frame
+ * @param rms destination of `n_ch` values
+ */
+void rhd_dsp_rms(const int16_t (*x)[RHD_FRAME_CH], size_t n_frames,
+                 size_t n_ch, uint16_t *rms);
+
+/**
+ * @brief Mean absolute value of every channel over a window of frames.
+ *
+ * @param x `n_frames` filtered frames
+ * @param n_frames window length
+ * @param n_ch channels per frame
+ * @param mav destination of `n_ch` values
+ */
+void rhd_dsp_mav(const int16_t (*x)[RHD_FRAME_CH], size_t n_frames,
+                 size_t n_ch, uint16_t *mav);
+
+#endif /* RHD_DSP_H */
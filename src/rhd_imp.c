@@ -0,0 +1,158 @@
+/** @file rhd_imp.c
+ *
+ * @brief Electrode impedance measurement with the RHD2164 impedance check.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#include "rhd_imp.h"
+
+#include "rhd_convert.h"
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * @brief Find where channel `ch` is in a frame.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param ch channel
+ * @param slot set to the slot of its CONVERT command
+ * @return int index of its samples in a frame, -1 if it is not sampled
+ */
+static int rhd_imp_locate(const rhd_device_t *dev, int ch, size_t *slot)
+{
+  int i = -1;
+  for (size_t j = 0; j < dev->n_ch; j++)
+  {
+    if (dev->ch_map[j] == ch)
+    {
+      i = (int)j;
+    }
+  }
+  *slot = ch % RHD_SWEEP_CMDS;
+  if (dev->sparse)
+  {
+    for (size_t k = 0; k < dev->n_conv; k++)
+    {
+      if (dev->sweep_ch[k] == ch % RHD_SWEEP_CMDS)
+      {
+        *slot = k;
+      }
+    }
+  }
+  return i;
+}
+
+static double rhd_imp_cap_f(rhd_zcheck_scale_t scale)
+{
+  switch (scale)
+  {
+  case RHD_ZCHECK_0PF1:
+    return 0.1e-12;
+  case RHD_ZCHECK_10PF:
+    return 10e-12;
+  default:
+    return 1e-12;
+  }
+}
+
+size_t rhd_imp_frames(const rhd_imp_cfg_t *cfg)
+{
+  return (cfg->n_settle + cfg->n_periods) * cfg->period;
+}
+
+int rhd_imp_measure(rhd_device_t *dev, const rhd_imp_cfg_t *cfg,
+                    uint16_t (*buf)[RHD_FRAME_CH], size_t buf_frames,
+                    rhd_imp_result_t *out)
+{
+  const size_t period = cfg->period;
+  const size_t n_frames = rhd_imp_frames(cfg);
+  uint16_t dac[RHD_IMP_MAX_PERIOD];
+
+  if (cfg->fs <= 0 || period < RHD_IMP_MIN_PERIOD ||
+      period > RHD_IMP_MAX_PERIOD || cfg->n_periods == 0 ||
+      buf_frames < n_frames)
+  {
+    return -1;
+  }
+
+  // One DAC step per frame, in the auxiliary slot after the CONVERTs
+  for (size_t j = 0; j < period; j++)
+  {
+    double v = sin(2 * M_PI * (double)j / (double)period);
+    dac[j] = RHD_CMD_WRITE(IMP_CHK_DAC, 128 + lround(RHD_IMP_DAC_AMP * v));
+  }
+  const uint16_t *aux_cmds = dev->aux_cmds;
+  uint16_t *aux_out = dev->aux_out;
+  const size_t n_aux = dev->n_aux;
+  const size_t aux_k = dev->aux_k;
+  rhd_aux_set(dev, dac, period, 1, NULL);
+
+  // Test current amplitude, the DAC holds every step for a frame, which
+  // attenuates its fundamental by sinc(pi / period)
+  const double w = 2 * M_PI * cfg->fs / (double)period;
+  const double x = M_PI / (double)period;
+  const double i_amp = rhd_imp_cap_f(cfg->scale) * w * RHD_IMP_DAC_AMP *
+                       RHD_IMP_DAC_V_PER_LSB * sin(x) / x;
+
+  int n_done = 0;
+  int ret = 0;
+  for (int ch = 0; ch < RHD_FRAME_CH && ret >= 0; ch++)
+  {
+    size_t slot;
+    int i = rhd_imp_locate(dev, ch, &slot);
+    if (!((cfg->ch_mask >> ch) & 1) || i < 0)
+    {
+      continue;
+    }
+
+    rhd_cfg_zcheck(dev, true, cfg->scale, ch);
+    // DAC step of burst frame f, from its auxiliary slot
+    const size_t aux0 = dev->aux_next;
+    ret = rhd2164_sample_frames(dev, n_frames, buf);
+    if (ret < 0)
+    {
+      break;
+    }
+
+    // Phase of the DAC fundamental at each sample: steps are centered half
+    // a frame after their WRITE, and the CONVERT comes `slot` slots into
+    // the frame
+    const double t0 =
+        (double)aux0 - 0.5 +
+        ((double)slot - (double)dev->n_conv) / (double)dev->n_sweep;
+    double re = 0;
+    double im = 0;
+    for (size_t f = cfg->n_settle * period; f < n_frames; f++)
+    {
+      float uv;
+      rhd_convert_block_uv(dev, &buf[f][i], &uv, 1);
+      double th = 2 * M_PI * ((double)f + t0) / (double)period;
+      re += uv * sin(th);
+      im += uv * cos(th);
+    }
+
+    // The capacitor current leads the DAC voltage by 90 degrees
+    const size_t n_fit = cfg->n_periods * period;
+    double amp = 2 * sqrt(re * re + im * im) / (double)n_fit;
+    double phase = atan2(im, re) * 180 / M_PI - 90;
+    if (phase <= -180)
+    {
+      phase += 360;
+    }
+    out[ch].amp_uv = (float)amp;
+    out[ch].mag_ohm = (float)(amp * 1e-6 / i_amp);
+    out[ch].phase_deg = (float)phase;
+    n_done++;
+  }
+
+  // The DAC steps went around the register shadow
+  dev->regs_valid &= ~(1UL << IMP_CHK_DAC);
+  rhd_cfg_zcheck(dev, false, cfg->scale, 0);
+  rhd_aux_set(dev, aux_cmds, n_aux, aux_k, aux_out);
+  return ret < 0 ? -1 : n_done;
+}
@@ -0,0 +1,102 @@
+/** @file rhd_imp.h
+ *
+ * @brief Electrode impedance measurement with the RHD2164 impedance check.
+ *
+ * The on-chip DAC plays a sine wave, one step per frame, which drives a test
+ * current `C dV/dt` through the selected capacitor into one electrode at a
+ * time. The DAC steps are WRITE commands in an auxiliary slot of every frame
+ * (see @ref rhd_aux_set), so they go out in the same burst transfers as the
+ * CONVERT commands. Each electrode then costs one register write and one
+ * @ref rhd2164_sample_frames burst, and its impedance is fitted from the
+ * burst with a single-bin DFT at the test frequency.
+ *
+ * The test frequency is `fs / period`, with `fs` the frame rate during the
+ * bursts. Frames must be evenly spaced for the phase to mean anything: pace
+ * them with a timer, or give the device a burst buffer that holds a whole
+ * measurement (@ref rhd_set_burst_buf) so that each electrode is a single
+ * transfer. The amplifier bandwidth must include the test frequency.
+ *
+ * With the default 1 kHz and 12 periods per electrode, 64 electrodes take
+ * about 0.8 s of sampling at 30 kHz.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_IMP_H
+#define RHD_IMP_H
+
+#include "rhd.h"
+
+/** Shortest and longest DAC sine [frames] */
+#define RHD_IMP_MIN_PERIOD 4
+#define RHD_IMP_MAX_PERIOD 256
+
+/** DAC sine amplitude [LSB], around mid-scale */
+#define RHD_IMP_DAC_AMP 127
+
+/** DAC resolution [V/LSB] */
+#define RHD_IMP_DAC_V_PER_LSB (1.225f / 256)
+
+typedef struct
+{
+  /** Frame rate during the bursts [Hz], with the auxiliary slot */
+  float fs;
+  /** Frames per DAC sine period */
+  size_t period;
+  /** Periods fitted per electrode */
+  size_t n_periods;
+  /** Periods discarded after switching electrode */
+  size_t n_settle;
+  /** Series capacitor, 1 pF suits most electrodes below 5 MOhm */
+  rhd_zcheck_scale_t scale;
+  /** Electrodes to measure, only those sampled by the device count */
+  uint64_t ch_mask;
+} rhd_imp_cfg_t;
+
+/** 1 kHz test, or the closest frequency `fs` allows */
+#define RHD_IMP_CFG_DEFAULT(frame_rate)                                        \
+  {                                                                            \
+    (frame_rate), (size_t)((frame_rate) / 1000.0f + 0.5f), 10, 2,              \
+        RHD_ZCHECK_1PF, ~0ULL                                                  \
+  }
+
+typedef struct
+{
+  /** Impedance magnitude [Ohm] */
+  float mag_ohm;
+  /** Impedance phase [deg], -90 for a capacitive electrode */
+  float phase_deg;
+  /** Fitted amplitude of the recorded sine [uV] */
+  float amp_uv;
+} rhd_imp_result_t;
+
+/**
+ * @brief Number of frames sampled per electrode, the size of the buffer
+ * @ref rhd_imp_measure needs.
+ *
+ * @param cfg measurement configuration
+ * @return size_t number of frames
+ */
+size_t rhd_imp_frames(const rhd_imp_cfg_t *cfg);
+
+/**
+ * @brief Measure the impedance of the electrodes in `cfg->ch_mask`.
+ *
+ * The device's auxiliary slots are taken over for the duration, then
+ * restored (their results are cleared), and the impedance check is disabled.
+ *
+ * @param dev pointer to rhd_device_t instance
+ * @param cfg measurement configuration
+ * @param buf scratch frames, at least @ref rhd_imp_frames
+ * @param buf_frames size of `buf`
+ * @param out results, indexed by channel, `RHD_FRAME_CH` entries. Other
+ * channels are left as they are.
+ * @return int number of electrodes measured, -1 for an invalid configuration
+ * or a transport error
+ */
+int rhd_imp_measure(rhd_device_t *dev, const rhd_imp_cfg_t *cfg,
+                    uint16_t (*buf)[RHD_FRAME_CH], size_t buf_frames,
+                    rhd_imp_result_t *out);
+
+#endif
@@ -0,0 +1,297 @@
+/** @file rhd_multi.c
+ *
+ * @brief Multi-chip RHD2164 acquisition, batched per bus and threaded per
+ * independent bus.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
+#include "rhd_multi.h"
+
+#ifndef RHD_NO_THREADS
+#include <sched.h>
+#endif
+
+int rhd_group_init(rhd_group_t *g, rhd_device_t **devs, size_t n_dev,
+                   rhd_multi_rw_t rw, void *ctx, uint16_t *tx, uint16_t *rx,
+                   size_t words)
+{
+  if (devs == NULL || n_dev == 0 || rw == NULL || tx == NULL || rx == NULL ||
+      words < 2 * n_dev)
+  {
+    return -1;
+  }
+  for (size_t d = 1; d < n_dev; d++)
+  {
+    if (devs[d]->double_bits != devs[0]->double_bits)
+    {
+      return -1;
+    }
+  }
+
+  g->devs = devs;
+  g->n_dev = n_dev;
+  g->rw = rw;
+  g->ctx = ctx;
+  g->tx = tx;
+  g->rx = rx;
+  g->words = words;
+  g->cpu = -1;
+  g->first_dev = 0;
+  return 0;
+}
+
+void rhd_group_set_cpu(rhd_group_t *g, int cpu) { g->cpu = cpu; }
+
+int rhd_group_sample_frames(rhd_group_t *g, size_t n_frames, uint16_t *out,
+                            size_t frame_stride)
+{
+  // 2 more commands flush the last frame out of the pipeline
+  const size_t n_slots = n_frames * g->devs[0]->n_sweep + 2;
+  // Both modes receive 2 words per command
+  const size_t chunk_cmds = g->words / g->n_dev / 2;
+  int ret = 0;
+
+  // Every device of a group shares the command stream length
+  for (size_t d = 1; d < g->n_dev; d++)
+  {
+    if (g->devs[d]->n_sweep != g->devs[0]->n_sweep)
+    {
+      return -1;
+    }
+  }
+  if (n_frames == 0 || g->devs[0]->n_sweep == 0)
+  {
+    return 0;
+  }
+
+  for (size_t slot = 0; slot < n_slots; slot += chunk_cmds)
+  {
+    size_t n = n_slots - slot < chunk_cmds ? n_slots - slot : chunk_cmds;
+
+    // Command streams back to back, device after device
+    const size_t len = g->devs[0]->double_bits ? 2 * n : n;
+    for (size_t d = 0; d < g->n_dev; d++)
+    {
+      rhd2164_burst_encode(g->devs[d], g->tx + d * len, slot, n);
+    }
+    ret = g->rw(g->ctx, g->tx, g->rx, len, g->n_dev);
+
+    for (size_t d = 0; d < g->n_dev; d++)
+    {
+      rhd2164_burst_decode(g->devs[d], g->rx + d * 2 * n, slot, n,
+                           out + d * RHD_FRAME_CH, frame_stride);
+    }
+  }
+
+  for (size_t d = 0; d < g->n_dev; d++)
+  {
+    rhd_aux_advance(g->devs[d], n_frames);
+  }
+
+  // Alignment
+  for (size_t f = 0; f < n_frames; f++)
+  {
+    for (size_t d = 0; d < g->n_dev; d++)
+    {
+      out[f * frame_stride + d * RHD_FRAME_CH] &= 0xFFFE;
+    }
+  }
+  return ret;
+}
+
+int rhd_multi_init(rhd_multi_t *m, rhd_group_t *groups, size_t n_groups)
+{
+  if (groups == NULL || n_groups == 0)
+  {
+    return -1;
+  }
+
+  m->groups = groups;
+  m->n_groups = n_groups;
+  m->n_dev = 0;
+  for (size_t i = 0; i < n_groups; i++)
+  {
+    groups[i].first_dev = m->n_dev;
+    m->n_dev += groups[i].n_dev;
+  }
+#ifndef RHD_NO_THREADS
+  m->threads = NULL;
+#endif
+  return 0;
+}
+
+static int rhd_multi_run_group(rhd_multi_t *m, rhd_group_t *g, size_t n_frames,
+                               uint16_t *out)
+{
+  return rhd_group_sample_frames(g, n_frames, out + g->first_dev * RHD_FRAME_CH,
+                                 m->n_dev * RHD_FRAME_CH);
+}
+
+#ifndef RHD_NO_THREADS
+static void *rhd_multi_thread(void *arg)
+{
+  rhd_multi_t *m = (rhd_multi_t *)arg;
+  unsigned int seen = 0;
+
+  // Take the next free group, in the order the threads get to run, then pin
+  // ourselves to its CPU
+  pthread_mutex_lock(&m->lock);
+  rhd_group_t *g = &m->groups[m->pending++];
+  pthread_cond_signal(&m->done);
+  pthread_mutex_unlock(&m->lock);
+#if defined(__linux__)
+  if (g->cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(g->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+
+  for (;;)
+  {
+    pthread_mutex_lock(&m->lock);
+    while (m->generation == seen && !m->quit)
+    {
+      pthread_cond_wait(&m->start, &m->lock);
+    }
+    seen = m->generation;
+    bool quit = m->quit;
+    size_t n_frames = m->job_frames;
+    uint16_t *out = m->job_out;
+    pthread_mutex_unlock(&m->lock);
+
+    if (quit)
+    {
+      break;
+    }
+
+    int ret = rhd_multi_run_group(m, g, n_frames, out);
+
+    pthread_mutex_lock(&m->lock);
+    if (ret < 0 && m->job_ret == 0)
+    {
+      m->job_ret = ret;
+    }
+    if (--m->pending == 0)
+    {
+      pthread_cond_signal(&m->done);
+    }
+    pthread_mutex_unlock(&m->lock);
+  }
+  return NULL;
+}
+
+/** Stop and join the first `n_threads` threads */
+static void rhd_multi_join(rhd_multi_t *m, size_t n_threads)
+{
+  pthread_mutex_lock(&m->lock);
+  m->quit = true;
+  pthread_cond_broadcast(&m->start);
+  pthread_mutex_unlock(&m->lock);
+
+  for (size_t i = 0; i < n_threads; i++)
+  {
+    pthread_join(m->threads[i], NULL);
+  }
+  pthread_cond_destroy(&m->start);
+  pthread_cond_destroy(&m->done);
+  pthread_mutex_destroy(&m->lock);
+  m->threads = NULL;
+}
+
+int rhd_multi_start(rhd_multi_t *m, pthread_t *threads)
+{
+  if (m->threads != NULL)
+  {
+    return -1;
+  }
+
+  pthread_mutex_init(&m->lock, NULL);
+  pthread_cond_init(&m->start, NULL);
+  pthread_cond_init(&m->done, NULL);
+  m->generation = 0;
+  m->pending = 0;
+  m->quit = false;
+  m->threads = threads;
+
+  for (size_t i = 0; i < m->n_groups; i++)
+  {
+    int ret = pthread_create(&threads[i], NULL, rhd_multi_thread, m);
+    if (ret != 0)
+    {
+      // Stop the threads spawned so far
+      pthread_mutex_lock(&m->lock);
+      while (m->pending < i)
+      {
+        pthread_cond_wait(&m->done, &m->lock);
+      }
+      pthread_mutex_unlock(&m->lock);
+      rhd_multi_join(m, i);
+      return ret;
+    }
+  }
+
+  // Wait for every thread to pick its group
+  pthread_mutex_lock(&m->lock);
+  while (m->pending < m->n_groups)
+  {
+    pthread_cond_wait(&m->done, &m->lock);
+  }
+  m->pending = 0;
+  pthread_mutex_unlock(&m->lock);
+  return 0;
+}
+
+int rhd_multi_stop(rhd_multi_t *m)
+{
+  if (m->threads == NULL)
+  {
+    return 0;
+  }
+
+  rhd_multi_join(m, m->n_groups);
+  return 0;
+}
+#endif
+
+int rhd_multi_sample_frames(rhd_multi_t *m, size_t n_frames, uint16_t *out)
+{
+#ifndef RHD_NO_THREADS
+  if (m->threads != NULL)
+  {
+    // All groups start the block together and we wait for the slowest one
+    pthread_mutex_lock(&m->lock);
+    m->job_frames = n_frames;
+    m->job_out = out;
+    m->job_ret = 0;
+    m->pending = m->n_groups;
+    m->generation++;
+    pthread_cond_broadcast(&m->start);
+    while (m->pending > 0)
+    {
+      pthread_cond_wait(&m->done, &m->lock);
+    }
+    int ret = m->job_ret;
+    pthread_mutex_unlock(&m->lock);
+    return ret;
+  }
+#endif
+
+  int ret = 0;
+  for (size_t i = 0; i < m->n_groups; i++)
+  {
+    int r = rhd_multi_run_group(m, &m->groups[i], n_frames, out);
+    if (r < 0 && ret == 0)
+    {
+      ret = r;
+    }
+  }
+  return ret;
+}
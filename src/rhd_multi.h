@@ -0,0 +1,165 @@
+/** @file rhd_multi.h
+ *
+ * @brief Multi-chip RHD2164 acquisition.
+ *
+ * Chips sharing a bus form a group: their command streams are batched into a
+ * single transfer per chunk, device after device. Groups on independent buses
+ * can each run on their own thread, pinned to its own core, and are
+ * synchronized on every block so the frames stay time-aligned.
+ *
+ * Output frames hold `n_dev * 64` channels, device 0 first.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_MULTI_H
+#define RHD_MULTI_H
+
+#include "rhd.h"
+
+#ifndef RHD_NO_THREADS
+#include <pthread.h>
+#endif
+
+/**
+ * @brief Group Read Write function typedef.
+ * Like @ref rhd_rw_t, but for `n_dev` chips at once. `tx_buf` holds
+ * `len` words for every device, device after device, and `rx_buf` receives
+ * the words of every device in the same layout (`2 * len` words per device
+ * without `double_bits`).
+ *
+ * How the words reach each chip (separate chip selects, parallel MISO lines,
+ * ...) is up to the transport.
+ *
+ * @param ctx user context
+ * @param tx_buf write buffer
+ * @param rx_buf receive buffer
+ * @param len number of 16-bit values to transfer per device
+ * @param n_dev number of devices
+ * @returns int : Return code
+ */
+typedef int (*rhd_multi_rw_t)(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf,
+                              size_t len, size_t n_dev);
+
+typedef struct
+{
+  rhd_device_t **devs;
+  size_t n_dev;
+  rhd_multi_rw_t rw;
+  void *ctx;
+  uint16_t *tx;
+  uint16_t *rx;
+  size_t words;
+  int cpu;
+  /* Set by rhd_multi_init */
+  size_t first_dev;
+} rhd_group_t;
+
+typedef struct
+{
+  rhd_group_t *groups;
+  size_t n_groups;
+  size_t n_dev;
+#ifndef RHD_NO_THREADS
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned int generation;
+  size_t pending;
+  bool quit;
+  size_t job_frames;
+  uint16_t *job_out;
+  int job_ret;
+#endif
+} rhd_multi_t;
+
+/**
+ * @brief Initialize a group of chips sharing a bus.
+ * The devices must be initialized (`rhd_init`, `rhd_setup`) beforehand, and
+ * all use the same `double_bits` mode.
+ *
+ * @param g pointer to rhd_group_t instance
+ * @param devs array of `n_dev` devices
+ * @param n_dev number of devices
+ * @param rw group transport
+ * @param ctx user context given to `rw`
+ * @param tx transmit buffer of `words` values
+ * @param rx receive buffer of `words` values, which also sets the chunk size:
+ * `words / (2 * n_dev)` commands per device per transfer
+ * @param words buffers length
+ * @return int 0 for success, -1 if the arguments are invalid
+ */
+int rhd_group_init(rhd_group_t *g, rhd_device_t **devs, size_t n_dev,
+                   rhd_multi_rw_t rw, void *ctx, uint16_t *tx, uint16_t *rx,
+                   size_t words);
+
+/**
+ * @brief Pin the group's acquisition thread to a CPU, see
+ * @ref rhd_multi_start. Linux only, ignored elsewhere.
+ *
+ * @param g pointer to rhd_group_t instance
+ * @param cpu CPU index, -1 to leave it to the scheduler
+ */
+void rhd_group_set_cpu(rhd_group_t *g, int cpu);
+
+/**
+ * @brief Sample `n_frames` consecutive frames from every device of a group.
+ * Same pipelining as @ref rhd2164_sample_frames. In channel list mode, every
+ * device needs the same number of CONVERT commands per frame.
+ *
+ * @param g pointer to rhd_group_t instance
+ * @param n_frames number of frames to sample
+ * @param out destination, device `d` of frame `f` starts at
+ * `out + f * frame_stride + d * 64`
+ * @param frame_stride distance between consecutive frames, in samples
+ * @return int return code of the last transfer, -1 if the devices' sweeps
+ * differ
+ */
+int rhd_group_sample_frames(rhd_group_t *g, size_t n_frames, uint16_t *out,
+                            size_t frame_stride);
+
+/**
+ * @brief Initialize a multi-chip engine.
+ *
+ * @param m pointer to rhd_multi_t instance
+ * @param groups array of `n_groups` initialized groups
+ * @param n_groups number of groups
+ * @return int 0 for success, -1 if the arguments are invalid
+ */
+int rhd_multi_init(rhd_multi_t *m, rhd_group_t *groups, size_t n_groups);
+
+/**
+ * @brief Sample `n_frames` time-aligned frames of `m->n_dev * 64` channels.
+ * Groups run concurrently on their threads if @ref rhd_multi_start was
+ * called, one after the other otherwise.
+ *
+ * @param m pointer to rhd_multi_t instance
+ * @param n_frames number of frames to sample
+ * @param out destination of `n_frames * m->n_dev * 64` samples
+ * @return int 0 for success, otherwise the first failing transfer's code
+ */
+int rhd_multi_sample_frames(rhd_multi_t *m, size_t n_frames, uint16_t *out);
+
+#ifndef RHD_NO_THREADS
+/**
+ * @brief Spawn one acquisition thread per group, pinned to the group's CPU.
+ * Meant for groups on independent buses.
+ *
+ * @param m pointer to rhd_multi_t instance
+ * @param threads storage for `m->n_groups` thread handles
+ * @return int 0 for success, otherwise a pthread error code
+ */
+int rhd_multi_start(rhd_multi_t *m, pthread_t *threads);
+
+/**
+ * @brief Stop and join the group threads.
+ *
+ * @param m pointer to rhd_multi_t instance
+ * @return int 0 for success
+ */
+int rhd_multi_stop(rhd_multi_t *m);
+#endif
+
+#endif /* RHD_MULTI_H */
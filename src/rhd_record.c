@@ -0,0 +1,374 @@
+/** @file rhd_record.c
+ *
+ * @brief Append-only recording of RHD2164 frames, with a memory-mapped
+ * reader.
+ *
+ * The chunk buffers are a single-producer/single-consumer ring like
+ * rhd_stream.c: the producer only writes `head`, the writer only writes
+ * `tail`, and both increase forever.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "rhd_record.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RHD_LOAD_ACQ(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RHD_STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/** Writer thread poll period, bounds the latency of a missed wake-up [ns] */
+#define RHD_REC_POLL_NS 10000000L
+
+static uint64_t rhd_rec_now_ns(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static rhd_rec_chunk_t *rhd_rec_buf(rhd_recorder_t *r, size_t i)
+{
+  return (rhd_rec_chunk_t *)(r->bufs + (i & (r->n_bufs - 1)) * r->chunk_bytes);
+}
+
+/**
+ * @brief Write `len` bytes, retrying on short writes and signals.
+ */
+static int rhd_rec_write_all(int fd, const uint8_t *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t ret = write(fd, buf, len);
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    buf += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+int rhd_rec_open(rhd_recorder_t *r, const char *path, rhd_device_t *dev,
+                 void *bufs, size_t n_bufs, size_t chunk_frames)
+{
+  if (bufs == NULL || ((uintptr_t)bufs & (RHD_REC_ALIGN - 1)) != 0 ||
+      n_bufs == 0 || (n_bufs & (n_bufs - 1)) != 0 || chunk_frames == 0 ||
+      dev->n_ch == 0)
+  {
+    return -1;
+  }
+
+  r->n_ch = dev->n_ch;
+  r->chunk_frames = chunk_frames;
+  r->chunk_bytes = RHD_REC_CHUNK_BYTES(r->n_ch, chunk_frames);
+  r->bufs = bufs;
+  r->n_bufs = n_bufs;
+  r->head = 0;
+  r->tail = 0;
+  r->fill = 0;
+  r->seq = 0;
+  r->dropped = 0;
+  r->error = 0;
+
+  rhd_chip_info_t info;
+  rhd_chip_info(dev, &info);
+
+  rhd_rec_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, RHD_REC_MAGIC, sizeof(RHD_REC_MAGIC));
+  hdr.version = RHD_REC_VERSION;
+  hdr.header_bytes = RHD_REC_ALIGN;
+  hdr.chunk_bytes = r->chunk_bytes;
+  hdr.chunk_frames = chunk_frames;
+  hdr.n_ch = r->n_ch;
+  hdr.fs = dev->fs;
+  hdr.ch_mask = dev->ch_mask;
+  hdr.t0_ns = rhd_rec_now_ns(CLOCK_MONOTONIC);
+  hdr.t0_unix_ns = rhd_rec_now_ns(CLOCK_REALTIME);
+  hdr.regs_valid = dev->regs_valid;
+  hdr.ddr = dev->double_bits;
+  hdr.sparse = dev->sparse;
+  hdr.chip_id = info.chip_id;
+  hdr.die_rev = info.die_rev;
+  memcpy(hdr.regs, dev->regs, sizeof(hdr.regs));
+  memcpy(hdr.ch_map, dev->ch_map, sizeof(hdr.ch_map));
+
+  r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+               0644);
+  if (r->fd < 0)
+  {
+    return -1;
+  }
+
+  // The header page goes through the first chunk buffer, still unused
+  uint8_t *page = r->bufs;
+  memset(page, 0, RHD_REC_ALIGN);
+  memcpy(page, &hdr, sizeof(hdr));
+  if (rhd_rec_write_all(r->fd, page, RHD_REC_ALIGN) < 0)
+  {
+    close(r->fd);
+    return -1;
+  }
+
+#ifndef RHD_NO_THREADS
+  r->running = false;
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->wake, NULL);
+#endif
+  return 0;
+}
+
+/**
+ * @brief Hand the chunk being filled to the writer.
+ */
+static void rhd_rec_publish(rhd_recorder_t *r)
+{
+  rhd_rec_buf(r, r->head)->n_frames = r->fill;
+  r->fill = 0;
+  RHD_STORE_REL(&r->head, r->head + 1);
+#ifndef RHD_NO_THREADS
+  // Unlocked signal: a wake-up missed by the writer costs one poll period
+  pthread_cond_signal(&r->wake);
+#endif
+}
+
+size_t rhd_rec_write(rhd_recorder_t *r, const uint16_t (*frames)[RHD_FRAME_CH],
+                     size_t n)
+{
+  const size_t frame_bytes = r->n_ch * sizeof(uint16_t);
+  size_t n_rec = 0;
+
+  for (size_t i = 0; i < n; i++, r->seq++)
+  {
+    rhd_rec_chunk_t *chunk = rhd_rec_buf(r, r->head);
+    if (r->fill == 0)
+    {
+      if (r->head - RHD_LOAD_ACQ(&r->tail) == r->n_bufs)
+      {
+        __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+        continue;
+      }
+      chunk->magic = RHD_REC_CHUNK_MAGIC;
+      chunk->n_frames = 0;
+      chunk->seq = r->seq;
+      chunk->t_ns = rhd_rec_now_ns(CLOCK_MONOTONIC);
+      chunk->dropped = r->dropped;
+    }
+
+    uint8_t *samples = (uint8_t *)(chunk + 1);
+    memcpy(samples + r->fill * frame_bytes, frames[i], frame_bytes);
+    n_rec++;
+    if (++r->fill == r->chunk_frames)
+    {
+      rhd_rec_publish(r);
+    }
+  }
+  return n_rec;
+}
+
+int rhd_rec_service(rhd_recorder_t *r)
+{
+  const size_t head = RHD_LOAD_ACQ(&r->head);
+  size_t tail = r->tail;
+  int n = 0;
+
+  for (; tail != head; tail++, n++)
+  {
+    const uint8_t *buf = (const uint8_t *)rhd_rec_buf(r, tail);
+    if (rhd_rec_write_all(r->fd, buf, r->chunk_bytes) < 0)
+    {
+      r->error = errno;
+      return -1;
+    }
+    RHD_STORE_REL(&r->tail, tail + 1);
+  }
+  return n;
+}
+
+uint64_t rhd_rec_dropped(rhd_recorder_t *r)
+{
+  return __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+}
+
+int rhd_rec_close(rhd_recorder_t *r)
+{
+#ifndef RHD_NO_THREADS
+  rhd_rec_stop(r);
+#endif
+  if (r->fill > 0)
+  {
+    rhd_rec_publish(r);
+  }
+  if (r->error == 0 && rhd_rec_service(r) < 0)
+  {
+    r->error = errno;
+  }
+#ifndef RHD_NO_THREADS
+  pthread_cond_destroy(&r->wake);
+  pthread_mutex_destroy(&r->lock);
+#endif
+  if (close(r->fd) < 0 && r->error == 0)
+  {
+    r->error = errno;
+  }
+  return r->error == 0 ? 0 : -1;
+}
+
+#ifndef RHD_NO_THREADS
+static void *rhd_rec_thread(void *ctx)
+{
+  rhd_recorder_t *r = (rhd_recorder_t *)ctx;
+
+  pthread_mutex_lock(&r->lock);
+  while (r->running)
+  {
+    pthread_mutex_unlock(&r->lock);
+    if (rhd_rec_service(r) < 0)
+    {
+      // Chunks stop being written, the producer drops frames from now on
+      pthread_mutex_lock(&r->lock);
+      break;
+    }
+    pthread_mutex_lock(&r->lock);
+    if (r->running && RHD_LOAD_ACQ(&r->head) == r->tail)
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += RHD_REC_POLL_NS;
+      if (ts.tv_nsec >= 1000000000L)
+      {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&r->wake, &r->lock, &ts);
+    }
+  }
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+int rhd_rec_start(rhd_recorder_t *r)
+{
+  if (r->running)
+  {
+    return 0;
+  }
+  r->running = true;
+  int ret = pthread_create(&r->thread, NULL, rhd_rec_thread, r);
+  if (ret != 0)
+  {
+    r->running = false;
+  }
+  return ret;
+}
+
+void rhd_rec_stop(rhd_recorder_t *r)
+{
+  pthread_mutex_lock(&r->lock);
+  bool running = r->running;
+  r->running = false;
+  pthread_cond_signal(&r->wake);
+  pthread_mutex_unlock(&r->lock);
+  if (running)
+  {
+    pthread_join(r->thread, NULL);
+  }
+}
+#endif
+
+int rhd_rec_map(rhd_rec_reader_t *rd, const char *path)
+{
+  rd->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (rd->fd < 0)
+  {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(rd->fd, &st) < 0 || (size_t)st.st_size < RHD_REC_ALIGN)
+  {
+    close(rd->fd);
+    return -1;
+  }
+  rd->size = st.st_size;
+  void *base = mmap(NULL, rd->size, PROT_READ, MAP_SHARED, rd->fd, 0);
+  if (base == MAP_FAILED)
+  {
+    close(rd->fd);
+    return -1;
+  }
+  rd->base = base;
+  rd->hdr = (const rhd_rec_header_t *)rd->base;
+
+  const rhd_rec_header_t *hdr = rd->hdr;
+  if (memcmp(hdr->magic, RHD_REC_MAGIC, sizeof(RHD_REC_MAGIC)) != 0 ||
+      hdr->version != RHD_REC_VERSION || hdr->header_bytes > rd->size ||
+      hdr->chunk_bytes < RHD_REC_CHUNK_BYTES(hdr->n_ch, hdr->chunk_frames))
+  {
+    rhd_rec_unmap(rd);
+    return -1;
+  }
+  rd->n_chunks = (rd->size - hdr->header_bytes) / hdr->chunk_bytes;
+  return 0;
+}
+
+void rhd_rec_unmap(rhd_rec_reader_t *rd)
+{
+  munmap((void *)rd->base, rd->size);
+  close(rd->fd);
+}
+
+const rhd_rec_chunk_t *rhd_rec_chunk(const rhd_rec_reader_t *rd, size_t i)
+{
+  return (const rhd_rec_chunk_t *)(rd->base + rd->hdr->header_bytes +
+                                   i * rd->hdr->chunk_bytes);
+}
+
+const uint16_t *rhd_rec_chunk_samples(const rhd_rec_chunk_t *chunk)
+{
+  return (const uint16_t *)(chunk + 1);
+}
+
+const uint16_t *rhd_rec_frame(const rhd_rec_reader_t *rd, uint64_t seq)
+{
+  // Chunks are in sequence order, find the last one starting before `seq`
+  size_t lo = 0;
+  size_t hi = rd->n_chunks;
+  while (hi - lo > 1)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (rhd_rec_chunk(rd, mid)->seq <= seq)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  if (rd->n_chunks == 0)
+  {
+    return NULL;
+  }
+
+  const rhd_rec_chunk_t *chunk = rhd_rec_chunk(rd, lo);
+  if (seq < chunk->seq || seq - chunk->seq >= chunk->n_frames)
+  {
+    return NULL;
+  }
+  return rhd_rec_chunk_samples(chunk) + (seq - chunk->seq) * rd->hdr->n_ch;
+}
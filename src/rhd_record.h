@@ -0,0 +1,249 @@
+/** @file rhd_record.h
+ *
+ * @brief Append-only recording of RHD2164 frames, with a memory-mapped
+ * reader.
+ *
+ * A recording starts with a header page holding the acquisition setup: the
+ * register shadow (bandwidth, DSP and sample format), sampling rate, channel
+ * mask and chip ID. It is followed by fixed-size chunks, each made of a
+ * @ref rhd_rec_chunk_t header and `chunk_frames` frames of `n_ch` samples.
+ * Chunks are padded to `RHD_REC_ALIGN`, so the file is written in large
+ * aligned blocks and chunk `i` is at a fixed offset.
+ *
+ * The acquisition thread only copies frames into a ring of chunk buffers,
+ * with no system call and no lock. Filled chunks are written by a writer
+ * thread (or by @ref rhd_rec_service from a main loop). When the writer falls
+ * behind, frames are dropped rather than blocking the acquisition: the
+ * sequence numbers keep counting, so the gap shows in the file.
+ *
+ * The file is in the host byte order.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_RECORD_H
+#define RHD_RECORD_H
+
+#include "rhd.h"
+
+#ifndef RHD_NO_THREADS
+#include <pthread.h>
+#endif
+
+/** File magic, with its NUL terminator */
+#define RHD_REC_MAGIC "RHDREC1"
+
+#define RHD_REC_VERSION 1
+
+/** Chunk magic, "CHNK" in little-endian */
+#define RHD_REC_CHUNK_MAGIC 0x4B4E4843u
+
+/** Alignment of the header, the chunks and the chunk buffers [bytes] */
+#define RHD_REC_ALIGN 4096
+
+/**
+ * Size of a chunk of `n_frames` frames of `n_ch` samples, including its
+ * header and padding [bytes]
+ */
+#define RHD_REC_CHUNK_BYTES(n_ch, n_frames)                                    \
+  ((sizeof(rhd_rec_chunk_t) + (size_t)(n_ch) * (n_frames) * 2 +               \
+    RHD_REC_ALIGN - 1) &                                                       \
+   ~(size_t)(RHD_REC_ALIGN - 1))
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  /** Offset of the first chunk */
+  uint32_t header_bytes;
+  /** Distance between chunks */
+  uint32_t chunk_bytes;
+  /** Frames per chunk, only the last one may hold less */
+  uint32_t chunk_frames;
+  /** Samples per frame */
+  uint32_t n_ch;
+  /** Frame rate [Hz] */
+  float fs;
+  uint64_t ch_mask;
+  /** Opening time, CLOCK_MONOTONIC and CLOCK_REALTIME [ns] */
+  uint64_t t0_ns;
+  uint64_t t0_unix_ns;
+  /** Which registers of `regs` are known */
+  uint32_t regs_valid;
+  uint8_t ddr;
+  uint8_t sparse;
+  uint8_t chip_id;
+  uint8_t die_rev;
+  uint8_t regs[RHD_SHADOW_REGS];
+  /** Physical channel of every sample of a frame */
+  uint8_t ch_map[RHD_FRAME_CH];
+} rhd_rec_header_t;
+
+typedef struct
+{
+  uint32_t magic;
+  /** Frames in this chunk */
+  uint32_t n_frames;
+  /** Sequence number of the first frame, counting dropped frames */
+  uint64_t seq;
+  /** Time the first frame was recorded, CLOCK_MONOTONIC [ns] */
+  uint64_t t_ns;
+  /** Frames dropped since the start of the recording */
+  uint64_t dropped;
+} rhd_rec_chunk_t;
+
+typedef struct
+{
+  int fd;
+  size_t n_ch;
+  size_t chunk_frames;
+  size_t chunk_bytes;
+  uint8_t *bufs;
+  size_t n_bufs;
+  /** Chunks filled by the producer, and written by the writer */
+  size_t head;
+  size_t tail;
+  /** Frames in the chunk being filled */
+  size_t fill;
+  uint64_t seq;
+  uint64_t dropped;
+  int error;
+#ifndef RHD_NO_THREADS
+  bool running;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+#endif
+} rhd_recorder_t;
+
+typedef struct
+{
+  int fd;
+  const uint8_t *base;
+  size_t size;
+  const rhd_rec_header_t *hdr;
+  /** Number of complete chunks in the file */
+  size_t n_chunks;
+} rhd_rec_reader_t;
+
+/**
+ * @brief Create a recording and write its header.
+ *
+ * The chip identification registers are read, so open the recording before
+ * the acquisition starts. Frames are recorded with `dev->n_ch` samples.
+ *
+ * @param r pointer to rhd_recorder_t instance
+ * @param path file to create or truncate
+ * @param dev configured device
+ * @param bufs ring of `n_bufs` chunk buffers of
+ * `RHD_REC_CHUNK_BYTES(dev->n_ch, chunk_frames)` bytes, aligned to
+ * `RHD_REC_ALIGN`
+ * @param n_bufs number of chunk buffers, a power of 2
+ * @param chunk_frames frames per chunk
+ * @return int 0 for success, -1 if the arguments are invalid or the file
+ * cannot be written
+ */
+int rhd_rec_open(rhd_recorder_t *r, const char *path, rhd_device_t *dev,
+                 void *bufs, size_t n_bufs, size_t chunk_frames);
+
+/**
+ * @brief Record frames. Never blocks: frames that find no free chunk buffer
+ * are dropped.
+ *
+ * @param r pointer to rhd_recorder_t instance
+ * @param frames frames to record
+ * @param n number of frames
+ * @return size_t number of frames recorded
+ */
+size_t rhd_rec_write(rhd_recorder_t *r, const uint16_t (*frames)[RHD_FRAME_CH],
+                     size_t n);
+
+/**
+ * @brief Write the filled chunks to the file. Called by the writer thread, or
+ * from a main loop when it is not running.
+ *
+ * @param r pointer to rhd_recorder_t instance
+ * @return int number of chunks written, -1 on a write error
+ */
+int rhd_rec_service(rhd_recorder_t *r);
+
+/**
+ * @brief Number of frames dropped so far.
+ *
+ * @param r pointer to rhd_recorder_t instance
+ * @return uint64_t dropped frames count
+ */
+uint64_t rhd_rec_dropped(rhd_recorder_t *r);
+
+/**
+ * @brief Write the last partial chunk and close the file. Stops the writer
+ * thread if it is running.
+ *
+ * @param r pointer to rhd_recorder_t instance
+ * @return int 0 for success, -1 if a write failed during the recording
+ */
+int rhd_rec_close(rhd_recorder_t *r);
+
+#ifndef RHD_NO_THREADS
+/**
+ * @brief Spawn the writer thread, which runs @ref rhd_rec_service as chunks
+ * get filled.
+ *
+ * @param r pointer to rhd_recorder_t instance
+ * @return int 0 for success, otherwise `pthread_create` error code
+ */
+int rhd_rec_start(rhd_recorder_t *r);
+
+/**
+ * @brief Stop the writer thread, after it wrote the filled chunks.
+ *
+ * @param r pointer to rhd_recorder_t instance
+ */
+void rhd_rec_stop(rhd_recorder_t *r);
+#endif
+
+/**
+ * @brief Map a recording for reading.
+ *
+ * @param rd pointer to rhd_rec_reader_t instance
+ * @param path recording file
+ * @return int 0 for success, -1 if the file is missing or not a recording
+ */
+int rhd_rec_map(rhd_rec_reader_t *rd, const char *path);
+
+/**
+ * @brief Unmap a recording.
+ *
+ * @param rd pointer to rhd_rec_reader_t instance
+ */
+void rhd_rec_unmap(rhd_rec_reader_t *rd);
+
+/**
+ * @brief Chunk header, in place in the mapping.
+ *
+ * @param rd pointer to rhd_rec_reader_t instance
+ * @param i chunk index, below `rd->n_chunks`
+ * @return const rhd_rec_chunk_t* chunk header
+ */
+const rhd_rec_chunk_t *rhd_rec_chunk(const rhd_rec_reader_t *rd, size_t i);
+
+/**
+ * @brief Samples of a chunk, `n_ch` per frame, in place in the mapping.
+ *
+ * @param chunk chunk header
+ * @return const uint16_t* first sample of the first frame
+ */
+const uint16_t *rhd_rec_chunk_samples(const rhd_rec_chunk_t *chunk);
+
+/**
+ * @brief Find a frame by sequence number.
+ *
+ * @param rd pointer to rhd_rec_reader_t instance
+ * @param seq sequence number
+ * @return const uint16_t* the `n_ch` samples of the frame, in place in the
+ * mapping, NULL if the frame was dropped or is not in the file
+ */
+const uint16_t *rhd_rec_frame(const rhd_rec_reader_t *rd, uint64_t seq);
+
+#endif
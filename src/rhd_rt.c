@@ -0,0 +1,238 @@
+/** @file rhd_rt.c
+ *
+ * @brief Real-time acquisition thread with deadline-miss detection.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // pthread_attr_setaffinity_np, CLOCK_MONOTONIC_RAW
+#endif
+
+#include "rhd_rt.h"
+
+#if defined(__linux__) && !defined(RHD_NO_THREADS)
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RHD_LOAD_ACQ(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RHD_STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define RHD_STORE_RLX(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+static uint64_t rhd_rt_now_raw_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/** Timestamp the frames of a producer step, spread over its sweeps */
+static void rhd_rt_hook(void *ctx, size_t slot, size_t n)
+{
+  rhd_rt_t *rt = (rhd_rt_t *)ctx;
+  const uint64_t t_end = rhd_rt_now_raw_ns();
+  const uint64_t dt = t_end - rt->t_start_ns;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    rhd_rt_meta_t *m = &rt->meta[slot + i];
+    m->t_ns = rt->t_start_ns + dt * (i + 1) / n;
+    m->seq = rt->seq++;
+    m->flags = rt->pending;
+    rt->pending = 0;
+  }
+  // The rest of a step split at the ring wrap is sampled after these
+  rt->t_start_ns = t_end;
+  RHD_STORE_RLX(&rt->stats.frames, rt->stats.frames + n);
+}
+
+static void rhd_rt_prefault_stack(void)
+{
+  volatile uint8_t buf[RHD_RT_STACK_PREFAULT];
+  for (size_t i = 0; i < sizeof(buf); i += 64)
+  {
+    buf[i] = 0;
+  }
+}
+
+static void *rhd_rt_thread(void *arg)
+{
+  rhd_rt_t *rt = (rhd_rt_t *)arg;
+  rhd_stream_t *s = rt->s;
+  const uint64_t burst = s->burst;
+  rhd_rt_prefault_stack();
+
+  while (RHD_LOAD_ACQ(&rt->running))
+  {
+    const uint64_t deadline = rt->timer.next_ns;
+    const uint32_t misses = rt->timer.misses;
+    rhd_timer_wait(&rt->timer);
+    rt->t_start_ns = rhd_rt_now_raw_ns();
+
+    // Deadlines slept through are frames that were never sampled
+    const uint64_t missed = rt->timer.misses - misses;
+    const uint64_t late = rt->timer.last_ns > deadline
+                              ? rt->timer.last_ns - deadline
+                              : 0;
+    if (missed > 0)
+    {
+      rt->pending |= RHD_RT_MISSED;
+      rt->seq += missed * burst;
+      RHD_STORE_RLX(&rt->stats.missed, rt->stats.missed + missed);
+      RHD_STORE_RLX(&rt->stats.missed_frames,
+                    rt->stats.missed_frames + missed * burst);
+    }
+    else if (late > rt->cfg.late_ns)
+    {
+      rt->pending |= RHD_RT_LATE;
+      RHD_STORE_RLX(&rt->stats.late, rt->stats.late + 1);
+    }
+    if (late > rt->stats.late_max_ns)
+    {
+      RHD_STORE_RLX(&rt->stats.late_max_ns, late);
+    }
+
+    // A tick covers `burst` frames of time: a step cut short at the end of
+    // the ring goes on from slot 0, and the frames the ring had no room for
+    // are never delivered, so `seq` skips them like missed deadlines
+    uint64_t n = rhd_stream_produce(s);
+    if (n > 0 && n < burst && rhd_stream_available(s) < s->n_slots)
+    {
+      n += rhd_stream_produce_n(s, burst - n);
+    }
+    if (n < burst)
+    {
+      rt->pending |= RHD_RT_DROPPED;
+      rt->seq += burst - n;
+      RHD_STORE_RLX(&rt->stats.dropped, rt->stats.dropped + burst - n);
+    }
+  }
+  return NULL;
+}
+
+int rhd_rt_init(rhd_rt_t *rt, rhd_stream_t *s, rhd_rt_meta_t *meta,
+                const rhd_rt_cfg_t *cfg)
+{
+  if (s == NULL || meta == NULL || cfg->fs <= 0)
+  {
+    return -1;
+  }
+
+  rt->s = s;
+  rt->meta = meta;
+  rt->cfg = *cfg;
+  // One tick per producer step
+  if (rhd_timer_init(&rt->timer, cfg->fs / (float)s->burst) != 0)
+  {
+    return -1;
+  }
+  if (rt->cfg.late_ns == 0)
+  {
+    rt->cfg.late_ns = rt->timer.period_ns / 2;
+  }
+  rt->running = false;
+  rt->seq = 0;
+  rt->pending = 0;
+  rt->t_start_ns = 0;
+  memset(&rt->stats, 0, sizeof(rt->stats));
+  rhd_stream_set_hook(s, rhd_rt_hook, rt);
+  return 0;
+}
+
+int rhd_rt_start(rhd_rt_t *rt)
+{
+  if (RHD_LOAD_ACQ(&rt->running))
+  {
+    return -1;
+  }
+  if (rt->cfg.lock_mem && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+  {
+    return errno;
+  }
+
+  // Touch every page the thread writes, so it never faults while sampling
+  const long page = sysconf(_SC_PAGESIZE);
+  volatile uint8_t *slots = (volatile uint8_t *)rt->s->slots;
+  volatile uint8_t *meta = (volatile uint8_t *)rt->meta;
+  const size_t slots_bytes = rt->s->n_slots * sizeof(rt->s->slots[0]);
+  const size_t meta_bytes = rt->s->n_slots * sizeof(rt->meta[0]);
+  for (size_t i = 0; i < slots_bytes; i += page)
+  {
+    slots[i] = slots[i];
+  }
+  for (size_t i = 0; i < meta_bytes; i += page)
+  {
+    meta[i] = meta[i];
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  int ret = 0;
+  if (rt->cfg.priority > 0)
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = rt->cfg.priority;
+    ret = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    ret = ret ? ret : pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    ret = ret ? ret : pthread_attr_setschedparam(&attr, &param);
+  }
+  if (ret == 0 && rt->cfg.cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(rt->cfg.cpu, &set);
+    ret = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+  }
+
+  if (ret == 0)
+  {
+    // Deadlines start from now
+    rt->timer.next_ns = rhd_timer_now_ns() + rt->timer.period_ns;
+    RHD_STORE_REL(&rt->running, true);
+    ret = pthread_create(&rt->thread, &attr, rhd_rt_thread, rt);
+    if (ret != 0)
+    {
+      RHD_STORE_REL(&rt->running, false);
+    }
+  }
+  pthread_attr_destroy(&attr);
+  return ret;
+}
+
+int rhd_rt_stop(rhd_rt_t *rt)
+{
+  if (!RHD_LOAD_ACQ(&rt->running))
+  {
+    return 0;
+  }
+
+  RHD_STORE_REL(&rt->running, false);
+  return pthread_join(rt->thread, NULL);
+}
+
+const rhd_rt_meta_t *rhd_rt_meta(const rhd_rt_t *rt,
+                                 const uint16_t (*frame)[RHD_FRAME_CH])
+{
+  const uint16_t(*slots)[RHD_FRAME_CH] =
+      (const uint16_t(*)[RHD_FRAME_CH])rt->s->slots;
+  return &rt->meta[(size_t)(frame - slots) & (rt->s->n_slots - 1)];
+}
+
+void rhd_rt_stats(const rhd_rt_t *rt, rhd_rt_stats_t *out)
+{
+  out->frames = __atomic_load_n(&rt->stats.frames, __ATOMIC_RELAXED);
+  out->missed = __atomic_load_n(&rt->stats.missed, __ATOMIC_RELAXED);
+  out->missed_frames =
+      __atomic_load_n(&rt->stats.missed_frames, __ATOMIC_RELAXED);
+  out->dropped = __atomic_load_n(&rt->stats.dropped, __ATOMIC_RELAXED);
+  out->late = __atomic_load_n(&rt->stats.late, __ATOMIC_RELAXED);
+  out->late_max_ns = __atomic_load_n(&rt->stats.late_max_ns, __ATOMIC_RELAXED);
+}
+
+#endif
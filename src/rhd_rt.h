@@ -0,0 +1,155 @@
+/** @file rhd_rt.h
+ *
+ * @brief Real-time acquisition thread for a stream, with per-frame timestamps
+ * and deadline-miss detection.
+ *
+ * The runner owns the producer side of an @ref rhd_stream_t. Its thread runs
+ * with a SCHED_FIFO priority, pinned to a CPU, with the process memory locked
+ * and the ring prefaulted, and samples `burst` frames per tick of an
+ * absolute-deadline timer. Every frame gets an @ref rhd_rt_meta_t in a side
+ * array indexed like the ring slots, so that consumers can tell:
+ *
+ * - real gaps in the data: the thread slept through sweep deadlines
+ *   (`RHD_RT_MISSED`), or the ring was full (`RHD_RT_DROPPED`), and `seq`
+ *   skips the frames that were never delivered;
+ * - late sweeps that kept every frame (`RHD_RT_LATE`);
+ * - late delivery, which is only the consumer's own delay after `t_ns`.
+ *
+ * Linux only, and disabled with `RHD_NO_THREADS`.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_RT_H
+#define RHD_RT_H
+
+#include "rhd_stream.h"
+
+#if defined(__linux__) && !defined(RHD_NO_THREADS)
+
+/** Sweep deadlines were skipped before this frame, `seq` jumps over them */
+#define RHD_RT_MISSED 0x1
+/** Frames were dropped before this one because the ring was full */
+#define RHD_RT_DROPPED 0x2
+/** The frame's sweep started late, but within its period */
+#define RHD_RT_LATE 0x4
+
+/** Stack prefaulted by the thread before sampling [bytes] */
+#define RHD_RT_STACK_PREFAULT (16 * 1024)
+
+typedef struct
+{
+  /** SCHED_FIFO priority, 1-99, 0 to keep the default policy */
+  int priority;
+  /** CPU to pin the thread to, -1 to leave it to the scheduler */
+  int cpu;
+  /** Lock all current and future pages of the process with mlockall */
+  bool lock_mem;
+  /** Frame rate [Hz], the thread samples `s->burst` frames per tick */
+  float fs;
+  /** Lateness of a flagged sweep [ns], 0 for half a tick */
+  uint64_t late_ns;
+} rhd_rt_cfg_t;
+
+#define RHD_RT_CFG_DEFAULT(frame_rate)                                         \
+  {                                                                            \
+    80, -1, true, (frame_rate), 0                                              \
+  }
+
+typedef struct
+{
+  /** End of the frame's sweep, CLOCK_MONOTONIC_RAW [ns] */
+  uint64_t t_ns;
+  /** Frame number since start, dropped and missed frames included */
+  uint64_t seq;
+  /** `RHD_RT_*` flags */
+  uint32_t flags;
+} rhd_rt_meta_t;
+
+typedef struct
+{
+  /** Frames delivered to the ring */
+  uint64_t frames;
+  /** Sweep deadlines skipped */
+  uint64_t missed;
+  /** Frames never sampled because of skipped deadlines */
+  uint64_t missed_frames;
+  /** Frames dropped because the ring was full */
+  uint64_t dropped;
+  /** Late sweeps, see `rhd_rt_cfg_t.late_ns` */
+  uint64_t late;
+  /** Worst lateness of a sweep [ns] */
+  uint64_t late_max_ns;
+} rhd_rt_stats_t;
+
+typedef struct
+{
+  rhd_stream_t *s;
+  rhd_rt_meta_t *meta;
+  rhd_rt_cfg_t cfg;
+  rhd_timer_t timer;
+  pthread_t thread;
+  bool running;
+  /* Acquisition thread only */
+  uint64_t seq;
+  uint32_t pending;
+  uint64_t t_start_ns;
+  /* Written by the thread, read with rhd_rt_stats */
+  rhd_rt_stats_t stats;
+} rhd_rt_t;
+
+/**
+ * @brief Initialize a runner for a stream.
+ *
+ * @param rt pointer to rhd_rt_t instance
+ * @param s initialized stream, not started: the runner is its producer
+ * @param meta metadata of every ring slot, `s->n_slots` entries
+ * @param cfg thread configuration, `cfg->fs` must be positive
+ * @return int 0 for success, -1 if the arguments are invalid
+ */
+int rhd_rt_init(rhd_rt_t *rt, rhd_stream_t *s, rhd_rt_meta_t *meta,
+                const rhd_rt_cfg_t *cfg);
+
+/**
+ * @brief Lock and prefault the memory, then spawn the acquisition thread.
+ *
+ * The priority needs CAP_SYS_NICE or an RLIMIT_RTPRIO, and `lock_mem` enough
+ * RLIMIT_MEMLOCK.
+ *
+ * @param rt pointer to rhd_rt_t instance
+ * @return int 0 for success, otherwise the errno of mlockall or the
+ * `pthread_*` error code, eg EPERM without the privileges
+ */
+int rhd_rt_start(rhd_rt_t *rt);
+
+/**
+ * @brief Stop and join the acquisition thread.
+ *
+ * @param rt pointer to rhd_rt_t instance
+ * @return int 0 for success, otherwise `pthread_join` error code
+ */
+int rhd_rt_stop(rhd_rt_t *rt);
+
+/**
+ * @brief Metadata of a frame borrowed from the runner's stream.
+ *
+ * @param rt pointer to rhd_rt_t instance
+ * @param frame frame returned by @ref rhd_stream_borrow, or one after it
+ * @return const rhd_rt_meta_t* its metadata, valid until the frame is
+ * released
+ */
+const rhd_rt_meta_t *rhd_rt_meta(const rhd_rt_t *rt,
+                                 const uint16_t (*frame)[RHD_FRAME_CH]);
+
+/**
+ * @brief Copy the counters, from any thread.
+ *
+ * @param rt pointer to rhd_rt_t instance
+ * @param out destination
+ */
+void rhd_rt_stats(const rhd_rt_t *rt, rhd_rt_stats_t *out);
+
+#endif
+
+#endif /* RHD_RT_H */
@@ -0,0 +1,233 @@
+/** @file rhd_sim.c
+ *
+ * @brief Simulated RHD2164 transport.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#include "rhd_sim.h"
+
+#include <math.h>
+#include <string.h>
+
+/** Spread a byte over the even bits of a word */
+static uint16_t rhd_sim_spread(uint8_t v)
+{
+  uint16_t x = v;
+  x = (x | (x << 4)) & 0x0F0F;
+  x = (x | (x << 2)) & 0x3333;
+  x = (x | (x << 1)) & 0x5555;
+  return x;
+}
+
+/** Gather the odd bits of a word, ie one copy of a duplicated byte */
+static uint8_t rhd_sim_compact(uint16_t v)
+{
+  uint16_t x = (v >> 1) & 0x5555;
+  x = (x | (x >> 1)) & 0x3333;
+  x = (x | (x >> 2)) & 0x0F0F;
+  x = (x | (x >> 4)) & 0x00FF;
+  return (uint8_t)x;
+}
+
+static uint16_t rhd_sim_sine(void *ctx, uint8_t ch, uint64_t t)
+{
+  rhd_sim_t *sim = (rhd_sim_t *)ctx;
+  // Phase in 1/2^32 of a period, wraps like the 64-bit product would
+  const uint32_t phase = (uint32_t)t * sim->step + ((uint32_t)ch << 26);
+  int32_t v = 0x8000 + sim->lut[phase >> 24];
+
+  if (sim->noise > 0)
+  {
+    // xorshift32
+    uint32_t r = sim->rng;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    sim->rng = r;
+    v += (int32_t)(r % (2u * sim->noise + 1)) - sim->noise;
+  }
+  return v < 0 ? 0 : v > 0xFFFF ? 0xFFFF : (uint16_t)v;
+}
+
+static uint16_t rhd_sim_replay(void *ctx, uint8_t ch, uint64_t t)
+{
+  const rhd_sim_t *sim = (const rhd_sim_t *)ctx;
+  return sim->replay[t % sim->n_replay][ch];
+}
+
+/** Answers of a command, MISO A and B */
+static void rhd_sim_exec(rhd_sim_t *sim, uint16_t cmd, uint16_t *res)
+{
+  const uint8_t reg = (cmd >> 8) & 0x3F;
+
+  res[1] = 0;
+  switch (cmd >> 14)
+  {
+  case 0:
+  {
+    // CONVERT c returns c on MISO A and c + 32 on MISO B
+    if (reg < RHD_SWEEP_CMDS)
+    {
+      const uint64_t t = sim->t[reg]++;
+      res[0] = sim->source(sim->source_ctx, reg, t);
+      res[1] = sim->source(sim->source_ctx, reg + RHD_SWEEP_CMDS, t);
+      if (sim->n_replay == 0 && (sim->regs[ADC_OUT_FMT_DPS_OFF_RMVL] & 0x40))
+      {
+        res[0] ^= 0x8000;
+        res[1] ^= 0x8000;
+      }
+    }
+    else if (reg == RHD_CH_SUPPLY)
+    {
+      res[0] = RHD_SIM_SUPPLY;
+    }
+    else if (reg == RHD_CH_TEMP)
+    {
+      res[0] = (sim->regs[MUX_LOAD_TEMP_SENS_AUX_DIG_OUT] & 0x10)
+                   ? RHD_SIM_TEMP_S2
+                   : RHD_SIM_TEMP_S1;
+    }
+    else
+    {
+      // Auxiliary inputs at mid-scale
+      res[0] = 0x8000;
+    }
+    break;
+  }
+  case 1:
+  {
+    // Calibrate and clear calibration are instant here
+    res[0] = 0;
+    break;
+  }
+  case 2:
+  {
+    if (reg < RHD_SHADOW_REGS)
+    {
+      sim->regs[reg] = cmd & 0xFF;
+    }
+    res[0] = 0xFF00 | (cmd & 0xFF);
+    break;
+  }
+  default:
+  {
+    res[0] = sim->regs[reg];
+    break;
+  }
+  }
+}
+
+static int rhd_sim_rw_ctx(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf,
+                          size_t len)
+{
+  return rhd_sim_rw((rhd_sim_t *)ctx, tx_buf, rx_buf, len);
+}
+
+void rhd_sim_init(rhd_sim_t *sim, bool ddr)
+{
+  sim->ddr = ddr;
+  memset(sim->regs, 0, sizeof(sim->regs));
+  memcpy(&sim->regs[INTAN_0], "INTAN", 5);
+  sim->regs[MISO_A_B] = 0x35;
+  sim->regs[DIE_REV] = 1;
+  sim->regs[UNI_BIPLR_AMPS] = 0;
+  sim->regs[NB_AMP] = 64;
+  sim->regs[CHIP_ID] = 4;
+  memset(sim->pipe, 0, sizeof(sim->pipe));
+  memset(sim->t, 0, sizeof(sim->t));
+  sim->n_cmds = 0;
+  sim->rng = 0x12345678;
+  rhd_sim_set_sine(sim, 20000, 100, 1000, 0);
+  rhd_rw_sync_init(&sim->sync, rhd_sim_rw_ctx, sim, &sim->async);
+}
+
+void rhd_sim_set_sine(rhd_sim_t *sim, float fs, float f, uint16_t amp,
+                      uint16_t noise)
+{
+  const double two_pi = 6.283185307179586;
+
+  if (amp > 0x7FFF)
+  {
+    amp = 0x7FFF;
+  }
+  for (int i = 0; i < RHD_SIM_LUT; i++)
+  {
+    sim->lut[i] = (int16_t)lround(amp * sin(two_pi * i / RHD_SIM_LUT));
+  }
+  sim->step = fs > 0 ? (uint32_t)fmod(f / fs * 4294967296.0, 4294967296.0) : 0;
+  sim->noise = noise;
+  sim->replay = NULL;
+  sim->n_replay = 0;
+  sim->source = rhd_sim_sine;
+  sim->source_ctx = sim;
+}
+
+void rhd_sim_set_replay(rhd_sim_t *sim, const uint16_t (*frames)[RHD_FRAME_CH],
+                        size_t n_frames)
+{
+  if (frames == NULL || n_frames == 0)
+  {
+    sim->replay = NULL;
+    sim->n_replay = 0;
+    sim->source = rhd_sim_sine;
+    sim->source_ctx = sim;
+    return;
+  }
+  sim->replay = frames;
+  sim->n_replay = n_frames;
+  sim->source = rhd_sim_replay;
+  sim->source_ctx = sim;
+}
+
+void rhd_sim_set_source(rhd_sim_t *sim, rhd_sim_source_t source, void *ctx)
+{
+  sim->replay = NULL;
+  sim->n_replay = 0;
+  sim->source = source != NULL ? source : rhd_sim_sine;
+  sim->source_ctx = source != NULL ? ctx : sim;
+}
+
+int rhd_sim_rw(rhd_sim_t *sim, uint16_t *tx_buf, uint16_t *rx_buf, size_t len)
+{
+  const size_t n_cmds = sim->ddr ? len / 2 : len;
+
+  for (size_t i = 0; i < n_cmds; i++)
+  {
+    uint16_t cmd;
+    uint16_t res[2];
+    if (sim->ddr)
+    {
+      cmd = (uint16_t)((rhd_sim_compact(tx_buf[2 * i]) << 8) |
+                       rhd_sim_compact(tx_buf[2 * i + 1]));
+    }
+    else
+    {
+      cmd = tx_buf[i];
+    }
+    rhd_sim_exec(sim, cmd, res);
+
+    // Answer 2 commands late
+    const uint16_t a = sim->pipe[0][0];
+    const uint16_t b = sim->pipe[0][1];
+    sim->pipe[0][0] = sim->pipe[1][0];
+    sim->pipe[0][1] = sim->pipe[1][1];
+    sim->pipe[1][0] = res[0];
+    sim->pipe[1][1] = res[1];
+    if (sim->ddr)
+    {
+      // MISO A on the odd bits, B on the even bits
+      rx_buf[2 * i] = (uint16_t)((rhd_sim_spread(a >> 8) << 1) |
+                                 rhd_sim_spread(b >> 8));
+      rx_buf[2 * i + 1] = (uint16_t)((rhd_sim_spread(a & 0xFF) << 1) |
+                                     rhd_sim_spread(b & 0xFF));
+    }
+    else
+    {
+      rx_buf[2 * i] = a;
+      rx_buf[2 * i + 1] = b;
+    }
+  }
+  sim->n_cmds += n_cmds;
+  return (int)len;
+}
@@ -0,0 +1,132 @@
+/** @file rhd_sim.h
+ *
+ * @brief Simulated RHD2164, to run the driver and everything downstream of it
+ * without hardware.
+ *
+ * The model answers every command like the chip does, 2 commands later: it
+ * keeps a register file (writable registers 0-21, and the read-only INTAN,
+ * chip ID and amplifier count registers), answers CONVERT commands with
+ * samples from a signal source, and encodes the results in SDR or DDR. The
+ * data is synthetic, sines on every channel, or frames replayed in a loop,
+ * eg from a recording mapped with @ref rhd_rec_map. The ADC output format
+ * (register 4) is followed, but not the DSP offset removal.
+ *
+ * Transfers run as fast as the host allows, so that the stream, DSP and
+ * recorder stages can be load-tested at many times the real-time rate. Pace
+ * them with a @ref rhd_stream_start timer otherwise.
+ *
+ * The transport is exposed as an @ref rhd_rw_async_t whose transfers are
+ * done by the time `submit` returns:
+ *
+ * @code
+ * rhd_sim_t sim;
+ * rhd_sim_init(&sim, true);
+ * rhd_init_async(&dev, true, &sim.async);
+ * @endcode
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_SIM_H
+#define RHD_SIM_H
+
+#include "rhd.h"
+
+/** Entries of the sine table of the synthetic source */
+#define RHD_SIM_LUT 256
+
+/** Supply voltage sensor result of the model, 3.3 V */
+#define RHD_SIM_SUPPLY 44118
+/** Temperature sensor results of the model, with temp_S2 off and on, 25 degC */
+#define RHD_SIM_TEMP_S1 10000
+#define RHD_SIM_TEMP_S2 39487
+
+/**
+ * @brief Signal source: ADC result of amplifier channel `ch` for its `t`-th
+ * conversion, in offset binary.
+ */
+typedef uint16_t (*rhd_sim_source_t)(void *ctx, uint8_t ch, uint64_t t);
+
+typedef struct
+{
+  bool ddr;
+  uint8_t regs[64];
+  /** Results of the last 2 commands, MISO A and B, oldest first */
+  uint16_t pipe[2][2];
+  /** Conversions of each CONVERT channel, `t` of the next sample */
+  uint64_t t[RHD_SWEEP_CMDS];
+  /** Commands received */
+  uint64_t n_cmds;
+  rhd_sim_source_t source;
+  void *source_ctx;
+  /* Synthetic source */
+  int16_t lut[RHD_SIM_LUT];
+  uint32_t step;
+  uint16_t noise;
+  uint32_t rng;
+  /* Replay source */
+  const uint16_t (*replay)[RHD_FRAME_CH];
+  size_t n_replay;
+  rhd_rw_sync_t sync;
+  /** Transport to give to @ref rhd_init_async */
+  rhd_rw_async_t async;
+} rhd_sim_t;
+
+/**
+ * @brief Power up the model: registers at reset, an empty pipeline, and the
+ * synthetic source at its defaults, a 100 Hz sine of 1000 LSB sampled at
+ * 20 kHz.
+ *
+ * @param sim pointer to rhd_sim_t instance
+ * @param ddr transfer mode, as given to @ref rhd_init_async
+ */
+void rhd_sim_init(rhd_sim_t *sim, bool ddr);
+
+/**
+ * @brief Use the synthetic source: a sine on every channel, each one phase
+ * shifted by 1/64 of a period from the previous one, plus uniform noise.
+ *
+ * @param sim pointer to rhd_sim_t instance
+ * @param fs sampling rate per channel the signal is generated for [Hz]
+ * @param f sine frequency [Hz]
+ * @param amp sine amplitude [LSB], at most 32767
+ * @param noise noise amplitude [LSB], 0 for none
+ */
+void rhd_sim_set_sine(rhd_sim_t *sim, float fs, float f, uint16_t amp,
+                      uint16_t noise);
+
+/**
+ * @brief Replay frames in a loop: conversion `t` of a channel returns its
+ * sample of frame `t % n_frames`. The samples are sent as they are, so they
+ * should follow the ADC output format of the replayed device.
+ *
+ * @param sim pointer to rhd_sim_t instance
+ * @param frames `n_frames` frames, must outlive their use
+ * @param n_frames number of frames, 0 to go back to the synthetic source
+ */
+void rhd_sim_set_replay(rhd_sim_t *sim, const uint16_t (*frames)[RHD_FRAME_CH],
+                        size_t n_frames);
+
+/**
+ * @brief Use a custom signal source. Its results are converted to two's
+ * complement when register 4 asks for it.
+ *
+ * @param sim pointer to rhd_sim_t instance
+ * @param source signal source, NULL to go back to the synthetic source
+ * @param ctx context given to `source`
+ */
+void rhd_sim_set_source(rhd_sim_t *sim, rhd_sim_source_t source, void *ctx);
+
+/**
+ * @brief Transfer `len` words, with the @ref rhd_rw_t buffer contract.
+ *
+ * @param sim pointer to rhd_sim_t instance
+ * @param tx_buf write buffer
+ * @param rx_buf receive buffer
+ * @param len number of words
+ * @return int `len`
+ */
+int rhd_sim_rw(rhd_sim_t *sim, uint16_t *tx_buf, uint16_t *rx_buf, size_t len);
+
+#endif /* RHD_SIM_H */
@@ -0,0 +1,181 @@
+/** @file rhd_spidev.c
+ *
+ * @brief Linux spidev transport for RHD2164.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // sched_setaffinity
+#endif
+
+#include "rhd_spidev.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+static void rhd_spidev_swap(uint16_t *buf, size_t len, size_t step)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    uint16_t v = buf[i * step];
+    buf[i * step] = (uint16_t)((v >> 8) | (v << 8));
+  }
+}
+
+static int rhd_spidev_rw_ctx(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf,
+                             size_t len)
+{
+  return rhd_spidev_rw((rhd_spidev_t *)ctx, tx_buf, rx_buf, len);
+}
+
+int rhd_spidev_open(rhd_spidev_t *spi, const rhd_spidev_cfg_t *cfg,
+                    struct spi_ioc_transfer *xfers, size_t n_xfers)
+{
+  uint8_t mode = cfg->mode;
+  uint8_t bits = cfg->word8 ? 8 : 16;
+  uint32_t speed = cfg->speed_hz;
+
+  if (xfers == NULL || n_xfers == 0 || n_xfers > RHD_SPIDEV_MAX_XFERS)
+  {
+    return -1;
+  }
+
+  spi->fd = open(cfg->path, O_RDWR | O_CLOEXEC);
+  if (spi->fd < 0)
+  {
+    return -1;
+  }
+  if (ioctl(spi->fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+      ioctl(spi->fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+      ioctl(spi->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0)
+  {
+    close(spi->fd);
+    return -1;
+  }
+
+  // Only the buffers and chip select change from call to call
+  memset(xfers, 0, n_xfers * sizeof(*xfers));
+  for (size_t i = 0; i < n_xfers; i++)
+  {
+    xfers[i].speed_hz = speed;
+    xfers[i].bits_per_word = bits;
+    xfers[i].delay_usecs = cfg->delay_us;
+  }
+
+  spi->ddr = cfg->ddr;
+  spi->word8 = cfg->word8;
+  spi->xfers = xfers;
+  spi->n_xfers = n_xfers;
+  rhd_rw_sync_init(&spi->sync, rhd_spidev_rw_ctx, spi, &spi->async);
+  return 0;
+}
+
+int rhd_spidev_rw(rhd_spidev_t *spi, uint16_t *tx_buf, uint16_t *rx_buf,
+                  size_t len)
+{
+  // DDR receives a word per word sent, SDR only MISO A of {a, b}
+  const size_t rx_step = spi->ddr ? 1 : 2;
+  const size_t cmd_words = spi->ddr ? 2 : 1;
+  int ret = (int)len;
+
+  if (len % cmd_words != 0)
+  {
+    return -EINVAL;
+  }
+  if (spi->word8)
+  {
+    // Bytes go out in memory order, so MSB first means swapped
+    rhd_spidev_swap(tx_buf, len, 1);
+  }
+
+  for (size_t i = 0; i < len;)
+  {
+    size_t n = rhd_spidev_fill(spi, &tx_buf[i], &rx_buf[i * rx_step], len - i);
+    int err = ioctl(spi->fd, SPI_IOC_MESSAGE(n), spi->xfers);
+    if (err < 0)
+    {
+      ret = -errno;
+      break;
+    }
+    i += n * cmd_words;
+  }
+
+  if (spi->word8)
+  {
+    rhd_spidev_swap(tx_buf, len, 1);
+    rhd_spidev_swap(rx_buf, len, rx_step);
+  }
+  if (!spi->ddr)
+  {
+    for (size_t i = 0; i < len; i++)
+    {
+      rx_buf[2 * i + 1] = 0;
+    }
+  }
+  return ret;
+}
+
+size_t rhd_spidev_fill(rhd_spidev_t *spi, uint16_t *tx_buf, uint16_t *rx_buf,
+                       size_t len)
+{
+  // A command is a single transfer, so its 2 DDR words share chip select
+  const size_t cmd_words = spi->ddr ? 2 : 1;
+  size_t n = len / cmd_words;
+  n = n < spi->n_xfers ? n : spi->n_xfers;
+
+  for (size_t j = 0; j < n; j++)
+  {
+    spi->xfers[j].tx_buf = (uintptr_t)&tx_buf[j * cmd_words];
+    // 2 words received per command in both modes
+    spi->xfers[j].rx_buf = (uintptr_t)&rx_buf[2 * j];
+    spi->xfers[j].len = cmd_words * sizeof(uint16_t);
+    // On the last transfer, cs_change would keep the chip selected
+    spi->xfers[j].cs_change = j + 1 < n;
+  }
+  return n;
+}
+
+void rhd_spidev_close(rhd_spidev_t *spi)
+{
+  if (spi->fd >= 0)
+  {
+    close(spi->fd);
+    spi->fd = -1;
+  }
+}
+
+int rhd_spidev_set_rt(int priority, int cpu)
+{
+  int ret = 0;
+  if (cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // 0 is the calling thread
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+    {
+      ret = errno;
+    }
+  }
+  if (priority > 0)
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    if (sched_setscheduler(0, SCHED_FIFO, &param) < 0 && ret == 0)
+    {
+      ret = errno;
+    }
+  }
+  return ret;
+}
+
+#endif
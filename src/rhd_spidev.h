@@ -0,0 +1,137 @@
+/** @file rhd_spidev.h
+ *
+ * @brief Linux spidev transport for RHD2164, eg on Raspberry Pi or Jetson
+ * hosts.
+ *
+ * A whole `rw` call, from a single command to a burst, goes out in as few
+ * `SPI_IOC_MESSAGE` ioctls as possible: every command is its own
+ * `spi_ioc_transfer`, with `cs_change` set on all but the last one, so chip
+ * select toggles between commands as the RHD2164 requires. A command is one
+ * 16-bit word in SDR mode and two words in DDR mode, which then share a chip
+ * select pulse. The transfer array is preallocated by the caller and only its
+ * buffer pointers change from call to call, and words are received in place
+ * into `rx_buf`.
+ *
+ * spidev has a single MISO line. That is all DDR mode needs, since MISO A and
+ * MISO B come interleaved on it. In SDR mode only MISO A is read, and the
+ * MISO B results are 0.
+ *
+ * The transport is exposed as an @ref rhd_rw_async_t whose transfers are
+ * done by the time `submit` returns:
+ *
+ * @code
+ * static struct spi_ioc_transfer xfers[RHD_SPIDEV_MAX_XFERS];
+ * rhd_spidev_cfg_t cfg = RHD_SPIDEV_CFG_DEFAULT("/dev/spidev0.0");
+ * rhd_spidev_t spi;
+ * rhd_spidev_open(&spi, &cfg, xfers, RHD_SPIDEV_MAX_XFERS);
+ * rhd_init_async(&dev, true, &spi.async);
+ * @endcode
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_SPIDEV_H
+#define RHD_SPIDEV_H
+
+#include "rhd.h"
+
+#ifdef __linux__
+
+#include <linux/spi/spidev.h>
+
+/** Most transfers, ie commands, per ioctl, the ioctl size field is 14 bits */
+#define RHD_SPIDEV_MAX_XFERS 511
+
+typedef struct
+{
+  /** spidev node, eg "/dev/spidev0.0" */
+  const char *path;
+  /** SPI clock [Hz], up to 25 MHz for the RHD2164 */
+  uint32_t speed_hz;
+  /** SPI mode, the RHD2164 uses mode 0 */
+  uint8_t mode;
+  /** Words are sent as 2 bytes, for controllers without 16-bit words */
+  bool word8;
+  /** Delay after every word, before chip select toggles [us] */
+  uint16_t delay_us;
+  /** DDR wiring: MISO A and MISO B interleaved on MISO, see rhd_init */
+  bool ddr;
+} rhd_spidev_cfg_t;
+
+#define RHD_SPIDEV_CFG_DEFAULT(dev_path)                                       \
+  {                                                                            \
+    (dev_path), 16000000, SPI_MODE_0, false, 0, true                           \
+  }
+
+typedef struct
+{
+  int fd;
+  bool ddr;
+  bool word8;
+  struct spi_ioc_transfer *xfers;
+  size_t n_xfers;
+  rhd_rw_sync_t sync;
+  /** Transport to give to @ref rhd_init_async */
+  rhd_rw_async_t async;
+} rhd_spidev_t;
+
+/**
+ * @brief Open and configure a spidev node.
+ *
+ * @param spi pointer to rhd_spidev_t instance
+ * @param cfg bus configuration
+ * @param xfers preallocated transfers, one per command
+ * @param n_xfers number of transfers, most commands per ioctl, at most
+ * `RHD_SPIDEV_MAX_XFERS`
+ * @return int 0 for success, -1 if the node cannot be opened or configured
+ */
+int rhd_spidev_open(rhd_spidev_t *spi, const rhd_spidev_cfg_t *cfg,
+                    struct spi_ioc_transfer *xfers, size_t n_xfers);
+
+/**
+ * @brief Transfer `len` words, with the @ref rhd_rw_t buffer contract.
+ *
+ * @param spi pointer to rhd_spidev_t instance
+ * @param tx_buf write buffer
+ * @param rx_buf receive buffer
+ * @param len number of words
+ * @return int `len` for success, a negative errno otherwise, -EINVAL for an
+ * odd `len` in DDR mode
+ */
+int rhd_spidev_rw(rhd_spidev_t *spi, uint16_t *tx_buf, uint16_t *rx_buf,
+                  size_t len);
+
+/**
+ * @brief Set up the transfers of the first ioctl of @ref rhd_spidev_rw for
+ * `len` words, one transfer per command.
+ *
+ * @param spi pointer to rhd_spidev_t instance
+ * @param tx_buf write buffer
+ * @param rx_buf receive buffer
+ * @param len number of words left to transfer, at least a command
+ * @return size_t number of transfers, ie commands, of the ioctl
+ */
+size_t rhd_spidev_fill(rhd_spidev_t *spi, uint16_t *tx_buf, uint16_t *rx_buf,
+                       size_t len);
+
+/**
+ * @brief Close the spidev node.
+ *
+ * @param spi pointer to rhd_spidev_t instance
+ */
+void rhd_spidev_close(rhd_spidev_t *spi);
+
+/**
+ * @brief Make the calling thread real-time, for the acquisition thread.
+ * Needs CAP_SYS_NICE, or an RLIMIT_RTPRIO, for the priority.
+ *
+ * @param priority SCHED_FIFO priority, 1-99, 0 to keep the current policy
+ * @param cpu CPU to pin the thread to, -1 to leave it to the scheduler
+ * @return int 0 for success, otherwise the first error code
+ */
+int rhd_spidev_set_rt(int priority, int cpu);
+
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+/** @file rhd_static.h
+ *
+ * @brief Static storage of the allocation-free profile, eg for MCU targets.
+ *
+ * The driver never allocates: every buffer it uses is part of a struct or
+ * given by the caller. This header sizes all of them with compile-time macros
+ * and groups them per device in @ref rhd_static_t, to be defined in static
+ * storage, so that the memory footprint of the whole acquisition is known at
+ * build time:
+ *
+ * @code
+ * #define RHD_STATIC_DEVICES 2
+ * #define RHD_STATIC_FRAMES 64
+ * #define RHD_STATIC_BURST 8
+ * #include "rhd_static.h"
+ *
+ * static rhd_static_t rhd_mem[RHD_STATIC_DEVICES];
+ *
+ * rhd_init(&rhd_mem[0].dev, true, spi0_rw);
+ * RHD_STATIC_ATTACH(&rhd_mem[0]);
+ * @endcode
+ *
+ * Build with `-DRHD_NO_THREADS` on bare-metal targets. `make footprint`
+ * reports the static storage, the code size and the worst stack frame of
+ * every module, and checks that no allocator is linked.
+ *
+ * The macros only size the caller's storage, the library does not depend on
+ * them, so each application can pick its own.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_STATIC_H
+#define RHD_STATIC_H
+
+#include "rhd.h"
+#include "rhd_stream.h"
+
+/** Number of devices in `rhd_static_t` arrays, for @ref RHD_STATIC_BYTES */
+#ifndef RHD_STATIC_DEVICES
+#define RHD_STATIC_DEVICES 1
+#endif
+
+/** Frames of the stream ring per device, a power of 2 */
+#ifndef RHD_STATIC_FRAMES
+#define RHD_STATIC_FRAMES 32
+#endif
+
+/**
+ * Frames per transfer, see @ref rhd_set_burst_buf. 0 sends bursts one sweep
+ * at a time through the device's own buffers.
+ */
+#ifndef RHD_STATIC_BURST
+#define RHD_STATIC_BURST 0
+#endif
+
+/**
+ * Auxiliary commands per device (see @ref rhd_aux_set), their table and
+ * results live in `rhd_static_t`
+ */
+#ifndef RHD_STATIC_AUX
+#define RHD_STATIC_AUX 0
+#endif
+
+/** Extra slots per frame, auxiliary and injected, that bursts must hold */
+#ifndef RHD_STATIC_SLOTS
+#define RHD_STATIC_SLOTS RHD_STATIC_AUX
+#endif
+
+/**
+ * Received words of a burst, plus its 2 flush commands and the 2 more of
+ * integrity checks, see @ref rhd_check_set
+ */
+#define RHD_STATIC_BURST_WORDS                                                 \
+  (2 * (RHD_STATIC_BURST * (RHD_SWEEP_CMDS + RHD_STATIC_SLOTS) + 4))
+
+typedef struct
+{
+  rhd_device_t dev;
+  rhd_stream_t stream;
+  uint16_t slots[RHD_STATIC_FRAMES][RHD_FRAME_CH];
+#if RHD_STATIC_BURST > 0
+  uint16_t burst_tx[RHD_STATIC_BURST_WORDS];
+  uint16_t burst_rx[RHD_STATIC_BURST_WORDS];
+#endif
+#if RHD_STATIC_AUX > 0
+  uint16_t aux_cmds[RHD_STATIC_AUX];
+  uint16_t aux_out[RHD_STATIC_AUX];
+#endif
+} rhd_static_t;
+
+/** Static storage of all devices [bytes] */
+#define RHD_STATIC_BYTES (RHD_STATIC_DEVICES * sizeof(rhd_static_t))
+
+/* Compile-time checks, a negative array size fails the build */
+typedef char rhd_static_frames_pow2
+    [RHD_STATIC_FRAMES > 0 &&
+             (RHD_STATIC_FRAMES & (RHD_STATIC_FRAMES - 1)) == 0
+         ? 1
+         : -1];
+typedef char rhd_static_slots_fit
+    [RHD_STATIC_SLOTS <= RHD_SWEEP_CMDS ? 1 : -1];
+#ifdef RHD_STATIC_SRAM_BUDGET
+/** Fails the build if the devices don't fit in `RHD_STATIC_SRAM_BUDGET` */
+typedef char rhd_static_fits_budget
+    [RHD_STATIC_BYTES <= (RHD_STATIC_SRAM_BUDGET) ? 1 : -1];
+#endif
+
+#if RHD_STATIC_BURST > 0
+#define RHD_STATIC_BURST_BUF(st)                                               \
+  rhd_set_burst_buf(&(st)->dev, (st)->burst_tx, (st)->burst_rx,                \
+                    RHD_STATIC_BURST_WORDS)
+#else
+#define RHD_STATIC_BURST_BUF(st) ((void)0)
+#endif
+
+/**
+ * @brief Give an initialized device its burst buffers and its stream, with
+ * `RHD_STATIC_BURST` frames per producer step.
+ *
+ * @param st pointer to rhd_static_t instance, `st->dev` initialized
+ */
+#define RHD_STATIC_ATTACH(st)                                                  \
+  (RHD_STATIC_BURST_BUF(st),                                                   \
+   rhd_stream_init(&(st)->stream, &(st)->dev, (st)->slots, RHD_STATIC_FRAMES, \
+                   RHD_STATIC_BURST))
+
+#endif /* RHD_STATIC_H */
@@ -0,0 +1,205 @@
+/** @file rhd_stream.c
+ *
+ * @brief Single-producer/single-consumer ring of RHD2164 frames.
+ *
+ * The producer only writes `head`, the consumer only writes `tail`. Both
+ * indices increase forever and are masked to address slots, so the ring is
+ * full when `head - tail == n_slots`.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "rhd_stream.h"
+
+#include <string.h>
+#ifndef RHD_NO_THREADS
+#include <time.h>
+#endif
+
+#define RHD_LOAD_ACQ(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RHD_STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/** Polling period of a blocking read [ns] */
+#define RHD_STREAM_POLL_NS 100000
+
+int rhd_stream_init(rhd_stream_t *s, rhd_device_t *dev,
+                    uint16_t (*slots)[RHD_FRAME_CH], size_t n_slots,
+                    size_t burst)
+{
+  if (dev == NULL || slots == NULL || n_slots == 0 ||
+      (n_slots & (n_slots - 1)) != 0)
+  {
+    return -1;
+  }
+
+  s->dev = dev;
+  s->slots = slots;
+  s->n_slots = n_slots;
+  s->burst = burst == 0 ? 1 : burst;
+  s->head = 0;
+  s->tail = 0;
+  s->overruns = 0;
+  s->hook = NULL;
+  s->hook_ctx = NULL;
+  s->running = false;
+#ifndef RHD_NO_THREADS
+  s->timer = NULL;
+#endif
+  return 0;
+}
+
+size_t rhd_stream_produce(rhd_stream_t *s)
+{
+  return rhd_stream_produce_n(s, s->burst);
+}
+
+size_t rhd_stream_produce_n(rhd_stream_t *s, size_t max)
+{
+  const size_t mask = s->n_slots - 1;
+  const size_t head = s->head;
+  const size_t n_free = s->n_slots - (head - RHD_LOAD_ACQ(&s->tail));
+
+  if (n_free == 0)
+  {
+    // Keep sampling so the acquisition timing does not depend on the consumer
+    rhd2164_sample_frames(s->dev, 1, &s->drop_buf);
+    __atomic_fetch_add(&s->overruns, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  size_t n = max < n_free ? max : n_free;
+  const size_t to_end = s->n_slots - (head & mask);
+  n = n < to_end ? n : to_end;
+
+  rhd2164_sample_frames(s->dev, n, &s->slots[head & mask]);
+  if (s->hook != NULL)
+  {
+    s->hook(s->hook_ctx, head & mask, n);
+  }
+  RHD_STORE_REL(&s->head, head + n);
+  return n;
+}
+
+void rhd_stream_set_hook(rhd_stream_t *s, rhd_stream_hook_t hook, void *ctx)
+{
+  s->hook = hook;
+  s->hook_ctx = ctx;
+}
+
+size_t rhd_stream_borrow(rhd_stream_t *s, uint16_t (**frames)[RHD_FRAME_CH])
+{
+  const size_t mask = s->n_slots - 1;
+  const size_t tail = s->tail;
+  const size_t n = RHD_LOAD_ACQ(&s->head) - tail;
+  const size_t to_end = s->n_slots - (tail & mask);
+
+  *frames = &s->slots[tail & mask];
+  return n < to_end ? n : to_end;
+}
+
+void rhd_stream_release(rhd_stream_t *s, size_t n)
+{
+  RHD_STORE_REL(&s->tail, s->tail + n);
+}
+
+size_t rhd_stream_available(rhd_stream_t *s)
+{
+  const size_t tail = RHD_LOAD_ACQ(&s->tail);
+  return RHD_LOAD_ACQ(&s->head) - tail;
+}
+
+uint32_t rhd_stream_overruns(rhd_stream_t *s)
+{
+  return __atomic_load_n(&s->overruns, __ATOMIC_RELAXED);
+}
+
+size_t rhd_stream_read(rhd_stream_t *s, uint16_t (*out)[RHD_FRAME_CH],
+                       size_t n_frames, uint32_t timeout_ms)
+{
+  size_t n_read = 0;
+#ifndef RHD_NO_THREADS
+  const uint64_t deadline_ns =
+      rhd_timer_now_ns() + (uint64_t)timeout_ms * 1000000ull;
+#else
+  (void)timeout_ms;
+#endif
+
+  while (n_read < n_frames)
+  {
+    uint16_t(*frames)[RHD_FRAME_CH];
+    size_t n = rhd_stream_borrow(s, &frames);
+    if (n > 0)
+    {
+      n = n < n_frames - n_read ? n : n_frames - n_read;
+      memcpy(out[n_read], frames[0], n * sizeof(frames[0]));
+      rhd_stream_release(s, n);
+      n_read += n;
+      continue;
+    }
+
+    if (!RHD_LOAD_ACQ(&s->running))
+    {
+      rhd_stream_produce(s);
+      continue;
+    }
+#ifndef RHD_NO_THREADS
+    if (timeout_ms > 0 && rhd_timer_now_ns() >= deadline_ns)
+    {
+      break;
+    }
+    struct timespec ts = {0, RHD_STREAM_POLL_NS};
+    nanosleep(&ts, NULL);
+#endif
+  }
+  return n_read;
+}
+
+#ifndef RHD_NO_THREADS
+static void *rhd_stream_thread(void *arg)
+{
+  rhd_stream_t *s = (rhd_stream_t *)arg;
+  while (RHD_LOAD_ACQ(&s->running))
+  {
+    if (s->timer != NULL)
+    {
+      rhd_timer_wait(s->timer);
+    }
+    rhd_stream_produce(s);
+  }
+  return NULL;
+}
+
+void rhd_stream_set_timer(rhd_stream_t *s, rhd_timer_t *timer)
+{
+  s->timer = timer;
+}
+
+int rhd_stream_start(rhd_stream_t *s)
+{
+  if (RHD_LOAD_ACQ(&s->running))
+  {
+    return -1;
+  }
+
+  RHD_STORE_REL(&s->running, true);
+  int ret = pthread_create(&s->thread, NULL, rhd_stream_thread, s);
+  if (ret != 0)
+  {
+    RHD_STORE_REL(&s->running, false);
+  }
+  return ret;
+}
+
+int rhd_stream_stop(rhd_stream_t *s)
+{
+  if (!RHD_LOAD_ACQ(&s->running))
+  {
+    return 0;
+  }
+
+  RHD_STORE_REL(&s->running, false);
+  return pthread_join(s->thread, NULL);
+}
+#endif
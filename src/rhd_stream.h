@@ -0,0 +1,174 @@
+/** @file rhd_stream.h
+ *
+ * @brief RHD2164 streaming acquisition into a lock-free ring of frames.
+ *
+ * A single producer (the acquisition thread, or a call to
+ * `rhd_stream_produce` from a main loop) samples frames straight into ring
+ * slots, and a single consumer borrows them by pointer, without copies.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_STREAM_H
+#define RHD_STREAM_H
+
+#include "rhd.h"
+
+#ifndef RHD_NO_THREADS
+#include "rhd_timer.h"
+#include <pthread.h>
+#endif
+
+/**
+ * Called by the producer with the `n` frames it just sampled into slots
+ * `[slot, slot + n)`, before the consumer can see them.
+ */
+typedef void (*rhd_stream_hook_t)(void *ctx, size_t slot, size_t n);
+
+typedef struct
+{
+  rhd_device_t *dev;
+  uint16_t (*slots)[RHD_FRAME_CH];
+  size_t n_slots;
+  size_t burst;
+  size_t head;
+  size_t tail;
+  uint32_t overruns;
+  uint16_t drop_buf[RHD_FRAME_CH];
+  rhd_stream_hook_t hook;
+  void *hook_ctx;
+  bool running;
+#ifndef RHD_NO_THREADS
+  pthread_t thread;
+  rhd_timer_t *timer;
+#endif
+} rhd_stream_t;
+
+/**
+ * @brief Initialize a stream. The ring storage is provided by the caller.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @param dev initialized device to sample from. The stream owns it while
+ * running.
+ * @param slots ring storage of `n_slots` frames
+ * @param n_slots number of frames in the ring, must be a power of 2
+ * @param burst maximum number of frames sampled per producer step, see
+ * @ref rhd2164_sample_frames
+ * @return int 0 for success, -1 if the arguments are invalid
+ */
+int rhd_stream_init(rhd_stream_t *s, rhd_device_t *dev,
+                    uint16_t (*slots)[RHD_FRAME_CH], size_t n_slots,
+                    size_t burst);
+
+/**
+ * @brief Run one producer step: sample up to `burst` frames into free slots.
+ *
+ * If the ring is full, a frame is still sampled to keep the acquisition
+ * going, but it is dropped and counted as an overrun.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @return size_t number of frames published to the consumer
+ */
+size_t rhd_stream_produce(rhd_stream_t *s);
+
+/**
+ * @brief Same as @ref rhd_stream_produce, sampling at most `max` frames, eg
+ * to finish a step that stopped at the end of the ring.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @param max most frames to sample, at most `burst`
+ * @return size_t number of frames published to the consumer
+ */
+size_t rhd_stream_produce_n(rhd_stream_t *s, size_t max);
+
+/**
+ * @brief Attach per-frame metadata to the produced frames, eg timestamps in a
+ * side array indexed like the slots. Call before starting the producer.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @param hook called by every producer step, NULL to detach
+ * @param ctx context given to `hook`
+ */
+void rhd_stream_set_hook(rhd_stream_t *s, rhd_stream_hook_t hook, void *ctx);
+
+/**
+ * @brief Borrow the oldest frames available.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @param frames set to the first available frame
+ * @return size_t number of contiguous frames available from `*frames`, 0 if
+ * the ring is empty
+ */
+size_t rhd_stream_borrow(rhd_stream_t *s, uint16_t (**frames)[RHD_FRAME_CH]);
+
+/**
+ * @brief Give borrowed frames back to the producer.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @param n number of frames to release, at most what was borrowed
+ */
+void rhd_stream_release(rhd_stream_t *s, size_t n);
+
+/**
+ * @brief Number of frames currently waiting for the consumer.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @return size_t frames count
+ */
+size_t rhd_stream_available(rhd_stream_t *s);
+
+/**
+ * @brief Number of frames dropped so far because the consumer fell behind.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @return uint32_t overruns count
+ */
+uint32_t rhd_stream_overruns(rhd_stream_t *s);
+
+/**
+ * @brief Copy the next `n_frames` frames into a contiguous buffer, waiting
+ * for the acquisition thread to sample them. Without a running thread, the
+ * caller samples them itself with @ref rhd_stream_produce.
+ *
+ * `out` is row-major, `n_frames` * `RHD_FRAME_CH` `uint16_t` without padding,
+ * eg a C-contiguous `(n_frames, 64)` `uint16` NumPy array.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @param out destination frames
+ * @param n_frames number of frames to read
+ * @param timeout_ms longest wait for the acquisition thread, 0 to wait forever
+ * @return size_t number of frames copied, less than `n_frames` on timeout
+ */
+size_t rhd_stream_read(rhd_stream_t *s, uint16_t (*out)[RHD_FRAME_CH],
+                       size_t n_frames, uint32_t timeout_ms);
+
+#ifndef RHD_NO_THREADS
+/**
+ * @brief Pace the acquisition thread with a timer. The thread waits for one
+ * tick before every producer step, so use a `burst` of 1 to pace every frame.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @param timer initialized timer, NULL to sample as fast as possible
+ */
+void rhd_stream_set_timer(rhd_stream_t *s, rhd_timer_t *timer);
+
+/**
+ * @brief Spawn the acquisition thread, which runs `rhd_stream_produce` until
+ * `rhd_stream_stop` is called.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @return int 0 for success, otherwise `pthread_create` error code
+ */
+int rhd_stream_start(rhd_stream_t *s);
+
+/**
+ * @brief Stop and join the acquisition thread.
+ *
+ * @param s pointer to rhd_stream_t instance
+ * @return int 0 for success, otherwise `pthread_join` error code
+ */
+int rhd_stream_stop(rhd_stream_t *s);
+#endif
+
+#endif /* RHD_STREAM_H */
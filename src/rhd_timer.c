@@ -0,0 +1,118 @@
+/** @file rhd_timer.c
+ *
+ * @brief Absolute-deadline sampling timer built on `clock_nanosleep`.
+ *
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML.  All rights reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "rhd_timer.h"
+
+#ifndef RHD_NO_THREADS
+
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+static int rhd_timer_nanosleep(void *ctx, uint64_t deadline_ns)
+{
+  (void)ctx;
+  struct timespec ts;
+  ts.tv_sec = deadline_ns / 1000000000ull;
+  ts.tv_nsec = deadline_ns % 1000000000ull;
+
+  int ret;
+  do
+  {
+    ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  } while (ret == EINTR);
+  return ret;
+}
+
+uint64_t rhd_timer_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int rhd_timer_init(rhd_timer_t *t, float fs)
+{
+  if (!(fs > 0))
+  {
+    return -1;
+  }
+
+  t->period_ns = (uint64_t)(1e9 / fs + 0.5);
+  t->start_ns = rhd_timer_now_ns();
+  t->next_ns = t->start_ns + t->period_ns;
+  t->last_ns = t->start_ns;
+  t->n_ticks = 0;
+  t->misses = 0;
+  t->late_min_ns = INT64_MAX;
+  t->late_max_ns = 0;
+  t->late_sum_ns = 0;
+  t->late_sq_sum_ns = 0;
+  rhd_timer_set_wait(t, NULL, NULL);
+  return 0;
+}
+
+void rhd_timer_set_wait(rhd_timer_t *t, rhd_timer_wait_t wait, void *ctx)
+{
+  t->wait = wait == NULL ? rhd_timer_nanosleep : wait;
+  t->wait_ctx = ctx;
+}
+
+int rhd_timer_wait(rhd_timer_t *t)
+{
+  int ret = t->wait(t->wait_ctx, t->next_ns);
+  const uint64_t now = rhd_timer_now_ns();
+  const int64_t late = (int64_t)(now - t->next_ns);
+
+  if (t->n_ticks == 0)
+  {
+    t->start_ns = now;
+  }
+  t->last_ns = now;
+  t->n_ticks++;
+  t->late_min_ns = late < t->late_min_ns ? late : t->late_min_ns;
+  t->late_max_ns = late > t->late_max_ns ? late : t->late_max_ns;
+  t->late_sum_ns += late;
+  t->late_sq_sum_ns += (double)late * late;
+
+  t->next_ns += t->period_ns;
+  if (late > (int64_t)t->period_ns)
+  {
+    // Skip the deadlines we slept through, keeping the original phase
+    uint64_t missed = (uint64_t)late / t->period_ns;
+    t->misses += missed;
+    t->next_ns += missed * t->period_ns;
+  }
+  return ret;
+}
+
+void rhd_timer_stats(const rhd_timer_t *t, rhd_timer_stats_t *stats)
+{
+  stats->n_ticks = t->n_ticks;
+  stats->misses = t->misses;
+  stats->late_min_ns = t->n_ticks > 0 ? t->late_min_ns : 0;
+  stats->late_max_ns = t->late_max_ns;
+  stats->late_mean_ns = 0;
+  stats->late_std_ns = 0;
+  stats->fs_eff = 0;
+
+  if (t->n_ticks > 0)
+  {
+    double mean = t->late_sum_ns / t->n_ticks;
+    double var = t->late_sq_sum_ns / t->n_ticks - mean * mean;
+    stats->late_mean_ns = mean;
+    stats->late_std_ns = var > 0 ? sqrt(var) : 0;
+  }
+  if (t->n_ticks > 1 && t->last_ns > t->start_ns)
+  {
+    stats->fs_eff = (t->n_ticks - 1) * 1e9 / (t->last_ns - t->start_ns);
+  }
+}
+
+#endif /* RHD_NO_THREADS */
@@ -0,0 +1,112 @@
+/** @file rhd_timer.h
+ *
+ * @brief Absolute-deadline sampling timer with jitter statistics.
+ *
+ * Ticks are scheduled against absolute deadlines (`start + n * period`) so
+ * the rate does not drift, and the process sleeps in between instead of
+ * spinning. The default wait is `clock_nanosleep(TIMER_ABSTIME)` on
+ * `CLOCK_MONOTONIC`. A hardware timer, eg a PL timer interrupt read through
+ * UIO, can be plugged in instead with @ref rhd_timer_set_wait.
+ *
+ * Like the other OS facilities, it is disabled with `RHD_NO_THREADS`.
+ *
+ * @par
+ * COPYRIGHT NOTICE: (c) 2023 SBIOML. All rights reserved.
+ */
+
+#ifndef RHD_TIMER_H
+#define RHD_TIMER_H
+
+#ifndef RHD_NO_THREADS
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Wait until a deadline.
+ *
+ * @param ctx user context given to @ref rhd_timer_set_wait
+ * @param deadline_ns absolute `CLOCK_MONOTONIC` deadline [ns]
+ * @return int 0 for success
+ */
+typedef int (*rhd_timer_wait_t)(void *ctx, uint64_t deadline_ns);
+
+typedef struct
+{
+  uint64_t period_ns;
+  uint64_t start_ns;
+  uint64_t next_ns;
+  uint64_t last_ns;
+  uint64_t n_ticks;
+  uint32_t misses;
+  int64_t late_min_ns;
+  int64_t late_max_ns;
+  double late_sum_ns;
+  double late_sq_sum_ns;
+  rhd_timer_wait_t wait;
+  void *wait_ctx;
+} rhd_timer_t;
+
+typedef struct
+{
+  /** Number of ticks so far */
+  uint64_t n_ticks;
+  /** Deadlines skipped because a tick was more than one period late */
+  uint32_t misses;
+  /** Wake-up lateness versus the deadline [ns] */
+  int64_t late_min_ns;
+  int64_t late_max_ns;
+  double late_mean_ns;
+  double late_std_ns;
+  /** Measured tick rate [Hz], to compare against the target rate */
+  double fs_eff;
+} rhd_timer_stats_t;
+
+/**
+ * @brief Initialize a timer. The first deadline is one period from now.
+ *
+ * @param t pointer to rhd_timer_t instance
+ * @param fs tick rate [Hz], eg the `fs` given to `rhd_setup`
+ * @return int 0 for success, -1 if `fs` is invalid
+ */
+int rhd_timer_init(rhd_timer_t *t, float fs);
+
+/**
+ * @brief Replace the default sleep with a custom wait, eg a hardware timer.
+ *
+ * @param t pointer to rhd_timer_t instance
+ * @param wait wait function, NULL to restore `clock_nanosleep`
+ * @param ctx user context given to `wait`
+ */
+void rhd_timer_set_wait(rhd_timer_t *t, rhd_timer_wait_t wait, void *ctx);
+
+/**
+ * @brief Sleep until the next deadline and update the statistics.
+ *
+ * If the caller is more than a period late, the missed deadlines are skipped
+ * and counted instead of firing back to back.
+ *
+ * @param t pointer to rhd_timer_t instance
+ * @return int 0 for success, otherwise the wait's error code
+ */
+int rhd_timer_wait(rhd_timer_t *t);
+
+/**
+ * @brief Get a snapshot of the jitter statistics.
+ *
+ * @param t pointer to rhd_timer_t instance
+ * @param stats destination statistics
+ */
+void rhd_timer_stats(const rhd_timer_t *t, rhd_timer_stats_t *stats);
+
+/**
+ * @brief Current `CLOCK_MONOTONIC` time.
+ *
+ * @return uint64_t time [ns]
+ */
+uint64_t rhd_timer_now_ns(void);
+
+#endif /* RHD_NO_THREADS */
+
+#endif /* RHD_TIMER_H */
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstring>
+
+extern "C" {
+#include "rhd.h"
+}
+
+/*
+ * Driver hot paths against a simulated transport. Every benchmark takes the
+ * transfer mode (0 for SDR, 1 for DDR) and the transport latency per rw call
+ * [ns] as arguments. For machine-readable results:
+ *
+ *   ./rhd_bench --benchmark_format=json --benchmark_out=bench.json
+ */
+
+static bool bench_ddr = false;
+static int64_t bench_latency_ns = 0;
+static uint16_t bench_pattern[4 * RHD_SWEEP_CMDS];
+
+/** Busy-wait, since sleeping is far too coarse for transfer latencies */
+static void bench_spin(int64_t ns) {
+  auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+static int rw_bench(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  // 2 words received per command: `len` commands, or `len` DDR words
+  const size_t rx_len = bench_ddr ? len : 2 * len;
+  benchmark::DoNotOptimize(tx_buf[0]);
+  for (size_t i = 0; i < rx_len; i += 4 * RHD_SWEEP_CMDS) {
+    size_t n = std::min(rx_len - i, sizeof(bench_pattern) / 2);
+    memcpy(&rx_buf[i], bench_pattern, n * sizeof(uint16_t));
+  }
+  if (bench_latency_ns > 0) {
+    bench_spin(bench_latency_ns);
+  }
+  return len;
+}
+
+static void bench_init(rhd_device_t *dev, const benchmark::State &state) {
+  for (size_t i = 0; i < sizeof(bench_pattern) / 2; i++) {
+    bench_pattern[i] = (uint16_t)(i * 2654435761u >> 16);
+  }
+  bench_ddr = state.range(0);
+  bench_latency_ns = 0;
+  rhd_init(dev, state.range(0), rw_bench);
+  bench_latency_ns = state.range(1);
+}
+
+#define BENCH_ARGS                                                             \
+  ArgNames({"ddr", "latency_ns"})                                              \
+      ->ArgsProduct({{0, 1}, {0, 1000}})
+
+static void BM_SampleAll(benchmark::State &state) {
+  rhd_device_t dev;
+  uint16_t buf[RHD_FRAME_CH];
+  bench_init(&dev, state);
+  for (auto _ : state) {
+    rhd2164_sample_all(&dev, buf);
+    benchmark::DoNotOptimize(buf);
+  }
+  state.SetItemsProcessed(state.iterations() * RHD_FRAME_CH);
+}
+BENCHMARK(BM_SampleAll)->BENCH_ARGS;
+
+static void BM_SampleFrames(benchmark::State &state) {
+  const size_t n_frames = 100;
+  static uint16_t out[n_frames][RHD_FRAME_CH];
+  static uint16_t tx[2 * (n_frames * RHD_SWEEP_CMDS + 2)];
+  static uint16_t rx[2 * (n_frames * RHD_SWEEP_CMDS + 2)];
+  rhd_device_t dev;
+  bench_init(&dev, state);
+  rhd_set_burst_buf(&dev, tx, rx, sizeof(rx) / sizeof(uint16_t));
+  for (auto _ : state) {
+    rhd2164_sample_frames(&dev, n_frames, out);
+    benchmark::DoNotOptimize(out);
+  }
+  state.SetItemsProcessed(state.iterations() * n_frames * RHD_FRAME_CH);
+}
+BENCHMARK(BM_SampleFrames)->BENCH_ARGS;
+
+static void BM_Send(benchmark::State &state) {
+  rhd_device_t dev;
+  bench_init(&dev, state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rhd_send(&dev, 0xC0 | CHIP_ID, 0));
+  }
+}
+BENCHMARK(BM_Send)->BENCH_ARGS;
+
+static void BM_Setup(benchmark::State &state) {
+  rhd_device_t dev;
+  bench_init(&dev, state);
+  for (auto _ : state) {
+    // Forget the shadow, so every register is written again
+    rhd_cfg_invalidate(&dev);
+    benchmark::DoNotOptimize(rhd_setup(&dev, 2000, 20, 500, true, 10));
+  }
+}
+BENCHMARK(BM_Setup)->BENCH_ARGS;
+
+/*
+ * The DDR bit kernels, rhd_duplicate_bits and rhd_unsplit_u16, are internal:
+ * they are measured through the sweep encoder and demux which run them.
+ */
+
+static void BM_BurstEncode(benchmark::State &state) {
+  uint16_t tx[2 * RHD_SWEEP_CMDS];
+  rhd_device_t dev;
+  bench_init(&dev, state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        rhd2164_burst_encode(&dev, tx, 0, RHD_SWEEP_CMDS));
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * RHD_SWEEP_CMDS);
+}
+BENCHMARK(BM_BurstEncode)->ArgNames({"ddr", "latency_ns"})->Args({0, 0})
+    ->Args({1, 0});
+
+static void BM_UnsplitFrame(benchmark::State &state) {
+  uint16_t a[RHD_SWEEP_CMDS], b[RHD_SWEEP_CMDS];
+  rhd_device_t dev;
+  bench_init(&dev, state);
+  for (auto _ : state) {
+    rhd_unsplit_frame(bench_pattern, a, b, RHD_SWEEP_CMDS);
+    benchmark::DoNotOptimize(a);
+    benchmark::DoNotOptimize(b);
+  }
+  state.SetItemsProcessed(state.iterations() * RHD_SWEEP_CMDS);
+}
+BENCHMARK(BM_UnsplitFrame)->ArgNames({"ddr", "latency_ns"})->Args({1, 0});
+
+BENCHMARK_MAIN();
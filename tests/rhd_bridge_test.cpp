@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <vector>
+
+extern "C" {
+#include "rhd_bridge.h"
+}
+
+/**
+ * Chip behind the MCU: every command returns its channel (A) and channel + 32
+ * (B) 2 commands later, like the RHD2164 does.
+ */
+static bool chip_ddr = false;
+static uint16_t chip_hist[2] = {0};
+
+static uint16_t chip_interleave(uint8_t a, uint8_t b) {
+  uint16_t out = 0;
+  for (int i = 0; i < 8; i++) {
+    out |= ((a >> i) & 1) << (2 * i + 1);
+    out |= ((b >> i) & 1) << (2 * i);
+  }
+  return out;
+}
+
+static uint8_t chip_odd_bits(uint16_t val) {
+  uint8_t out = 0;
+  for (int i = 0; i < 8; i++) {
+    out |= ((val >> (2 * i + 1)) & 1) << i;
+  }
+  return out;
+}
+
+static int rw_chip(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  size_t n_cmds = chip_ddr ? len / 2 : len;
+  for (size_t i = 0; i < n_cmds; i++) {
+    uint16_t cmd;
+    if (chip_ddr) {
+      cmd = (chip_odd_bits(tx_buf[2 * i]) << 8) |
+            chip_odd_bits(tx_buf[2 * i + 1]);
+    } else {
+      cmd = tx_buf[i];
+    }
+    uint16_t ch = chip_hist[0];
+    chip_hist[0] = chip_hist[1];
+    chip_hist[1] = (cmd >> 8) & 0x3F;
+
+    uint16_t a = ch << 4;
+    uint16_t b = (ch + 32) << 4;
+    if (chip_ddr) {
+      rx_buf[2 * i] = chip_interleave(a >> 8, b >> 8);
+      rx_buf[2 * i + 1] = chip_interleave(a & 0xFF, b & 0xFF);
+    } else {
+      rx_buf[2 * i] = a;
+      rx_buf[2 * i + 1] = b;
+    }
+  }
+  return len;
+}
+
+/**
+ * Serial link: host writes go straight to the MCU, MCU writes are queued for
+ * the host. The MCU sweeps a frame whenever the host waits on an empty queue.
+ */
+typedef struct {
+  rhd_bridge_mcu_t mcu;
+  std::vector<uint8_t> to_host;
+  size_t pos;
+  // FRAME message to lose or corrupt, -1 for none
+  int bad_frame;
+  bool corrupt;
+} link_t;
+
+static int link_host_write(void *ctx, uint8_t *buf, size_t len) {
+  link_t *link = (link_t *)ctx;
+  rhd_bridge_mcu_feed(&link->mcu, buf, len);
+  return len;
+}
+
+static int link_mcu_write(void *ctx, uint8_t *buf, size_t len) {
+  link_t *link = (link_t *)ctx;
+  size_t start = link->to_host.size();
+  uint16_t seq = buf[3] | (buf[4] << 8);
+  bool bad = buf[2] == RHD_BRIDGE_FRAME && seq == link->bad_frame;
+  if (bad && !link->corrupt) {
+    return len;
+  }
+  link->to_host.insert(link->to_host.end(), buf, buf + len);
+  if (bad) {
+    link->to_host[start + RHD_BRIDGE_HDR_BYTES + 5] ^= 0x10;
+  }
+  return len;
+}
+
+static int link_host_read(void *ctx, uint8_t *buf, size_t len) {
+  link_t *link = (link_t *)ctx;
+  while (link->pos == link->to_host.size()) {
+    link->to_host.clear();
+    link->pos = 0;
+    if (!rhd_bridge_mcu_step(&link->mcu)) {
+      return 0;
+    }
+  }
+  size_t n = std::min(len, link->to_host.size() - link->pos);
+  memcpy(buf, &link->to_host[link->pos], n);
+  link->pos += n;
+  return n;
+}
+
+static void link_init(link_t *link, rhd_bridge_host_t *h, bool ddr) {
+  chip_ddr = ddr;
+  chip_hist[0] = chip_hist[1] = 0;
+  link->to_host.clear();
+  link->pos = 0;
+  link->bad_frame = -1;
+  link->corrupt = false;
+  rhd_bridge_mcu_init(&link->mcu, ddr, rw_chip, link_mcu_write, link);
+  rhd_bridge_host_init(h, ddr, link_host_write, link_host_read, link);
+}
+
+TEST(RHDBridge, Crc) {
+  const uint8_t check[] = "123456789";
+  EXPECT_EQ(rhd_bridge_crc16(check, 9, 0xFFFF), 0x29B1);
+  // Incremental
+  uint16_t crc = rhd_bridge_crc16(check, 4, 0xFFFF);
+  EXPECT_EQ(rhd_bridge_crc16(check + 4, 5, crc), 0x29B1);
+}
+
+TEST(RHDBridge, ParserResyncs) {
+  static uint8_t msg[RHD_BRIDGE_MAX_MSG];
+  static rhd_bridge_parser_t p;
+  const uint8_t payload[] = {1, 2, 3, 4, 5};
+  size_t n = rhd_bridge_encode(msg, RHD_BRIDGE_XFER, 0x1234, payload, 5);
+  EXPECT_EQ(n, RHD_BRIDGE_HDR_BYTES + 5 + 2);
+
+  // Garbage and a false start before the message
+  std::vector<uint8_t> stream = {0x00, 0xA5, 0x11, 0xA5};
+  stream.insert(stream.end(), msg, msg + n);
+  // Corrupted copy, then a good one
+  stream.insert(stream.end(), msg, msg + n);
+  stream[stream.size() - 3] ^= 1;
+  stream.insert(stream.end(), msg, msg + n);
+
+  rhd_bridge_parser_init(&p);
+  int n_msgs = 0;
+  for (uint8_t byte : stream) {
+    if (rhd_bridge_parse(&p, byte)) {
+      n_msgs++;
+      EXPECT_EQ(p.type, RHD_BRIDGE_XFER);
+      EXPECT_EQ(p.seq, 0x1234);
+      ASSERT_EQ(p.len, 5);
+      EXPECT_EQ(memcmp(p.payload, payload, 5), 0);
+    }
+  }
+  EXPECT_EQ(n_msgs, 2);
+  EXPECT_EQ(p.errors, 1u);
+
+  // Oversized length
+  n = rhd_bridge_encode(msg, RHD_BRIDGE_RX, 0, payload, 0);
+  msg[6] = 0xFF;
+  for (size_t i = 0; i < n; i++) {
+    EXPECT_EQ(rhd_bridge_parse(&p, msg[i]), 0);
+  }
+  EXPECT_EQ(p.errors, 2u);
+}
+
+TEST(RHDBridge, Rw) {
+  static link_t link;
+  static rhd_bridge_host_t h;
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    link_init(&link, &h, ddr);
+    rhd_init_async(&dev, ddr, &h.async);
+
+    uint16_t buf[RHD_FRAME_CH] = {0};
+    rhd2164_sample_all(&dev, buf);
+    rhd2164_sample_all(&dev, buf);
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      EXPECT_EQ(buf[ch] & 0xFFFE, ch << 4);
+    }
+
+    if (ddr) {
+      continue;
+    }
+    // Longer than a message
+    const size_t n = 2 * RHD_BRIDGE_MAX_XFER_WORDS + 10;
+    static uint16_t tx[n], rx[2 * n];
+    for (size_t i = 0; i < n; i++) {
+      tx[i] = RHD_CMD_CONVERT(i % 32);
+    }
+    EXPECT_EQ(rhd_bridge_rw(&h, tx, rx, n), (int)n);
+    for (size_t i = 2; i < n; i++) {
+      EXPECT_EQ(rx[2 * i], ((i - 2) % 32) << 4) << "word " << i;
+    }
+  }
+}
+
+TEST(RHDBridge, Sweep) {
+  static link_t link;
+  static rhd_bridge_host_t h;
+  const uint16_t cmds[4] = {RHD_CMD_CONVERT(RHD_CH_SUPPLY),
+                            RHD_CMD_CONVERT(RHD_CH_TEMP),
+                            RHD_CMD_CONVERT(RHD_CH_AUX1), RHD_CMD_READ(40)};
+  const uint16_t exp[4] = {RHD_CH_SUPPLY << 4, RHD_CH_TEMP << 4,
+                           RHD_CH_AUX1 << 4, 40 << 4};
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    uint16_t results[4];
+    uint16_t out[12][RHD_FRAME_CH];
+    link_init(&link, &h, ddr);
+    rhd_init_async(&dev, ddr, &h.async);
+    ASSERT_EQ(rhd_aux_set(&dev, cmds, 4, 3, results), 0);
+
+    ASSERT_EQ(rhd_bridge_sweep(&h, &dev, 10), 0);
+    EXPECT_EQ(rhd_bridge_read_frames(&h, out, 12), 10u);
+    for (int f = 0; f < 10; f++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(out[f][ch] & 0xFFFE, ch << 4) << "frame " << f;
+      }
+      EXPECT_EQ(out[f][0] & 1, 0);
+    }
+    for (int i = 0; i < 4; i++) {
+      EXPECT_EQ(results[i], exp[i]) << "aux " << i;
+    }
+    // 30 auxiliary slots went out
+    EXPECT_EQ(dev.aux_next, 2u);
+    EXPECT_EQ(h.lost, 0u);
+
+    // Continuous, then back to configuration transfers
+    ASSERT_EQ(rhd_bridge_sweep(&h, &dev, 0), 0);
+    EXPECT_EQ(rhd_bridge_read_frames(&h, out, 12), 12u);
+    EXPECT_EQ(rhd_bridge_stop(&h), 0);
+    EXPECT_EQ(rhd_bridge_read_frames(&h, out, 12), 0u);
+    uint16_t buf[RHD_FRAME_CH];
+    rhd_aux_set(&dev, NULL, 0, 0, NULL);
+    rhd2164_sample_all(&dev, buf);
+    rhd2164_sample_all(&dev, buf);
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      EXPECT_EQ(buf[ch] & 0xFFFE, ch << 4);
+    }
+  }
+}
+
+TEST(RHDBridge, SweepLosesFrames) {
+  static link_t link;
+  static rhd_bridge_host_t h;
+  for (int corrupt = 0; corrupt < 2; corrupt++) {
+    rhd_device_t dev;
+    uint16_t out[12][RHD_FRAME_CH];
+    link_init(&link, &h, true);
+    rhd_init_async(&dev, true, &h.async);
+    link.bad_frame = 3;
+    link.corrupt = corrupt;
+
+    // Frame 3 is lost, and so is frame 2 which it completes
+    ASSERT_EQ(rhd_bridge_sweep(&h, &dev, 10), 0);
+    EXPECT_EQ(rhd_bridge_read_frames(&h, out, 12), 8u);
+    EXPECT_EQ(h.lost, 2u);
+    EXPECT_EQ(h.parser.errors, corrupt ? 1u : 0u);
+    for (int f = 0; f < 8; f++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(out[f][ch] & 0xFFFE, ch << 4) << "frame " << f;
+      }
+    }
+  }
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <random>
+
+extern "C" {
+#include "rhd_codec.h"
+}
+
+/**
+ * Synthetic recording: every channel is a slow random walk around mid-scale
+ * with a few LSb of noise, like a high-passed EMG baseline.
+ */
+static void codec_frames(uint16_t (*frames)[RHD_FRAME_CH], size_t n,
+                         int noise, unsigned int seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> step(-noise, noise);
+  int val[RHD_FRAME_CH];
+  for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+    val[ch] = 0x8000 + ch * 64;
+  }
+  for (size_t f = 0; f < n; f++) {
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      val[ch] = (val[ch] + step(rng)) & 0xFFFF;
+      frames[f][ch] = val[ch];
+    }
+  }
+}
+
+TEST(RHDCodec, PackBits) {
+  uint16_t frame[RHD_FRAME_CH], out[RHD_FRAME_CH];
+  uint8_t buf[RHD_CODEC_MAX_BYTES];
+  codec_frames(&frame, 1, 1000, 1);
+
+  for (unsigned int bits : {12u, 14u, 16u}) {
+    size_t len = rhd_pack_bits(frame, RHD_FRAME_CH, bits, buf);
+    EXPECT_EQ(len, (RHD_FRAME_CH * bits + 7) / 8);
+    EXPECT_EQ(rhd_unpack_bits(buf, RHD_FRAME_CH, bits, out), len);
+    uint16_t mask = 0xFFFF << (16 - bits);
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      EXPECT_EQ(out[ch], frame[ch] & mask);
+    }
+  }
+}
+
+TEST(RHDCodec, VarintRoundTrip) {
+  const size_t n = 200;
+  static uint16_t frames[n][RHD_FRAME_CH];
+  codec_frames(frames, n, 40, 2);
+  // Big jumps, and wrap-around
+  frames[50][3] = 0;
+  frames[51][3] = 0xFFFF;
+
+  for (unsigned int shift : {0u, 4u}) {
+    rhd_codec_t enc, dec;
+    rhd_codec_init(&enc, RHD_FRAME_CH, shift);
+    rhd_codec_init(&dec, RHD_FRAME_CH, shift);
+    uint8_t buf[RHD_CODEC_MAX_BYTES];
+    uint16_t out[RHD_FRAME_CH];
+    for (size_t f = 0; f < n; f++) {
+      size_t len = rhd_encode_varint(&enc, frames[f], buf);
+      ASSERT_LE(len, (size_t)RHD_CODEC_MAX_BYTES);
+      ASSERT_EQ(rhd_decode_varint(&dec, buf, len, out), len);
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(out[ch], frames[f][ch] >> shift << shift);
+      }
+    }
+  }
+}
+
+TEST(RHDCodec, RiceRoundTrip) {
+  const size_t n = 500;
+  static uint16_t frames[n][RHD_FRAME_CH];
+  codec_frames(frames, n, 200, 3);
+  frames[100][7] = 0;
+  frames[101][7] = 0xFFFF;
+  frames[102][7] = 0x1234;
+
+  for (unsigned int shift : {0u, 2u, 4u}) {
+    rhd_codec_t enc, dec;
+    rhd_codec_init(&enc, RHD_FRAME_CH, shift);
+    rhd_codec_init(&dec, RHD_FRAME_CH, shift);
+    uint8_t buf[RHD_CODEC_MAX_BYTES];
+    uint16_t out[RHD_FRAME_CH];
+    for (size_t f = 0; f < n; f++) {
+      size_t len = rhd_encode_rice(&enc, frames[f], buf);
+      ASSERT_LE(len, (size_t)RHD_CODEC_MAX_BYTES);
+      ASSERT_EQ(rhd_decode_rice(&dec, buf, len, out), len);
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        ASSERT_EQ(out[ch], frames[f][ch] >> shift << shift)
+            << "frame " << f << " ch " << ch;
+      }
+    }
+  }
+}
+
+TEST(RHDCodec, Truncated) {
+  rhd_codec_t enc, dec;
+  uint16_t frame[RHD_FRAME_CH], out[RHD_FRAME_CH];
+  uint8_t buf[RHD_CODEC_MAX_BYTES];
+  codec_frames(&frame, 1, 10, 4);
+
+  rhd_codec_init(&enc, RHD_FRAME_CH, 0);
+  rhd_codec_init(&dec, RHD_FRAME_CH, 0);
+  size_t len = rhd_encode_varint(&enc, frame, buf);
+  EXPECT_EQ(rhd_decode_varint(&dec, buf, len - 1, out), 0u);
+
+  rhd_codec_init(&enc, RHD_FRAME_CH, 0);
+  rhd_codec_init(&dec, RHD_FRAME_CH, 0);
+  len = rhd_encode_rice(&enc, frame, buf);
+  EXPECT_EQ(rhd_decode_rice(&dec, buf, len / 2, out), 0u);
+}
+
+TEST(RHDCodec, FitsSerialLink) {
+  // 460800 baud, 8N1, 1 kHz frames
+  const size_t budget = 460800 / 10 / 1000;
+  const size_t n = 1000;
+  static uint16_t frames[n][RHD_FRAME_CH];
+  // 12 useful bits, a few LSb of noise at that resolution
+  codec_frames(frames, n, 6 << 4, 5);
+
+  rhd_codec_t enc;
+  rhd_codec_init(&enc, RHD_FRAME_CH, 4);
+  uint8_t buf[RHD_CODEC_MAX_BYTES];
+  size_t total = 0;
+  for (size_t f = 0; f < n; f++) {
+    total += rhd_encode_rice(&enc, frames[f], buf);
+  }
+  EXPECT_LE(total / n, budget);
+  // 12-bit packing alone is twice too big
+  EXPECT_GT((size_t)(RHD_FRAME_CH * 12 / 8), budget);
+}
@@ -0,0 +1,83 @@
+#include <cmath>
+#include <cstring>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "rhd_convert.h"
+}
+
+static int rw_convert(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)tx_buf;
+  memset(rx_buf, 0, 2 * len * sizeof(uint16_t));
+  return len;
+}
+
+TEST(RHDConvert, TwosComplement) {
+  rhd_device_t dev;
+  rhd_init(&dev, false, rw_convert);
+  EXPECT_TRUE(rhd_cfg_twos_comp(&dev));
+
+  // Alignment bit set, as the demux leaves it, except on the first sample
+  const uint16_t raw[] = {0x0000, 0x0001, 0x0065, 0xFF9B, 0x7FFF, 0x8001};
+  const int32_t code[] = {0, 0, 100, -102, 32766, -32768};
+  const size_t n = sizeof(raw) / sizeof(raw[0]);
+  float uv[n];
+  int32_t nv[n];
+  rhd_convert_block_uv(&dev, raw, uv, n);
+  rhd_convert_block_nv(&dev, raw, nv, n);
+  for (size_t i = 0; i < n; i++) {
+    EXPECT_EQ(nv[i], code[i] * RHD_AMP_NV_PER_LSB);
+    EXPECT_FLOAT_EQ(uv[i], code[i] * 0.195f);
+  }
+}
+
+TEST(RHDConvert, OffsetBinary) {
+  rhd_device_t dev;
+  rhd_init(&dev, false, rw_convert);
+  rhd_cfg_dsp(&dev, false, false, false, 0, 1000);
+  EXPECT_FALSE(rhd_cfg_twos_comp(&dev));
+
+  const uint16_t raw[] = {0x8000, 0x8065, 0x7F9B, 0xFFFF, 0x0001};
+  const int32_t code[] = {0, 100, -102, 32766, -32768};
+  const size_t n = sizeof(raw) / sizeof(raw[0]);
+  int32_t nv[n];
+  rhd_convert_block_nv(&dev, raw, nv, n);
+  for (size_t i = 0; i < n; i++) {
+    EXPECT_EQ(nv[i], code[i] * RHD_AMP_NV_PER_LSB);
+  }
+}
+
+TEST(RHDConvert, Frames) {
+  rhd_device_t dev;
+  rhd_init(&dev, false, rw_convert);
+
+  // Frames and blocks are flat arrays of samples
+  static uint16_t frames[100][RHD_FRAME_CH];
+  static float uv[100][RHD_FRAME_CH];
+  for (int t = 0; t < 100; t++) {
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      frames[t][ch] = (uint16_t)(int16_t)((t - 50) * ch * 2) | 1;
+    }
+  }
+  rhd_convert_block_uv(&dev, frames[0], uv[0], 100 * RHD_FRAME_CH);
+  for (int t = 0; t < 100; t++) {
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      EXPECT_FLOAT_EQ(uv[t][ch], (t - 50) * ch * 2 * 0.195f);
+    }
+  }
+}
+
+TEST(RHDConvert, Aux) {
+  const uint16_t raw[] = {0, 26738, 65535};
+  float v[3];
+  rhd_convert_aux_v(raw, v, 3);
+  EXPECT_FLOAT_EQ(v[0], 0);
+  EXPECT_NEAR(v[1], 1.0, 1e-4);
+  EXPECT_NEAR(v[2], 2.45, 1e-2);
+
+  EXPECT_NEAR(rhd_convert_supply_v(44118), 3.3, 1e-3);
+
+  // 25 degC
+  uint16_t d = (uint16_t)lround((25 + 273.15) * 98.9);
+  EXPECT_NEAR(rhd_convert_temp_c(1000, 1000 + d), 25, 0.05);
+}
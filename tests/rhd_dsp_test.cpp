@@ -0,0 +1,141 @@
+#include <cmath>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "rhd_dsp.h"
+}
+
+static const float DSP_FS = 2000;
+
+/**
+ * Fill `n` frames with a sine of amplitude `amp` on every channel, with a
+ * phase shift per channel, in two's complement or offset binary.
+ */
+static void dsp_sine(uint16_t (*frames)[RHD_FRAME_CH], size_t n, float f,
+                     float amp, int dc, bool offset) {
+  for (size_t t = 0; t < n; t++) {
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      double v = dc + amp * sin(2 * M_PI * f * t / DSP_FS + ch * 0.1);
+      int16_t s = (int16_t)lround(v);
+      frames[t][ch] = (uint16_t)s ^ (offset ? 0x8000 : 0);
+    }
+  }
+}
+
+/** Peak amplitude of channel `ch` over the last `n` of `total` frames */
+static int dsp_peak(const int16_t (*out)[RHD_FRAME_CH], size_t total,
+                    size_t n, int ch) {
+  int peak = 0;
+  for (size_t t = total - n; t < total; t++) {
+    peak = std::max(peak, std::abs((int)out[t][ch]));
+  }
+  return peak;
+}
+
+static uint16_t dsp_in[4000][RHD_FRAME_CH];
+static int16_t dsp_out[4000][RHD_FRAME_CH];
+
+TEST(RHDDsp, Passthrough) {
+  rhd_dsp_t d;
+  dsp_sine(dsp_in, 100, 100, 1000, 0, true);
+  rhd_dsp_init(&d, RHD_FRAME_CH, false);
+  rhd_dsp_process(&d, dsp_in, dsp_out, 100);
+  for (int t = 0; t < 100; t++) {
+    EXPECT_EQ(dsp_out[t][5], (int16_t)(dsp_in[t][5] ^ 0x8000));
+  }
+}
+
+TEST(RHDDsp, Notch) {
+  rhd_dsp_t d;
+  rhd_biquad_t bq;
+  rhd_dsp_init(&d, RHD_FRAME_CH, true);
+  rhd_biquad_notch(&bq, DSP_FS, 50, 30);
+  ASSERT_EQ(rhd_dsp_add(&d, &bq), 0);
+
+  dsp_sine(dsp_in, 4000, 50, 10000, 0, false);
+  rhd_dsp_process(&d, dsp_in, dsp_out, 4000);
+  for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+    EXPECT_LT(dsp_peak(dsp_out, 4000, 400, ch), 500) << "ch " << ch;
+  }
+
+  rhd_dsp_reset(&d);
+  dsp_sine(dsp_in, 4000, 150, 10000, 0, false);
+  rhd_dsp_process(&d, dsp_in, dsp_out, 4000);
+  EXPECT_GT(dsp_peak(dsp_out, 4000, 400, 0), 9500);
+}
+
+TEST(RHDDsp, BandpassBlocks) {
+  rhd_dsp_t d, d_blocks;
+  rhd_biquad_t hp, lp;
+  rhd_dsp_init(&d, RHD_FRAME_CH, true);
+  rhd_biquad_highpass(&hp, DSP_FS, 20);
+  rhd_biquad_lowpass(&lp, DSP_FS, 450);
+  rhd_dsp_add(&d, &hp);
+  rhd_dsp_add(&d, &lp);
+  d_blocks = d;
+
+  // DC offset is removed, 100 Hz passes
+  dsp_sine(dsp_in, 4000, 100, 8000, 3000, false);
+  rhd_dsp_process(&d, dsp_in, dsp_out, 4000);
+  int peak = dsp_peak(dsp_out, 4000, 400, 0);
+  EXPECT_GT(peak, 7600);
+  EXPECT_LT(peak, 8400);
+
+  // States carry over blocks
+  static int16_t out2[4000][RHD_FRAME_CH];
+  for (int b = 0; b < 4000; b += 250) {
+    rhd_dsp_process(&d_blocks, &dsp_in[b], &out2[b], 250);
+  }
+  EXPECT_EQ(memcmp(dsp_out, out2, sizeof(out2)), 0);
+
+  // 900 Hz is attenuated
+  rhd_dsp_reset(&d);
+  dsp_sine(dsp_in, 4000, 900, 8000, 0, false);
+  rhd_dsp_process(&d, dsp_in, dsp_out, 4000);
+  EXPECT_LT(dsp_peak(dsp_out, 4000, 400, 0), 2000);
+}
+
+TEST(RHDDsp, RectifyFeatures) {
+  rhd_dsp_t d;
+  rhd_dsp_init(&d, RHD_FRAME_CH, true);
+  d.rectify = true;
+  // 40 periods of 100 Hz
+  dsp_sine(dsp_in, 800, 100, 10000, 0, false);
+  rhd_dsp_process(&d, dsp_in, dsp_out, 800);
+
+  uint16_t rms[RHD_FRAME_CH], mav[RHD_FRAME_CH];
+  rhd_dsp_rms(dsp_out, 800, RHD_FRAME_CH, rms);
+  rhd_dsp_mav(dsp_out, 800, RHD_FRAME_CH, mav);
+  for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+    // 20 samples per period
+    EXPECT_NEAR(rms[ch], 10000 / sqrt(2), 20);
+    EXPECT_NEAR(mav[ch], 20000 / M_PI, 70);
+  }
+  for (int t = 0; t < 800; t++) {
+    EXPECT_GE(dsp_out[t][0], 0);
+  }
+}
+
+static int rw_dsp(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)tx_buf;
+  memset(rx_buf, 0, 2 * len * sizeof(uint16_t));
+  return len;
+}
+
+TEST(RHDDsp, InitFromDevice) {
+  rhd_device_t dev;
+  rhd_dsp_t d;
+  rhd_init(&dev, false, rw_dsp);
+  EXPECT_EQ(rhd_dsp_init_emg(&d, &dev, 50, 20, 450, false), -1);
+
+  rhd_cfg_fs(&dev, DSP_FS, 0);
+  rhd_cfg_dsp(&dev, false, false, false, 0, DSP_FS);
+  ASSERT_EQ(rhd_dsp_init_emg(&d, &dev, 50, 20, 450, true), 0);
+  EXPECT_EQ(d.n_stages, 3u);
+  EXPECT_EQ(d.in_xor, 0x8000);
+  EXPECT_TRUE(d.rectify);
+
+  rhd_biquad_t bq;
+  rhd_biquad_notch(&bq, DSP_FS, 50, 30);
+  EXPECT_EQ(memcmp(&d.stages[0], &bq, sizeof(bq)), 0);
+}
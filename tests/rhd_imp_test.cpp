@@ -0,0 +1,128 @@
+#include <cmath>
+#include <cstring>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "rhd_convert.h"
+#include "rhd_imp.h"
+}
+
+/**
+ * Impedance check mock, SDR: the selected electrode records the DAC output
+ * with a gain of `ch % 8 + 1`, every other channel records 0. Register
+ * writes take effect right away, results come back 2 commands later.
+ */
+static uint8_t zchip_regs[64];
+static uint16_t zchip_hist[2][2];
+
+static int rw_zchip(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    uint16_t cmd = tx_buf[i];
+    uint16_t a = 0, b = 0;
+    if ((cmd >> 14) == 0b10) {
+      zchip_regs[(cmd >> 8) & 0x3F] = cmd & 0xFF;
+    } else if ((cmd >> 14) == 0) {
+      int ch = (cmd >> 8) & 0x3F;
+      int sel = zchip_regs[IMP_CHK_AMP_SEL];
+      int v = zchip_regs[IMP_CHK_DAC] - 128;
+      if ((zchip_regs[IMP_CHK_CTRL] & 0x41) == 0x41) {
+        if (sel == ch) {
+          a = (uint16_t)((sel % 8 + 1) * v);
+        } else if (sel == ch + 32) {
+          b = (uint16_t)((sel % 8 + 1) * v);
+        }
+      }
+    }
+    rx_buf[2 * i] = zchip_hist[0][0];
+    rx_buf[2 * i + 1] = zchip_hist[0][1];
+    memcpy(zchip_hist[0], zchip_hist[1], sizeof(zchip_hist[0]));
+    zchip_hist[1][0] = a;
+    zchip_hist[1][1] = b;
+  }
+  return len;
+}
+
+static void zchip_init(rhd_device_t *dev) {
+  memset(zchip_regs, 0, sizeof(zchip_regs));
+  memset(zchip_hist, 0, sizeof(zchip_hist));
+  rhd_init(dev, false, rw_zchip);
+}
+
+/** Magnitude of a mock electrode, it records the DAC voltage itself */
+static double zchip_mag(const rhd_imp_cfg_t *cfg, int ch) {
+  double v_uv = (ch % 8 + 1) * RHD_IMP_DAC_AMP * RHD_AMP_UV_PER_LSB;
+  double i_amp = 1e-12 * 2 * M_PI * cfg->fs / cfg->period * RHD_IMP_DAC_AMP *
+                 RHD_IMP_DAC_V_PER_LSB;
+  return v_uv * 1e-6 / i_amp;
+}
+
+TEST(RHDImp, Measure) {
+  rhd_device_t dev;
+  rhd_imp_cfg_t cfg = RHD_IMP_CFG_DEFAULT(30000.0f);
+  static uint16_t buf[12 * 30][RHD_FRAME_CH];
+  rhd_imp_result_t out[RHD_FRAME_CH];
+  zchip_init(&dev);
+  EXPECT_EQ(cfg.period, 30u);
+  ASSERT_EQ(rhd_imp_frames(&cfg), 12u * 30);
+
+  const uint16_t aux_cmds[2] = {RHD_CMD_CONVERT(RHD_CH_TEMP),
+                                RHD_CMD_CONVERT(RHD_CH_SUPPLY)};
+  uint16_t aux_res[2];
+  rhd_aux_set(&dev, aux_cmds, 2, 1, aux_res);
+
+  ASSERT_EQ(rhd_imp_measure(&dev, &cfg, buf, 12 * 30, out), RHD_FRAME_CH);
+  for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+    double mag = zchip_mag(&cfg, ch);
+    EXPECT_NEAR(out[ch].mag_ohm, mag, 0.01 * mag) << "ch " << ch;
+    EXPECT_NEAR(out[ch].amp_uv, (ch % 8 + 1) * 127 * 0.195, 0.5)
+        << "ch " << ch;
+    // Capacitive, give or take half a DAC step: the mock samples the steps
+    // rather than the smoothed waveform
+    EXPECT_NEAR(out[ch].phase_deg, -90, 360.0 / 30 / 2 + 0.5) << "ch " << ch;
+  }
+
+  // Impedance check off, auxiliary slots back
+  EXPECT_EQ(zchip_regs[IMP_CHK_CTRL], 0);
+  EXPECT_EQ(zchip_regs[IMP_CHK_DAC], 0);
+  EXPECT_EQ(dev.aux_cmds, aux_cmds);
+  EXPECT_EQ(dev.n_aux, 2u);
+  EXPECT_EQ(dev.n_sweep, RHD_SWEEP_CMDS + 1u);
+}
+
+TEST(RHDImp, ChannelList) {
+  rhd_device_t dev;
+  rhd_imp_cfg_t cfg = RHD_IMP_CFG_DEFAULT(20000.0f);
+  static uint16_t buf[12 * 20][RHD_FRAME_CH];
+  rhd_imp_result_t out[RHD_FRAME_CH];
+  zchip_init(&dev);
+  memset(out, 0, sizeof(out));
+  rhd_cfg_ch(&dev, 0x00000106, 0x00000001);
+  rhd_cfg_sparse(&dev, true);
+
+  // Channel 8 is not requested, channel 3 is not sampled
+  cfg.ch_mask = (1ULL << 1) | (1ULL << 2) | (1ULL << 3) | (1ULL << 63);
+  ASSERT_EQ(rhd_imp_measure(&dev, &cfg, buf, 12 * 20, out), 3);
+  for (int ch : {1, 2, 63}) {
+    double mag = zchip_mag(&cfg, ch);
+    EXPECT_NEAR(out[ch].mag_ohm, mag, 0.01 * mag) << "ch " << ch;
+    EXPECT_NEAR(out[ch].phase_deg, -90, 360.0 / 20 / 2 + 0.5) << "ch " << ch;
+  }
+  EXPECT_EQ(out[3].mag_ohm, 0);
+  EXPECT_EQ(out[8].mag_ohm, 0);
+}
+
+TEST(RHDImp, InvalidConfig) {
+  rhd_device_t dev;
+  rhd_imp_cfg_t cfg = RHD_IMP_CFG_DEFAULT(30000.0f);
+  static uint16_t buf[12 * 30][RHD_FRAME_CH];
+  rhd_imp_result_t out[RHD_FRAME_CH];
+  zchip_init(&dev);
+
+  EXPECT_EQ(rhd_imp_measure(&dev, &cfg, buf, 12 * 30 - 1, out), -1);
+  cfg.period = 2;
+  EXPECT_EQ(rhd_imp_measure(&dev, &cfg, buf, 12 * 30, out), -1);
+  cfg.period = 30;
+  cfg.n_periods = 0;
+  EXPECT_EQ(rhd_imp_measure(&dev, &cfg, buf, 12 * 30, out), -1);
+  EXPECT_EQ(zchip_regs[IMP_CHK_CTRL], 0);
+}
@@ -0,0 +1,145 @@
+#include <cstring>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "rhd_multi.h"
+}
+
+/**
+ * Group mock: each device keeps its own 2-command pipeline and returns its
+ * index in the upper bits, channel (A) and channel + 32 (B) in the lower ones.
+ */
+#define MULTI_MAX_DEV 4
+
+typedef struct {
+  size_t base;
+  int calls;
+  uint16_t hist[MULTI_MAX_DEV][2];
+} multi_bus_t;
+
+static int rw_multi(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf, size_t len,
+                    size_t n_dev) {
+  multi_bus_t *bus = (multi_bus_t *)ctx;
+  for (size_t d = 0; d < n_dev; d++) {
+    uint16_t *tx = tx_buf + d * len;
+    uint16_t *rx = rx_buf + d * 2 * len;
+    uint16_t tag = (bus->base + d) << 10;
+    for (size_t i = 0; i < len; i++) {
+      uint16_t ch = bus->hist[d][0];
+      bus->hist[d][0] = bus->hist[d][1];
+      bus->hist[d][1] = (tx[i] >> 8) & 0x3F;
+      rx[2 * i] = tag | (ch << 2);
+      rx[2 * i + 1] = tag | ((ch + 32) << 2);
+    }
+  }
+  bus->calls++;
+  return len;
+}
+
+// Per-device transport, only used by rhd_init. DDR transfers only receive
+// `len` words
+static int rw_nop(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)tx_buf;
+  memset(rx_buf, 0, len * sizeof(uint16_t));
+  return len;
+}
+
+static void multi_check(const uint16_t *out, size_t n_frames, size_t n_dev) {
+  for (size_t f = 0; f < n_frames; f++) {
+    for (size_t d = 0; d < n_dev; d++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        uint16_t v = out[(f * n_dev + d) * RHD_FRAME_CH + ch];
+        EXPECT_EQ(v & 0xFFFE, (d << 10) | (ch << 2))
+            << "frame " << f << " dev " << d << " ch " << ch;
+      }
+      EXPECT_EQ(out[(f * n_dev + d) * RHD_FRAME_CH] & 1, 0);
+    }
+  }
+}
+
+TEST(RHDMulti, GroupInitChecks) {
+  rhd_device_t devs[2];
+  rhd_device_t *pdevs[2] = {&devs[0], &devs[1]};
+  rhd_group_t g;
+  uint16_t tx[64], rx[64];
+  multi_bus_t bus = {};
+
+  rhd_init(&devs[0], false, rw_nop);
+  rhd_init(&devs[1], true, rw_nop);
+  EXPECT_EQ(rhd_group_init(&g, pdevs, 2, rw_multi, &bus, tx, rx, 64), -1);
+  rhd_init(&devs[1], false, rw_nop);
+  EXPECT_EQ(rhd_group_init(&g, pdevs, 2, rw_multi, &bus, tx, rx, 2), -1);
+  EXPECT_EQ(rhd_group_init(&g, pdevs, 2, rw_multi, &bus, tx, rx, 64), 0);
+}
+
+TEST(RHDMulti, GroupBatchesDevices) {
+  const size_t n_frames = 5;
+  rhd_device_t devs[3];
+  rhd_device_t *pdevs[3] = {&devs[0], &devs[1], &devs[2]};
+  rhd_group_t g;
+  rhd_multi_t m;
+  uint16_t tx[3 * 64], rx[3 * 64];
+  uint16_t out[n_frames * 3 * RHD_FRAME_CH];
+  multi_bus_t bus = {};
+
+  for (int d = 0; d < 3; d++) {
+    rhd_init(&devs[d], false, rw_nop);
+  }
+  ASSERT_EQ(rhd_group_init(&g, pdevs, 3, rw_multi, &bus, tx, rx, 3 * 64), 0);
+  ASSERT_EQ(rhd_multi_init(&m, &g, 1), 0);
+  EXPECT_EQ(m.n_dev, 3u);
+
+  EXPECT_EQ(rhd_multi_sample_frames(&m, n_frames, out), 0);
+  // 32 commands per device per transfer
+  EXPECT_EQ(bus.calls, (int)((n_frames * 32 + 2 + 31) / 32));
+  multi_check(out, n_frames, 3);
+}
+
+static void multi_groups_run(bool threaded) {
+  const size_t n_frames = 7;
+  rhd_device_t devs[4];
+  rhd_device_t *bus0[1] = {&devs[0]};
+  rhd_device_t *bus1[3] = {&devs[1], &devs[2], &devs[3]};
+  rhd_group_t groups[2];
+  rhd_multi_t m;
+  uint16_t tx0[64], rx0[64], tx1[3 * 40], rx1[3 * 40];
+  uint16_t out[n_frames * 4 * RHD_FRAME_CH];
+  multi_bus_t buses[2] = {};
+  buses[1].base = 1;
+
+  for (int d = 0; d < 4; d++) {
+    rhd_init(&devs[d], false, rw_nop);
+  }
+  ASSERT_EQ(rhd_group_init(&groups[0], bus0, 1, rw_multi, &buses[0], tx0, rx0,
+                           64),
+            0);
+  ASSERT_EQ(rhd_group_init(&groups[1], bus1, 3, rw_multi, &buses[1], tx1, rx1,
+                           3 * 40),
+            0);
+  rhd_group_set_cpu(&groups[0], 0);
+  ASSERT_EQ(rhd_multi_init(&m, groups, 2), 0);
+  EXPECT_EQ(groups[1].first_dev, 1u);
+
+#ifndef RHD_NO_THREADS
+  pthread_t threads[2];
+  if (threaded) {
+    ASSERT_EQ(rhd_multi_start(&m, threads), 0);
+  }
+#endif
+  for (int block = 0; block < 3; block++) {
+    memset(out, 0, sizeof(out));
+    EXPECT_EQ(rhd_multi_sample_frames(&m, n_frames, out), 0);
+    multi_check(out, n_frames, 4);
+  }
+#ifndef RHD_NO_THREADS
+  if (threaded) {
+    EXPECT_EQ(rhd_multi_stop(&m), 0);
+  }
+#endif
+}
+
+TEST(RHDMulti, GroupsSequential) { multi_groups_run(false); }
+
+#ifndef RHD_NO_THREADS
+TEST(RHDMulti, GroupsThreaded) { multi_groups_run(true); }
+#endif
@@ -0,0 +1,179 @@
+#include <cstdlib>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+extern "C" {
+#include "rhd_record.h"
+}
+
+// Used in both modes: DDR transfers only receive `len` words
+static int rw_rec_chip(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)tx_buf;
+  memset(rx_buf, 0, len * sizeof(uint16_t));
+  return len;
+}
+
+static const size_t REC_FRAMES = 64;
+alignas(RHD_REC_ALIGN) static uint8_t
+    rec_bufs[4 * RHD_REC_CHUNK_BYTES(RHD_FRAME_CH, REC_FRAMES)];
+
+/** Frame `seq` holds `seq` on channel 0 and `seq + ch` on channel `ch` */
+static void rec_frames(uint16_t (*frames)[RHD_FRAME_CH], size_t n,
+                       uint64_t seq) {
+  for (size_t f = 0; f < n; f++) {
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      frames[f][ch] = (uint16_t)(seq + f + ch);
+    }
+  }
+}
+
+static std::string rec_path() {
+  char path[] = "/tmp/rhd_rec_XXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+  return path;
+}
+
+TEST(RHDRecord, Header) {
+  rhd_device_t dev;
+  rhd_recorder_t r;
+  rhd_rec_reader_t rd;
+  std::string path = rec_path();
+
+  rhd_init(&dev, true, rw_rec_chip);
+  rhd_cfg_fs(&dev, 2000, 0);
+  rhd_cfg_dsp(&dev, false, false, true, 10, 2000);
+  EXPECT_EQ(rhd_rec_open(&r, path.c_str(), &dev, rec_bufs + 1, 4, REC_FRAMES),
+            -1);
+  EXPECT_EQ(rhd_rec_open(&r, path.c_str(), &dev, rec_bufs, 3, REC_FRAMES), -1);
+  ASSERT_EQ(rhd_rec_open(&r, path.c_str(), &dev, rec_bufs, 4, REC_FRAMES), 0);
+  EXPECT_EQ(rhd_rec_close(&r), 0);
+
+  ASSERT_EQ(rhd_rec_map(&rd, path.c_str()), 0);
+  EXPECT_EQ(rd.n_chunks, 0u);
+  EXPECT_EQ(rd.hdr->n_ch, (uint32_t)RHD_FRAME_CH);
+  EXPECT_EQ(rd.hdr->chunk_frames, REC_FRAMES);
+  EXPECT_EQ(rd.hdr->fs, 2000);
+  EXPECT_EQ(rd.hdr->ddr, 1);
+  EXPECT_EQ(rd.hdr->regs[ADC_OUT_FMT_DPS_OFF_RMVL],
+            dev.regs[ADC_OUT_FMT_DPS_OFF_RMVL]);
+  EXPECT_EQ(rd.hdr->ch_mask, dev.ch_mask);
+  EXPECT_EQ(rhd_rec_frame(&rd, 0), nullptr);
+  rhd_rec_unmap(&rd);
+
+  // Not a recording
+  FILE *f = fopen(path.c_str(), "r+");
+  fputc('X', f);
+  fclose(f);
+  EXPECT_EQ(rhd_rec_map(&rd, path.c_str()), -1);
+  unlink(path.c_str());
+}
+
+TEST(RHDRecord, DropsWhenWriterLags) {
+  rhd_device_t dev;
+  rhd_recorder_t r;
+  rhd_rec_reader_t rd;
+  std::string path = rec_path();
+  static uint16_t frames[6 * REC_FRAMES][RHD_FRAME_CH];
+
+  rhd_init(&dev, false, rw_rec_chip);
+  ASSERT_EQ(rhd_rec_open(&r, path.c_str(), &dev, rec_bufs, 4, REC_FRAMES), 0);
+
+  // 4 chunks fit, then the next 2 are dropped without blocking
+  rec_frames(frames, 6 * REC_FRAMES, 0);
+  EXPECT_EQ(rhd_rec_write(&r, frames, 6 * REC_FRAMES), 4 * REC_FRAMES);
+  EXPECT_EQ(rhd_rec_dropped(&r), 2 * REC_FRAMES);
+  EXPECT_EQ(rhd_rec_service(&r), 4);
+
+  // Recording resumes with a partial chunk
+  rec_frames(frames, 10, 6 * REC_FRAMES);
+  EXPECT_EQ(rhd_rec_write(&r, frames, 10), 10u);
+  EXPECT_EQ(rhd_rec_close(&r), 0);
+
+  ASSERT_EQ(rhd_rec_map(&rd, path.c_str()), 0);
+  ASSERT_EQ(rd.n_chunks, 5u);
+  const rhd_rec_chunk_t *last = rhd_rec_chunk(&rd, 4);
+  EXPECT_EQ(last->magic, RHD_REC_CHUNK_MAGIC);
+  EXPECT_EQ(last->seq, 6 * REC_FRAMES);
+  EXPECT_EQ(last->n_frames, 10u);
+  EXPECT_EQ(last->dropped, 2 * REC_FRAMES);
+  EXPECT_GE(last->t_ns, rhd_rec_chunk(&rd, 0)->t_ns);
+
+  for (uint64_t seq = 0; seq < 6 * REC_FRAMES + 20; seq++) {
+    const uint16_t *frame = rhd_rec_frame(&rd, seq);
+    bool recorded = seq < 4 * REC_FRAMES ||
+                    (seq >= 6 * REC_FRAMES && seq < 6 * REC_FRAMES + 10);
+    ASSERT_EQ(frame != nullptr, recorded) << seq;
+    if (recorded) {
+      EXPECT_EQ(frame[0], (uint16_t)seq);
+      EXPECT_EQ(frame[63], (uint16_t)(seq + 63));
+    }
+  }
+  rhd_rec_unmap(&rd);
+  unlink(path.c_str());
+}
+
+TEST(RHDRecord, SparseFrames) {
+  rhd_device_t dev;
+  rhd_recorder_t r;
+  rhd_rec_reader_t rd;
+  std::string path = rec_path();
+  static uint16_t frames[100][RHD_FRAME_CH];
+
+  rhd_init(&dev, false, rw_rec_chip);
+  rhd_cfg_ch(&dev, 0x0000000F, 0);
+  rhd_cfg_sparse(&dev, true);
+  ASSERT_EQ(dev.n_ch, 4u);
+  ASSERT_EQ(rhd_rec_open(&r, path.c_str(), &dev, rec_bufs, 4, REC_FRAMES), 0);
+  rec_frames(frames, 100, 0);
+  rhd_rec_write(&r, frames, 100);
+  EXPECT_EQ(rhd_rec_close(&r), 0);
+
+  ASSERT_EQ(rhd_rec_map(&rd, path.c_str()), 0);
+  EXPECT_EQ(rd.hdr->n_ch, 4u);
+  EXPECT_EQ(rd.hdr->sparse, 1);
+  EXPECT_EQ(rd.hdr->ch_map[3], 3);
+  // Both chunks fit in a page
+  EXPECT_EQ(rd.size, 3u * RHD_REC_ALIGN);
+  EXPECT_EQ(rhd_rec_frame(&rd, 70)[3], 73);
+  rhd_rec_unmap(&rd);
+  unlink(path.c_str());
+}
+
+TEST(RHDRecord, WriterThread) {
+  rhd_device_t dev;
+  rhd_recorder_t r;
+  rhd_rec_reader_t rd;
+  std::string path = rec_path();
+  static uint16_t frames[16][RHD_FRAME_CH];
+  const uint64_t total = 200 * REC_FRAMES;
+
+  rhd_init(&dev, false, rw_rec_chip);
+  ASSERT_EQ(rhd_rec_open(&r, path.c_str(), &dev, rec_bufs, 4, REC_FRAMES), 0);
+  ASSERT_EQ(rhd_rec_start(&r), 0);
+  uint64_t n_rec = 0;
+  for (uint64_t seq = 0; seq < total; seq += 16) {
+    rec_frames(frames, 16, seq);
+    n_rec += rhd_rec_write(&r, frames, 16);
+    usleep(20);
+  }
+  uint64_t dropped = rhd_rec_dropped(&r);
+  EXPECT_EQ(rhd_rec_close(&r), 0);
+  EXPECT_EQ(n_rec + dropped, total);
+
+  // Whatever got dropped, every recorded frame is found by its number
+  ASSERT_EQ(rhd_rec_map(&rd, path.c_str()), 0);
+  EXPECT_EQ(rd.n_chunks, n_rec / REC_FRAMES);
+  uint64_t n_found = 0;
+  for (uint64_t seq = 0; seq < total; seq++) {
+    const uint16_t *frame = rhd_rec_frame(&rd, seq);
+    if (frame != nullptr) {
+      EXPECT_EQ(frame[1], (uint16_t)(seq + 1));
+      n_found++;
+    }
+  }
+  EXPECT_EQ(n_found, n_rec);
+  rhd_rec_unmap(&rd);
+  unlink(path.c_str());
+}
@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+#include <time.h>
+#include <vector>
+
+extern "C" {
+#include "rhd_rt.h"
+}
+
+static int rw_rt(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  for (size_t i = 0; i < 2 * len; i++) {
+    rx_buf[i] = 0;
+  }
+  return len;
+}
+
+/* No realtime privileges in CI: default policy, no memory locking */
+static rhd_rt_cfg_t rt_cfg(float fs) {
+  rhd_rt_cfg_t cfg = RHD_RT_CFG_DEFAULT(fs);
+  cfg.priority = 0;
+  cfg.lock_mem = false;
+  return cfg;
+}
+
+/* Drain the stream until `n` frames were read, copying their metadata, or
+ * fail after 10 s */
+static std::vector<rhd_rt_meta_t> rt_collect(rhd_rt_t *rt, size_t n) {
+  std::vector<rhd_rt_meta_t> out;
+  uint16_t(*frames)[RHD_FRAME_CH];
+  const uint64_t deadline = rhd_timer_now_ns() + 10000000000ull;
+  while (out.size() < n) {
+    if (rhd_timer_now_ns() > deadline) {
+      ADD_FAILURE() << "only " << out.size() << " of " << n << " frames";
+      out.resize(n);
+      break;
+    }
+    size_t got = rhd_stream_borrow(rt->s, &frames);
+    for (size_t i = 0; i < got; i++) {
+      out.push_back(*rhd_rt_meta(rt, &frames[i]));
+    }
+    rhd_stream_release(rt->s, got);
+  }
+  return out;
+}
+
+static void sleep_until(uint64_t t_ns) {
+  struct timespec ts;
+  ts.tv_sec = t_ns / 1000000000ull;
+  ts.tv_nsec = t_ns % 1000000000ull;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+  }
+}
+
+/* Oversleeps the 5th tick by 3.5 periods */
+struct stall_t {
+  int ticks;
+  uint64_t period_ns;
+};
+
+static int wait_stall(void *ctx, uint64_t deadline_ns) {
+  stall_t *st = (stall_t *)ctx;
+  if (++st->ticks == 5) {
+    deadline_ns += st->period_ns * 7 / 2;
+  }
+  sleep_until(deadline_ns);
+  return 0;
+}
+
+TEST(RHDRt, InitChecksArgs) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  rhd_rt_t rt;
+  uint16_t slots[8][RHD_FRAME_CH];
+  rhd_rt_meta_t meta[8];
+  rhd_init(&dev, false, rw_rt);
+  rhd_stream_init(&s, &dev, slots, 8, 2);
+
+  rhd_rt_cfg_t cfg = rt_cfg(0);
+  EXPECT_EQ(rhd_rt_init(&rt, &s, meta, &cfg), -1);
+  EXPECT_EQ(rhd_rt_init(&rt, &s, NULL, &cfg), -1);
+  cfg.fs = 1000;
+  EXPECT_EQ(rhd_rt_init(&rt, &s, meta, &cfg), 0);
+  // Half of a 2-frame tick
+  EXPECT_EQ(rt.cfg.late_ns, 1000000u);
+}
+
+TEST(RHDRt, SequenceAndTimestamps) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  rhd_rt_t rt;
+  uint16_t slots[64][RHD_FRAME_CH];
+  rhd_rt_meta_t meta[64];
+  rhd_init(&dev, false, rw_rt);
+  rhd_stream_init(&s, &dev, slots, 64, 2);
+  rhd_rt_cfg_t cfg = rt_cfg(2000);
+  ASSERT_EQ(rhd_rt_init(&rt, &s, meta, &cfg), 0);
+
+  ASSERT_EQ(rhd_rt_start(&rt), 0);
+  std::vector<rhd_rt_meta_t> m = rt_collect(&rt, 200);
+  EXPECT_EQ(rhd_rt_stop(&rt), 0);
+
+  uint64_t next = 0;
+  for (size_t i = 0; i < m.size(); i++) {
+    if (i > 0) {
+      EXPECT_GE(m[i].t_ns, m[i - 1].t_ns);
+    }
+    // A loaded machine may skip deadlines, but never silently
+    if (m[i].seq != next) {
+      EXPECT_GT(m[i].seq, next);
+      EXPECT_NE(m[i].flags & (RHD_RT_MISSED | RHD_RT_DROPPED), 0u);
+    }
+    next = m[i].seq + 1;
+  }
+
+  rhd_rt_stats_t stats;
+  rhd_rt_stats(&rt, &stats);
+  EXPECT_GE(stats.frames, 200u);
+}
+
+TEST(RHDRt, StepAcrossWrap) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  rhd_rt_t rt;
+  uint16_t slots[8][RHD_FRAME_CH];
+  rhd_rt_meta_t meta[8];
+  rhd_init(&dev, false, rw_rt);
+  // 3 frames per step never divide the ring: every wrap splits a step
+  rhd_stream_init(&s, &dev, slots, 8, 3);
+  rhd_rt_cfg_t cfg = rt_cfg(1500);
+  ASSERT_EQ(rhd_rt_init(&rt, &s, meta, &cfg), 0);
+
+  ASSERT_EQ(rhd_rt_start(&rt), 0);
+  std::vector<rhd_rt_meta_t> m = rt_collect(&rt, 60);
+  EXPECT_EQ(rhd_rt_stop(&rt), 0);
+
+  // The consumer keeps up, so nothing is dropped at the wraps
+  for (size_t i = 1; i < m.size(); i++) {
+    EXPECT_EQ(m[i].flags & RHD_RT_DROPPED, 0u) << "frame " << i;
+    EXPECT_GE(m[i].t_ns, m[i - 1].t_ns);
+    if (m[i].seq != m[i - 1].seq + 1) {
+      EXPECT_NE(m[i].flags & RHD_RT_MISSED, 0u);
+    }
+  }
+
+  rhd_rt_stats_t stats;
+  rhd_rt_stats(&rt, &stats);
+  EXPECT_EQ(stats.dropped, 0u);
+  EXPECT_EQ(rhd_stream_overruns(&s), 0u);
+}
+
+TEST(RHDRt, MissedDeadlines) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  rhd_rt_t rt;
+  uint16_t slots[64][RHD_FRAME_CH];
+  rhd_rt_meta_t meta[64];
+  rhd_init(&dev, false, rw_rt);
+  rhd_stream_init(&s, &dev, slots, 64, 2);
+  rhd_rt_cfg_t cfg = rt_cfg(1000);
+  ASSERT_EQ(rhd_rt_init(&rt, &s, meta, &cfg), 0);
+  stall_t st = {0, rt.timer.period_ns};
+  rhd_timer_set_wait(&rt.timer, wait_stall, &st);
+
+  ASSERT_EQ(rhd_rt_start(&rt), 0);
+  std::vector<rhd_rt_meta_t> m = rt_collect(&rt, 40);
+  EXPECT_EQ(rhd_rt_stop(&rt), 0);
+
+  // The stalled tick skips at least 3 deadlines of 2 frames
+  bool flagged = false;
+  for (size_t i = 1; i < m.size(); i++) {
+    if (m[i].seq != m[i - 1].seq + 1) {
+      EXPECT_NE(m[i].flags & RHD_RT_MISSED, 0u);
+      flagged |= m[i].seq - m[i - 1].seq >= 7;
+    }
+  }
+  EXPECT_TRUE(flagged);
+
+  rhd_rt_stats_t stats;
+  rhd_rt_stats(&rt, &stats);
+  EXPECT_GE(stats.missed, 3u);
+  EXPECT_EQ(stats.missed_frames, 2 * stats.missed);
+}
+
+TEST(RHDRt, DroppedFrames) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  rhd_rt_t rt;
+  uint16_t slots[4][RHD_FRAME_CH];
+  rhd_rt_meta_t meta[4];
+  uint16_t(*frames)[RHD_FRAME_CH];
+  rhd_init(&dev, false, rw_rt);
+  rhd_stream_init(&s, &dev, slots, 4, 4);
+  rhd_rt_cfg_t cfg = rt_cfg(4000);
+  ASSERT_EQ(rhd_rt_init(&rt, &s, meta, &cfg), 0);
+
+  ASSERT_EQ(rhd_rt_start(&rt), 0);
+  // Let the ring fill up and overrun
+  sleep_until(rhd_timer_now_ns() + 20000000ull);
+  ASSERT_EQ(rhd_stream_borrow(&s, &frames), 4u);
+  const uint64_t seq = rhd_rt_meta(&rt, &frames[3])->seq;
+  EXPECT_EQ(seq, rhd_rt_meta(&rt, &frames[0])->seq + 3);
+  rhd_stream_release(&s, 4);
+
+  std::vector<rhd_rt_meta_t> m = rt_collect(&rt, 1);
+  EXPECT_EQ(rhd_rt_stop(&rt), 0);
+  EXPECT_NE(m[0].flags & RHD_RT_DROPPED, 0u);
+  EXPECT_GT(m[0].seq, seq + 1);
+  // Whole steps were skipped, `seq` still counts time
+  EXPECT_EQ((m[0].seq - seq - 1) % 4, 0u);
+
+  rhd_rt_stats_t stats;
+  rhd_rt_stats(&rt, &stats);
+  // A full ring drops the whole 4-frame step
+  EXPECT_GT(stats.dropped, 0u);
+  EXPECT_EQ(stats.dropped, 4u * rhd_stream_overruns(&s));
+}
@@ -0,0 +1,106 @@
+#include <cerrno>
+#include <cstring>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "rhd_spidev.h"
+}
+
+#ifdef __linux__
+
+static struct spi_ioc_transfer spidev_xfers[RHD_SPIDEV_MAX_XFERS];
+
+TEST(RHDSpidev, OpenErrors) {
+  rhd_spidev_t spi;
+  rhd_spidev_cfg_t cfg = RHD_SPIDEV_CFG_DEFAULT("/dev/spidev-missing");
+  EXPECT_EQ(rhd_spidev_open(&spi, &cfg, spidev_xfers, RHD_SPIDEV_MAX_XFERS),
+            -1);
+
+  // Not a SPI device, the mode ioctl fails
+  cfg.path = "/dev/null";
+  EXPECT_EQ(rhd_spidev_open(&spi, &cfg, spidev_xfers, RHD_SPIDEV_MAX_XFERS),
+            -1);
+
+  EXPECT_EQ(rhd_spidev_open(&spi, &cfg, NULL, 16), -1);
+  EXPECT_EQ(
+      rhd_spidev_open(&spi, &cfg, spidev_xfers, RHD_SPIDEV_MAX_XFERS + 1), -1);
+}
+
+/* Transport state of an open node, without the node */
+static void spidev_fake(rhd_spidev_t *spi, bool ddr, size_t n_xfers) {
+  memset(spidev_xfers, 0, sizeof(spidev_xfers));
+  spi->fd = -1;
+  spi->ddr = ddr;
+  spi->word8 = false;
+  spi->xfers = spidev_xfers;
+  spi->n_xfers = n_xfers;
+}
+
+TEST(RHDSpidev, FillDdr) {
+  rhd_spidev_t spi;
+  uint16_t tx[8], rx[8];
+  spidev_fake(&spi, true, RHD_SPIDEV_MAX_XFERS);
+
+  // Both words of a command in one transfer, under one chip select pulse
+  ASSERT_EQ(rhd_spidev_fill(&spi, tx, rx, 8), 4u);
+  for (size_t j = 0; j < 4; j++) {
+    EXPECT_EQ(spidev_xfers[j].tx_buf, (uintptr_t)&tx[2 * j]);
+    EXPECT_EQ(spidev_xfers[j].rx_buf, (uintptr_t)&rx[2 * j]);
+    EXPECT_EQ(spidev_xfers[j].len, 4u);
+    EXPECT_EQ(spidev_xfers[j].cs_change, j < 3 ? 1 : 0);
+  }
+
+  // Half a command cannot go out
+  EXPECT_EQ(rhd_spidev_rw(&spi, tx, rx, 7), -EINVAL);
+}
+
+TEST(RHDSpidev, FillSdr) {
+  rhd_spidev_t spi;
+  uint16_t tx[4], rx[8];
+  spidev_fake(&spi, false, RHD_SPIDEV_MAX_XFERS);
+
+  // A word per transfer, MISO A lands in rx[2i]
+  ASSERT_EQ(rhd_spidev_fill(&spi, tx, rx, 4), 4u);
+  for (size_t j = 0; j < 4; j++) {
+    EXPECT_EQ(spidev_xfers[j].tx_buf, (uintptr_t)&tx[j]);
+    EXPECT_EQ(spidev_xfers[j].rx_buf, (uintptr_t)&rx[2 * j]);
+    EXPECT_EQ(spidev_xfers[j].len, 2u);
+    EXPECT_EQ(spidev_xfers[j].cs_change, j < 3 ? 1 : 0);
+  }
+  EXPECT_EQ(rhd_spidev_rw(&spi, tx, rx, 4), -EBADF);
+}
+
+TEST(RHDSpidev, FillChunks) {
+  rhd_spidev_t spi;
+  uint16_t tx[10], rx[10];
+  spidev_fake(&spi, true, 3);
+
+  // 5 DDR commands in ioctls of at most 3, never splitting a command
+  ASSERT_EQ(rhd_spidev_fill(&spi, tx, rx, 10), 3u);
+  EXPECT_EQ(spidev_xfers[2].tx_buf, (uintptr_t)&tx[4]);
+  EXPECT_EQ(spidev_xfers[2].len, 4u);
+  EXPECT_EQ(spidev_xfers[1].cs_change, 1);
+  EXPECT_EQ(spidev_xfers[2].cs_change, 0);
+
+  ASSERT_EQ(rhd_spidev_fill(&spi, &tx[6], &rx[6], 4), 2u);
+  EXPECT_EQ(spidev_xfers[0].tx_buf, (uintptr_t)&tx[6]);
+  EXPECT_EQ(spidev_xfers[0].rx_buf, (uintptr_t)&rx[6]);
+  EXPECT_EQ(spidev_xfers[1].tx_buf, (uintptr_t)&tx[8]);
+  EXPECT_EQ(spidev_xfers[1].rx_buf, (uintptr_t)&rx[8]);
+  EXPECT_EQ(spidev_xfers[0].cs_change, 1);
+  EXPECT_EQ(spidev_xfers[1].cs_change, 0);
+
+  // Same in SDR, the rx offset follows the 2 words per command
+  spidev_fake(&spi, false, 3);
+  ASSERT_EQ(rhd_spidev_fill(&spi, &tx[3], &rx[6], 2), 2u);
+  EXPECT_EQ(spidev_xfers[0].tx_buf, (uintptr_t)&tx[3]);
+  EXPECT_EQ(spidev_xfers[1].rx_buf, (uintptr_t)&rx[8]);
+  EXPECT_EQ(spidev_xfers[1].cs_change, 0);
+}
+
+TEST(RHDSpidev, SetRt) {
+  EXPECT_EQ(rhd_spidev_set_rt(0, -1), 0);
+  EXPECT_EQ(rhd_spidev_set_rt(0, 0), 0);
+}
+
+#endif
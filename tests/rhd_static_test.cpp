@@ -0,0 +1,62 @@
+#include <cstring>
+#include <gtest/gtest.h>
+
+#define RHD_STATIC_DEVICES 2
+#define RHD_STATIC_FRAMES 16
+#define RHD_STATIC_BURST 4
+#define RHD_STATIC_AUX 2
+#define RHD_STATIC_SRAM_BUDGET 32768
+
+extern "C" {
+#include "rhd_static.h"
+}
+
+/** Every command returns its channel << 4, 2 commands later, SDR */
+static uint16_t static_hist[2];
+
+static int rw_static(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    uint16_t ch = static_hist[0];
+    static_hist[0] = static_hist[1];
+    static_hist[1] = (tx_buf[i] >> 8) & 0x3F;
+    rx_buf[2 * i] = ch << 4;
+    rx_buf[2 * i + 1] = (ch + 32) << 4;
+  }
+  return len;
+}
+
+static rhd_static_t rhd_mem[RHD_STATIC_DEVICES];
+
+TEST(RHDStatic, Sizes) {
+  // A whole checked burst with its auxiliary slots in one transfer
+  EXPECT_EQ(RHD_STATIC_BURST_WORDS, 2 * (4 * (32 + 2) + 4));
+  EXPECT_EQ(sizeof(rhd_mem[0].slots), 16u * 64 * 2);
+  EXPECT_EQ(RHD_STATIC_BYTES, sizeof(rhd_mem));
+}
+
+TEST(RHDStatic, Attach) {
+  for (int i = 0; i < RHD_STATIC_DEVICES; i++) {
+    rhd_static_t *st = &rhd_mem[i];
+    static_hist[0] = static_hist[1] = 0;
+    rhd_init(&st->dev, false, rw_static);
+    ASSERT_EQ(RHD_STATIC_ATTACH(st), 0);
+    EXPECT_EQ(st->dev.burst_tx, st->burst_tx);
+    EXPECT_EQ(st->dev.burst_words, (size_t)RHD_STATIC_BURST_WORDS);
+
+    st->aux_cmds[0] = RHD_CMD_CONVERT(RHD_CH_SUPPLY);
+    st->aux_cmds[1] = RHD_CMD_CONVERT(RHD_CH_TEMP);
+    ASSERT_EQ(rhd_aux_set(&st->dev, st->aux_cmds, 2, 2, st->aux_out), 0);
+
+    EXPECT_EQ(rhd_stream_produce(&st->stream), 4u);
+    uint16_t(*frames)[RHD_FRAME_CH];
+    ASSERT_EQ(rhd_stream_borrow(&st->stream, &frames), 4u);
+    EXPECT_EQ(frames, &st->slots[0]);
+    for (int f = 0; f < 4; f++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(frames[f][ch] & 0xFFFE, ch << 4);
+      }
+    }
+    EXPECT_EQ(st->aux_out[0], RHD_CH_SUPPLY << 4);
+    EXPECT_EQ(st->aux_out[1], RHD_CH_TEMP << 4);
+  }
+}
@@ -0,0 +1,92 @@
+#include <cstring>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+extern "C" {
+#include "rhd.h"
+}
+
+static int stats_fail = 0;
+
+// DDR transfers of `len` words, 2 received words per command
+static int rw_stats(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)tx_buf;
+  memset(rx_buf, 0, len * sizeof(uint16_t));
+  usleep(100);
+  return stats_fail ? -1 : (int)len;
+}
+
+static uint64_t stats_sum(const uint64_t *hist) {
+  uint64_t total = 0;
+  for (int i = 0; i < RHD_STATS_BUCKETS; i++) {
+    total += hist[i];
+  }
+  return total;
+}
+
+TEST(RHDStats, Counters) {
+  rhd_device_t dev;
+  rhd_stats_t st;
+
+  // No chip answers, so the sanity check fails
+  EXPECT_NE(rhd_init(&dev, true, rw_stats), 0);
+  rhd_stats_snapshot(&dev, &st);
+  EXPECT_EQ(st.sanity_failures, 1u);
+  EXPECT_EQ(st.frames, 0u);
+  uint64_t calls = st.rw_calls;
+  uint64_t words = st.words;
+  EXPECT_GT(calls, 0u);
+
+  uint16_t buf[RHD_FRAME_CH];
+  rhd2164_sample_all(&dev, buf);
+  uint16_t frames[5][RHD_FRAME_CH];
+  rhd2164_sample_frames(&dev, 5, frames);
+
+  rhd_stats_snapshot(&dev, &st);
+  EXPECT_EQ(st.frames, 6u);
+  // One sweep, then 5 frames and 2 flush commands in sweep-sized chunks
+  EXPECT_EQ(st.rw_calls - calls, 1u + 6);
+  EXPECT_EQ(st.words - words, 2u * (RHD_SWEEP_CMDS + 5 * RHD_SWEEP_CMDS + 2));
+  EXPECT_EQ(st.rw_errors, 0u);
+  EXPECT_EQ(stats_sum(st.rw_ns), st.rw_calls);
+  // The first call has no previous frame to measure a period from
+  EXPECT_EQ(stats_sum(st.period_ns), 5u);
+
+  stats_fail = 1;
+  rhd2164_sample_all(&dev, buf);
+  stats_fail = 0;
+  rhd_stats_snapshot(&dev, &st);
+  EXPECT_EQ(st.rw_errors, 1u);
+}
+
+TEST(RHDStats, Retries) {
+  rhd_device_t dev;
+  rhd_stats_t st;
+  rhd_init(&dev, true, rw_stats);
+
+  // Every attempt fails its sanity check
+  EXPECT_EQ(rhd_resync(&dev), -1);
+  rhd_stats_snapshot(&dev, &st);
+  EXPECT_EQ(st.retries, (uint64_t)RHD_CHECK_RETRIES);
+  EXPECT_EQ(st.sanity_failures, 1u + RHD_CHECK_RETRIES);
+  EXPECT_EQ(dev.check.failures, 1u);
+}
+
+TEST(RHDStats, Quantile) {
+  uint64_t hist[RHD_STATS_BUCKETS] = {0};
+  EXPECT_EQ(rhd_stats_quantile(hist, 0.5), 0u);
+
+  // 90 calls around 1 us, 10 around 1 ms
+  hist[10] = 90;
+  hist[20] = 10;
+  EXPECT_EQ(rhd_stats_quantile(hist, 0.5), 2048u);
+  EXPECT_EQ(rhd_stats_quantile(hist, 0.95), 2u << 20);
+  EXPECT_EQ(rhd_stats_quantile(hist, 1.0), 2u << 20);
+
+  // 100 us transfers land in the 2^16-2^17 ns bucket
+  rhd_device_t dev;
+  rhd_stats_t st;
+  rhd_init(&dev, true, rw_stats);
+  rhd_stats_snapshot(&dev, &st);
+  EXPECT_GE(rhd_stats_quantile(st.rw_ns, 0.5), 1u << 17);
+}
@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "rhd_stream.h"
+}
+
+/**
+ * Counting mock: MISO A of every command returns an increasing counter, so
+ * consecutive channels of a frame hold consecutive values.
+ */
+static uint16_t stream_cnt = 0;
+
+int rw_count(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    rx_buf[2 * i] = stream_cnt++ << 1;
+    rx_buf[2 * i + 1] = 0;
+  }
+  return len;
+}
+
+static void stream_dev_init(rhd_device_t *dev) {
+  rhd_init(dev, false, rw_count);
+  stream_cnt = 0;
+}
+
+TEST(RHDStream, InitChecksSlots) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  uint16_t slots[8][RHD_FRAME_CH];
+  stream_dev_init(&dev);
+
+  EXPECT_EQ(rhd_stream_init(&s, &dev, slots, 0, 1), -1);
+  EXPECT_EQ(rhd_stream_init(&s, &dev, slots, 6, 1), -1);
+  EXPECT_EQ(rhd_stream_init(&s, &dev, slots, 8, 1), 0);
+}
+
+TEST(RHDStream, ProduceBorrowRelease) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  uint16_t slots[8][RHD_FRAME_CH];
+  uint16_t(*frames)[RHD_FRAME_CH];
+  stream_dev_init(&dev);
+  rhd_stream_init(&s, &dev, slots, 8, 3);
+
+  EXPECT_EQ(rhd_stream_borrow(&s, &frames), 0u);
+  EXPECT_EQ(rhd_stream_produce(&s), 3u);
+  EXPECT_EQ(rhd_stream_produce(&s), 3u);
+  EXPECT_EQ(rhd_stream_available(&s), 6u);
+
+  // Frames are sampled straight into the ring slots
+  EXPECT_EQ(rhd_stream_borrow(&s, &frames), 6u);
+  EXPECT_EQ(frames, &slots[0]);
+  rhd_stream_release(&s, 4);
+
+  // Only 2 slots left before wrapping around
+  EXPECT_EQ(rhd_stream_produce(&s), 2u);
+  EXPECT_EQ(rhd_stream_produce(&s), 3u);
+  EXPECT_EQ(rhd_stream_borrow(&s, &frames), 4u);
+  EXPECT_EQ(frames, &slots[4]);
+  rhd_stream_release(&s, 4);
+  EXPECT_EQ(rhd_stream_borrow(&s, &frames), 3u);
+  EXPECT_EQ(frames, &slots[0]);
+  EXPECT_EQ(rhd_stream_overruns(&s), 0u);
+}
+
+TEST(RHDStream, Overrun) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  uint16_t slots[4][RHD_FRAME_CH];
+  stream_dev_init(&dev);
+  rhd_stream_init(&s, &dev, slots, 4, 4);
+
+  EXPECT_EQ(rhd_stream_produce(&s), 4u);
+  EXPECT_EQ(rhd_stream_produce(&s), 0u);
+  EXPECT_EQ(rhd_stream_produce(&s), 0u);
+  EXPECT_EQ(rhd_stream_overruns(&s), 2u);
+  EXPECT_EQ(rhd_stream_available(&s), 4u);
+}
+
+TEST(RHDStream, ReadWithoutThread) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  uint16_t slots[8][RHD_FRAME_CH];
+  uint16_t out[20][RHD_FRAME_CH];
+  stream_dev_init(&dev);
+  rhd_stream_init(&s, &dev, slots, 8, 3);
+
+  // Across the ring's wrap-around, sampled by the reader itself
+  EXPECT_EQ(rhd_stream_read(&s, out, 20, 0), 20u);
+  for (int f = 1; f < 20; f++) {
+    // In order, plus the 2 flush commands after every burst
+    int step = ((out[f][0] >> 1) - (out[f - 1][0] >> 1)) & 0x7FFF;
+    EXPECT_TRUE(step == RHD_SWEEP_CMDS || step == RHD_SWEEP_CMDS + 2) << f;
+  }
+  EXPECT_EQ(rhd_stream_overruns(&s), 0u);
+}
+
+TEST(RHDStream, Thread) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  static uint16_t slots[64][RHD_FRAME_CH];
+  uint16_t(*frames)[RHD_FRAME_CH];
+  stream_dev_init(&dev);
+  rhd_stream_init(&s, &dev, slots, 64, 4);
+
+  ASSERT_EQ(rhd_stream_start(&s), 0);
+  EXPECT_EQ(rhd_stream_start(&s), -1);
+
+  // Every frame must come from a single, complete sweep
+  size_t n_read = 0;
+  while (n_read < 1000) {
+    size_t n = rhd_stream_borrow(&s, &frames);
+    for (size_t i = 0; i < n; i++) {
+      for (int ch = 1; ch < RHD_SWEEP_CMDS; ch++) {
+        EXPECT_EQ(((frames[i][ch] >> 1) - (frames[i][0] >> 1)) & 0x7FFF, ch);
+      }
+      n_read++;
+    }
+    rhd_stream_release(&s, n);
+  }
+  EXPECT_EQ(rhd_stream_stop(&s), 0);
+}
+
+TEST(RHDStream, ReadFromThread) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  static uint16_t slots[64][RHD_FRAME_CH];
+  static uint16_t out[1000][RHD_FRAME_CH];
+  stream_dev_init(&dev);
+  rhd_stream_init(&s, &dev, slots, 64, 4);
+
+  ASSERT_EQ(rhd_stream_start(&s), 0);
+  EXPECT_EQ(rhd_stream_read(&s, out, 1000, 0), 1000u);
+  EXPECT_EQ(rhd_stream_stop(&s), 0);
+  for (int f = 0; f < 1000; f++) {
+    EXPECT_EQ(((out[f][31] >> 1) - (out[f][0] >> 1)) & 0x7FFF, 31);
+  }
+
+}
+
+TEST(RHDStream, ReadTimeout) {
+  rhd_device_t dev;
+  rhd_stream_t s;
+  rhd_timer_t timer;
+  uint16_t slots[8][RHD_FRAME_CH];
+  uint16_t out[100][RHD_FRAME_CH];
+  stream_dev_init(&dev);
+  rhd_stream_init(&s, &dev, slots, 8, 1);
+  rhd_timer_init(&timer, 100.0f);
+  rhd_stream_set_timer(&s, &timer);
+
+  // 100 Hz, about 5 frames in 50 ms
+  ASSERT_EQ(rhd_stream_start(&s), 0);
+  size_t n = rhd_stream_read(&s, out, 100, 50);
+  EXPECT_EQ(rhd_stream_stop(&s), 0);
+  EXPECT_GT(n, 0u);
+  EXPECT_LT(n, 100u);
+}
@@ -1,38 +1,56 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <gtest/gtest.h>
+#include <thread>
+#include <vector>
 
 extern "C" {
 #include "rhd.h"
 }
 
-TEST(RHD, DupeUnsplit) {
-  uint8_t a[] = {135, 42, 187, 91,  14,  239, 55,  178, 63, 105,
-                 200, 33, 76,  162, 208, 4,   117, 88,  22, 195};
-  for (int i = 0; i < sizeof(a); i++) {
-    uint8_t ta;
-    uint8_t tb;
-    int ret = rhd_duplicate_bits(a[i]);
-    rhd_unsplit_u16(ret, &ta, &tb);
-    EXPECT_EQ(ta, a[i]);
+/* Duplicate every bit of a byte, like the DDR command encoding */
+static uint16_t dup_bits(uint8_t val) {
+  uint16_t out = 0;
+  for (int i = 0; i < 8; i++) {
+    out |= ((val >> i) & 1) * (0x3 << (2 * i));
   }
+  return out;
 }
 
-TEST(RHD, DuplicateBits) {
-  int val[] = {0xAA, 0x55};
-  int exp[] = {0xCCCC, 0x3333};
-  for (int i = 0; i < sizeof(val) / sizeof(int); i++) {
-    int ret = rhd_duplicate_bits(val[i]);
-    EXPECT_EQ(ret, exp[i]);
+/* Answers the two words of words_rx to every command */
+static uint16_t words_rx[2];
+
+int rw_words(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)tx_buf;
+  rx_buf[0] = words_rx[0];
+  rx_buf[1] = words_rx[1];
+  return len;
+}
+
+TEST(RHD, DupeUnsplit) {
+  uint8_t a[] = {135, 42, 187, 91,  14,  239, 55,  178, 63, 105,
+                 200, 33, 76,  162, 208, 4,   117, 88,  22, 195};
+  rhd_device_t dev;
+  uint16_t rx[2];
+  rhd_init(&dev, 1, rw_words);
+  for (size_t i = 0; i < sizeof(a); i++) {
+    words_rx[0] = words_rx[1] = dup_bits(a[i]);
+    rhd2164_sample(&dev, 0, rx);
+    EXPECT_EQ(rx[0], ((a[i] << 8) | a[i]) | 1);
+    EXPECT_EQ(rx[1], ((a[i] << 8) | a[i]) | 1);
   }
 }
 
 TEST(RHD, UnsplitMiso) {
-  int val[] = {0xCCCC, 0x3333};
-  int exp[] = {0xAA, 0x55};
-  for (int i = 0; i < sizeof(val) / sizeof(int); i++) {
-    uint8_t ret, dum;
-    rhd_unsplit_u16(val[i], &ret, &dum);
-    EXPECT_EQ(ret, exp[i]);
-  }
+  rhd_device_t dev;
+  uint16_t rx[2];
+  rhd_init(&dev, 1, rw_words);
+  words_rx[0] = 0xCCCC;
+  words_rx[1] = 0x3333;
+  rhd2164_sample(&dev, 0, rx);
+  EXPECT_EQ(rx[0], 0xAA55);
+  EXPECT_EQ(rx[1], 0xAA55);
 }
 
 /**
@@ -44,143 +62,1084 @@ int rw(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
   return len;
 }
 
-TEST(RHD, RhdInit) {
-  rhd_device_t dev;
+/* Same answers as rw, keeping the words sent by the last call */
+static uint16_t cap_tx[4];
+static size_t cap_len = 0;
 
-  rhd_init(&dev, 0, rw);
-  EXPECT_EQ(rhd_send(&dev, 0, 0), 1);
+int rw_cap(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  cap_len = len;
+  memcpy(cap_tx, tx_buf, (len < 4 ? len : 4) * sizeof(uint16_t));
+  return rw(tx_buf, rx_buf, len);
+}
 
-  rhd_init(&dev, 1, rw);
-  EXPECT_EQ(rhd_send(&dev, 0, 0), 2);
+TEST(RHD, DuplicateBits) {
+  rhd_device_t dev;
+  rhd_init(&dev, 1, rw_cap);
+  rhd_send(&dev, 0xAA, 0x55);
+  EXPECT_EQ(cap_tx[0], 0xCCCC);
+  EXPECT_EQ(cap_tx[1], 0x3333);
+  EXPECT_EQ(cap_len, 2u);
 }
 
-TEST(RHD, RhdSendRaw) {
+TEST(RHD, RhdInit) {
   rhd_device_t dev;
-  rhd_init(&dev, 0, rw);
-  int len = rhd_send_raw(&dev, 0xAA);
-  EXPECT_EQ(dev.tx_buf[0], 0xAA);
-  EXPECT_EQ(len, 1);
 
-  rhd_init(&dev, 1, rw);
-  len = rhd_send_raw(&dev, 0xAA);
-  EXPECT_EQ(dev.tx_buf[0], 0xAA);
-  EXPECT_EQ(len, 2);
+  // Never answers INTAN
+  EXPECT_NE(rhd_init(&dev, 0, rw), 0);
+  EXPECT_NE(rhd_init(&dev, 1, rw), 0);
 }
 
 TEST(RHD, RhdSend) {
   rhd_device_t dev;
-  rhd_init(&dev, 0, rw);
-  int len = rhd_send(&dev, 0xAA, 0x55);
-  EXPECT_EQ(dev.tx_buf[0] & 0xFF00, (0xAA) << 8);
-  EXPECT_EQ(dev.tx_buf[0] & 0xFF, 0x55);
-  EXPECT_EQ(len, 1);
+  rhd_init(&dev, 0, rw_cap);
+  EXPECT_EQ(rhd_send(&dev, 0xAA, 0x55), 0xAA);
+  EXPECT_EQ(cap_tx[0], 0xAA55);
+  EXPECT_EQ(cap_len, 1u);
 
-  rhd_init(&dev, 1, rw);
-  len = rhd_send(&dev, 0xAA, 0x55);
-  EXPECT_EQ(dev.tx_buf[0], 0xCCCC);
-  EXPECT_EQ(dev.tx_buf[1], 0x3333);
-  EXPECT_EQ(len, 2);
+  rhd_init(&dev, 1, rw_cap);
+  EXPECT_EQ(rhd_send(&dev, 0xAA, 0x55), 0x00);
+  EXPECT_EQ(cap_tx[0], 0xCCCC);
+  EXPECT_EQ(cap_tx[1], 0x3333);
+  EXPECT_EQ(cap_len, 2u);
 }
 
 TEST(RHD, RhdRead) {
   rhd_device_t dev;
-  rhd_init(&dev, 0, rw);
-  int ret = rhd_r(&dev, 0x0F);
-  EXPECT_EQ(dev.tx_buf[0] & 0xFF00, 0xCF00);
-  EXPECT_EQ(ret, 0xAA);
-  EXPECT_EQ(dev.rx_buf[0], 0xAAAA);
-  EXPECT_EQ(dev.rx_buf[1], 0x5555);
+  rhd_init(&dev, 0, rw_cap);
+  EXPECT_EQ(rhd_r(&dev, 0x0F), 0xAA);
+  EXPECT_EQ(cap_tx[0], 0xCF00);
 
-  rhd_init(&dev, 1, rw);
-  ret = rhd_r(&dev, 0x0F);
-  EXPECT_EQ(dev.tx_buf[0], 0xF0FF);
-  EXPECT_EQ(ret, 0x0);
-  EXPECT_EQ(dev.rx_buf[0], 0xAAAA);
-  EXPECT_EQ(dev.rx_buf[1], 0x5555);
+  rhd_init(&dev, 1, rw_cap);
+  EXPECT_EQ(rhd_r(&dev, 0x0F), 0x0);
+  EXPECT_EQ(cap_tx[0], 0xF0FF);
+  EXPECT_EQ(cap_tx[1], 0x0000);
 }
 
 TEST(RHD, RhdWrite) {
   rhd_device_t dev;
-  rhd_init(&dev, 0, rw);
-  int len = rhd_w(&dev, 0x0F, 0x55);
-  EXPECT_EQ(dev.tx_buf[0] & 0xFF00, 0x8F00);
-  EXPECT_EQ(dev.tx_buf[0] & 0xFF, 0x55);
-  EXPECT_EQ(len, 1);
+  rhd_init(&dev, 0, rw_cap);
+  rhd_w(&dev, 0x0F, 0x55);
+  EXPECT_EQ(cap_tx[0], 0x8F55);
+  EXPECT_EQ(cap_len, 1u);
 
-  rhd_init(&dev, 1, rw);
-  len = rhd_w(&dev, 0x0F, 0x55);
-  EXPECT_EQ(dev.tx_buf[0], 0xC0FF);
-  EXPECT_EQ(dev.tx_buf[1], 0x3333);
-  EXPECT_EQ(len, 2);
+  rhd_init(&dev, 1, rw_cap);
+  rhd_w(&dev, 0x0F, 0x55);
+  EXPECT_EQ(cap_tx[0], 0xC0FF);
+  EXPECT_EQ(cap_tx[1], 0x3333);
+  EXPECT_EQ(cap_len, 2u);
 }
 
 TEST(RHD, RhdClearCalib) {
   rhd_device_t dev;
-  rhd_init(&dev, 0, rw);
-  int len = rhd_clear_calib(&dev);
-  EXPECT_EQ(dev.tx_buf[0], 0b01101010 << 8);
-  EXPECT_EQ(len, 1);
+  rhd_init(&dev, 0, rw_cap);
+  rhd_clear_calib(&dev);
+  EXPECT_EQ(cap_tx[0], 0x6A << 8);
+  EXPECT_EQ(cap_len, 1u);
 
-  rhd_init(&dev, 1, rw);
-  len = rhd_clear_calib(&dev);
-  EXPECT_EQ(dev.tx_buf[0], 0b0011110011001100);
-  EXPECT_EQ(len, 2);
+  rhd_init(&dev, 1, rw_cap);
+  rhd_clear_calib(&dev);
+  EXPECT_EQ(cap_tx[0], 0x3CCC);
+  EXPECT_EQ(cap_len, 2u);
 }
 
 TEST(RHD, RhdSample) {
-  extern int RHD_CHANNEL_MAP[32];
-
   rhd_device_t dev;
-  rhd_init(&dev, 0, rw);
-  int ch = 10;
+  uint16_t rx[2];
+  const int ch = 10;
 
-  int len = rhd_sample(&dev, ch);
-  EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[ch]], 0xAAAA | 1);
-  EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[ch + 32]], 0x5555);
-  EXPECT_EQ(len, 1);
+  rhd_init(&dev, 0, rw_cap);
+  rhd2164_sample(&dev, ch, rx);
+  EXPECT_EQ(cap_tx[0], ch << 8);
+  EXPECT_EQ(rx[0], 0xAAAA);
+  EXPECT_EQ(rx[1], 0x5555);
 
-  rhd_init(&dev, 1, rw);
-  len = rhd_sample(&dev, ch);
-  EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[ch]], 0xFF00 | 1);
-  EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[ch + 32]], 0x00FF | 1);
-  EXPECT_EQ(len, 2);
+  rhd_init(&dev, 1, rw_cap);
+  rhd2164_sample(&dev, ch, rx);
+  EXPECT_EQ(cap_tx[0], dup_bits(ch));
+  EXPECT_EQ(cap_len, 2u);
+  EXPECT_EQ(rx[0], 0xFF00 | 1);
+  EXPECT_EQ(rx[1], 0x00FF | 1);
 }
 
-TEST(RHD, RhdSampleAll) {
-  extern const uint16_t RHD_ADC_CH_CMD[32];
-  extern const uint16_t RHD_ADC_CH_CMD_DOUBLE[32];
-  extern int RHD_CHANNEL_MAP[32];
+/* Answers 0xAAAA on MISO A and 0x5555 on MISO B to every command */
+int rw_fill(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)tx_buf;
+  for (size_t i = 0; i < 2 * len; i++) {
+    rx_buf[i] = i % 2 ? 0x5555 : 0xAAAA;
+  }
+  return len;
+}
 
+TEST(RHD, RhdSampleAll) {
   rhd_device_t dev;
-  rhd_init(&dev, 0, rw);
-  rhd_sample_all(&dev);
-  EXPECT_EQ(dev.tx_buf[0], RHD_ADC_CH_CMD[0]);
-  EXPECT_EQ(dev.sample_buf[0] & 1, 0); // Check channel 0 lsb == 0
-  EXPECT_EQ(dev.sample_buf[1] & 1, 1); // Check other channel lsb
+  uint16_t buf[RHD_FRAME_CH];
+  rhd_init(&dev, 0, rw_fill);
+  rhd2164_sample_all(&dev, buf);
+  EXPECT_EQ(buf[0] & 1, 0); // Check channel 0 lsb == 0
+  EXPECT_EQ(buf[1] & 1, 0);
 
   // Check all channel values
-  EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[0]] & 0xFFFE, 0xAAAA & 0xFFFE);
-  EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[32]] & 0xFFFE, 0x5555 & 0xFFFE);
+  for (int i = 0; i < 32; i++) {
+    EXPECT_EQ(buf[i] & 0xFFFE, 0xAAAA);
+    EXPECT_EQ(buf[i + 32] & 0xFFFE, 0x5555 & 0xFFFE);
+  }
+}
+
+/**
+ * Pipelined mock: every command returns its channel (A) and channel + 32 (B)
+ * 2 commands later, like the RHD2164 does.
+ */
+static bool pipe_ddr = false;
+static int pipe_calls = 0;
+static uint16_t pipe_hist[2] = {0};
+
+static uint16_t pipe_interleave(uint8_t a, uint8_t b) {
+  uint16_t out = 0;
+  for (int i = 0; i < 8; i++) {
+    out |= ((a >> i) & 1) << (2 * i + 1);
+    out |= ((b >> i) & 1) << (2 * i);
+  }
+  return out;
+}
+
+static uint8_t pipe_odd_bits(uint16_t val) {
+  uint8_t out = 0;
+  for (int i = 0; i < 8; i++) {
+    out |= ((val >> (2 * i + 1)) & 1) << i;
+  }
+  return out;
+}
+
+int rw_pipe(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  size_t n_cmds = pipe_ddr ? len / 2 : len;
+  for (size_t i = 0; i < n_cmds; i++) {
+    uint16_t cmd;
+    if (pipe_ddr) {
+      cmd = (pipe_odd_bits(tx_buf[2 * i]) << 8) |
+            pipe_odd_bits(tx_buf[2 * i + 1]);
+    } else {
+      cmd = tx_buf[i];
+    }
+    uint16_t ch = pipe_hist[0];
+    pipe_hist[0] = pipe_hist[1];
+    pipe_hist[1] = (cmd >> 8) & 0x3F;
+
+    uint16_t a = ch << 4;
+    uint16_t b = (ch + 32) << 4;
+    if (pipe_ddr) {
+      rx_buf[2 * i] = pipe_interleave(a >> 8, b >> 8);
+      rx_buf[2 * i + 1] = pipe_interleave(a & 0xFF, b & 0xFF);
+    } else {
+      rx_buf[2 * i] = a;
+      rx_buf[2 * i + 1] = b;
+    }
+  }
+  pipe_calls++;
+  return len;
+}
+
+TEST(RHD, RhdSampleAllBatched) {
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    pipe_ddr = ddr;
+    rhd_init(&dev, ddr, rw_pipe);
+
+    uint16_t buf[RHD_FRAME_CH] = {0};
+    rhd2164_sample_all(&dev, buf); // fill the pipeline
+    pipe_calls = 0;
+    rhd2164_sample_all(&dev, buf);
+    EXPECT_EQ(pipe_calls, 1);
+
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      EXPECT_EQ(buf[ch] & 0xFFFE, ch << 4);
+    }
+    EXPECT_EQ(buf[0] & 1, 0);
+  }
+}
+
+TEST(RHD, RhdSampleFrames) {
+  const int n_frames = 5;
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    pipe_ddr = ddr;
+    rhd_init(&dev, ddr, rw_pipe);
+
+    uint16_t out[n_frames][RHD_FRAME_CH] = {{0}};
+
+    // Default buffers: one rw call per sweep, plus the 2 flush commands
+    pipe_calls = 0;
+    rhd2164_sample_frames(&dev, n_frames, out);
+    EXPECT_EQ(pipe_calls, n_frames + 1);
+
+    // A large enough buffer sends the whole burst at once
+    uint16_t tx[(n_frames * RHD_SWEEP_CMDS + 2) * 2];
+    uint16_t rx[(n_frames * RHD_SWEEP_CMDS + 2) * 2];
+    rhd_set_burst_buf(&dev, tx, rx, sizeof(rx) / sizeof(uint16_t));
+    pipe_calls = 0;
+    rhd2164_sample_frames(&dev, n_frames, out);
+    EXPECT_EQ(pipe_calls, 1);
+
+    for (int f = 0; f < n_frames; f++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(out[f][ch] & 0xFFFE, ch << 4);
+      }
+      EXPECT_EQ(out[f][0] & 1, 0);
+    }
+
+    // Chunks that straddle frame boundaries
+    memset(out, 0, sizeof(out));
+    rhd_set_burst_buf(&dev, tx, rx, 14);
+    rhd2164_sample_frames(&dev, n_frames, out);
+    for (int f = 0; f < n_frames; f++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(out[f][ch] & 0xFFFE, ch << 4);
+      }
+    }
+  }
+}
+
+TEST(RHD, RhdUnsplitFrame) {
+  const int n = 256;
+  uint16_t rx[2 * n];
+  uint16_t a[n], b[n];
+
+  // Every 16-bit pattern shows up in both the MSB and LSB words
+  for (int i = 0; i < 2 * n; i++) {
+    rx[i] = (uint16_t)(i * 40503u + 0x1234);
+  }
+  for (int pass = 0; pass < 256; pass++) {
+    for (int i = 0; i < 2 * n; i++) {
+      rx[i] = (uint16_t)(rx[i] + 257 * pass);
+    }
+    rhd_unsplit_frame(rx, a, b, n);
+    for (int i = 0; i < n; i++) {
+      uint16_t exp_a = (pipe_odd_bits(rx[2 * i]) << 8) |
+                       pipe_odd_bits(rx[2 * i + 1]);
+      uint16_t exp_b = (pipe_odd_bits(rx[2 * i] << 1) << 8) |
+                       pipe_odd_bits(rx[2 * i + 1] << 1);
+      ASSERT_EQ(a[i], exp_a | 1);
+      ASSERT_EQ(b[i], exp_b | 1);
+    }
+  }
+}
+
+/**
+ * Asynchronous mock: transfers are queued on submit and run through rw_pipe
+ * on complete, like a DMA engine finishing in order.
+ */
+struct pipe_async_xfer {
+  uint16_t *tx;
+  uint16_t *rx;
+  size_t len;
+};
+static pipe_async_xfer pipe_queue[4];
+static int pipe_submitted = 0;
+static int pipe_completed = 0;
+static int pipe_max_inflight = 0;
+
+int pipe_submit(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  (void)ctx;
+  pipe_queue[pipe_submitted % 4] = {tx_buf, rx_buf, len};
+  int inflight = pipe_submitted + 1 - pipe_completed;
+  pipe_max_inflight = inflight > pipe_max_inflight ? inflight : pipe_max_inflight;
+  return pipe_submitted++;
+}
+
+int pipe_complete(void *ctx, int ticket) {
+  (void)ctx;
+  EXPECT_EQ(ticket, pipe_completed);
+  pipe_async_xfer x = pipe_queue[ticket % 4];
+  pipe_completed++;
+  return rw_pipe(x.tx, x.rx, x.len);
+}
+
+TEST(RHD, RhdSampleFramesAsync) {
+  const int n_frames = 4;
+  const rhd_rw_async_t async = {pipe_submit, NULL, pipe_complete, NULL};
+
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    pipe_ddr = ddr;
+    rhd_init_async(&dev, ddr, &async);
+
+    uint16_t out[n_frames][RHD_FRAME_CH] = {{0}};
+    pipe_max_inflight = 0;
+    rhd2164_sample_frames(&dev, n_frames, out);
+    EXPECT_EQ(pipe_max_inflight, 2);
+    EXPECT_EQ(pipe_submitted, pipe_completed);
+
+    for (int f = 0; f < n_frames; f++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(out[f][ch] & 0xFFFE, ch << 4);
+      }
+    }
+  }
+}
+
+/**
+ * Recording mock: logs every command sent, and how many transfers were used.
+ * DDR transfers only receive `len` words, set `rec_ddr` to match the device.
+ */
+static uint16_t rec_cmds[256];
+static size_t rec_n = 0;
+static int rec_calls = 0;
+static bool rec_ddr = false;
+
+int rw_rec(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  for (size_t i = 0; i < len && rec_n < 256; i++) {
+    rec_cmds[rec_n++] = tx_buf[i];
+  }
+  memset(rx_buf, 0, (rec_ddr ? len : 2 * len) * sizeof(uint16_t));
+  rec_calls++;
+  return len;
+}
+
+static void rec_reset() {
+  rec_n = 0;
+  rec_calls = 0;
+}
+
+TEST(RHD, RhdCfgSkipsUnchanged) {
+  rhd_device_t dev;
+  rhd_init(&dev, false, rw_rec);
+
+  rec_reset();
+  rhd_cfg_ch(&dev, 0xFFFFFFFF, 0xFFFFFFFF);
+  EXPECT_EQ(rec_n, 8u);
+
+  rec_reset();
+  rhd_cfg_ch(&dev, 0xFFFFFFFF, 0xFFFFFFFF);
+  EXPECT_EQ(rec_n, 0u);
+
+  rec_reset();
+  rhd_cfg_ch(&dev, 0xFFFF00FF, 0xFFFFFFFF);
+  ASSERT_EQ(rec_n, 1u);
+  EXPECT_EQ(rec_cmds[0], ((0x80 | IND_AMP_PWR_1) << 8) | 0x00);
+
+  // Raw writes keep the shadow coherent
+  rhd_w(&dev, IND_AMP_PWR_1, 0xFF);
+  rec_reset();
+  rhd_cfg_ch(&dev, 0xFFFFFFFF, 0xFFFFFFFF);
+  EXPECT_EQ(rec_n, 0u);
+
+  rhd_cfg_invalidate(&dev);
+  rec_reset();
+  rhd_cfg_ch(&dev, 0xFFFFFFFF, 0xFFFFFFFF);
+  EXPECT_EQ(rec_n, 8u);
+}
+
+TEST(RHD, RhdCfgBatchFlush) {
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    rec_ddr = ddr;
+    rhd_init(&dev, ddr, rw_rec);
+    rhd_cfg_ch(&dev, 0xFFFFFFFF, 0xFFFFFFFF);
+    rhd_cfg_amp_bw(&dev, 10, 1000);
+
+    rec_reset();
+    rhd_cfg_begin(&dev);
+    EXPECT_EQ(rhd_cfg_ch(&dev, 0x0000FFFF, 0xFFFFFFFF), 0);
+    rhd_cfg_amp_bw(&dev, 10, 1000);
+    EXPECT_EQ(rec_n, 0u);
+
+    EXPECT_EQ(rhd_cfg_flush(&dev), 2);
+    EXPECT_EQ(rec_calls, 1);
+    ASSERT_EQ(rec_n, ddr ? 4u : 2u);
+    uint16_t exp[2] = {((0x80 | IND_AMP_PWR_2) << 8) | 0x00,
+                       ((0x80 | IND_AMP_PWR_3) << 8) | 0x00};
+    for (int i = 0; i < 2; i++) {
+      if (ddr) {
+        uint8_t hi = exp[i] >> 8, lo = exp[i] & 0xFF;
+        EXPECT_EQ(rec_cmds[2 * i], pipe_interleave(hi, hi));
+        EXPECT_EQ(rec_cmds[2 * i + 1], pipe_interleave(lo, lo));
+      } else {
+        EXPECT_EQ(rec_cmds[i], exp[i]);
+      }
+    }
+
+    // Nothing left to flush, and writes go through again
+    rec_reset();
+    EXPECT_EQ(rhd_cfg_flush(&dev), 0);
+    EXPECT_EQ(rec_calls, 0);
+    rhd_cfg_ch(&dev, 0xFFFFFFFF, 0xFFFFFFFF);
+    EXPECT_EQ(rec_n, ddr ? 4u : 2u);
+  }
+  rec_ddr = false;
+}
+
+/**
+ * Register file mock: reads and writes registers with the 2-command pipeline
+ * latency of the chip.
+ */
+static uint8_t chip_regs[64];
+static uint8_t chip_hist[2];
+
+static void chip_reset() {
+  memset(chip_regs, 0, sizeof(chip_regs));
+  memcpy(&chip_regs[INTAN_0], "INTAN", 5);
+  chip_regs[DIE_REV] = 1;
+  chip_regs[NB_AMP] = 64;
+  chip_regs[CHIP_ID] = 4;
+  chip_hist[0] = chip_hist[1] = 0;
+}
+
+int rw_chip(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  size_t n_cmds = pipe_ddr ? len / 2 : len;
+  for (size_t i = 0; i < n_cmds; i++) {
+    uint16_t cmd;
+    if (pipe_ddr) {
+      cmd = (pipe_odd_bits(tx_buf[2 * i]) << 8) |
+            pipe_odd_bits(tx_buf[2 * i + 1]);
+    } else {
+      cmd = tx_buf[i];
+    }
+    uint8_t reg = (cmd >> 8) & 0x3F;
+    uint8_t res = 0;
+    if ((cmd >> 14) == 0b11) {
+      res = chip_regs[reg];
+    } else if ((cmd >> 14) == 0b10) {
+      chip_regs[reg] = cmd & 0xFF;
+      res = cmd & 0xFF;
+    }
+    uint8_t a = chip_hist[0];
+    chip_hist[0] = chip_hist[1];
+    chip_hist[1] = res;
+    if (pipe_ddr) {
+      rx_buf[2 * i] = 0;
+      rx_buf[2 * i + 1] = pipe_interleave(a, 0);
+    } else {
+      rx_buf[2 * i] = a;
+      rx_buf[2 * i + 1] = 0;
+    }
+  }
+  rec_calls++;
+  return len;
+}
+
+TEST(RHD, RhdReadRegs) {
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    pipe_ddr = ddr;
+    chip_reset();
+
+    rec_reset();
+    EXPECT_EQ(rhd_init(&dev, ddr, rw_chip), 0);
+    EXPECT_EQ(rec_calls, 1);
+
+    rec_reset();
+    EXPECT_EQ(rhd_read_force(&dev, CHIP_ID), 4);
+    EXPECT_EQ(rec_calls, 1);
+
+    rhd_chip_info_t info;
+    rhd_chip_info(&dev, &info);
+    EXPECT_EQ(info.die_rev, 1);
+    EXPECT_EQ(info.n_amps, 64);
+    EXPECT_EQ(info.chip_id, 4);
+
+    // More registers than fit in one transfer
+    uint16_t regs[40];
+    uint8_t vals[40];
+    for (int i = 0; i < 40; i++) {
+      regs[i] = (i * 7) % 64;
+      chip_regs[regs[i]] = regs[i] + 100;
+    }
+    rec_reset();
+    rhd_read_regs(&dev, regs, vals, 40);
+    EXPECT_EQ(rec_calls, 2);
+    for (int i = 0; i < 40; i++) {
+      EXPECT_EQ(vals[i], chip_regs[regs[i]]);
+    }
+
+    memcpy(&chip_regs[INTAN_0], "INTAN", 5);
+    EXPECT_EQ(rhd_sanity_check(&dev), 0);
+    chip_regs[INTAN_2] = 'X';
+    EXPECT_EQ(rhd_sanity_check(&dev), INTAN_2);
+  }
+}
+
+TEST(RHD, RhdDumpRegsFillsShadow) {
+  rhd_device_t dev;
+  pipe_ddr = false;
+  chip_reset();
+  rhd_init(&dev, false, rw_chip);
+  for (int reg = IND_AMP_PWR_0; reg <= IND_AMP_PWR_7; reg++) {
+    chip_regs[reg] = 0xFF;
+  }
+
+  uint8_t vals[RHD_SHADOW_REGS];
+  rhd_dump_regs(&dev, vals);
+  EXPECT_EQ(vals[IND_AMP_PWR_3], 0xFF);
+
+  // The shadow now knows the channels are already enabled
+  rec_reset();
+  rhd_cfg_ch(&dev, 0xFFFFFFFF, 0xFFFFFFFF);
+  EXPECT_EQ(rec_calls, 0);
+}
+
+TEST(RHD, RhdSparseSampling) {
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    pipe_ddr = ddr;
+    rhd_init(&dev, ddr, rw_pipe);
+
+    // Channels 0-7 and their MISO B pairs 32-39, plus channel 20 alone
+    uint32_t ch_h = 0xFF000000;
+    rhd_cfg_ch(&dev, 0x000000FF | (1 << 20), ch_h);
+    EXPECT_EQ(dev.n_sweep, 32u);
+    EXPECT_EQ(rhd_cfg_sparse(&dev, true), 17);
+    EXPECT_EQ(dev.n_sweep, 9u);
+
+    const uint8_t exp_map[17] = {0,  1,  2,  3,  4,  5,  6,  7, 20,
+                                 32, 33, 34, 35, 36, 37, 38, 39};
+    for (int i = 0; i < 17; i++) {
+      EXPECT_EQ(dev.ch_map[i], exp_map[i]);
+    }
+
+    uint16_t frames[3][RHD_FRAME_CH];
+    pipe_calls = 0;
+    rhd2164_sample_frames(&dev, 3, frames);
+    // 3 * 9 + 2 commands fit in a single sweep buffer
+    EXPECT_EQ(pipe_calls, 1);
+    for (int f = 0; f < 3; f++) {
+      for (int i = 0; i < 17; i++) {
+        EXPECT_EQ(frames[f][i] & 0xFFFE, dev.ch_map[i] << 4);
+      }
+      EXPECT_EQ(frames[f][0] & 1, 0);
+    }
+
+    uint16_t buf[RHD_FRAME_CH];
+    rhd2164_sample_all(&dev, buf); // fill the pipeline
+    rhd2164_sample_all(&dev, buf);
+    for (int i = 0; i < 17; i++) {
+      EXPECT_EQ(buf[i] & 0xFFFE, dev.ch_map[i] << 4);
+    }
+
+    // A new mask rebuilds the sweep
+    rhd_cfg_ch(&dev, 0x0000FFFF, 0xFFFF0000);
+    EXPECT_EQ(dev.n_sweep, 16u);
+    EXPECT_EQ(dev.n_ch, 32u);
+
+    EXPECT_EQ(rhd_cfg_sparse(&dev, false), 64);
+    EXPECT_EQ(dev.n_sweep, 32u);
+  }
+}
+
+TEST(RHD, RhdCfgFsFollowsSweep) {
+  rhd_device_t dev;
+  pipe_ddr = false;
+  chip_reset();
+  rhd_init(&dev, false, rw_chip);
+
+  // 30 kS/s * 32 commands = 960 kS/s, highest ADC bias
+  rhd_cfg_fs(&dev, 30000, 0);
+  EXPECT_EQ(dev.regs[MUX_BIAS_CURR], 4);
+
+  // 4 commands per frame, 120 kS/s
+  rhd_cfg_ch(&dev, 0x0000000F, 0xF0000000);
+  rhd_cfg_sparse(&dev, true);
+  EXPECT_EQ(dev.regs[MUX_BIAS_CURR], 40);
+  EXPECT_EQ(chip_regs[MUX_BIAS_CURR], 40);
+}
+
+TEST(RHD, RhdAuxSlots) {
+  const uint16_t cmds[4] = {RHD_CMD_CONVERT(RHD_CH_SUPPLY),
+                            RHD_CMD_CONVERT(RHD_CH_TEMP),
+                            RHD_CMD_CONVERT(RHD_CH_AUX1), RHD_CMD_READ(40)};
+  const uint16_t exp[4] = {RHD_CH_SUPPLY << 4, RHD_CH_TEMP << 4,
+                           RHD_CH_AUX1 << 4, 40 << 4};
+  for (int sparse = 0; sparse < 2; sparse++) {
+    for (int ddr = 0; ddr < 2; ddr++) {
+      rhd_device_t dev;
+      uint16_t results[4];
+      pipe_ddr = ddr;
+      rhd_init(&dev, ddr, rw_pipe);
+      if (sparse) {
+        rhd_cfg_ch(&dev, 0x0000000F, 0xF0000000);
+        rhd_cfg_sparse(&dev, true);
+      }
+      size_t n_conv = dev.n_conv;
+
+      EXPECT_EQ(rhd_aux_set(&dev, cmds, 4, 33, results), -1);
+      ASSERT_EQ(rhd_aux_set(&dev, cmds, 4, 3, results), 0);
+      EXPECT_EQ(dev.n_sweep, n_conv + 3);
+
+      uint16_t frames[5][RHD_FRAME_CH];
+      rhd2164_sample_frames(&dev, 5, frames);
+      for (int f = 0; f < 5; f++) {
+        for (size_t i = 0; i < dev.n_ch; i++) {
+          EXPECT_EQ(frames[f][i] & 0xFFFE, dev.ch_map[i] << 4);
+        }
+      }
+      for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(results[i], exp[i]) << "aux " << i;
+      }
+      // 15 auxiliary slots went out
+      EXPECT_EQ(dev.aux_next, 3u);
+
+      uint16_t buf[RHD_FRAME_CH];
+      memset(results, 0, sizeof(results));
+      for (int i = 0; i < 3; i++) {
+        rhd2164_sample_all(&dev, buf);
+      }
+      for (size_t i = 0; i < dev.n_ch; i++) {
+        EXPECT_EQ(buf[i] & 0xFFFE, dev.ch_map[i] << 4);
+      }
+      for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(results[i], exp[i]) << "aux " << i;
+      }
+
+      rhd_aux_set(&dev, NULL, 0, 0, NULL);
+      EXPECT_EQ(dev.n_sweep, n_conv);
+    }
+  }
+}
+
+TEST(RHD, RhdSampleBlock) {
+  const size_t n_frames = 40;
+  const size_t len = RHD_BLOCK_LEN(n_frames);
+  EXPECT_EQ(len, 64u);
+  alignas(RHD_BLOCK_ALIGN) static uint16_t block[RHD_FRAME_CH * 64];
+
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    pipe_ddr = ddr;
+    rhd_init(&dev, ddr, rw_pipe);
 
-  for (int i = 1; i < 32; i++) {
-    EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[i]] & 0xFFFE, 0xAAAA);
-    EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[i + 32]] & 0xFFFE,
-              0x5555 & 0xFFFE);
+    // Chunks that straddle frame boundaries
+    uint16_t tx[2 * 50], rx[2 * 50];
+    rhd_set_burst_buf(&dev, tx, rx, 2 * 50);
+    memset(block, 0, sizeof(block));
+    EXPECT_GE(rhd2164_sample_block(&dev, n_frames, block, len), 0);
+    for (size_t ch = 0; ch < RHD_FRAME_CH; ch++) {
+      for (size_t t = 0; t < n_frames; t++) {
+        EXPECT_EQ(block[ch * len + t] & 0xFFFE, ch << 4);
+      }
+    }
+    for (size_t t = 0; t < n_frames; t++) {
+      EXPECT_EQ(block[t] & 1, 0);
+    }
+
+    // Channel list rows follow ch_map
+    rhd_cfg_ch(&dev, 0x000000F0, 0x0F000000);
+    EXPECT_EQ(rhd_cfg_sparse(&dev, true), 8);
+    memset(block, 0, sizeof(block));
+    EXPECT_GE(rhd2164_sample_block(&dev, n_frames, block, len), 0);
+    for (size_t i = 0; i < 8; i++) {
+      for (size_t t = 0; t < n_frames; t++) {
+        EXPECT_EQ(block[i * len + t] & 0xFFFE, dev.ch_map[i] << 4);
+      }
+    }
+
+    // Misaligned block, unaligned rows, or too many frames
+    EXPECT_EQ(rhd2164_sample_block(&dev, n_frames, block + 1, len), -1);
+    EXPECT_EQ(rhd2164_sample_block(&dev, n_frames, block, 48), -1);
+    EXPECT_EQ(rhd2164_sample_block(&dev, len + 1, block, len), -1);
   }
+}
+
+TEST(RHD, RhdPreset) {
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    rhd_preset_t emg, wide;
+    pipe_ddr = ddr;
+    chip_reset();
+    rhd_init(&dev, ddr, rw_chip);
 
-  return;
+    rhd_preset_compile(&emg, 2000, 20, 500, true, 10, 0xFFFFFFFF, 0xFFFFFFFF);
+    rhd_preset_compile(&wide, 20000, 0.1, 7500, false, 0, 0x0000FFFF,
+                       0xFFFF0000);
+    EXPECT_EQ(emg.ch_mask, ~0ULL);
+    EXPECT_EQ(wide.ch_mask, 0x0000FFFF0000FFFFULL);
 
-  rhd_init(&dev, 1, rw);
-  rhd_sample_all(&dev);
-  EXPECT_EQ(dev.tx_buf[0], RHD_ADC_CH_CMD_DOUBLE[0]);
-  EXPECT_EQ(dev.sample_buf[0] & 1, 0);
-  EXPECT_EQ(dev.sample_buf[1] & 1, 1);
+    // Same registers as rhd_setup, which sends 2 dummy reads, then the
+    // configuration and the calibration together, then the sanity check
+    rec_reset();
+    rhd_setup(&dev, 2000, 20, 500, true, 10);
+    EXPECT_EQ(memcmp(dev.regs, emg.regs, RHD_SHADOW_REGS), 0);
+    EXPECT_EQ(memcmp(chip_regs, emg.regs, RHD_SHADOW_REGS), 0);
+    EXPECT_EQ(rec_calls, 2 + 1 + 1);
 
-  EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[0]], 0xFF00);
-  EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[32]], 0x00FF);
+    // Only the differences go out, in one transfer
+    int n_diff = 0;
+    for (int reg = 0; reg < RHD_SHADOW_REGS; reg++) {
+      n_diff += emg.regs[reg] != wide.regs[reg];
+    }
+    rec_reset();
+    EXPECT_EQ(rhd_preset_apply(&dev, &wide, false), n_diff);
+    EXPECT_EQ(rec_calls, 1);
+    EXPECT_EQ(memcmp(chip_regs, wide.regs, RHD_SHADOW_REGS), 0);
+    EXPECT_EQ(dev.ch_mask, wide.ch_mask);
+    EXPECT_EQ(dev.fs, 20000);
 
-  for (int i = 1; i < 32; i++) {
-    EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[i]] & 0xFFFE, 0xFF00);
-    EXPECT_EQ(dev.sample_buf[RHD_CHANNEL_MAP[i + 32]] & 0xFFFE, 0x00FE);
+    rec_reset();
+    EXPECT_EQ(rhd_preset_apply(&dev, &wide, false), 0);
+    EXPECT_EQ(rec_calls, 0);
+    EXPECT_EQ(rhd_preset_apply(&dev, &emg, true), n_diff);
+    EXPECT_EQ(rec_calls, 1);
+    EXPECT_EQ(memcmp(chip_regs, emg.regs, RHD_SHADOW_REGS), 0);
+
+    // Channel list mode follows the image
+    rhd_cfg_sparse(&dev, true);
+    rhd_preset_apply(&dev, &wide, false);
+    EXPECT_EQ(dev.n_ch, 32u);
+    EXPECT_EQ(dev.n_conv, 16u);
   }
-}
\ No newline at end of file
+}
+
+static void cmdq_count(rhd_future_t *fut, void *ctx) {
+  (void)fut;
+  ++*(std::atomic<int> *)ctx;
+}
+
+TEST(RHD, RhdCmdQueue) {
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    rhd_cmdq_t q;
+    rhd_cmdq_cell_t cells[8];
+    std::atomic<int> n_done(0);
+    pipe_ddr = ddr;
+    chip_reset();
+    rhd_init(&dev, ddr, rw_chip);
+
+    EXPECT_EQ(rhd_cmdq_init(&q, cells, 6), -1);
+    ASSERT_EQ(rhd_cmdq_init(&q, cells, 8), 0);
+    EXPECT_EQ(rhd_cmdq_attach(&dev, &q, 33), -1);
+    ASSERT_EQ(rhd_cmdq_attach(&dev, &q, 2), 0);
+    EXPECT_EQ(dev.n_sweep, RHD_SWEEP_CMDS + 2u);
+
+    rhd_future_t w = {cmdq_count, &n_done, 0, 0};
+    rhd_future_t r = {cmdq_count, &n_done, 0, 0};
+    rhd_future_t id = {cmdq_count, &n_done, 0, 0};
+    ASSERT_EQ(rhd_cmdq_push(&q, RHD_CMD_WRITE(IMP_CHK_DAC, 0x5A), &w), 0);
+    ASSERT_EQ(rhd_cmdq_push(&q, RHD_CMD_READ(IMP_CHK_DAC), &r), 0);
+    ASSERT_EQ(rhd_cmdq_push(&q, RHD_CMD_READ(CHIP_ID), &id), 0);
+    EXPECT_FALSE(rhd_future_ready(&w));
+
+    // 2 commands per frame, the last one completes with the next burst
+    uint16_t frames[2][RHD_FRAME_CH];
+    rhd2164_sample_frames(&dev, 1, frames);
+    EXPECT_TRUE(rhd_future_ready(&w));
+    EXPECT_TRUE(rhd_future_ready(&r));
+    EXPECT_FALSE(rhd_future_ready(&id));
+    rhd2164_sample_frames(&dev, 2, frames);
+    ASSERT_TRUE(rhd_future_ready(&id));
+    EXPECT_EQ(n_done, 3);
+    EXPECT_EQ(w.result & 0xFF, 0x5A);
+    EXPECT_EQ(r.result, 0x5A);
+    EXPECT_EQ(id.result, 4);
+    EXPECT_EQ(chip_regs[IMP_CHK_DAC], 0x5A);
+
+    // Full queue, then drained by single sweeps
+    rhd_future_t futs[9];
+    for (int i = 0; i < 9; i++) {
+      futs[i] = {NULL, NULL, 0, 0};
+      int ret = rhd_cmdq_push(&q, RHD_CMD_READ(INTAN_0 + i % 5), &futs[i]);
+      EXPECT_EQ(ret, i < 8 ? 0 : -1) << "push " << i;
+    }
+    uint16_t buf[RHD_FRAME_CH];
+    for (int i = 0; i < 5; i++) {
+      rhd2164_sample_all(&dev, buf);
+    }
+    for (int i = 0; i < 8; i++) {
+      ASSERT_TRUE(rhd_future_ready(&futs[i])) << "cmd " << i;
+      EXPECT_EQ(futs[i].result, "INTAN"[i % 5]) << "cmd " << i;
+    }
+
+    // Dummy reads when idle
+    rhd2164_sample_frames(&dev, 2, frames);
+    EXPECT_EQ(n_done, 3);
+    EXPECT_EQ(rhd_cmdq_attach(&dev, NULL, 0), 0);
+    EXPECT_EQ(dev.n_sweep, (size_t)RHD_SWEEP_CMDS);
+  }
+}
+
+/* Number of times `cmd` was sent since the last rec_reset, SDR */
+static int rec_count(uint16_t cmd) {
+  int n = 0;
+  for (size_t i = 0; i < rec_n; i++) {
+    n += rec_cmds[i] == cmd;
+  }
+  return n;
+}
+
+TEST(RHD, RhdCmdQueueSentOnce) {
+  rhd_device_t dev;
+  rhd_cmdq_t q;
+  rhd_cmdq_cell_t cells[4];
+  uint16_t frames[4][RHD_FRAME_CH];
+  const uint16_t cal = 0x5500; // CALIBRATE
+  rec_ddr = false;
+  rhd_init(&dev, false, rw_rec);
+  rhd_cfg_sparse(&dev, true);
+  ASSERT_EQ(rhd_cmdq_init(&q, cells, 4), 0);
+
+  // The flush commands of a burst would be an injection slot
+  rhd_cfg_ch(&dev, 0x1, 0);
+  ASSERT_EQ(dev.n_conv, 1u);
+  EXPECT_EQ(rhd_cmdq_attach(&dev, &q, 1), -1);
+
+  rhd_cfg_ch(&dev, 0x3, 0);
+  ASSERT_EQ(rhd_cmdq_attach(&dev, &q, 1), 0);
+  rhd_future_t f1 = {NULL, NULL, 0, 0};
+  rec_reset();
+  ASSERT_EQ(rhd_cmdq_push(&q, cal, &f1), 0);
+  for (int i = 0; i < 3; i++) {
+    rhd2164_sample_frames(&dev, 4, frames);
+  }
+  EXPECT_TRUE(rhd_future_ready(&f1));
+  EXPECT_EQ(rec_count(cal), 1);
+
+  // A shorter channel list holds the queue back
+  rhd_cfg_ch(&dev, 0x1, 0);
+  EXPECT_EQ(dev.n_sweep, 1u);
+  rhd_future_t f2 = {NULL, NULL, 0, 0};
+  rec_reset();
+  ASSERT_EQ(rhd_cmdq_push(&q, cal, &f2), 0);
+  for (int i = 0; i < 3; i++) {
+    rhd2164_sample_frames(&dev, 4, frames);
+  }
+  EXPECT_FALSE(rhd_future_ready(&f2));
+  EXPECT_EQ(rec_count(cal), 0);
+
+  rhd_cfg_ch(&dev, 0x3, 0);
+  for (int i = 0; i < 3; i++) {
+    rhd2164_sample_frames(&dev, 4, frames);
+  }
+  EXPECT_TRUE(rhd_future_ready(&f2));
+  EXPECT_EQ(rec_count(cal), 1);
+}
+
+TEST(RHD, RhdCmdQueueThreaded) {
+  const int n_threads = 4;
+  const int n_cmds = 200;
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    rhd_cmdq_t q;
+    rhd_cmdq_cell_t cells[16];
+    static rhd_future_t futs[n_threads][n_cmds];
+    std::atomic<int> n_done(0);
+    pipe_ddr = ddr;
+    chip_reset();
+    rhd_init(&dev, ddr, rw_chip);
+    rhd_cmdq_init(&q, cells, 16);
+    rhd_cmdq_attach(&dev, &q, 3);
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> n_running(n_threads);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < n_threads; t++) {
+      producers.emplace_back([&, t] {
+        for (int i = 0; i < n_cmds && !stop; i++) {
+          futs[t][i] = {cmdq_count, &n_done, 0, 0};
+          uint16_t cmd = RHD_CMD_READ(INTAN_0 + (t + i) % 5);
+          while (rhd_cmdq_push(&q, cmd, &futs[t][i]) < 0 && !stop) {
+            std::this_thread::yield();
+          }
+        }
+        n_running--;
+      });
+    }
+
+    // Keep sampling until every producer is done and its commands answered,
+    // the producers never wait for a pause
+    uint16_t frames[4][RHD_FRAME_CH];
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while ((n_running > 0 || n_done < n_threads * n_cmds) &&
+           std::chrono::steady_clock::now() < deadline) {
+      rhd2164_sample_frames(&dev, 4, frames);
+    }
+    stop = true;
+    for (auto &p : producers) {
+      p.join();
+    }
+    ASSERT_EQ(n_done, n_threads * n_cmds);
+    for (int t = 0; t < n_threads; t++) {
+      for (int i = 0; i < n_cmds; i++) {
+        EXPECT_TRUE(rhd_future_ready(&futs[t][i]));
+        EXPECT_EQ(futs[t][i].result, "INTAN"[(t + i) % 5]);
+      }
+    }
+  }
+}
+
+/**
+ * Register file and CONVERT mock with the 2-command pipeline, which can drop
+ * one received word of a transfer, shifting the rest of it.
+ */
+static uint16_t chk_hist[2][2];
+static long chk_drop_at = -1;
+
+int rw_chk(uint16_t *tx_buf, uint16_t *rx_buf, size_t len) {
+  size_t n_cmds = pipe_ddr ? len / 2 : len;
+  for (size_t i = 0; i < n_cmds; i++) {
+    uint16_t cmd;
+    if (pipe_ddr) {
+      cmd = (pipe_odd_bits(tx_buf[2 * i]) << 8) |
+            pipe_odd_bits(tx_buf[2 * i + 1]);
+    } else {
+      cmd = tx_buf[i];
+    }
+    uint8_t reg = (cmd >> 8) & 0x3F;
+    uint16_t res[2] = {(uint16_t)(reg << 4), (uint16_t)((reg + 32) << 4)};
+    if ((cmd >> 14) == 0b11) {
+      res[0] = chip_regs[reg];
+      res[1] = 0;
+    } else if ((cmd >> 14) == 0b10) {
+      chip_regs[reg] = cmd & 0xFF;
+      res[0] = cmd & 0xFF;
+      res[1] = 0;
+    }
+    uint16_t a = chk_hist[0][0];
+    uint16_t b = chk_hist[0][1];
+    memcpy(chk_hist[0], chk_hist[1], sizeof(chk_hist[0]));
+    memcpy(chk_hist[1], res, sizeof(res));
+    if (pipe_ddr) {
+      rx_buf[2 * i] = pipe_interleave(a >> 8, b >> 8);
+      rx_buf[2 * i + 1] = pipe_interleave(a & 0xFF, b & 0xFF);
+    } else {
+      rx_buf[2 * i] = a;
+      rx_buf[2 * i + 1] = b;
+    }
+  }
+  if (chk_drop_at >= 0 && (size_t)chk_drop_at < 2 * n_cmds) {
+    memmove(&rx_buf[chk_drop_at], &rx_buf[chk_drop_at + 1],
+            (2 * n_cmds - chk_drop_at - 1) * sizeof(uint16_t));
+    rx_buf[2 * n_cmds - 1] = 0;
+    chk_drop_at = -1;
+  }
+  rec_calls++;
+  return len;
+}
+
+static void chk_reset() {
+  chip_reset();
+  memset(chk_hist, 0, sizeof(chk_hist));
+  chk_drop_at = -1;
+}
+
+TEST(RHD, RhdCheckBurst) {
+  const size_t n_frames = 5;
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    uint16_t tx[(n_frames * RHD_SWEEP_CMDS + 4) * 2];
+    uint16_t rx[(n_frames * RHD_SWEEP_CMDS + 4) * 2];
+    uint16_t out[n_frames][RHD_FRAME_CH];
+    pipe_ddr = ddr;
+    chk_reset();
+    rhd_init(&dev, ddr, rw_chk);
+    rhd_set_burst_buf(&dev, tx, rx, sizeof(rx) / sizeof(uint16_t));
+    ASSERT_EQ(rhd_check_set(&dev, 4), 0);
+    EXPECT_EQ(dev.chk_word[0], 4);
+    EXPECT_EQ(dev.chk_word[1], 'I');
+
+    // The checked reads fit in the same transfer
+    rec_calls = 0;
+    rhd2164_sample_frames(&dev, n_frames, out);
+    EXPECT_EQ(rec_calls, 1);
+    for (size_t f = 0; f < n_frames; f++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(out[f][ch] & 0xFFFE, ch << 4);
+      }
+    }
+    EXPECT_EQ(dev.check.checks, 2u);
+    EXPECT_EQ(dev.check.errors, 0u);
+
+    // A word dropped in the middle of the burst shifts its end
+    chk_drop_at = 201;
+    rhd2164_sample_frames(&dev, n_frames, out);
+    EXPECT_GT(dev.check.errors, 0u);
+    EXPECT_EQ(dev.check.resyncs, 1u);
+    EXPECT_EQ(dev.check.failures, 0u);
+
+    uint64_t errors = dev.check.errors;
+    rhd2164_sample_frames(&dev, n_frames, out);
+    EXPECT_EQ(dev.check.errors, errors);
+    for (size_t f = 0; f < n_frames; f++) {
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(out[f][ch] & 0xFFFE, ch << 4);
+      }
+    }
+
+    // A chip which stops answering fails to resync
+    memset(&chip_regs[INTAN_0], 0, 5);
+    rhd2164_sample_frames(&dev, n_frames, out);
+    EXPECT_EQ(dev.check.failures, 1u);
+
+    ASSERT_EQ(rhd_check_set(&dev, 0), 0);
+    rhd2164_sample_frames(&dev, n_frames, out);
+    EXPECT_EQ(dev.check.checks, 0u);
+  }
+}
+
+TEST(RHD, RhdCheckSampleAll) {
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    uint16_t buf[RHD_FRAME_CH];
+    pipe_ddr = ddr;
+    chk_reset();
+    rhd_init(&dev, ddr, rw_chk);
+    ASSERT_EQ(rhd_check_set(&dev, 3), 0);
+
+    // Every third sweep carries the reads, the channels are unaffected
+    rhd2164_sample_all(&dev, buf); // fill the pipeline
+    rec_calls = 0;
+    for (int i = 0; i < 6; i++) {
+      rhd2164_sample_all(&dev, buf);
+      for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+        EXPECT_EQ(buf[ch] & 0xFFFE, ch << 4) << "sweep " << i;
+      }
+    }
+    EXPECT_EQ(rec_calls, 6);
+    EXPECT_EQ(dev.check.checks, 4u);
+    EXPECT_EQ(dev.check.errors, 0u);
+
+    // A duplicated word, seen by the next check
+    ASSERT_EQ(rhd_check_set(&dev, 1), 0);
+    chk_drop_at = 11;
+    rhd2164_sample_all(&dev, buf);
+    EXPECT_GT(dev.check.errors, 0u);
+    EXPECT_EQ(dev.check.resyncs, 1u);
+    // The next frame still holds ch30 and ch31 of the shifted sweep
+    rhd2164_sample_all(&dev, buf);
+    rhd2164_sample_all(&dev, buf);
+    EXPECT_EQ(dev.check.resyncs, 1u);
+    for (int ch = 0; ch < RHD_FRAME_CH; ch++) {
+      EXPECT_EQ(buf[ch] & 0xFFFE, ch << 4);
+    }
+  }
+}
+
+/* Context-taking transport for rhd_rw_sync_init, counts its calls */
+static int rw_sync_ctx(void *ctx, uint16_t *tx_buf, uint16_t *rx_buf,
+                       size_t len) {
+  (*(int *)ctx)++;
+  return rw_chip(tx_buf, rx_buf, len);
+}
+
+TEST(RHD, RhdRwSync) {
+  for (int ddr = 0; ddr < 2; ddr++) {
+    rhd_device_t dev;
+    rhd_rw_sync_t sync;
+    rhd_rw_async_t async;
+    int calls = 0;
+    pipe_ddr = ddr;
+    chip_reset();
+    rhd_rw_sync_init(&sync, rw_sync_ctx, &calls, &async);
+    EXPECT_EQ(async.ctx, &sync);
+
+    EXPECT_EQ(rhd_init_async(&dev, ddr, &async), 0);
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(rhd_read_force(&dev, CHIP_ID), 4);
+
+    // Tickets follow each other, results are kept until completed
+    uint16_t tx[4] = {0}, rx[8];
+    int t0 = async.submit(async.ctx, tx, rx, 2);
+    int t1 = async.submit(async.ctx, tx, rx, 4);
+    EXPECT_EQ(t1, t0 + 1);
+    EXPECT_EQ(async.poll(async.ctx, t0), 1);
+    EXPECT_EQ(async.complete(async.ctx, t0), 2);
+    EXPECT_EQ(async.complete(async.ctx, t1), 4);
+  }
+  pipe_ddr = false;
+}
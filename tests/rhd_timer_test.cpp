@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "rhd_timer.h"
+}
+
+TEST(RHDTimer, Init) {
+  rhd_timer_t t;
+  EXPECT_EQ(rhd_timer_init(&t, 0), -1);
+  EXPECT_EQ(rhd_timer_init(&t, -10), -1);
+  EXPECT_EQ(rhd_timer_init(&t, 2000), 0);
+  EXPECT_EQ(t.period_ns, 500000u);
+  EXPECT_EQ(t.next_ns, t.start_ns + t.period_ns);
+}
+
+TEST(RHDTimer, Rate) {
+  rhd_timer_t t;
+  rhd_timer_stats_t stats;
+  rhd_timer_init(&t, 1000);
+  for (int i = 0; i < 200; i++) {
+    EXPECT_EQ(rhd_timer_wait(&t), 0);
+  }
+  rhd_timer_stats(&t, &stats);
+  EXPECT_EQ(stats.n_ticks, 200u);
+  EXPECT_NEAR(stats.fs_eff, 1000, 50);
+  EXPECT_GE(stats.late_min_ns, 0);
+  EXPECT_GE(stats.late_max_ns, stats.late_min_ns);
+}
+
+static std::vector<uint64_t> deadlines;
+
+static int wait_record(void *ctx, uint64_t deadline_ns) {
+  (void)ctx;
+  deadlines.push_back(deadline_ns);
+  return 0;
+}
+
+TEST(RHDTimer, AbsoluteDeadlinesAndMisses) {
+  rhd_timer_t t;
+  rhd_timer_stats_t stats;
+  rhd_timer_init(&t, 1000);
+  rhd_timer_set_wait(&t, wait_record, NULL);
+  deadlines.clear();
+
+  // Deadlines don't depend on when wait is called
+  for (int i = 0; i < 3; i++) {
+    rhd_timer_wait(&t);
+  }
+  ASSERT_EQ(deadlines.size(), 3u);
+  EXPECT_EQ(deadlines[1] - deadlines[0], t.period_ns);
+  EXPECT_EQ(deadlines[2] - deadlines[1], t.period_ns);
+
+  // Sleeping through several periods skips their deadlines
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  rhd_timer_wait(&t);
+  rhd_timer_stats(&t, &stats);
+  EXPECT_GE(stats.misses, 5u);
+  EXPECT_GT(t.next_ns, rhd_timer_now_ns());
+  EXPECT_EQ((t.next_ns - deadlines[0]) % t.period_ns, 0u);
+}